@@ -191,3 +191,39 @@ int parse(char *s, int len, struct parse_param *specs, int *err_index)
 	*err_index = 0;
 	return 0;
 }
+
+/*
+ * Bulk commands carry several records separated by PARSE_RECORD_SEPARATOR
+ * after a prefix such as "S++:". Copies the record at *pos behind the
+ * prefix into rec, so it can be handed to the same parser as a single
+ * record command, and advances *pos. *pos starts out at prefix_len.
+ * Returns the length of rec including the terminating NUL, 0 when there
+ * are no more records or -1 if a record does not fit.
+ */
+int parse_next_record(char *buf, int buflen, int prefix_len, int *pos,
+		      char *rec, int rec_size)
+{
+	int start = *pos;
+	int end = start;
+	int len;
+
+	if (start >= buflen || '\0' == buf[start])
+		return 0;
+
+	while (end < buflen && buf[end] != '\0' &&
+	       buf[end] != PARSE_RECORD_SEPARATOR)
+		end++;
+
+	len = prefix_len + (end - start);
+	if (len + 1 > rec_size)
+		return -1;
+
+	memcpy(rec, buf, prefix_len);
+	memcpy(rec + prefix_len, buf + start, end - start);
+	rec[len] = '\0';
+
+	*pos = (end < buflen && buf[end] == PARSE_RECORD_SEPARATOR) ?
+	    end + 1 : end;
+
+	return len + 1;
+}
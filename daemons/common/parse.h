@@ -47,6 +47,7 @@ enum parse_types {
 
 #define PARSE_DELIMITER ','
 #define PARSE_ASSIGN "="
+#define PARSE_RECORD_SEPARATOR ';'
 
 struct parse_param {
 	char *name;
@@ -55,5 +56,7 @@ struct parse_param {
 };
 
 int parse(char *s, int len, struct parse_param *specs, int *err_index);
+int parse_next_record(char *buf, int buflen, int prefix_len, int *pos,
+		      char *rec, int rec_size);
 
 #endif				/* PARSE_H_ */
@@ -100,6 +100,7 @@ private:
 	Timestamp _prev_system_time;
 	
 	HWTimestamper *_timestamper;
+	bool _shared_phc;
 	
 	OS_IPC *ipc;
 
@@ -143,6 +144,9 @@ public:
 	unsigned char getDomain(void) {
 		return domain_number;
 	}
+	void setDomain( unsigned char domain ) {
+		domain_number = domain;
+	}
 
 	ClockIdentity getGrandmasterClockIdentity(void) {
 		return grandmaster_clock_identity;
@@ -213,6 +217,29 @@ public:
 		count = number_ports;
 		return;
 	}
+
+	/* Returns the port currently synchronized to an upstream master, or
+	   NULL when this clock is the grandmaster */
+	IEEE1588Port *getSlavePort(void);
+
+	/* In bridge mode all ports may timestamp against one PHC (shared) or
+	   each port may carry its own PHC (per-port, the default) */
+	void setSharedPHC( bool shared ) {
+		_shared_phc = shared;
+	}
+	bool getSharedPHC(void) {
+		return _shared_phc;
+	}
+	/* Selects the timestamper disciplined by setMasterOffset(); this is
+	   the slave port's PHC when ports do not share one */
+	void setTimestamper( HWTimestamper *timestamper ) {
+		_timestamper = timestamper;
+	}
+
+	void forwardSync
+	( IEEE1588Port *ingress, Timestamp ingress_time,
+	  Timestamp precise_origin, int64_t correction,
+	  FrequencyRatio rate_ratio );
 	
 	static Timestamp getSystemTime(void);
 	
@@ -251,7 +278,7 @@ public:
 
 		getPortList( number_ports, ports );
 
-		for( i = 0; i < number_ports; ++i ) {
+		for( i = 0; i < number_ports; ++i, ++j ) {
 			while( ports[j] == NULL ) ++j;
 			if( ports[j]->getTxLock() == false ) {
 				return false;
@@ -267,7 +294,7 @@ public:
 
 		getPortList( number_ports, ports );
 		
-		for( i = 0; i < number_ports; ++i ) {
+		for( i = 0; i < number_ports; ++i, ++j ) {
 			while( ports[j] == NULL ) ++j;
 			if( ports[j]->putTxLock() == false ) {
 				return false;
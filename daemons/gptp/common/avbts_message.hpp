@@ -399,7 +399,10 @@ class FollowUpTLV {
 		memcpy(byte_str, this, sizeof(*this));
 	}
 	int32_t getRateOffset() {
-		return cumulativeScaledRateOffset;
+		return PLAT_ntohl(cumulativeScaledRateOffset);
+	}
+	void setRateOffset(int32_t offset) {
+		cumulativeScaledRateOffset = PLAT_htonl(offset);
 	}
 };
 
@@ -423,6 +426,9 @@ public:
 	void setPreciseOriginTimestamp(Timestamp & timestamp) {
 		preciseOriginTimestamp = timestamp;
 	}
+	void setRateOffset(int32_t offset) {
+		tlv.setRateOffset(offset);
+	}
 	
 	friend PTPMessageCommon *buildPTPMessage
 	(char *buf, int size, LinkLayerAddress * remote, IEEE1588Port * port);
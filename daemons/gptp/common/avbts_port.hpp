@@ -198,10 +198,28 @@ class IEEE1588Port {
 
 	HWTimestamper *_hw_timestamper;
 
+	/* Ports of other domain instances on the same interface; the
+	   primary owns the socket, receive thread and PDelay measurement */
+	IEEE1588Port *_domain_primary;
+	IEEE1588Port *_domain_next;
+
+	/* Sync received on the slave port waiting to be relayed from this
+	   port at SYNC_RELAY_PENDING, protected by the timer queue lock */
+	bool relay_pending;
+	Timestamp relay_ingress_time;
+	int64_t relay_ingress_system_time;
+	Timestamp relay_precise_origin;
+	int64_t relay_correction;
+	FrequencyRatio relay_rate_ratio;
+
 	net_result port_send
 	(uint8_t * buf, int size, MulticastType mcast_type,
 	 PortIdentity * destIdentity, bool timestamp);
 
+	int sendSyncTimestamped
+	(PTPMessageSync * sync, Timestamp & sync_timestamp,
+	 long long & wait_time);
+
 	InterfaceLabel *net_label;
 	
 	OSLockFactory *lock_factory;
@@ -238,7 +256,13 @@ class IEEE1588Port {
 			_peer_offset_init = false;
 		}
 		asCapable = ascap;
+		if( _domain_next != NULL ) {
+			_domain_next->setAsCapable( ascap );
+		}
 	}
+
+	void shareInterface( IEEE1588Port *primary );
+	IEEE1588Port *getDomainPort( unsigned char domain );
 	
 	~IEEE1588Port();
 	IEEE1588Port
@@ -263,6 +287,15 @@ class IEEE1588Port {
 	 PortIdentity * destIdentity);
 	void processEvent(Event e);
 
+	void queueRelaySync
+	(Timestamp ingress_time, int64_t ingress_system_time,
+	 Timestamp precise_origin, int64_t correction,
+	 FrequencyRatio rate_ratio);
+	void relaySync
+	(Timestamp ingress_time, int64_t ingress_system_time,
+	 Timestamp precise_origin, int64_t correction,
+	 FrequencyRatio rate_ratio);
+
 	PTPMessageAnnounce *calculateERBest(void);
 
 	void addForeignMaster(PTPMessageAnnounce * msg);
@@ -360,6 +393,9 @@ class IEEE1588Port {
 	}
 
 	FrequencyRatio getPeerRateOffset(void) {
+		if( _domain_primary != NULL ) {
+			return _domain_primary->getPeerRateOffset();
+		}
 		return _peer_rate_offset;
 	}
 	void setPeerRateOffset( FrequencyRatio offset ) {
@@ -414,6 +450,9 @@ class IEEE1588Port {
 	 uint32_t & nominal_clock_rate);
 
 	uint64_t getLinkDelay(void) {
+		if( _domain_primary != NULL ) {
+			return _domain_primary->getLinkDelay();
+		}
 		return one_way_delay > 0LL ? one_way_delay : 0LL;
 	}
 	void setLinkDelay(int64_t delay) {
@@ -78,6 +78,7 @@ typedef enum {
 	FAULT_DETECTED,
 	PDELAY_DEFERRED_PROCESSING,
 	PDELAY_RESP_RECEIPT_TIMEOUT_EXPIRES,
+	SYNC_RELAY_PENDING,
 } Event;
 
 typedef struct {
@@ -84,6 +84,7 @@ IEEE1588Clock::IEEE1588Clock
 	priority2 = 248;
 
 	number_ports = 0;
+	memset( port_list, 0, sizeof( port_list ));
 
 	this->forceOrdinarySlave = forceOrdinarySlave;
 
@@ -102,6 +103,7 @@ IEEE1588Clock::IEEE1588Clock
 	_master_local_freq_offset_init = false;
 	_local_system_freq_offset_init = false;
 	_timestamper = timestamper;
+	_shared_phc = false;
 
 	this->ipc = ipc;
 
@@ -224,6 +226,19 @@ void timerq_handler(void *arg)
 	event_descriptor->port->processEvent(event_descriptor->event);
 }
 
+/* Timer queue entries are keyed by port as well as by event, otherwise
+   cancelling a timer on one port would cancel it on every port */
+static int timerq_type( IEEE1588Port *target, Event e )
+{
+	PortIdentity identity;
+	uint16_t port_number;
+
+	target->getPortIdentity( identity );
+	identity.getPortNumber( &port_number );
+
+	return (int)(port_number << 8) | (int)e;
+}
+
 void IEEE1588Clock::addEventTimer
 ( IEEE1588Port * target, Event e, unsigned long long time_ns )
 {
@@ -231,8 +246,8 @@ void IEEE1588Clock::addEventTimer
 	event_descriptor->event = e;
 	event_descriptor->port = target;
 	timerq->addEvent
-		((unsigned)(time_ns / 1000), (int)e, timerq_handler, event_descriptor,
-		 true, NULL);
+		((unsigned)(time_ns / 1000), timerq_type( target, e ), timerq_handler,
+		 event_descriptor, true, NULL);
 }
 
 void IEEE1588Clock::addEventTimerLocked
@@ -247,14 +262,14 @@ void IEEE1588Clock::addEventTimerLocked
 
 void IEEE1588Clock::deleteEventTimer(IEEE1588Port * target, Event event)
 {
-	timerq->cancelEvent((int)event, NULL);
+	timerq->cancelEvent(timerq_type( target, event ), NULL);
 }
 
 void IEEE1588Clock::deleteEventTimerLocked(IEEE1588Port * target, Event event)
 {
     if( getTimerQLock() == oslock_fail ) return;
 
-	timerq->cancelEvent((int)event, NULL);
+	timerq->cancelEvent(timerq_type( target, event ), NULL);
 
     if( putTimerQLock() == oslock_fail ) return;
 }
@@ -375,6 +390,63 @@ void IEEE1588Clock::setMasterOffset
 	return;
 }
 
+IEEE1588Port *IEEE1588Clock::getSlavePort(void)
+{
+	int i, j = 0;
+
+	for( i = 0; i < number_ports; ++i, ++j ) {
+		while( port_list[j] == NULL ) ++j;
+		if( port_list[j]->getPortState() == PTP_SLAVE ) {
+			return port_list[j];
+		}
+	}
+
+	return NULL;
+}
+
+/* Relay a Sync/Follow-Up pair received on the slave port to every other
+   port that is master for its segment (802.1AS time-aware relay).
+   ingress_time is the device receive timestamp of the Sync, correction is
+   the upstream correction plus the upstream link delay in ns of
+   grandmaster time, and rate_ratio is the cumulative grandmaster to local
+   frequency ratio. Each egress port sends from its own timer event */
+void IEEE1588Clock::forwardSync
+( IEEE1588Port *ingress, Timestamp ingress_time, Timestamp precise_origin,
+  int64_t correction, FrequencyRatio rate_ratio )
+{
+	Timestamp system_time;
+	Timestamp device_time;
+	uint32_t local_clock, nominal_clock_rate;
+	int64_t ingress_system_time;
+	int i, j = 0;
+
+	if( number_ports < 2 ) return;
+
+	/* When each port has its own PHC, residence time is measured in the
+	   system time base using each port's device/system cross-timestamp */
+	ingress->getDeviceTime
+		( system_time, device_time, local_clock, nominal_clock_rate );
+	ingress_system_time = TIMESTAMP_TO_NS(system_time) +
+		((int64_t) TIMESTAMP_TO_NS(ingress_time) -
+		 (int64_t) TIMESTAMP_TO_NS(device_time));
+
+	/* Port state only changes from timer queue events, so holding the
+	   timer queue lock keeps each port's role stable while the relay is
+	   handed to it */
+	getTimerQLock();
+	for( i = 0; i < number_ports; ++i, ++j ) {
+		while( port_list[j] == NULL ) ++j;
+		if( port_list[j] == ingress ||
+			port_list[j]->getPortState() != PTP_MASTER ) {
+			continue;
+		}
+		port_list[j]->queueRelaySync
+			( ingress_time, ingress_system_time, precise_origin,
+			  correction, rate_ratio );
+	}
+	putTimerQLock();
+}
+
 /* Get current time from system clock */
 Timestamp IEEE1588Clock::getTime(void)
 {
@@ -116,6 +116,11 @@ IEEE1588Port::IEEE1588Port
 
 	qualified_announce = NULL;
 
+	_domain_primary = NULL;
+	_domain_next = NULL;
+
+	relay_pending = false;
+
 	this->net_label = net_label;
 
 	this->timer_factory = timer_factory;
@@ -128,17 +133,47 @@ IEEE1588Port::IEEE1588Port
 	sync_count = 0;
 }
 
+void IEEE1588Port::shareInterface( IEEE1588Port *primary )
+{
+	IEEE1588Port *last = primary;
+
+	while( last->_domain_next != NULL ) last = last->_domain_next;
+	last->_domain_next = this;
+	_domain_primary = primary;
+	asCapable = primary->asCapable;
+}
+
+IEEE1588Port *IEEE1588Port::getDomainPort( unsigned char domain )
+{
+	IEEE1588Port *port;
+
+	for( port = this; port != NULL; port = port->_domain_next ) {
+		if( port->clock->getDomain() == domain ) return port;
+	}
+
+	return NULL;
+}
+
 bool IEEE1588Port::init_port()
 {
-	if (!OSNetworkInterfaceFactory::buildInterface
+	if( _domain_primary != NULL ) {
+		/* Secondary domain instance, the primary port already opened
+		   the interface and initialized the timestamper */
+		net_iface = _domain_primary->net_iface;
+		_hw_timestamper = _domain_primary->_hw_timestamper;
+	} else if (!OSNetworkInterfaceFactory::buildInterface
 	    (&net_iface, factory_name_t("default"), net_label, _hw_timestamper))
 		return false;
 
 	this->net_iface = net_iface;
 	this->net_iface->getLinkLayerAddress(&local_addr);
-	clock->setClockIdentity(&local_addr);
+	/* In bridge mode the first port names the clock; all port
+	   identities share that clock identity */
+	if( ifindex == 1 ) {
+		clock->setClockIdentity(&local_addr);
+	}
 
-	if( _hw_timestamper != NULL ) {
+	if( _hw_timestamper != NULL && _domain_primary == NULL ) {
 		if( !_hw_timestamper->HWTimestamper_init( net_label, net_iface )) {
 			XPTPD_ERROR
 				( "Failed to initialize hardware timestamper, "
@@ -148,7 +183,13 @@ bool IEEE1588Port::init_port()
 	}
 
 	pdelay_rx_lock = lock_factory->createLock(oslock_recursive);
-	port_tx_lock = lock_factory->createLock(oslock_recursive);
+	/* Transmit timestamps are read back per interface, so all domains
+	   on an interface serialize transmit on one lock */
+	if( _domain_primary != NULL ) {
+		port_tx_lock = _domain_primary->port_tx_lock;
+	} else {
+		port_tx_lock = lock_factory->createLock(oslock_recursive);
+	}
 
 	port_identity.setClockIdentity(clock->getClockIdentity());
 	port_identity.setPortNumber(&ifindex);
@@ -160,6 +201,8 @@ bool IEEE1588Port::init_port()
 
 void IEEE1588Port::startPDelay() {
 	pdelay_started = true;
+	/* Link delay is measured once per interface by the primary port */
+	if( _domain_primary != NULL ) return;
 	clock->addEventTimer( this, PDELAY_INTERVAL_TIMEOUT_EXPIRES, 32000000 );
 }
 
@@ -300,12 +343,30 @@ void *IEEE1588Port::openPort(void)
 		size_t length = sizeof(buf);
 
 		if ((rrecv = net_iface->nrecv(&remote, buf, length)) == net_succeed) {
+			IEEE1588Port *target = this;
+			unsigned char msg_type = buf
+				[PTP_COMMON_HDR_TRANSSPEC_MSGTYPE(PTP_COMMON_HDR_OFFSET)]
+				& 0xF;
+
+			/* Demultiplex by domain, PDelay is common to all domains */
+			if( msg_type != PATH_DELAY_REQ_MESSAGE &&
+				msg_type != PATH_DELAY_RESP_MESSAGE &&
+				msg_type != PATH_DELAY_FOLLOWUP_MESSAGE ) {
+				target = getDomainPort
+					( buf[PTP_COMMON_HDR_DOMAIN_NUMBER
+						  (PTP_COMMON_HDR_OFFSET)] );
+				if( target == NULL ) {
+					XPTPD_INFO("Discarding message for unknown domain");
+					continue;
+				}
+			}
+
 			XPTPD_INFO("Processing network buffer");
 			msg = buildPTPMessage((char *)buf, (int)length, &remote,
-					    this);
+					    target);
 			if (msg != NULL) {
 				XPTPD_INFO("Processing message");
-				msg->processMessage(this);
+				msg->processMessage(target);
 				if (msg->garbage()) {
 					delete msg;
 				}
@@ -411,15 +472,19 @@ void IEEE1588Port::processEvent(Event e)
 					 pow((double)2,getAnnounceInterval())*1000000000.0);
 			}
       
-			port_ready_condition->wait_prelock();
-			listening_thread = thread_factory->createThread();
-			if (!listening_thread->
-				start (openPortWrapper, (void *)this))
-			{
-				XPTPD_ERROR("Error creating port thread");
-				return;
+			/* Secondary domain instances receive through the primary
+			   port's listening thread */
+			if( _domain_primary == NULL ) {
+				port_ready_condition->wait_prelock();
+				listening_thread = thread_factory->createThread();
+				if (!listening_thread->
+					start (openPortWrapper, (void *)this))
+				{
+					XPTPD_ERROR("Error creating port thread");
+					return;
+				}
+				port_ready_condition->wait();
 			}
-			port_ready_condition->wait();
 			
 			if (e3 != NULL_EVENT)
 				clock->addEventTimer(this, e3, interval3);
@@ -443,13 +508,16 @@ void IEEE1588Port::processEvent(Event e)
 
 			/* Find EBest for all ports */
 			j = 0;
-			for (int i = 0; i < number_ports; ++i) {
+			for (int i = 0; i < number_ports; ++i, ++j) {
 				while (ports[j] == NULL)
 					++j;
 				if (ports[j]->port_state == PTP_DISABLED
 				    || ports[j]->port_state == PTP_FAULTY) {
 					continue;
 				}
+				if (ports[j]->calculateERBest() == NULL) {
+					continue;
+				}
 				if (EBest == NULL) {
 					EBest = ports[j]->calculateERBest();
 				} else {
@@ -459,6 +527,10 @@ void IEEE1588Port::processEvent(Event e)
 				}
 			}
 
+			if (EBest == NULL) {
+				break;
+			}
+
 			/* Check if we've changed */
 			{
 			  
@@ -497,14 +569,14 @@ void IEEE1588Port::processEvent(Event e)
 			}
 
 			j = 0;
-			for (int i = 0; i < number_ports; ++i) {
+			for (int i = 0; i < number_ports; ++i, ++j) {
 				while (ports[j] == NULL)
 					++j;
 				if (ports[j]->port_state == PTP_DISABLED
 				    || ports[j]->port_state == PTP_FAULTY) {
 					continue;
 				}
-				if (clock->isBetterThan(EBest)) {
+				if (EBest == NULL || clock->isBetterThan(EBest)) {
 					// We are the GrandMaster, all ports are master
 					EBest = NULL;	// EBest == NULL : we were grandmaster
 					ports[j]->recommendState(PTP_MASTER,
@@ -725,40 +797,27 @@ void IEEE1588Port::processEvent(Event e)
 				
 				uint32_t local_clock, nominal_clock_rate;
 
+				/* A bridge port relays Sync from the slave port instead
+				   of originating it, see relaySync() */
+				if (clock->getSlavePort() != NULL) {
+					clock->addEventTimer
+						( this, SYNC_INTERVAL_TIMEOUT_EXPIRES,
+						  (unsigned long long)
+						  (pow((double)2,getSyncInterval())*1000000000.0));
+					break;
+				}
+
 				// Send a sync message and then a followup to broadcast
 				if (asCapable) {
 					PTPMessageSync *sync = new PTPMessageSync(this);
 					PortIdentity dest_id;
 					getPortIdentity(dest_id);
 					sync->setPortIdentity(&dest_id);
-					getTxLock();
-					sync->sendPort(this, NULL);
-					XPTPD_INFO("Sent SYNC message");
-					
+
 					int ts_good;
 					Timestamp sync_timestamp;
-					unsigned sync_timestamp_counter_value;
-					int iter = TX_TIMEOUT_ITER;
-					long req = TX_TIMEOUT_BASE;
 					ts_good =
-						getTxTimestamp(sync, sync_timestamp,
-									   sync_timestamp_counter_value,
-									   false);
-					while (ts_good != 0 && iter-- != 0) {
-						timer->sleep(req);
-						wait_time += req;
-
-						if (ts_good != -72 && iter < 1)
-							XPTPD_ERROR(
-								"Error (TX) timestamping Sync (Retrying), "
-								"error=%d", ts_good);
-						ts_good =
-							getTxTimestamp
-							(sync, sync_timestamp, 
-							 sync_timestamp_counter_value, iter == 0);
-						req *= 2;
-					}
-					putTxLock();
+						sendSyncTimestamped(sync, sync_timestamp, wait_time);
 					
 					if (ts_good != 0) {
 						char msg
@@ -880,6 +939,19 @@ void IEEE1588Port::processEvent(Event e)
 		setAsCapable(false);
 		pdelay_count = 0;
 		break;
+	case SYNC_RELAY_PENDING:
+		/* Later Syncs overwrite the pending one, so only the newest is
+		   relayed; drop it if the port stopped being master meanwhile */
+		if (!relay_pending)
+			break;
+		relay_pending = false;
+		if (port_state != PTP_MASTER)
+			break;
+		relaySync
+			(relay_ingress_time, relay_ingress_system_time,
+			 relay_precise_origin, relay_correction,
+			 relay_rate_ratio);
+		break;
 	default:
 		XPTPD_INFO
 		    ("Unhandled event type in IEEE1588Port::processEvent(), %d",
@@ -891,6 +963,122 @@ void IEEE1588Port::processEvent(Event e)
 	return;
 }
 
+int IEEE1588Port::sendSyncTimestamped
+(PTPMessageSync * sync, Timestamp & sync_timestamp, long long & wait_time)
+{
+	OSTimer *timer = timer_factory->createTimer();
+	int ts_good;
+	unsigned sync_timestamp_counter_value;
+	int iter = TX_TIMEOUT_ITER;
+	long req = TX_TIMEOUT_BASE;
+
+	getTxLock();
+	sync->sendPort(this, NULL);
+	XPTPD_INFO("Sent SYNC message");
+
+	ts_good =
+		getTxTimestamp(sync, sync_timestamp,
+					   sync_timestamp_counter_value, false);
+	while (ts_good != 0 && iter-- != 0) {
+		timer->sleep(req);
+		wait_time += req;
+
+		if (ts_good != -72 && iter < 1)
+			XPTPD_ERROR(
+				"Error (TX) timestamping Sync (Retrying), "
+				"error=%d", ts_good);
+		ts_good =
+			getTxTimestamp
+			(sync, sync_timestamp,
+			 sync_timestamp_counter_value, iter == 0);
+		req *= 2;
+	}
+	putTxLock();
+
+	delete timer;
+	return ts_good;
+}
+
+/* Called with the timer queue lock held; the Sync is sent from the timer
+   thread so the slave port's receive thread never waits on our transmit
+   timestamp */
+void IEEE1588Port::queueRelaySync
+(Timestamp ingress_time, int64_t ingress_system_time,
+ Timestamp precise_origin, int64_t correction, FrequencyRatio rate_ratio)
+{
+	relay_ingress_time = ingress_time;
+	relay_ingress_system_time = ingress_system_time;
+	relay_precise_origin = precise_origin;
+	relay_correction = correction;
+	relay_rate_ratio = rate_ratio;
+	relay_pending = true;
+	clock->addEventTimer(this, SYNC_RELAY_PENDING, EVENT_TIMER_GRANULARITY);
+}
+
+void IEEE1588Port::relaySync
+(Timestamp ingress_time, int64_t ingress_system_time,
+ Timestamp precise_origin, int64_t correction, FrequencyRatio rate_ratio)
+{
+	PTPMessageSync *sync;
+	PTPMessageFollowUp *follow_up;
+	PortIdentity dest_id;
+	Timestamp egress_time;
+	Timestamp system_time;
+	Timestamp device_time;
+	uint32_t local_clock, nominal_clock_rate;
+	long long wait_time = 0;
+	int64_t residence_time;
+	int ts_good;
+
+	if (!asCapable) {
+		return;
+	}
+
+	sync = new PTPMessageSync(this);
+	getPortIdentity(dest_id);
+	sync->setPortIdentity(&dest_id);
+
+	ts_good = sendSyncTimestamped(sync, egress_time, wait_time);
+	if (ts_good != 0) {
+		char msg[HWTIMESTAMPER_EXTENDED_MESSAGE_SIZE];
+		getExtendedError(msg);
+		XPTPD_ERROR
+			("Error (TX) timestamping relayed Sync, error=%d\n%s",
+			 ts_good, msg);
+		delete sync;
+		return;
+	}
+
+	if (clock->getSharedPHC()) {
+		residence_time =
+			TIMESTAMP_TO_NS(egress_time) - TIMESTAMP_TO_NS(ingress_time);
+	} else {
+		getDeviceTime
+			(system_time, device_time, local_clock, nominal_clock_rate);
+		residence_time = TIMESTAMP_TO_NS(system_time) +
+			((int64_t) TIMESTAMP_TO_NS(egress_time) -
+			 (int64_t) TIMESTAMP_TO_NS(device_time)) -
+			ingress_system_time;
+	}
+	XPTPD_INFO("Relayed Sync residence time: %lld ns", residence_time);
+
+	/* Residence time is measured in local time, correctionField carries
+	   grandmaster time */
+	correction += (int64_t) (residence_time * rate_ratio);
+
+	follow_up = new PTPMessageFollowUp(this);
+	follow_up->setPortIdentity(&dest_id);
+	follow_up->setSequenceId(sync->getSequenceId());
+	follow_up->setPreciseOriginTimestamp(precise_origin);
+	follow_up->setCorrectionField(correction << 16);
+	follow_up->setRateOffset
+		((int32_t) ((rate_ratio - 1.0) * (1ULL << 41)));
+	follow_up->sendPort(this, NULL);
+
+	delete follow_up;
+	delete sync;
+}
+
 PTPMessageAnnounce *IEEE1588Port::calculateERBest(void)
 {
 	return qualified_announce;
@@ -940,6 +1128,9 @@ void IEEE1588Port::becomeSlave( bool restart_syntonization ) {
   clock->deleteEventTimer( this, SYNC_INTERVAL_TIMEOUT_EXPIRES );
 
   port_state = PTP_SLAVE;
+  if( !clock->getSharedPHC() && _hw_timestamper != NULL ) {
+    clock->setTimestamper( _hw_timestamper );
+  }
 
   /*clock->addEventTimer
 	  ( this, SYNC_RECEIPT_TIMEOUT_EXPIRES,
@@ -687,18 +687,38 @@ void PTPMessageSync::sendPort(IEEE1588Port * port, PortIdentity * destIdentity)
 	control = MESSAGE_OTHER;
 	ClockIdentity clock_identity;
 
-	id = port->getClock()->getClockIdentity();
-	tlv.appendClockIdentity(&id);
+	IEEE1588Port *slave = port->getClock()->getSlavePort();
+	PTPMessageAnnounce *upstream = NULL;
+
+	if( slave != NULL && slave != port ) {
+		upstream = slave->calculateERBest();
+	}
 
-	currentUtcOffset = port->getClock()->getCurrentUtcOffset();
-	grandmasterPriority1 = port->getClock()->getPriority1();
-	grandmasterPriority2 = port->getClock()->getPriority2();
 	grandmasterClockQuality = new ClockQuality();
-	*grandmasterClockQuality = port->getClock()->getClockQuality();
-	stepsRemoved = 0;
-	timeSource = port->getClock()->getTimeSource();
-	clock_identity = port->getClock()->getGrandmasterClockIdentity();
-	clock_identity.getIdentityString(grandmasterIdentity);
+	if( upstream != NULL ) {
+		/* Bridge mode, relay the grandmaster received on the slave port */
+		tlv = upstream->tlv;
+		currentUtcOffset = upstream->currentUtcOffset;
+		grandmasterPriority1 = upstream->grandmasterPriority1;
+		grandmasterPriority2 = upstream->grandmasterPriority2;
+		*grandmasterClockQuality = *upstream->grandmasterClockQuality;
+		stepsRemoved = upstream->stepsRemoved + 1;
+		timeSource = upstream->timeSource;
+		memcpy( grandmasterIdentity, upstream->grandmasterIdentity,
+			PTP_CLOCK_IDENTITY_LENGTH );
+	} else {
+		currentUtcOffset = port->getClock()->getCurrentUtcOffset();
+		grandmasterPriority1 = port->getClock()->getPriority1();
+		grandmasterPriority2 = port->getClock()->getPriority2();
+		*grandmasterClockQuality = port->getClock()->getClockQuality();
+		stepsRemoved = 0;
+		timeSource = port->getClock()->getTimeSource();
+		clock_identity = port->getClock()->getGrandmasterClockIdentity();
+		clock_identity.getIdentityString(grandmasterIdentity);
+	}
+
+	id = port->getClock()->getClockIdentity();
+	tlv.appendClockIdentity(&id);
 
 	logMeanMessageInterval = port->getAnnounceInterval();
 	return;
@@ -897,6 +917,10 @@ void PTPMessageFollowUp::processMessage(IEEE1588Port * port)
 	FrequencyRatio master_local_freq_offset;
 	int correction;
 
+	/* Upstream values as received, forwarded unmodified in bridge mode */
+	Timestamp upstream_origin = preciseOriginTimestamp;
+	int64_t upstream_correction = correctionField >> 16;
+
 	XPTPD_INFO("Processing a follow-up message");
 
 	// Expire any SYNC_RECEIPT timers that exist
@@ -1003,6 +1027,13 @@ void PTPMessageFollowUp::processMessage(IEEE1588Port * port)
 			  local_system_offset, system_time, local_system_freq_offset,
 			  port->getSyncCount(), port->getPdelayCount(),
 			  port->getPortState() );
+		if( port->getPortState() == PTP_SLAVE ) {
+			port->getClock()->forwardSync
+				( port, sync_arrival, upstream_origin,
+				  upstream_correction + (int64_t)
+				  (delay * master_local_freq_offset),
+				  master_local_freq_offset );
+		}
 		port->syncDone();
 		// Restart the SYNC_RECEIPT timer
 		port->getClock()->addEventTimerLocked
@@ -49,10 +49,16 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "rt_setup.h"
+
+#define MAX_DOMAINS 8
+
 void print_usage( char *arg0 ) {
   fprintf( stderr,
 	   "%s <network interface> [-S] [-P] [-M <filename>] "
-	   "[-A <count>] [-G <group>] [-R <priority 1>]\n",
+	   "[-A <count>] [-G <group>] [-R <priority 1>] "
+	   "[-B <network interface>] [-C] [-D <domain>] "
+	   "[-F <priority>] [-N <cpu>]\n",
 	   arg0 );
   fprintf
 	  ( stderr,
@@ -61,13 +67,29 @@ void print_usage( char *arg0 ) {
 		"\t-A <count> initial accelerated sync count\n"
 		"\t-G <group> group id for shared memory\n"
 		"\t-R <priority 1> priority 1 value\n" 
-		"\t-T force master\n\t-L force slave\n" );
+		"\t-T force master\n\t-L force slave\n"
+		"\t-B <network interface> add bridge port (repeatable)\n"
+		"\t-C bridge ports share one hardware clock\n"
+		"\t-D <domain> add domain instance (repeatable)\n"
+		"\t-F <priority> run at this SCHED_FIFO priority, memory locked\n"
+		"\t-N <cpu> pin to this CPU, memory locked\n" );
 }
 
 int main(int argc, char **argv)
 {
 	sigset_t set;
-	InterfaceName *ifname;
+	InterfaceName *ifname[MAX_PORTS];
+	HWTimestamper *timestamper[MAX_PORTS];
+	IEEE1588Port *port[MAX_PORTS];
+	char *ifname_arg[MAX_PORTS];
+	int number_ports = 1;
+	bool shared_phc = false;
+	IEEE1588Clock *domain_clock[MAX_DOMAINS];
+	IEEE1588Port *domain_port[MAX_DOMAINS][MAX_PORTS];
+	LinuxSharedMemoryIPC *domain_ipc[MAX_DOMAINS];
+	unsigned char domain_list[MAX_DOMAINS];
+	int number_domains = 0;
+	const char *group_name = DEFAULT_GROUPNAME;
 	int sig;
 
 	bool syntonize = false;
@@ -86,14 +108,18 @@ int main(int argc, char **argv)
 	LinuxIPCArg *ipc_arg = NULL;
 	
 	int accelerated_sync_count = 0;
+	struct rt_config rt = RT_CONFIG_INIT;
+	bool rt_enable = false;
 
-	// Block SIGUSR1
+	// Block SIGUSR1 and the timer signals of further domain instances
 	{
 		sigset_t block;
 		sigemptyset( &block );
-		sigaddset( &block, SIGUSR1 );
+		for( i = 0; i <= MAX_DOMAINS; ++i ) {
+			sigaddset( &block, LinuxTimerQueueFactory::getSignal( i ));
+		}
 		if( pthread_sigmask( SIG_BLOCK, &block, NULL ) != 0 ) {
-			fprintf( stderr, "Failed to block SIGUSR1\n" );
+			fprintf( stderr, "Failed to block timer signals\n" );
 			return -1;
 		}
 	}
@@ -114,7 +140,7 @@ int main(int argc, char **argv)
 		print_usage( argv[0] );
 		return -1;
 	}
-	ifname = new InterfaceName( argv[1], strlen(argv[1]) ); 
+	ifname_arg[0] = argv[1];
 
 	/* Process optional arguments */
 	for( i = 2; i < argc; ++i ) {
@@ -153,7 +179,8 @@ int main(int argc, char **argv)
 			}
 			else if( toupper( argv[i][1] ) == 'G' ) {
 				if( i+1 < argc ) {
-					ipc_arg = new LinuxIPCArg(argv[++i]);
+					group_name = argv[++i];
+					ipc_arg = new LinuxIPCArg(group_name);
 				} else {
 					printf( "Must specify group name on the command line\n" );
 				}
@@ -161,6 +188,35 @@ int main(int argc, char **argv)
 			else if( toupper( argv[i][1] ) == 'P' ) {
 				pps = true;
 			}
+			else if( toupper( argv[i][1] ) == 'B' ) {
+				if( i+1 >= argc ) {
+					printf( "Bridge port interface must be specified on "
+							"command line\n" );
+				} else if( number_ports >= MAX_PORTS ) {
+					printf( "Too many bridge ports, ignoring %s\n",
+							argv[++i] );
+				} else {
+					ifname_arg[number_ports++] = argv[++i];
+				}
+			}
+			else if( toupper( argv[i][1] ) == 'C' ) {
+				shared_phc = true;
+			}
+			else if( toupper( argv[i][1] ) == 'D' ) {
+				if( i+1 >= argc ) {
+					printf( "Domain number must be specified on "
+							"command line\n" );
+				} else {
+					unsigned long tmp = strtoul( argv[i+1], NULL, 0 ); ++i;
+					if( tmp == 0 || tmp > 127 ) {
+						printf( "Invalid domain number, ignoring\n" );
+					} else if( number_domains >= MAX_DOMAINS ) {
+						printf( "Too many domains, ignoring %lu\n", tmp );
+					} else {
+						domain_list[number_domains++] = (unsigned char) tmp;
+					}
+				}
+			}
 			else if( toupper( argv[i][1] ) == 'H' ) {
 				print_usage( argv[0] );
 				return 0;
@@ -179,8 +235,30 @@ int main(int argc, char **argv)
 					}
 				}
 			}
+			else if( toupper( argv[i][1] ) == 'F' ) {
+				if( i+1 >= argc ) {
+					printf( "Scheduling priority must be specified on "
+							"command line\n" );
+				} else {
+					rt.priority = atoi( argv[++i] );
+					rt_enable = true;
+				}
+			}
+			else if( toupper( argv[i][1] ) == 'N' ) {
+				if( i+1 >= argc ) {
+					printf( "CPU must be specified on command line\n" );
+				} else {
+					rt.cpu = atoi( argv[++i] );
+					rt_enable = true;
+				}
+			}
 		}
 	}
+
+	/* Before any thread is started, so that all inherit CPU and policy */
+	if( rt_enable && rt_setup( &rt ) != 0 ) {
+		printf( "Real-time setup incomplete\n" );
+	}
     
 	if( !ipc->init( ipc_arg ) ) {
 	  delete ipc;
@@ -212,13 +290,15 @@ int main(int argc, char **argv)
 	
 	if (argc < 2)
 		return -1;
-	ifname = new InterfaceName(argv[1], strlen(argv[1]));
-
+	for( i = 0; i < number_ports; ++i ) {
+		ifname[i] = new InterfaceName
+			( ifname_arg[i], strlen( ifname_arg[i] ));
 #ifdef ARCH_INTELCE
-	HWTimestamper *timestamper = new LinuxTimestamperIntelCE();
+		timestamper[i] = new LinuxTimestamperIntelCE();
 #else
-	HWTimestamper *timestamper = new LinuxTimestamperGeneric();
+		timestamper[i] = new LinuxTimestamperGeneric();
 #endif
+	}
 
 	sigemptyset(&set);
 	sigaddset(&set, SIGINT);
@@ -229,8 +309,9 @@ int main(int argc, char **argv)
 	}
 
 	IEEE1588Clock *clock =
-	  new IEEE1588Clock( false, syntonize, priority1, timestamper,
+	  new IEEE1588Clock( false, syntonize, priority1, timestamper[0],
 			     timerq_factory , ipc, lock_factory );
+	clock->setSharedPHC( shared_phc );
 	
 	if( restoredataptr != NULL ) {
 	  if( !restorefailed )
@@ -241,34 +322,85 @@ int main(int argc, char **argv)
 	    (restoredatalength - restoredatacount);
 	}
 
-    IEEE1588Port *port =
-      new IEEE1588Port
-      ( clock, 1, false, accelerated_sync_count, timestamper, 0, ifname,
-	condition_factory, thread_factory, timer_factory, lock_factory );
-	if (!port->init_port()) {
-		printf("failed to initialize port \n");
+	/* Port numbers start at 1, the first port names the clock */
+	for( i = 0; i < number_ports; ++i ) {
+	  port[i] =
+	    new IEEE1588Port
+	    ( clock, i+1, false, accelerated_sync_count, timestamper[i], 0,
+	      ifname[i], condition_factory, thread_factory, timer_factory,
+	      lock_factory );
+	  if (!port[i]->init_port()) {
+		printf("failed to initialize port %s\n", ifname_arg[i]);
 		return -1;
-	}
+	  }
 
-	if( restoredataptr != NULL ) {
-	  if( !restorefailed ) restorefailed =
-	    !port->restoreSerializedState( restoredataptr, &restoredatacount );
-	  restoredataptr = ((char *)restoredata) +
-	    (restoredatalength - restoredatacount);
+	  if( restoredataptr != NULL ) {
+	    if( !restorefailed ) restorefailed =
+	      !port[i]->restoreSerializedState
+	      ( restoredataptr, &restoredatacount );
+	    restoredataptr = ((char *)restoredata) +
+	      (restoredatalength - restoredatacount);
+	  }
+
+	  if( override_portstate ) {
+		port[i]->setPortState( port_state );
+	  }
 	}
 
-	if( override_portstate ) {
-		port->setPortState( port_state );
+	/* Further domains get their own clock state and IPC segment but share
+	   each interface's socket, receive thread and timestamper with domain
+	   0.  Only domain 0 may discipline the PHC, so they never syntonize */
+	for( int d = 0; d < number_domains; ++d ) {
+	  char shm_name[SHM_NAME_MAX];
+	  snprintf( shm_name, sizeof( shm_name ), "%s%u", SHM_NAME,
+		    domain_list[d] );
+	  LinuxIPCArg domain_ipc_arg( group_name, shm_name );
+
+	  domain_ipc[d] = new LinuxSharedMemoryIPC();
+	  if( !domain_ipc[d]->init( &domain_ipc_arg ) ) {
+	    delete domain_ipc[d];
+	    domain_ipc[d] = NULL;
+	  }
+
+	  domain_clock[d] =
+	    new IEEE1588Clock( false, false, priority1, timestamper[0],
+			       timerq_factory, domain_ipc[d], lock_factory );
+	  domain_clock[d]->setDomain( domain_list[d] );
+	  domain_clock[d]->setSharedPHC( shared_phc );
+
+	  for( i = 0; i < number_ports; ++i ) {
+	    domain_port[d][i] =
+	      new IEEE1588Port
+	      ( domain_clock[d], i+1, false, accelerated_sync_count,
+		timestamper[i], 0, ifname[i], condition_factory,
+		thread_factory, timer_factory, lock_factory );
+	    domain_port[d][i]->shareInterface( port[i] );
+	    if (!domain_port[d][i]->init_port()) {
+		  printf("failed to initialize port %s domain %u\n",
+			 ifname_arg[i], domain_list[d]);
+		  return -1;
+	    }
+	    if( override_portstate ) {
+		  domain_port[d][i]->setPortState( port_state );
+	    }
+	  }
 	}
 
 	// Start PPS if requested
 	if( pps ) {
-	  if( !timestamper->HWTimestamper_PPS_start()) {
+	  if( !timestamper[0]->HWTimestamper_PPS_start()) {
 	    printf( "Failed to start pulse per second I/O\n" );
 	  }
 	}
 
-	port->processEvent(POWERUP);
+	for( i = 0; i < number_ports; ++i ) {
+		port[i]->processEvent(POWERUP);
+	}
+	for( int d = 0; d < number_domains; ++d ) {
+		for( i = 0; i < number_ports; ++i ) {
+			domain_port[d][i]->processEvent(POWERUP);
+		}
+	}
 
 	do {
 	if (sigwait(&set, &sig) != 0) {
@@ -279,15 +411,17 @@ int main(int argc, char **argv)
 	if (sig == SIGHUP) {
 	// If port is either master or slave, save clock and then port state
 	if( restorefd != -1 ) {
-	  if( port->getPortState() == PTP_MASTER ||
-	      port->getPortState() == PTP_SLAVE ) {
+	  if( port[0]->getPortState() == PTP_MASTER ||
+	      port[0]->getPortState() == PTP_SLAVE ) {
 	    printf( "Signal received to write restore data\n" );
 	    off_t len;
 	    restoredatacount = 0;
 	    clock->serializeState( NULL, &len );
 	    restoredatacount += len;
-	    port->serializeState( NULL, &len );
-	    restoredatacount += len;
+	    for( i = 0; i < number_ports; ++i ) {
+	      port[i]->serializeState( NULL, &len );
+	      restoredatacount += len;
+	    }
 	
 	    if( restoredatacount > restoredatalength ) {
 	      ftruncate( restorefd, restoredatacount );
@@ -308,9 +442,11 @@ int main(int argc, char **argv)
 	    clock->serializeState( restoredataptr, &restoredatacount );
 	    restoredataptr = ((char *)restoredata) +
 	      (restoredatalength - restoredatacount);
-	    port->serializeState( restoredataptr, &restoredatacount );
-	    restoredataptr = ((char *)restoredata) +
-	      (restoredatalength - restoredatacount);
+	    for( i = 0; i < number_ports; ++i ) {
+	      port[i]->serializeState( restoredataptr, &restoredatacount );
+	      restoredataptr = ((char *)restoredata) +
+		(restoredatalength - restoredatacount);
+	    }
 	  remap_failed:
 	    ;;
 	  }
@@ -326,12 +462,15 @@ int main(int argc, char **argv)
 
 	// Stop PPS if previously started
 	if( pps ) {
-	    if( !timestamper->HWTimestamper_PPS_stop()) {
+	    if( !timestamper[0]->HWTimestamper_PPS_stop()) {
 		printf( "Failed to stop pulse per second I/O\n" );
 	    }
 	}
 
 	if( ipc ) delete ipc;
+	for( int d = 0; d < number_domains; ++d ) {
+		if( domain_ipc[d] ) delete domain_ipc[d];
+	}
 
 	return 0;
 }
@@ -199,7 +199,7 @@ void *LinuxTimerQueueHandler( void *arg ) {
 	while( !timerq->stop ) {
 		siginfo_t info;
 		LinuxTimerQueueMap_t::iterator iter;
-		sigaddset( &waitfor, SIGUSR1 );
+		sigaddset( &waitfor, timerq->signo );
 		if( sigtimedwait( &waitfor, &info, &timeout ) == -1 ) {
 			if( errno == EAGAIN ) continue;
 			else break;
@@ -238,6 +238,13 @@ OSTimerQueue *LinuxTimerQueueFactory::createOSTimerQueue
 		return NULL;
 	}
 
+	ret->signo = getSignal( queue_count );
+	if( ret->signo > SIGRTMAX ) {
+		XPTPD_ERROR( "No signal left for timer queue %d", queue_count );
+		return NULL;
+	}
+	++queue_count;
+
 	if( pthread_create
 		( &(ret->_private->signal_thread),
 		  NULL, LinuxTimerQueueHandler, ret ) != 0 ) {
@@ -278,7 +285,7 @@ bool LinuxTimerQueue::addEvent
 		struct itimerspec its;
 		memset(&(outer_arg->sevp), 0, sizeof(outer_arg->sevp));
 		outer_arg->sevp.sigev_notify = SIGEV_SIGNAL;
-		outer_arg->sevp.sigev_signo  = SIGUSR1;
+		outer_arg->sevp.sigev_signo  = signo;
 		outer_arg->sevp.sigev_value.sival_int = key;
 		if ( timer_create
 			 (CLOCK_MONOTONIC, &outer_arg->sevp, &outer_arg->timer_handle)
@@ -608,7 +615,7 @@ LinuxThread::~LinuxThread() {
 
 LinuxSharedMemoryIPC::~LinuxSharedMemoryIPC() {
 	munmap(master_offset_buffer, SHM_SIZE);
-	shm_unlink(SHM_NAME);
+	shm_unlink(shm_name);
 }
 
 bool LinuxSharedMemoryIPC::init( OS_IPC_ARG *barg ) {
@@ -618,6 +625,7 @@ bool LinuxSharedMemoryIPC::init( OS_IPC_ARG *barg ) {
 	pthread_mutexattr_t shared;
 	mode_t oldumask = umask(0);
 
+	strncpy( shm_name, SHM_NAME, SHM_NAME_MAX );
 	if( barg == NULL ) {
 		group_name = DEFAULT_GROUPNAME;
 	} else {
@@ -627,6 +635,9 @@ bool LinuxSharedMemoryIPC::init( OS_IPC_ARG *barg ) {
 			goto exit_error;
 		} else {
 			group_name = arg->group_name;
+			if( arg->shm_name[0] != '\0' ) {
+				strncpy( shm_name, arg->shm_name, SHM_NAME_MAX );
+			}
 		}
 	}
 	grp = getgrnam( group_name );
@@ -634,7 +645,7 @@ bool LinuxSharedMemoryIPC::init( OS_IPC_ARG *barg ) {
 		XPTPD_ERROR( "Group %s not found, will try root (0) instead", group_name );
 	}
 		
-	shm_fd = shm_open( SHM_NAME, O_RDWR | O_CREAT, 0660 );
+	shm_fd = shm_open( shm_name, O_RDWR | O_CREAT, 0660 );
 	if( shm_fd == -1 ) {
 		XPTPD_ERROR( "shm_open(): %s", strerror(errno) );
 		goto exit_error;
@@ -673,7 +684,7 @@ bool LinuxSharedMemoryIPC::init( OS_IPC_ARG *barg ) {
 	}
 	return true;
  exit_unlink:
-	shm_unlink( SHM_NAME ); 
+	shm_unlink( shm_name ); 
  exit_error:
 	return false;
 }
@@ -709,7 +720,7 @@ bool LinuxSharedMemoryIPC::update
 void LinuxSharedMemoryIPC::stop() {
 	if( master_offset_buffer != NULL ) {
 		munmap( master_offset_buffer, SHM_SIZE );
-		shm_unlink( SHM_NAME );
+		shm_unlink( shm_name );
 	}
 }
 
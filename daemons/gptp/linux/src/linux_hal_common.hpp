@@ -44,6 +44,7 @@
 #include "ieee1588.hpp"
 
 #include <list>
+#include <signal.h>
 
 #define ONE_WAY_PHY_DELAY 400
 #define P8021AS_MULTICAST "\x01\x80\xC2\x00\x00\x0E"
@@ -189,6 +190,7 @@ class LinuxTimerQueue : public OSTimerQueue {
 private:
 	LinuxTimerQueueMap_t timerQueueMap;
 	int key;
+	int signo;
 	bool stop;
 	LinuxTimerQueuePrivate_t _private;
 	OSLock *lock;
@@ -207,8 +209,19 @@ public:
 };
 
 class LinuxTimerQueueFactory : public OSTimerQueueFactory {
+private:
+	int queue_count;
 public:
+	LinuxTimerQueueFactory() {
+		queue_count = 0;
+	}
 	virtual OSTimerQueue *createOSTimerQueue( IEEE1588Clock *clock );
+	/* Each timer queue waits on its own signal so that queues of several
+	   clocks do not steal each other's expirations; every thread must
+	   block the signals of all queues that will be created */
+	static int getSignal( int index ) {
+		return index == 0 ? SIGUSR1 : SIGRTMIN + index - 1;
+	}
 };
 
 
@@ -267,15 +280,25 @@ public:
 };
 
 
+#define DEFAULT_GROUPNAME "ptp"
+#define SHM_NAME_MAX 32
+
 class LinuxIPCArg : public OS_IPC_ARG {
 private:
 	char *group_name;
+	char shm_name[SHM_NAME_MAX];
 public:
-	LinuxIPCArg( char *group_name ) {
+	/* shm_name selects the segment; NULL uses the default SHM_NAME */
+	LinuxIPCArg( const char *group_name, const char *shm_name = NULL ) {
 		int len = strnlen(group_name,16);
 		this->group_name = new char[len+1];
 		strncpy( this->group_name, group_name, len+1 );
 		this->group_name[len] = '\0';
+		this->shm_name[0] = '\0';
+		if( shm_name != NULL ) {
+			strncpy( this->shm_name, shm_name, SHM_NAME_MAX );
+			this->shm_name[SHM_NAME_MAX-1] = '\0';
+		}
 	}
 	virtual ~LinuxIPCArg() {
 		delete group_name;
@@ -283,18 +306,18 @@ public:
 	friend class LinuxSharedMemoryIPC;
 };
 
-#define DEFAULT_GROUPNAME "ptp"
-
 class LinuxSharedMemoryIPC:public OS_IPC {
 private:
 	int shm_fd;
 	char *master_offset_buffer;
+	char shm_name[SHM_NAME_MAX];
 	int err;
 public:
 	LinuxSharedMemoryIPC() {
 		shm_fd = 0;
 		err = 0;
 		master_offset_buffer = NULL;
+		shm_name[0] = '\0';
 	};
 	~LinuxSharedMemoryIPC();
 	virtual bool init( OS_IPC_ARG *barg = NULL );
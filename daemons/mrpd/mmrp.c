@@ -49,137 +49,291 @@ int mmrp_txpdu(void);
 
 unsigned char MMRP_ADDR[] = { 0x01, 0x80, 0xC2, 0x00, 0x00, 0x20 };
 
-extern unsigned char STATION_ADDR[];
+extern MRPD_THREAD_LOCAL unsigned char STATION_ADDR[];
 
-SOCKET mmrp_socket;
+MRPD_THREAD_LOCAL SOCKET mmrp_socket;
 
-struct mmrp_database *MMRP_db;
+/* frame buffer reused by every transmitted PDU */
+static unsigned char mmrp_tx_frame[MAX_FRAME_SIZE];
 
-struct mmrp_attribute *mmrp_lookup(struct mmrp_attribute *rattrib)
+MRPD_THREAD_LOCAL struct mmrp_database *MMRP_db;
+
+/* attributes of all ports */
+static struct mrp_slab mmrp_slab = MRP_SLAB_INIT(struct mmrp_attribute);
+
+#define MMRP_MAC_HASH_MIN	64
+
+static uint64_t mmrp_mac_key(const unsigned char *macaddr)
+{
+	return ((uint64_t) macaddr[0] << 40) | ((uint64_t) macaddr[1] << 32) |
+	    ((uint64_t) macaddr[2] << 24) | ((uint64_t) macaddr[3] << 16) |
+	    ((uint64_t) macaddr[4] << 8) | (uint64_t) macaddr[5];
+}
+
+static unsigned int mmrp_mac_slot(const unsigned char *macaddr,
+				  unsigned int size)
+{
+	/* Fibonacci hashing - multicast MACs mostly differ in the low bytes */
+	return (unsigned int)((mmrp_mac_key(macaddr) *
+			       0x9E3779B97F4A7C15ULL) >> 32) & (size - 1);
+}
+
+static struct mmrp_attribute *mmrp_mac_find(const unsigned char *macaddr)
 {
 	struct mmrp_attribute *attrib;
-	int mac_eq;
+	unsigned int mask;
+	unsigned int i;
 
-	attrib = MMRP_db->attrib_list;
-	while (NULL != attrib) {
-		if (rattrib->type == attrib->type) {
-			if (MMRP_SVCREQ_TYPE == attrib->type) {
-				/* this makes no sense to me ...
-				 * its boolean .. but ..
-				 */
-				if (attrib->attribute.svcreq ==
-				    rattrib->attribute.svcreq)
-					return attrib;
-			} else {
-				mac_eq = memcmp(attrib->attribute.macaddr,
-						rattrib->attribute.macaddr, 6);
-				if (0 == mac_eq)
-					return attrib;
-			}
-		}
-		attrib = attrib->next;
+	if (0 == MMRP_db->mac_count)
+		return NULL;
+
+	mask = MMRP_db->mac_hash_size - 1;
+	i = mmrp_mac_slot(macaddr, MMRP_db->mac_hash_size);
+	while (NULL != (attrib = MMRP_db->mac_hash[i])) {
+		if (0 == memcmp(attrib->attribute.macaddr, macaddr, 6))
+			return attrib;
+		i = (i + 1) & mask;
 	}
 	return NULL;
 }
 
-int mmrp_add(struct mmrp_attribute *rattrib)
+static void mmrp_mac_hash_put(struct mmrp_attribute **hash, unsigned int size,
+			      struct mmrp_attribute *attrib)
 {
-	struct mmrp_attribute *attrib;
-	struct mmrp_attribute *attrib_tail;
-	int mac_eq;
+	unsigned int i;
 
-	/* XXX do a lookup first to guarantee uniqueness? */
+	i = mmrp_mac_slot(attrib->attribute.macaddr, size);
+	while (NULL != hash[i])
+		i = (i + 1) & (size - 1);
+	hash[i] = attrib;
+}
+
+/* keep the hash at most half full and the ordered array large enough */
+static int mmrp_mac_reserve(unsigned int count)
+{
+	struct mmrp_attribute **hash;
+	struct mmrp_attribute **order;
+	unsigned int size;
+	unsigned int i;
+
+	if (count > MMRP_db->mac_order_size) {
+		size = MMRP_db->mac_order_size ?
+		    2 * MMRP_db->mac_order_size : MMRP_MAC_HASH_MIN / 2;
+		order = realloc(MMRP_db->mac_order, size * sizeof(*order));
+		if (NULL == order)
+			return -1;
+		MMRP_db->mac_order = order;
+		MMRP_db->mac_order_size = size;
+	}
 
-	attrib_tail = attrib = MMRP_db->attrib_list;
+	if (2 * count <= MMRP_db->mac_hash_size)
+		return 0;
 
-	while (NULL != attrib) {
-		/* sort list into types, then sorted in order within types */
-		if (rattrib->type == attrib->type) {
-			if (MMRP_SVCREQ_TYPE == attrib->type) {
-				if (attrib->attribute.svcreq <
-				    rattrib->attribute.svcreq) {
-					/* possible tail insertion ... */
-
-					if (NULL != attrib->next) {
-						if (MMRP_SVCREQ_TYPE ==
-						    attrib->next->type) {
-							attrib = attrib->next;
-							continue;
-						}
-					}
+	size = MMRP_db->mac_hash_size ?
+	    2 * MMRP_db->mac_hash_size : MMRP_MAC_HASH_MIN;
+	hash = calloc(size, sizeof(*hash));
+	if (NULL == hash)
+		return -1;
+	for (i = 0; i < MMRP_db->mac_count; i++)
+		mmrp_mac_hash_put(hash, size, MMRP_db->mac_order[i]);
+	free(MMRP_db->mac_hash);
+	MMRP_db->mac_hash = hash;
+	MMRP_db->mac_hash_size = size;
+	return 0;
+}
 
-					rattrib->next = attrib->next;
-					rattrib->prev = attrib;
-					attrib->next = rattrib;
-					if (rattrib->next)
-						rattrib->next->prev = rattrib;
-					return 0;
-
-				} else {
-					/* head insertion ... */
-					rattrib->next = attrib;
-					rattrib->prev = attrib->prev;
-					attrib->prev = rattrib;
-					if (NULL != rattrib->prev)
-						rattrib->prev->next = rattrib;
-					else
-						MMRP_db->attrib_list = rattrib;
-
-					return 0;
-				}
-			} else {
-				mac_eq = memcmp(attrib->attribute.macaddr,
-						rattrib->attribute.macaddr, 6);
+/* index of the first ordered MAC attribute not below macaddr */
+static unsigned int mmrp_mac_order_pos(const unsigned char *macaddr)
+{
+	unsigned int lo = 0;
+	unsigned int hi = MMRP_db->mac_count;
+	unsigned int mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (memcmp(MMRP_db->mac_order[mid]->attribute.macaddr,
+			   macaddr, 6) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
 
-				if (mac_eq < 0) {
-					/* possible tail insertion ... */
+static void mmrp_mac_remove(struct mmrp_attribute *attrib)
+{
+	struct mmrp_attribute **hash = MMRP_db->mac_hash;
+	unsigned int mask = MMRP_db->mac_hash_size - 1;
+	unsigned int i, j, home;
+	unsigned int pos;
+
+	pos = mmrp_mac_order_pos(attrib->attribute.macaddr);
+	if ((pos >= MMRP_db->mac_count) || (MMRP_db->mac_order[pos] != attrib))
+		return;		/* not indexed */
+
+	memmove(&MMRP_db->mac_order[pos], &MMRP_db->mac_order[pos + 1],
+		(MMRP_db->mac_count - pos - 1) * sizeof(*MMRP_db->mac_order));
+	MMRP_db->mac_count--;
+
+	i = mmrp_mac_slot(attrib->attribute.macaddr, MMRP_db->mac_hash_size);
+	while (hash[i] != attrib)
+		i = (i + 1) & mask;
+
+	/* backward shift deletion, no tombstones needed */
+	j = i;
+	for (;;) {
+		hash[i] = NULL;
+		do {
+			j = (j + 1) & mask;
+			if (NULL == hash[j])
+				return;
+			home = mmrp_mac_slot(hash[j]->attribute.macaddr,
+					     MMRP_db->mac_hash_size);
+		} while ((i <= j) ? ((i < home) && (home <= j))
+			 : ((i < home) || (home <= j)));
+		hash[i] = hash[j];
+		i = j;
+	}
+}
 
-					if (NULL != attrib->next) {
-						if (MMRP_MACVEC_TYPE ==
-						    attrib->next->type) {
-							attrib = attrib->next;
-							continue;
-						}
-					}
+static void mmrp_link_before(struct mmrp_attribute *rattrib,
+			     struct mmrp_attribute *attrib)
+{
+	rattrib->next = attrib;
+	rattrib->prev = attrib->prev;
+	attrib->prev = rattrib;
+	if (NULL != rattrib->prev)
+		rattrib->prev->next = rattrib;
+	else
+		MMRP_db->attrib_list = rattrib;
+}
 
-					rattrib->next = attrib->next;
-					rattrib->prev = attrib;
-					attrib->next = rattrib;
-					if (rattrib->next)
-						rattrib->next->prev = rattrib;
-					return 0;
-
-				} else {
-					/* head insertion ... */
-					rattrib->next = attrib;
-					rattrib->prev = attrib->prev;
-					attrib->prev = rattrib;
-					if (NULL != rattrib->prev)
-						rattrib->prev->next = rattrib;
-					else
-						MMRP_db->attrib_list = rattrib;
-
-					return 0;
-				}
+static void mmrp_link_after(struct mmrp_attribute *rattrib,
+			    struct mmrp_attribute *attrib)
+{
+	rattrib->prev = attrib;
+	rattrib->next = attrib->next;
+	attrib->next = rattrib;
+	if (NULL != rattrib->next)
+		rattrib->next->prev = rattrib;
+}
+
+static void mmrp_link_head(struct mmrp_attribute *rattrib)
+{
+	rattrib->prev = NULL;
+	rattrib->next = MMRP_db->attrib_list;
+	if (NULL != rattrib->next)
+		rattrib->next->prev = rattrib;
+	MMRP_db->attrib_list = rattrib;
+}
+
+static void mmrp_unlink(struct mmrp_attribute *attrib)
+{
+	mrp_lvtimer_stop(&(MMRP_db->mrp_db), &(attrib->registrar));
+
+	if (MMRP_SVCREQ_TYPE == attrib->type) {
+		if (MMRP_db->svc_table[attrib->attribute.svcreq] == attrib)
+			MMRP_db->svc_table[attrib->attribute.svcreq] = NULL;
+	} else {
+		mmrp_mac_remove(attrib);
+	}
+
+	if (NULL != attrib->prev)
+		attrib->prev->next = attrib->next;
+	else
+		MMRP_db->attrib_list = attrib->next;
+	if (NULL != attrib->next)
+		attrib->next->prev = attrib->prev;
+}
+
+/*
+ * Pending transmit set order, as in attrib_list: the service requirements
+ * first, then the MACs sorted like mac_order.
+ */
+static int mmrp_tx_cmp(mrp_applicant_attribute_t * a,
+		       mrp_applicant_attribute_t * b)
+{
+	struct mmrp_attribute *aa = MRP_APPLICANT_OWNER(a, struct mmrp_attribute);
+	struct mmrp_attribute *ba = MRP_APPLICANT_OWNER(b, struct mmrp_attribute);
+
+	if (aa->type != ba->type)
+		return (MMRP_SVCREQ_TYPE == aa->type) ? -1 : 1;
+	if (MMRP_SVCREQ_TYPE == aa->type)
+		return (int)aa->attribute.svcreq - (int)ba->attribute.svcreq;
+	return memcmp(aa->attribute.macaddr, ba->attribute.macaddr, 6);
+}
+
+/* walk the pending transmit set, sorted by mmrp_tx_cmp() */
+static struct mmrp_attribute *mmrp_tx_next(struct mmrp_attribute *attrib)
+{
+	mrp_applicant_attribute_t *app;
+
+	if (NULL == attrib)
+		app = MMRP_db->mrp_db.tx_pending;
+	else
+		app = attrib->applicant.tx_next;
+
+	if (NULL == app)
+		return NULL;
+	return MRP_APPLICANT_OWNER(app, struct mmrp_attribute);
+}
+
+struct mmrp_attribute *mmrp_lookup(struct mmrp_attribute *rattrib)
+{
+	if (MMRP_SVCREQ_TYPE == rattrib->type)
+		return MMRP_db->svc_table[rattrib->attribute.svcreq];
+
+	return mmrp_mac_find(rattrib->attribute.macaddr);
+}
+
+int mmrp_add(struct mmrp_attribute *rattrib)
+{
+	struct mmrp_attribute **order;
+	unsigned int pos;
+	int svc;
+
+	/* XXX do a lookup first to guarantee uniqueness? */
+
+	/*
+	 * The list stays sorted into types, then sorted in order within
+	 * types - the indexes find the neighbour to stitch in against.
+	 */
+	if (MMRP_SVCREQ_TYPE == rattrib->type) {
+		MMRP_db->svc_table[rattrib->attribute.svcreq] = rattrib;
+		for (svc = rattrib->attribute.svcreq - 1; svc >= 0; svc--) {
+			if (NULL != MMRP_db->svc_table[svc]) {
+				mmrp_link_after(rattrib, MMRP_db->svc_table[svc]);
+				return 0;
 			}
 		}
-		attrib_tail = attrib;
-		attrib = attrib->next;
+		for (svc = rattrib->attribute.svcreq + 1; svc < 256; svc++) {
+			if (NULL != MMRP_db->svc_table[svc]) {
+				mmrp_link_before(rattrib, MMRP_db->svc_table[svc]);
+				return 0;
+			}
+		}
+		mmrp_link_head(rattrib);
+		return 0;
 	}
 
-	/* if we are here we didn't need to stitch in a a sorted entry
-	 * so append it onto the tail (if it exists)
-	 */
+	if (mmrp_mac_reserve(MMRP_db->mac_count + 1) < 0)
+		return -1;
 
-	if (NULL == attrib_tail) {
-		rattrib->next = NULL;
-		rattrib->prev = NULL;
-		MMRP_db->attrib_list = rattrib;
-	} else {
-		rattrib->next = NULL;
-		rattrib->prev = attrib_tail;
-		attrib_tail->next = rattrib;
-	}
+	order = MMRP_db->mac_order;
+	pos = mmrp_mac_order_pos(rattrib->attribute.macaddr);
+
+	if (pos > 0)
+		mmrp_link_after(rattrib, order[pos - 1]);
+	else if (pos < MMRP_db->mac_count)
+		mmrp_link_before(rattrib, order[pos]);
+	else
+		mmrp_link_head(rattrib);
+
+	memmove(&order[pos + 1], &order[pos],
+		(MMRP_db->mac_count - pos) * sizeof(*order));
+	order[pos] = rattrib;
+	MMRP_db->mac_count++;
+	mmrp_mac_hash_put(MMRP_db->mac_hash, MMRP_db->mac_hash_size, rattrib);
 
 	return 0;
 }
@@ -201,7 +355,13 @@ int mmrp_merge(struct mmrp_attribute *rattrib)
 int mmrp_event(int event, struct mmrp_attribute *rattrib)
 {
 	struct mmrp_attribute *attrib;
-	int count = 0;
+	mrp_registrar_attribute_t *reg;
+
+	if ((MRP_EVENT_TX == event) || (MRP_EVENT_LVATIMER == event)) {
+		event = mrp_tx_opportunity(&(MMRP_db->mrp_db), event);
+		if (0 == event)
+			return 0;
+	}
 
 	switch (event) {
 	case MRP_EVENT_LVATIMER:
@@ -226,7 +386,9 @@ int mmrp_event(int event, struct mmrp_attribute *rattrib)
 
 		MMRP_db->send_empty_LeaveAll_flag = 1;
 		mrp_lvatimer_fsm(&(MMRP_db->mrp_db), MRP_EVENT_TX);
+		mrp_tx_pending_sort(&(MMRP_db->mrp_db), mmrp_tx_cmp);
 		mmrp_txpdu();
+		mrp_tx_pending_retire(&(MMRP_db->mrp_db));
 		MMRP_db->send_empty_LeaveAll_flag = 0;
 		break;
 	case MRP_EVENT_RLA:
@@ -256,40 +418,37 @@ int mmrp_event(int event, struct mmrp_attribute *rattrib)
 		break;
 	case MRP_EVENT_TX:
 		mrp_jointimer_stop(&(MMRP_db->mrp_db));
-		attrib = MMRP_db->attrib_list;
-
-		while (NULL != attrib) {
+		/* only the attributes with something to send */
+		for (attrib = mmrp_tx_next(NULL); NULL != attrib;
+		     attrib = mmrp_tx_next(attrib)) {
 #if LOG_MMRP
 			mrpd_log_printf("MMRP -> mrp_applicant_fsm\n");
 #endif
 			mrp_applicant_fsm(&(MMRP_db->mrp_db),
 					  &(attrib->applicant), MRP_EVENT_TX,
 					  mrp_registrar_in(&(attrib->registrar)));
-			count += mrp_applicant_state_transition_implies_tx(&(attrib->applicant));
-			attrib = attrib->next;
 		}
 
+		mrp_tx_pending_sort(&(MMRP_db->mrp_db), mmrp_tx_cmp);
 		mmrp_txpdu();
 
 		/*
 		 * Certain state transitions imply we need to request another tx
 		 * opportunity.
 		 */
-		if (count) {
+		if (mrp_tx_pending_retire(&(MMRP_db->mrp_db))) {
 			mrp_jointimer_start(&(MMRP_db->mrp_db));
 		}
 
 		break;
 	case MRP_EVENT_LVTIMER:
-		mrp_lvtimer_stop(&(MMRP_db->mrp_db));
-		attrib = MMRP_db->attrib_list;
+		/* only the registrars whose own leave timer ran out */
+		reg = mrp_lvtimer_expired(&(MMRP_db->mrp_db));
 
-		while (NULL != attrib) {
-			mrp_registrar_fsm(&(attrib->registrar),
-					  &(MMRP_db->mrp_db),
+		while (NULL != reg) {
+			mrp_registrar_fsm(reg, &(MMRP_db->mrp_db),
 					  MRP_EVENT_LVTIMER);
-
-			attrib = attrib->next;
+			reg = reg->lv_next;
 		}
 		break;
 	case MRP_EVENT_PERIODIC:
@@ -327,11 +486,17 @@ int mmrp_event(int event, struct mmrp_attribute *rattrib)
 		attrib = mmrp_lookup(rattrib);
 
 		if (NULL == attrib) {
-			mmrp_add(rattrib);
+			if (mmrp_add(rattrib) < 0) {
+				mmrp_free(rattrib);
+				return -1;
+			}
 			attrib = rattrib;
+			/* it may stay reclaimable without an FSM transition */
+			mrp_gc_push(&(MMRP_db->mrp_db), &(attrib->registrar.gc),
+				    1);
 		} else {
 			mmrp_merge(rattrib);
-			free(rattrib);
+			mmrp_free(rattrib);
 		}
 
 #if LOG_MMRP
@@ -391,16 +556,14 @@ int mmrp_event(int event, struct mmrp_attribute *rattrib)
 	return 0;
 }
 
-struct mmrp_attribute *mmrp_alloc()
+struct mmrp_attribute *mmrp_alloc(void)
 {
 	struct mmrp_attribute *attrib;
 
-	attrib = (struct mmrp_attribute *) malloc(sizeof(struct mmrp_attribute));
+	attrib = (struct mmrp_attribute *)mrp_slab_alloc(&mmrp_slab);
 	if (NULL == attrib)
 		return NULL;
 
-	memset(attrib, 0, sizeof(struct mmrp_attribute));
-
 	attrib->applicant.mrp_state = MRP_VO_STATE;
 	attrib->applicant.tx = 0;
 	attrib->applicant.sndmsg = MRP_SND_NULL;
@@ -417,6 +580,16 @@ struct mmrp_attribute *mmrp_alloc()
 	return attrib;
 }
 
+void mmrp_free(struct mmrp_attribute *attrib)
+{
+	if (NULL != MMRP_db) {
+		mrp_gc_remove(&(MMRP_db->mrp_db), &(attrib->applicant.gc));
+		mrp_gc_remove(&(MMRP_db->mrp_db), &(attrib->registrar.gc));
+		mrp_tx_dequeue(&(MMRP_db->mrp_db), &(attrib->applicant));
+	}
+	mrp_slab_free(&mmrp_slab, attrib);
+}
+
 void mmrp_increment_macaddr(uint8_t * macaddr)
 {
 
@@ -460,6 +633,7 @@ int mmrp_recv_msg()
 	bytes = mrpd_recvmsgbuf(mmrp_socket, &msgbuf);
 	if (bytes <= 0)
 		goto out;
+	MRP_STAT_INC(MMRP_db->mrp_db.stats.pdu_rx);
 
 	if ((unsigned int)bytes < (sizeof(eth_hdr_t) + sizeof(mrpdu_t) +
 				   sizeof(mrpdu_message_t)))
@@ -534,7 +708,7 @@ int mmrp_recv_msg()
 
 					attrib->type = 	MMRP_SVCREQ_TYPE;				
 					mmrp_event(MRP_EVENT_RLA, attrib);
-					free(attrib);
+					mmrp_free(attrib);
 				}
 
 				if (0 == numvalues)
@@ -561,12 +735,7 @@ int mmrp_recv_msg()
 					vect_3pack =
 					    mrpdu_vectorptr->
 					    FirstValue_VectorEvents[vectidx];
-					vectevt[0] = vect_3pack / 36;
-					vectevt[1] =
-					    (vect_3pack - vectevt[0] * 36) / 6;
-					vectevt[2] =
-					    vect_3pack - (36 * vectevt[0]) -
-					    (6 * vectevt[1]);
+					MRPDU_3PACK_DECODE(vect_3pack, vectevt);
 
 					numvalues_processed =
 					    (numvalues > 3 ? 3 : numvalues);
@@ -622,7 +791,7 @@ int mmrp_recv_msg()
 							     attrib);
 							break;
 						default:
-							free(attrib);
+							mmrp_free(attrib);
 							break;
 						}
 					}
@@ -669,7 +838,7 @@ int mmrp_recv_msg()
 
 					attrib->type = 	MMRP_MACVEC_TYPE;				
 					mmrp_event(MRP_EVENT_RLA, attrib);
-					free(attrib);
+					mmrp_free(attrib);
 				}
 
 				if (0 == numvalues)
@@ -697,12 +866,7 @@ int mmrp_recv_msg()
 					vect_3pack =
 					    mrpdu_vectorptr->
 					    FirstValue_VectorEvents[vectidx];
-					vectevt[0] = vect_3pack / 36;
-					vectevt[1] =
-					    (vect_3pack - vectevt[0] * 36) / 6;
-					vectevt[2] =
-					    vect_3pack - (36 * vectevt[0]) -
-					    (6 * vectevt[1]);
+					MRPDU_3PACK_DECODE(vect_3pack, vectevt);
 
 					numvalues_processed =
 					    (numvalues > 3 ? 3 : numvalues);
@@ -758,7 +922,7 @@ int mmrp_recv_msg()
 							     attrib);
 							break;
 						default:
-							free(attrib);
+							mmrp_free(attrib);
 							break;
 						}
 					}
@@ -782,11 +946,10 @@ int mmrp_recv_msg()
 		}
 	}
 
-	free(msgbuf);
 	return 0;
  out:
-	free(msgbuf);
-
+	if (bytes > 0)
+		MRP_STAT_INC(MMRP_db->mrp_db.stats.pdu_rx_errors);
 	return -1;
 }
 
@@ -816,24 +979,24 @@ mmrp_emit_svcvectors(unsigned char *msgbuf, unsigned char *msgbuf_eof,
 	mrpdu_msg->AttributeType = MMRP_SVCREQ_TYPE;
 	mrpdu_msg->AttributeLength = 1;
 
-	attrib = MMRP_db->attrib_list;
+	attrib = mmrp_tx_next(NULL);
 
 	mrpdu_vectorptr = (mrpdu_vectorattrib_t *) mrpdu_msg->Data;
 
 	while ((mrpdu_msg_ptr < (mrpdu_msg_eof - vector_size - MRPDU_ENDMARK_SZ)) && (NULL != attrib)) {
 
 		if (MMRP_SVCREQ_TYPE != attrib->type) {
-			attrib = attrib->next;
+			attrib = mmrp_tx_next(attrib);
 			continue;
 		}
 
 		if (0 == attrib->applicant.tx) {
-			attrib = attrib->next;
+			attrib = mmrp_tx_next(attrib);
 			continue;
 		}
 		attrib->applicant.tx = 0;
 		if (MRP_ENCODE_OPTIONAL == attrib->applicant.encode) {
-			attrib = attrib->next;
+			attrib = mmrp_tx_next(attrib);
 			continue;
 		}
 
@@ -887,7 +1050,7 @@ mmrp_emit_svcvectors(unsigned char *msgbuf, unsigned char *msgbuf_eof,
 		 */
 
 		vectidx = 2;
-		vattrib = attrib->next;
+		vattrib = mmrp_tx_next(attrib);
 
 		while (NULL != vattrib) {
 			if (MMRP_SVCREQ_TYPE != vattrib->type)
@@ -961,7 +1124,7 @@ mmrp_emit_svcvectors(unsigned char *msgbuf, unsigned char *msgbuf_eof,
 			    > (mrpdu_msg_eof - MRPDU_ENDMARK_SZ))
 				goto oops;
 
-			vattrib = vattrib->next;
+			vattrib = mmrp_tx_next(vattrib);
 		}
 
 		/* handle any trailers */
@@ -992,7 +1155,7 @@ mmrp_emit_svcvectors(unsigned char *msgbuf, unsigned char *msgbuf_eof,
 		mrpdu_msg_ptr =
 		    &(mrpdu_vectorptr->FirstValue_VectorEvents[vectidx]);
 
-		attrib = attrib->next;
+		attrib = mmrp_tx_next(attrib);
 
 		mrpdu_vectorptr = (mrpdu_vectorattrib_t *) mrpdu_msg_ptr;
 
@@ -1059,24 +1222,24 @@ mmrp_emit_macvectors(unsigned char *msgbuf, unsigned char *msgbuf_eof,
 	mrpdu_msg->AttributeType = MMRP_MACVEC_TYPE;
 	mrpdu_msg->AttributeLength = 6;
 
-	attrib = MMRP_db->attrib_list;
+	attrib = mmrp_tx_next(NULL);
 
 	mrpdu_vectorptr = (mrpdu_vectorattrib_t *) mrpdu_msg->Data;
 
 	while ((mrpdu_msg_ptr < (mrpdu_msg_eof - vector_size - MRPDU_ENDMARK_SZ)) && (NULL != attrib)) {
 
 		if (MMRP_MACVEC_TYPE != attrib->type) {
-			attrib = attrib->next;
+			attrib = mmrp_tx_next(attrib);
 			continue;
 		}
 
 		if (0 == attrib->applicant.tx) {
-			attrib = attrib->next;
+			attrib = mmrp_tx_next(attrib);
 			continue;
 		}
 		attrib->applicant.tx = 0;
 		if (MRP_ENCODE_OPTIONAL == attrib->applicant.encode) {
-			attrib = attrib->next;
+			attrib = mmrp_tx_next(attrib);
 			continue;
 		}
 
@@ -1132,7 +1295,7 @@ mmrp_emit_macvectors(unsigned char *msgbuf, unsigned char *msgbuf_eof,
 		 */
 
 		vectidx = 6;
-		vattrib = attrib->next;
+		vattrib = mmrp_tx_next(attrib);
 
 		while (NULL != vattrib) {
 			if (MMRP_MACVEC_TYPE != vattrib->type)
@@ -1210,7 +1373,7 @@ mmrp_emit_macvectors(unsigned char *msgbuf, unsigned char *msgbuf_eof,
 			    > (mrpdu_msg_eof - vector_size))
 				goto oops;
 
-			vattrib = vattrib->next;
+			vattrib = mmrp_tx_next(vattrib);
 		}
 
 		/* handle any trailers */
@@ -1239,7 +1402,7 @@ mmrp_emit_macvectors(unsigned char *msgbuf, unsigned char *msgbuf_eof,
 		mrpdu_msg_ptr =
 		    &(mrpdu_vectorptr->FirstValue_VectorEvents[vectidx]);
 
-		attrib = attrib->next;
+		attrib = mmrp_tx_next(attrib);
 
 		mrpdu_vectorptr = (mrpdu_vectorattrib_t *) mrpdu_msg_ptr;
 	}
@@ -1275,9 +1438,7 @@ int mmrp_txpdu(void)
 	int rc;
 	int lva = 0;
 
-	msgbuf = (unsigned char *)malloc(MAX_FRAME_SIZE);
-	if (NULL == msgbuf)
-		return -1;
+	msgbuf = mmrp_tx_frame;
 	memset(msgbuf, 0, MAX_FRAME_SIZE);
 	msgbuf_len = 0;
 
@@ -1364,7 +1525,6 @@ int mmrp_txpdu(void)
 	/* endmark */
 
 	if (mrpdu_msg_ptr == MRPD_GET_MRPDU_MESSAGE_LIST(mrpdu)) {
-		free(msgbuf);
 		return 0;
 	}
 
@@ -1386,13 +1546,13 @@ int mmrp_txpdu(void)
 #if LOG_ERRORS
 		fprintf(stderr, "%s - Error on send %s", __FUNCTION__, strerror(errno));
 #endif
+		MRP_STAT_INC(MMRP_db->mrp_db.stats.pdu_tx_errors);
 		goto out;
 	}
+	MRP_STAT_INC(MMRP_db->mrp_db.stats.pdu_tx);
 
-	free(msgbuf);
 	return 0;
  out:
-	free(msgbuf);
 	/* caller should assume TXLAF */
 	return -1;
 }
@@ -1404,10 +1564,36 @@ int mmrp_send_notifications(struct mmrp_attribute *attrib, int notify)
 	char *regsrc;
 	char mrp_state[8];
 	client_t *client;
+	struct mrpd_notify_rec rec;
+	int i;
 
 	if (NULL == attrib)
 		return -1;
 
+	if ((MRP_NOTIFY_NEW != notify) && (MRP_NOTIFY_JOIN != notify) &&
+	    (MRP_NOTIFY_LV != notify))
+		return 0;
+
+	/* MAC vector attributes are keyed by MAC address */
+	if (0 == mrp_client_match(&MMRP_db->mrp_db, attrib->type,
+				  MMRP_MACVEC_TYPE == attrib->type,
+				  mmrp_mac_key(attrib->attribute.macaddr)))
+		return 0;	/* nobody subscribed */
+
+	memset(&rec, 0, sizeof(rec));
+	rec.notify = (uint8_t)notify;
+	rec.type = (uint8_t)attrib->type;
+	rec.applicant_state = (uint8_t)attrib->applicant.mrp_state;
+	rec.registrar_state = (uint8_t)attrib->registrar.mrp_state;
+	memcpy(rec.registrar, attrib->registrar.macaddr, sizeof(rec.registrar));
+	if (MMRP_SVCREQ_TYPE == attrib->type)
+		rec.u.svcreq = attrib->attribute.svcreq;
+	else
+		memcpy(rec.u.macaddr, attrib->attribute.macaddr,
+		       sizeof(rec.u.macaddr));
+	if (0 == mrp_client_notify_post(&MMRP_db->mrp_db, &rec))
+		return 0;	/* no text clients, skip formatting */
+
 	msgbuf = (char *)malloc(MAX_MRPD_CMDSZ);
 	if (NULL == msgbuf)
 		return -1;
@@ -1459,10 +1645,12 @@ int mmrp_send_notifications(struct mmrp_attribute *attrib, int notify)
 		break;
 	}
 
-	client = MMRP_db->mrp_db.clients;
-	while (NULL != client) {
+	for (i = 0; i < MMRP_db->mrp_db.notify_set_count; i++) {
+		client = MMRP_db->mrp_db.notify_set[i];
+		if (client->flags & MRP_CLIENT_BINARY)
+			continue;
 		mrpd_send_ctl_msg(&(client->client), msgbuf, MAX_MRPD_CMDSZ);
-		client = client->next;
+		MRP_STAT_INC(MMRP_db->mrp_db.stats.notify_sent);
 	}
 
  free_msgbuf:
@@ -1474,7 +1662,8 @@ int mmrp_send_notifications(struct mmrp_attribute *attrib, int notify)
 	return 0;
 }
 
-int mmrp_dumptable(struct sockaddr_in *client)
+/* the database from entry 'offset' on, as msrp_dump() pages */
+static int mmrp_dump(struct sockaddr_in *client, int offset)
 {
 	char *msgbuf;
 	char *msgbuf_wrptr;
@@ -1482,6 +1671,7 @@ int mmrp_dumptable(struct sockaddr_in *client)
 	char *variant;
 	char *regsrc;
 	struct mmrp_attribute *attrib;
+	int index = 0;
 
 	msgbuf = (char *)malloc(MAX_MRPD_CMDSZ);
 	if (NULL == msgbuf)
@@ -1502,11 +1692,11 @@ int mmrp_dumptable(struct sockaddr_in *client)
 
 	attrib = MMRP_db->attrib_list;
 
-	if (attrib == NULL) {
-		sprintf(msgbuf, "MMRP:Empty\n");
-	}
-
 	while (NULL != attrib) {
+		if (index++ < offset) {
+			attrib = attrib->next;
+			continue;
+		}
 		if (MMRP_SVCREQ_TYPE == attrib->type) {
 			sprintf(variant, "S=%d", attrib->attribute.svcreq);
 		} else {
@@ -1538,11 +1728,20 @@ int mmrp_dumptable(struct sockaddr_in *client)
 		default:
 			break;
 		}
+		if (msgbuf_wrptr + strnlen(stage, 128) >=
+		    msgbuf + MAX_MRPD_CMDSZ - MRP_DUMP_TRAILER_SZ) {
+			sprintf(msgbuf_wrptr, "MMRP:More O=%d\n", index - 1);
+			msgbuf_wrptr += strlen(msgbuf_wrptr);
+			break;
+		}
 		sprintf(msgbuf_wrptr, "%s", stage);
 		msgbuf_wrptr += strnlen(stage, 128);
 		attrib = attrib->next;
 	}
 
+	if (msgbuf_wrptr == msgbuf)
+		sprintf(msgbuf, "MMRP:Empty\n");
+
 	mrpd_send_ctl_msg(client, msgbuf, MAX_MRPD_CMDSZ);
 
  free_msgbuf:
@@ -1554,7 +1753,11 @@ int mmrp_dumptable(struct sockaddr_in *client)
 		free(stage);
 	free(msgbuf);
 	return 0;
+}
 
+int mmrp_dumptable(struct sockaddr_in *client)
+{
+	return mmrp_dump(client, 0);
 }
 
 int mmrp_cmd_parse_mac(char *buf, int buflen, uint8_t * mac, int *err_index)
@@ -1606,6 +1809,31 @@ int mmrp_cmd_service(uint8_t service, int mrp_event)
 	return 0;
 }
 
+/* M+F:T=2 or M+F:M=0180c2000020 - narrow the notifications */
+static int mmrp_cmd_filter(char *buf, int buflen, struct sockaddr_in *client,
+			   int *err_index)
+{
+	uint8_t type;
+	uint8_t mac[6];
+	struct parse_param type_specs[] = {
+		{"T" PARSE_ASSIGN, parse_u8, &type},
+		{0, parse_null, 0}
+	};
+
+	if (buflen < 7)
+		return -1;
+
+	if (strstr(buf + 4, "T" PARSE_ASSIGN)) {
+		if (parse(buf + 4, buflen - 4, type_specs, err_index))
+			return -1;
+		return mrp_client_filter_type(&MMRP_db->mrp_db, client, type);
+	}
+	if (mmrp_cmd_parse_mac(buf, buflen, mac, err_index))
+		return -1;
+	return mrp_client_filter_key(&MMRP_db->mrp_db, client,
+				     mmrp_mac_key(mac), mmrp_mac_key(mac));
+}
+
 int mmrp_recv_cmd(char *buf, int buflen, struct sockaddr_in *client)
 {
 	int rc;
@@ -1621,7 +1849,9 @@ int mmrp_recv_cmd(char *buf, int buflen, struct sockaddr_in *client)
 		goto out;
 	}
 
-	rc = mrp_client_add(&(MMRP_db->mrp_db.clients), client);
+	rc = mrp_client_add(&(MMRP_db->mrp_db), client);
+	if (rc)
+		goto out_ERI;
 
 	if (buflen < 3)
 		return -1;
@@ -1630,13 +1860,39 @@ int mmrp_recv_cmd(char *buf, int buflen, struct sockaddr_in *client)
 		return -1;
 
 	/*
-	 * M?? - query MMRP Registrar MAC Address database
+	 * M?? - query MMRP Registrar MAC Address database, M??:O=<n> from
+	 *       entry n on
 	 * M+? - JOIN a MAC address or service declaration
 	 * M++   NEW a MAC Address (XXX: MMRP doesn't use 'New' though?)
 	 * M-- - LV a MAC address or service declaration
+	 * M+B   Send notifications to this client in binary form
+	 * M-B   Send notifications to this client as text (default)
+	 * M+F   Only notify this client of an attribute type or MAC
+	 * M-F   Remove the notification filters of this client
+	 * M?A   Report the occupancy of the MMRP attribute slab
+	 * M?T   Report the transmit opportunities taken and held back
 	 */
 	if (strncmp(buf, "M??", 3) == 0) {
-		mmrp_dumptable(client);
+		rc = mrp_dump_offset(buf, buflen);
+		if (rc < 0)
+			goto out_ERP;
+		mmrp_dump(client, rc);
+	} else if (strncmp(buf, "M?A", 3) == 0) {
+		mrp_slab_report(&mmrp_slab, "MMRP", client);
+	} else if (strncmp(buf, "M?T", 3) == 0) {
+		mrp_tx_report(&(MMRP_db->mrp_db), "MMRP", client);
+	} else if ((strncmp(buf, "M+B", 3) == 0)
+		   || (strncmp(buf, "M-B", 3) == 0)) {
+		rc = mrp_client_set_binary(&(MMRP_db->mrp_db), client,
+					   'M', '+' == buf[1]);
+		if (rc)
+			goto out_ERI;
+	} else if (strncmp(buf, "M+F", 3) == 0) {
+		rc = mmrp_cmd_filter(buf, buflen, client, &err_index);
+		if (rc)
+			goto out_ERP;
+	} else if (strncmp(buf, "M-F", 3) == 0) {
+		mrp_client_filter_clear(&MMRP_db->mrp_db, client);
 	} else if (strncmp(buf, "M--:S", 5) == 0) {
 		rc = mmrp_cmd_parse_service(buf, buflen, &svcreq_param,
 					    &err_index);
@@ -1765,32 +2021,78 @@ int mmrp_init(int mmrp_enable)
 	return -1;
 }
 
+/* returns the number of candidates left for the next tick */
 int mmrp_reclaim(void)
 {
-	struct mmrp_attribute *mattrib, *free_mattrib;
+	struct mmrp_attribute *mattrib;
+	struct mrp_gc_link *link;
+	int budget = MRP_GC_BUDGET;
 
 	if (NULL == MMRP_db)
 		return 0;
 
-	mattrib = MMRP_db->attrib_list;
-	while (NULL != mattrib) {
-		if ((mattrib->registrar.mrp_state == MRP_MT_STATE) &&
-		    ((mattrib->applicant.mrp_state == MRP_VO_STATE) ||
-		     (mattrib->applicant.mrp_state == MRP_AO_STATE) ||
-		     (mattrib->applicant.mrp_state == MRP_QO_STATE))) {
-			if (NULL != mattrib->prev)
-				mattrib->prev->next = mattrib->next;
-			else
-				MMRP_db->attrib_list = mattrib->next;
-			if (NULL != mattrib->next)
-				mattrib->next->prev = mattrib->prev;
-			free_mattrib = mattrib;
-			mattrib = mattrib->next;
-			mmrp_send_notifications(free_mattrib, MRP_NOTIFY_LV);
-			free(free_mattrib);
-		} else
-			mattrib = mattrib->next;
+	while (budget-- && (NULL != (link = mrp_gc_pop(&(MMRP_db->mrp_db))))) {
+		mattrib = MRP_GC_OWNER(link, struct mmrp_attribute);
+		if (mrp_reclaimable(&(mattrib->applicant),
+				    &(mattrib->registrar))) {
+			mmrp_unlink(mattrib);
+			mmrp_send_notifications(mattrib, MRP_NOTIFY_LV);
+			mmrp_free(mattrib);
+		}
 	}
+	return MMRP_db->mrp_db.gc_count;
+}
+
+/* add the attributes worth keeping to a checkpoint, see mrpd -c */
+int mmrp_snapshot(struct mrp_snapshot *snap)
+{
+	struct mmrp_attribute *attrib;
+
+	if (NULL == MMRP_db)
+		return 0;
+
+	snap->app = 'M';
+	for (attrib = MMRP_db->attrib_list; NULL != attrib;
+	     attrib = attrib->next) {
+		if (mrp_reclaimable(&(attrib->applicant), &(attrib->registrar)))
+			continue;
+		if (NULL == mrp_snapshot_attrib(snap, &(attrib->applicant),
+						&(attrib->registrar),
+						attrib->type,
+						&(attrib->attribute),
+						sizeof(attrib->attribute)))
+			return -1;
+	}
+
+	return mrp_snapshot_clients(snap, &(MMRP_db->mrp_db));
+}
+
+int mmrp_restore(const struct mrp_snapshot_rec *rec, int fresh)
+{
+	struct mmrp_attribute *attrib;
+
+	if (NULL == MMRP_db)
+		return -1;
+
+	if (MRP_SNAP_ATTRIB != rec->kind)
+		return mrp_restore_client(&(MMRP_db->mrp_db), rec);
+
+	if (!mrp_restore_wanted(rec, fresh))
+		return 0;
+
+	attrib = mmrp_alloc();
+	if (NULL == attrib)
+		return -1;
+
+	attrib->type = rec->type;
+	memcpy(&(attrib->attribute), rec->u.value, sizeof(attrib->attribute));
+
+	if ((NULL != mmrp_lookup(attrib)) || (mmrp_add(attrib) < 0)) {
+		mmrp_free(attrib);
+		return 0;
+	}
+	mrp_restore_attrib(&(MMRP_db->mrp_db), rec, &(attrib->applicant),
+			   &(attrib->registrar), fresh);
 	return 0;
 }
 
@@ -1807,14 +2109,18 @@ void mmrp_reset(void)
 	while (NULL != sattrib) {
 		free_sattrib = sattrib;
 		sattrib = sattrib->next;
-		free(free_sattrib);
+		mmrp_free(free_sattrib);
 	}
+	free(MMRP_db->mac_hash);
+	free(MMRP_db->mac_order);
 	free(MMRP_db);
 }
 
 
 void mmrp_bye(struct sockaddr_in *client)
 {
-	if (NULL != MMRP_db)
-		mrp_client_delete(&(MMRP_db->mrp_db.clients), client);
+	if (NULL != MMRP_db) {
+		mrp_client_filter_clear(&MMRP_db->mrp_db, client);
+		mrp_client_delete(&(MMRP_db->mrp_db), client);
+	}
 }
@@ -66,14 +66,27 @@ struct mmrp_database {
 	struct mrp_database mrp_db;
 	struct mmrp_attribute *attrib_list;
 	int send_empty_LeaveAll_flag;
+	/* service requirement attributes indexed by value */
+	struct mmrp_attribute *svc_table[256];
+	/* open addressed (linear probe) hash of MAC attributes */
+	struct mmrp_attribute **mac_hash;
+	unsigned int mac_hash_size;	/* power of 2 */
+	/* the same MAC attributes in address order, for run detection */
+	struct mmrp_attribute **mac_order;
+	unsigned int mac_order_size;
+	unsigned int mac_count;
 };
 
 int mmrp_init(int mmrp_enable);
 void mmrp_reset(void);
 int mmrp_event(int event, struct mmrp_attribute *rattrib);
+struct mmrp_attribute *mmrp_alloc(void);
+void mmrp_free(struct mmrp_attribute *attrib);
 struct mmrp_attribute *mmrp_lookup(struct mmrp_attribute *rattrib);
 int mmrp_recv_cmd(char *buf, int buflen, struct sockaddr_in *client);
 int mmrp_reclaim(void);
+int mmrp_snapshot(struct mrp_snapshot *snap);
+int mmrp_restore(const struct mrp_snapshot_rec *rec, int fresh);
 void mmrp_bye(struct sockaddr_in *client);
 int mmrp_recv_msg(void);
 void mmrp_increment_macaddr(uint8_t * macaddr);
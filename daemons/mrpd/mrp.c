@@ -36,10 +36,12 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stddef.h>
+#include <stdarg.h>
 #include <string.h>
 
 #include "mrpd.h"
 #include "mrp.h"
+#include "parse.h"
 
 /* state machine controls */
 int p2pmac;
@@ -230,67 +232,94 @@ char *mrp_print_status(const mrp_applicant_attribute_t * app,
 
 #endif
 
-static int client_lookup(client_t * list, struct sockaddr_in *newclient)
+static client_t *client_lookup(client_t * list, struct sockaddr_in *newclient)
 {
 	client_t *client_item;
 
 	client_item = list;
 
 	if (NULL == newclient)
-		return 0;
+		return NULL;
 
 	while (NULL != client_item) {
-		if (client_item->client.sin_port == newclient->sin_port)
-			return 1;
+		/* Unix domain clients carry AF_UNIX and a connection number */
+		if ((client_item->client.sin_port == newclient->sin_port) &&
+		    (client_item->client.sin_family == newclient->sin_family))
+			return client_item;
 		client_item = client_item->next;
 	}
+	return NULL;
+}
+
+/* the UDP clients and their filters are part of the -c snapshot */
+static void mrp_client_changed(struct mrp_database *mrp_db, client_t * client)
+{
+	if (AF_INET == client->client.sin_family)
+		MRP_STAT_INC(mrp_db->state_gen);
+}
+
+/* grow notify_set to hold 'count' clients */
+static int mrp_client_reserve(struct mrp_database *mrp_db, int count)
+{
+	client_t **set;
+	int size;
+
+	if (count <= mrp_db->notify_set_size)
+		return 0;
+
+	size = mrp_db->notify_set_size ? 2 * mrp_db->notify_set_size : 8;
+	while (size < count)
+		size *= 2;
+	set = (client_t **)realloc(mrp_db->notify_set, size * sizeof(*set));
+	if (NULL == set)
+		return -1;
+	mrp_db->notify_set = set;
+	mrp_db->notify_set_size = size;
+
 	return 0;
 }
 
-int mrp_client_add(client_t ** list, struct sockaddr_in *newclient)
+/*
+ * Add a client to the database. notify_set is grown here to hold every
+ * client, so that mrp_client_match() never allocates and can not lose a
+ * client; a failure is returned to the caller instead.
+ */
+int mrp_client_add(struct mrp_database *mrp_db, struct sockaddr_in *newclient)
 {
 	client_t *client_item;
-
-	client_item = *list;
+	client_t **link;
+	int count = 1;
 
 	if (NULL == newclient)
 		return -1;
 
-	if (client_lookup(client_item, newclient))
+	if (client_lookup(mrp_db->clients, newclient))
 		return 0;	/* already present */
 
-	/* handle 1st entry into list */
-	if (NULL == client_item) {
-		client_item = (client_t *)malloc(sizeof(client_t));
-		if (NULL == client_item)
-			return -1;
-		client_item->next = NULL;
-		client_item->client = *newclient;
-		*list = client_item;
-		return 0;
-	}
+	for (link = &mrp_db->clients; NULL != *link; link = &(*link)->next)
+		count++;
 
-	while (client_item) {
-		if (NULL == client_item->next) {
-			client_item->next = (client_t *)malloc(sizeof(client_t));
-			if (NULL == client_item->next)
-				return -1;
-			client_item = client_item->next;
-			client_item->next = NULL;
-			client_item->client = *newclient;
-			return 0;
-		}
-		client_item = client_item->next;
-	}
-	return -1;
+	if (mrp_client_reserve(mrp_db, count) < 0)
+		return -1;
+
+	client_item = (client_t *)malloc(sizeof(client_t));
+	if (NULL == client_item)
+		return -1;
+	memset(client_item, 0, sizeof(client_t));
+	client_item->client = *newclient;
+	*link = client_item;
+	mrp_client_changed(mrp_db, client_item);
+
+	return 0;
 }
 
-int mrp_client_delete(client_t ** list, struct sockaddr_in *newclient)
+int mrp_client_delete(struct mrp_database *mrp_db,
+		      struct sockaddr_in *newclient)
 {
 	client_t *client_item;
 	client_t *client_last;
 
-	client_item = *list;
+	client_item = mrp_db->clients;
 	client_last = NULL;
 
 	if (NULL == newclient)
@@ -306,12 +335,14 @@ int mrp_client_delete(client_t ** list, struct sockaddr_in *newclient)
 
 			if (client_last) {
 				client_last->next = client_item->next;
-				free(client_item);
 			} else {
 				/* reset the head pointer */
-				*list = client_item->next;
-				free(client_item);
+				mrp_db->clients = client_item->next;
 			}
+			mrp_client_changed(mrp_db, client_item);
+			if (client_item->notify_buf)
+				free(client_item->notify_buf);
+			free(client_item);
 			return 0;
 		}
 		client_last = client_item;
@@ -321,6 +352,255 @@ int mrp_client_delete(client_t ** list, struct sockaddr_in *newclient)
 	return 0;
 }
 
+static void mrp_client_notify_send(client_t * client)
+{
+	struct mrpd_notify_hdr *hdr;
+
+	if (0 == client->notify_count)
+		return;
+
+	hdr = (struct mrpd_notify_hdr *)client->notify_buf;
+	hdr->count = htons((uint16_t)client->notify_count);
+	mrpd_send_ctl_msg(&client->client, (char *)client->notify_buf,
+			  sizeof(*hdr) +
+			  client->notify_count * sizeof(struct mrpd_notify_rec));
+	client->notify_count = 0;
+}
+
+/*
+ * Switch a client between text and binary notifications. The binary
+ * batch buffer is allocated on the first switch and kept, so toggling
+ * back and forth does not allocate again.
+ */
+int mrp_client_set_binary(struct mrp_database *mrp_db,
+			  struct sockaddr_in *client, int app, int enable)
+{
+	struct mrpd_notify_hdr *hdr;
+	client_t *list;
+
+	list = client_lookup(mrp_db->clients, client);
+	if (NULL == list)
+		return -1;
+
+	if (!enable) {
+		mrp_client_notify_send(list);
+		if (list->flags & MRP_CLIENT_BINARY)
+			mrp_client_changed(mrp_db, list);
+		list->flags &= ~MRP_CLIENT_BINARY;
+		return 0;
+	}
+
+	if (NULL == list->notify_buf) {
+		list->notify_buf = (unsigned char *)malloc(MAX_MRPD_CMDSZ);
+		if (NULL == list->notify_buf)
+			return -1;
+		memset(list->notify_buf, 0, MAX_MRPD_CMDSZ);
+	}
+	hdr = (struct mrpd_notify_hdr *)list->notify_buf;
+	hdr->magic = htons(MRPD_NOTIFY_MAGIC);
+	hdr->version = MRPD_NOTIFY_VERSION;
+	hdr->app = (uint8_t)app;
+	list->notify_count = 0;
+	if (!(list->flags & MRP_CLIENT_BINARY))
+		mrp_client_changed(mrp_db, list);
+	list->flags |= MRP_CLIENT_BINARY;
+
+	return 0;
+}
+
+static unsigned int mrp_sub_hash(uint64_t key)
+{
+	/* Fibonacci hashing, top bits select the bucket */
+	return (unsigned int)((key * 0x9e3779b97f4a7c15ull) >> 58) &
+	    (MRP_SUB_HASH_SIZE - 1);
+}
+
+/* only attribute types set with mrp_client_filter_type() reach a client */
+int mrp_client_filter_type(struct mrp_database *mrp_db,
+			   struct sockaddr_in *client, int type)
+{
+	client_t *client_item;
+
+	client_item = client_lookup(mrp_db->clients, client);
+	if ((NULL == client_item) || (type < 0) || (type > 31))
+		return -1;
+
+	if (!(client_item->type_mask & ((uint32_t)1 << type)))
+		mrp_client_changed(mrp_db, client_item);
+	client_item->type_mask |= (uint32_t)1 << type;
+	return 0;
+}
+
+/*
+ * Restrict keyed notifications to keys in lo..hi. Several keys and
+ * ranges may be added; events that carry no key (e.g. an MSRP domain)
+ * are not affected.
+ */
+int mrp_client_filter_key(struct mrp_database *mrp_db,
+			  struct sockaddr_in *client, uint64_t lo, uint64_t hi)
+{
+	client_t *client_item;
+	struct mrp_subscription *sub;
+	struct mrp_subscription **head;
+
+	client_item = client_lookup(mrp_db->clients, client);
+	if ((NULL == client_item) || (lo > hi))
+		return -1;
+
+	sub = (struct mrp_subscription *)malloc(sizeof(*sub));
+	if (NULL == sub)
+		return -1;
+
+	sub->client = client_item;
+	sub->lo = lo;
+	sub->hi = hi;
+	if (lo == hi)
+		head = &mrp_db->sub_hash[mrp_sub_hash(lo)];
+	else
+		head = &mrp_db->sub_ranges;
+	sub->next = *head;
+	*head = sub;
+	client_item->sub_count++;
+	mrp_client_changed(mrp_db, client_item);
+
+	return 0;
+}
+
+static void mrp_sub_remove(struct mrp_subscription **head, client_t * client)
+{
+	struct mrp_subscription *sub;
+
+	while (NULL != *head) {
+		sub = *head;
+		if (sub->client == client) {
+			*head = sub->next;
+			free(sub);
+		} else {
+			head = &sub->next;
+		}
+	}
+}
+
+/* drop all filters of a client; it receives every notification again */
+void mrp_client_filter_clear(struct mrp_database *mrp_db,
+			     struct sockaddr_in *client)
+{
+	client_t *client_item;
+	int i;
+
+	client_item = client_lookup(mrp_db->clients, client);
+	if (NULL == client_item)
+		return;
+
+	if (client_item->sub_count || client_item->type_mask)
+		mrp_client_changed(mrp_db, client_item);
+	if (client_item->sub_count) {
+		for (i = 0; i < MRP_SUB_HASH_SIZE; i++)
+			mrp_sub_remove(&mrp_db->sub_hash[i], client_item);
+		mrp_sub_remove(&mrp_db->sub_ranges, client_item);
+	}
+	client_item->sub_count = 0;
+	client_item->type_mask = 0;
+}
+
+/* notify_set has room for every client, see mrp_client_add() */
+static void mrp_client_select(struct mrp_database *mrp_db, client_t * client,
+			      int type)
+{
+	if (client->match_gen == mrp_db->sub_gen)
+		return;		/* already selected */
+	if (client->type_mask && !(client->type_mask & ((uint32_t)1 << type)))
+		return;
+
+	client->match_gen = mrp_db->sub_gen;
+	mrp_db->notify_set[mrp_db->notify_set_count++] = client;
+}
+
+/*
+ * Select the clients interested in an event of attribute 'type' and,
+ * if 'keyed', with the given key into mrp_db->notify_set. Subscribed
+ * keys are found through the hash and range index instead of testing
+ * every client's key set. Returns the number of clients selected.
+ */
+int mrp_client_match(struct mrp_database *mrp_db, int type, int keyed,
+		     uint64_t key)
+{
+	struct mrp_subscription *sub;
+	client_t *client;
+
+	mrp_db->notify_set_count = 0;
+	if (NULL == mrp_db->clients)
+		return 0;
+
+	mrp_db->sub_gen++;
+	if (0 == mrp_db->sub_gen) {
+		/* wrapped, forget stale selection marks */
+		for (client = mrp_db->clients; client; client = client->next)
+			client->match_gen = 0;
+		mrp_db->sub_gen = 1;
+	}
+
+	for (client = mrp_db->clients; client; client = client->next) {
+		if (!keyed || (0 == client->sub_count))
+			mrp_client_select(mrp_db, client, type);
+	}
+
+	if (keyed) {
+		for (sub = mrp_db->sub_hash[mrp_sub_hash(key)]; sub;
+		     sub = sub->next) {
+			if (sub->lo == key)
+				mrp_client_select(mrp_db, sub->client, type);
+		}
+		for (sub = mrp_db->sub_ranges; sub; sub = sub->next) {
+			if ((sub->lo <= key) && (key <= sub->hi))
+				mrp_client_select(mrp_db, sub->client, type);
+		}
+	}
+
+	return mrp_db->notify_set_count;
+}
+
+/*
+ * Queue a notification record for every binary client selected by
+ * mrp_client_match(); a full batch is sent straight away. Returns the
+ * number of selected clients still using the text protocol, so the
+ * caller can skip formatting the text message when there are none.
+ */
+int mrp_client_notify_post(struct mrp_database *mrp_db,
+			   struct mrpd_notify_rec *rec)
+{
+	struct mrpd_notify_rec *slot;
+	client_t *client;
+	int text_clients = 0;
+	int i;
+
+	for (i = 0; i < mrp_db->notify_set_count; i++) {
+		client = mrp_db->notify_set[i];
+		if (!(client->flags & MRP_CLIENT_BINARY)) {
+			text_clients++;
+			continue;
+		}
+		if (client->notify_count >= (int)MRPD_NOTIFY_MAX_RECS)
+			mrp_client_notify_send(client);
+		slot = (struct mrpd_notify_rec *)
+		    (client->notify_buf + sizeof(struct mrpd_notify_hdr));
+		memcpy(&slot[client->notify_count], rec, sizeof(*rec));
+		client->notify_count++;
+		MRP_STAT_INC(mrp_db->stats.notify_sent);
+	}
+	return text_clients;
+}
+
+/* send out the partially filled batches, once per event loop wakeup */
+void mrp_client_notify_flush(client_t * list)
+{
+	while (NULL != list) {
+		if (list->flags & MRP_CLIENT_BINARY)
+			mrp_client_notify_send(list);
+		list = list->next;
+	}
+}
+
 int mrp_jointimer_start(struct mrp_database *mrp_db)
 {
 	int ret = 0;
@@ -335,6 +615,9 @@ int mrp_jointimer_start(struct mrp_database *mrp_db)
 #endif
 	if (!mrp_db->join_timer_running) {
 		ret = mrpd_timer_start(mrp_db->join_timer, MRP_JOINTIMER_VAL);
+	} else {
+		/* joins the transmit opportunity already scheduled */
+		mrp_db->tx_merged++;
 	}
 	if (ret >= 0)
 		mrp_db->join_timer_running = 1;
@@ -350,32 +633,540 @@ int mrp_jointimer_stop(struct mrp_database *mrp_db)
 	return mrpd_timer_stop(mrp_db->join_timer);
 }
 
-int mrp_lvtimer_start(struct mrp_database *mrp_db)
+/*
+ * Gate the TX and LVATIMER events of an application. Returns the event
+ * to go ahead with, or 0 if the application used up its transmit
+ * opportunities (10.7.4.1); the join timer is then re-armed for the
+ * moment the oldest one leaves the window, and everything pending by then
+ * goes out in a single opportunity. A LeaveAll held back this way is sent
+ * in place of that TX.
+ */
+int mrp_tx_opportunity(struct mrp_database *mrp_db, int event)
+{
+	unsigned long now = mrpd_clock_ms();
+	unsigned long oldest;
+
+	oldest = mrp_db->txopp_ms[mrp_db->txopp_next];
+	if ((mrp_db->txopp_count == MRP_TXOPP_MAX) &&
+	    (now - oldest < MRP_TXOPP_WINDOW)) {
+		mrp_db->tx_suppressed++;
+		if (MRP_EVENT_LVATIMER == event)
+			mrp_db->lva_deferred = 1;
+#if LOG_TIMERS
+		mrpd_log_printf("MRP transmit opportunity deferred %lu ms\n",
+				MRP_TXOPP_WINDOW - (now - oldest));
+#endif
+		mrpd_timer_stop(mrp_db->join_timer);
+		mrp_db->join_timer_running =
+		    (mrpd_timer_start(mrp_db->join_timer,
+				      MRP_TXOPP_WINDOW - (now - oldest)) >= 0);
+		return 0;
+	}
+
+	mrp_db->txopp_ms[mrp_db->txopp_next] = now;
+	mrp_db->txopp_next = (mrp_db->txopp_next + 1) % MRP_TXOPP_MAX;
+	if (mrp_db->txopp_count < MRP_TXOPP_MAX)
+		mrp_db->txopp_count++;
+	mrp_db->tx_opportunities++;
+
+	if (mrp_db->lva_deferred) {
+		mrp_db->lva_deferred = 0;
+		if (MRP_EVENT_TX == event)
+			mrp_db->tx_merged++;
+		return MRP_EVENT_LVATIMER;
+	}
+	return event;
+}
+
+int mrp_tx_report(struct mrp_database *mrp_db, const char *name,
+		  struct sockaddr_in *client)
+{
+	char respbuf[160];
+
+	memset(respbuf, 0, sizeof(respbuf));
+	snprintf(respbuf, sizeof(respbuf) - 1,
+		 "TXS %s opportunities=%lu suppressed=%lu merged=%lu "
+		 "leaveall_deferred=%d\n", name, mrp_db->tx_opportunities,
+		 mrp_db->tx_suppressed, mrp_db->tx_merged,
+		 mrp_db->lva_deferred);
+
+	return mrpd_send_ctl_msg(client, respbuf, sizeof(respbuf));
+}
+
+void mrp_histogram_add(struct mrp_histogram *hist, unsigned long us)
+{
+	int n = 0;
+
+	while ((n < MRP_HIST_BUCKETS - 1) && (us >> n))
+		n++;
+
+	MRP_STAT_INC(hist->bucket[n]);
+	MRP_STAT_INC(hist->count);
+	MRP_STAT_ADD(hist->sum_us, us);
+	if (us > hist->max_us)
+		MRP_STAT_SET(hist->max_us, us);
+}
+
+/*
+ * snprintf() at buf + len. Returns the new length, which stops at
+ * size - 1 once the output is cut short.
+ */
+static int mrp_appendf(char *buf, int size, int len, const char *fmt, ...)
+{
+	va_list ap;
+	int rc;
+
+	if (len >= size - 1)
+		return size - 1;
+
+	va_start(ap, fmt);
+	rc = vsnprintf(buf + len, size - len, fmt, ap);
+	va_end(ap);
+	if (rc < 0)
+		return len;
+
+	return (rc >= size - 1 - len) ? size - 1 : len + rc;
+}
+
+/* the buckets up to the last one in use, comma separated */
+static int mrp_counters_format(char *buf, int size, int len,
+			       const unsigned long *counters, int n)
+{
+	int i;
+
+	while ((n > 1) && (0 == MRP_STAT_READ(counters[n - 1])))
+		n--;
+
+	for (i = 0; i < n; i++)
+		len = mrp_appendf(buf, size, len, "%s%lu", i ? "," : "",
+				  MRP_STAT_READ(counters[i]));
+
+	return len;
+}
+
+int mrp_histogram_report(struct mrp_histogram *hist, const char *name,
+			 int port, struct sockaddr_in *client)
+{
+	char respbuf[320];
+	int len;
+
+	memset(respbuf, 0, sizeof(respbuf));
+	len = mrp_appendf(respbuf, sizeof(respbuf) - 1, 0,
+			  "HST %s P=%d n=%lu sum_us=%llu max_us=%lu b=", name,
+			  port, MRP_STAT_READ(hist->count),
+			  MRP_STAT_READ(hist->sum_us),
+			  MRP_STAT_READ(hist->max_us));
+	len = mrp_counters_format(respbuf, sizeof(respbuf) - 1, len,
+				  hist->bucket, MRP_HIST_BUCKETS);
+	if (len < (int)sizeof(respbuf) - 2)
+		respbuf[len] = '\n';
+
+	return mrpd_send_ctl_msg(client, respbuf, sizeof(respbuf));
+}
+
+/*
+ * Two lines: the PDU and notification counters, then the FSM events
+ * indexed by MRP_EVENT_x / MRP_EVENT_SPACING - 1, applicant (A) and
+ * registrar (R).
+ */
+int mrp_stats_report(struct mrp_database *mrp_db, const char *name,
+		     int port, struct sockaddr_in *client)
+{
+	struct mrp_stats *stats = &mrp_db->stats;
+	char respbuf[512];
+	int len;
+	int rc;
+
+	memset(respbuf, 0, sizeof(respbuf));
+	snprintf(respbuf, sizeof(respbuf) - 1,
+		 "MET %s P=%d rx=%lu rx_err=%lu tx=%lu tx_err=%lu "
+		 "notify=%lu\n", name, port, MRP_STAT_READ(stats->pdu_rx),
+		 MRP_STAT_READ(stats->pdu_rx_errors),
+		 MRP_STAT_READ(stats->pdu_tx),
+		 MRP_STAT_READ(stats->pdu_tx_errors),
+		 MRP_STAT_READ(stats->notify_sent));
+	rc = mrpd_send_ctl_msg(client, respbuf, sizeof(respbuf));
+	if (rc < 0)
+		return rc;
+
+	memset(respbuf, 0, sizeof(respbuf));
+	len = mrp_appendf(respbuf, sizeof(respbuf) - 1, 0, "EVT %s P=%d A=",
+			  name, port);
+	len = mrp_counters_format(respbuf, sizeof(respbuf) - 1, len,
+				  stats->applicant_events, MRP_EVENT_COUNT);
+	len = mrp_appendf(respbuf, sizeof(respbuf) - 1, len, " R=");
+	len = mrp_counters_format(respbuf, sizeof(respbuf) - 1, len,
+				  stats->registrar_events, MRP_EVENT_COUNT);
+	if (len < (int)sizeof(respbuf) - 2)
+		respbuf[len] = '\n';
+
+	return mrpd_send_ctl_msg(client, respbuf, sizeof(respbuf));
+}
+
+static void mrp_stats_event(unsigned long *counters, int event)
+{
+	int idx = event / MRP_EVENT_SPACING - 1;
+
+	if ((idx >= 0) && (idx < MRP_EVENT_COUNT))
+		MRP_STAT_INC(counters[idx]);
+}
+
+/*
+ * First entry of a paged dump: n for "x??:O=n", 0 if no offset is
+ * given and -1 if it does not parse.
+ */
+int mrp_dump_offset(char *buf, int buflen)
+{
+	uint32_t offset = 0;
+	int err_index;
+	struct parse_param specs[] = {
+		{"O" PARSE_ASSIGN, parse_u32, &offset},
+		{0, parse_null, 0}
+	};
+
+	if ((buflen <= 4) || (NULL == strstr(buf + 4, "O" PARSE_ASSIGN)))
+		return 0;
+
+	if (parse(buf + 4, buflen - 4, specs, &err_index))
+		return -1;
+	if (offset > 0x7fffffff)
+		return -1;
+
+	return (int)offset;
+}
+
+static struct mrp_snapshot_rec *mrp_snapshot_add(struct mrp_snapshot *snap,
+						 int kind)
+{
+	struct mrp_snapshot_rec *recs;
+	struct mrp_snapshot_rec *rec;
+	unsigned int size;
+
+	if (snap->count == snap->size) {
+		size = snap->size ? 2 * snap->size : 64;
+		recs = (struct mrp_snapshot_rec *)realloc(snap->recs,
+							  size * sizeof(*recs));
+		if (NULL == recs)
+			return NULL;
+		snap->recs = recs;
+		snap->size = size;
+	}
+
+	rec = &snap->recs[snap->count++];
+	memset(rec, 0, sizeof(*rec));
+	rec->kind = (uint8_t)kind;
+	rec->app = (uint8_t)snap->app;
+	rec->port = (uint8_t)snap->port;
+	return rec;
+}
+
+/*
+ * Record the applicant and registrar of an attribute. The caller fills
+ * in the application specific fields (substate, direction, ...) of the
+ * returned record.
+ */
+struct mrp_snapshot_rec *mrp_snapshot_attrib(struct mrp_snapshot *snap,
+					     mrp_applicant_attribute_t * app,
+					     mrp_registrar_attribute_t * reg,
+					     uint32_t type, const void *value,
+					     size_t len)
+{
+	struct mrp_snapshot_rec *rec;
+
+	if (len > MRP_SNAP_VALUE_SZ)
+		return NULL;
+
+	rec = mrp_snapshot_add(snap, MRP_SNAP_ATTRIB);
+	if (NULL == rec)
+		return NULL;
+
+	rec->applicant = (uint8_t)app->mrp_state;
+	rec->registrar = (uint8_t)reg->mrp_state;
+	memcpy(rec->macaddr, reg->macaddr, sizeof(rec->macaddr));
+	rec->type = type;
+	memcpy(rec->u.value, value, len);
+	return rec;
+}
+
+/*
+ * Record the UDP clients with their notification format and filters.
+ * Clients on the unix socket are connections of the previous process
+ * and are gone after a restart.
+ */
+int mrp_snapshot_clients(struct mrp_snapshot *snap,
+			 struct mrp_database *mrp_db)
+{
+	struct mrp_snapshot_rec *rec;
+	struct mrp_subscription *sub;
+	client_t *client;
+	int i;
+
+	for (client = mrp_db->clients; NULL != client; client = client->next) {
+		if (AF_INET != client->client.sin_family)
+			continue;
+		rec = mrp_snapshot_add(snap, MRP_SNAP_CLIENT);
+		if (NULL == rec)
+			return -1;
+		rec->type = (uint32_t)client->flags;
+		rec->substate = client->type_mask;
+		rec->u.client = client->client;
+	}
+
+	for (i = 0; i <= MRP_SUB_HASH_SIZE; i++) {
+		sub = (i < MRP_SUB_HASH_SIZE) ?
+		    mrp_db->sub_hash[i] : mrp_db->sub_ranges;
+		for (; NULL != sub; sub = sub->next) {
+			if (AF_INET != sub->client->client.sin_family)
+				continue;
+			rec = mrp_snapshot_add(snap, MRP_SNAP_SUB);
+			if (NULL == rec)
+				return -1;
+			rec->lo = sub->lo;
+			rec->hi = sub->hi;
+			rec->u.client = sub->client->client;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * A fresh snapshot is restored whole. One older than
+ * MRP_SNAPSHOT_MAX_AGE keeps only our own declarations: what the
+ * neighbours registered has been withdrawn or refreshed since.
+ */
+int mrp_restore_wanted(const struct mrp_snapshot_rec *rec, int fresh)
 {
+	if (fresh)
+		return 1;
+
+	switch (rec->applicant) {
+	case MRP_VP_STATE:
+	case MRP_VN_STATE:
+	case MRP_AN_STATE:
+	case MRP_AA_STATE:
+	case MRP_QA_STATE:
+	case MRP_AP_STATE:
+	case MRP_QP_STATE:
+		return 1;
+	}
+	return 0;
+}
+
+/* the applicant states that send at every tx! until they move on */
+static int mrp_applicant_tx_ready(int mrp_state)
+{
+	switch (mrp_state) {
+	case MRP_VP_STATE:
+	case MRP_VN_STATE:
+	case MRP_AN_STATE:
+	case MRP_AA_STATE:
+	case MRP_LA_STATE:
+	case MRP_AP_STATE:
+	case MRP_LO_STATE:
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * Put an attribute back into the states of the snapshot, without
+ * running the state machines: the declarations resume where they were
+ * instead of starting over with New events. A registrar left in LV
+ * gets a full leave timer; a stale snapshot declares again from VP.
+ */
+void mrp_restore_attrib(struct mrp_database *mrp_db,
+			const struct mrp_snapshot_rec *rec,
+			mrp_applicant_attribute_t * app,
+			mrp_registrar_attribute_t * reg, int fresh)
+{
+	app->mrp_state = rec->applicant;
+	if (!fresh) {
+		switch (app->mrp_state) {
+		case MRP_AA_STATE:
+		case MRP_QA_STATE:
+		case MRP_AP_STATE:
+		case MRP_QP_STATE:
+			app->mrp_state = MRP_VP_STATE;
+			break;
+		}
+	}
+	/* no previous state, so any anxious state counts as a transition */
+	app->mrp_previous_state = -1;
+
+	if (fresh) {
+		reg->mrp_state = rec->registrar;
+		memcpy(reg->macaddr, rec->macaddr, sizeof(reg->macaddr));
+	} else {
+		reg->mrp_state = MRP_MT_STATE;
+	}
+	if (MRP_LV_STATE == reg->mrp_state)
+		mrp_lvtimer_start(mrp_db, reg);
+
+	if (mrp_applicant_tx_ready(app->mrp_state))
+		mrp_tx_enqueue(mrp_db, app);
+	if (mrp_applicant_state_transition_implies_tx(app))
+		mrp_jointimer_start(mrp_db);
+	MRP_STAT_INC(mrp_db->state_gen);
+}
+
+int mrp_restore_client(struct mrp_database *mrp_db,
+		       const struct mrp_snapshot_rec *rec)
+{
+	struct sockaddr_in client = rec->u.client;
+	client_t *client_item;
+
+	if (MRP_SNAP_SUB == rec->kind)
+		return mrp_client_filter_key(mrp_db, &client, rec->lo, rec->hi);
+
+	if (mrp_client_add(mrp_db, &client) < 0)
+		return -1;
+	if (rec->type & MRP_CLIENT_BINARY) {
+		if (mrp_client_set_binary(mrp_db, &client, rec->app, 1) < 0)
+			return -1;
+	}
+	client_item = client_lookup(mrp_db->clients, &client);
+	if (NULL == client_item)
+		return -1;
+	client_item->type_mask = rec->substate;
+	return 0;
+}
+
+/* (re)arm lv_timer for the given wheel tick */
+static int mrp_lvtimer_arm(struct mrp_database *mrp_db, unsigned long tick)
+{
+	unsigned long now_ms = mrpd_clock_ms();
+	unsigned long due_ms = tick * MRP_LV_WHEEL_TICK;
 	int ret;
+
+	if (mrp_db->lv_timer_running)
+		mrpd_timer_stop(mrp_db->lv_timer);
+
+	/* a zero timeout would disarm the timerfd */
+	ret = mrpd_timer_start(mrp_db->lv_timer,
+			       (due_ms > now_ms) ? due_ms - now_ms : 1);
+	mrp_db->lv_timer_running = (ret >= 0);
+	mrp_db->lv_timer_tick = tick;
+	return ret;
+}
+
+int mrp_lvtimer_start(struct mrp_database *mrp_db,
+		      mrp_registrar_attribute_t * attrib)
+{
+	unsigned long now;
+	unsigned int slot;
+
 	/* leavetimer has expired (10.7.5.21)
 	 * controls how long the Registrar state machine stays in the
 	 * LV state before transitioning to the MT state.
 	 */
 #if LOG_TIMERS
-	if (mrp_db->lv_timer_running)
+	if (attrib->lv_queued)
 		mrpd_log_printf("MRP start leave timer *ALREADY RUNNING*\n");
 	else
 		mrpd_log_printf("MRP start leave timer\n");
 #endif
-	ret = mrpd_timer_start(mrp_db->lv_timer, MRP_LVTIMER_VAL);
-	if (ret >= 0)
-		mrp_db->lv_timer_running = 1;
-	return ret;
+	if (attrib->lv_queued)
+		mrp_lvtimer_stop(mrp_db, attrib);
+
+	now = mrpd_clock_ms() / MRP_LV_WHEEL_TICK;
+	if (0 == mrp_db->lv_count)
+		mrp_db->lv_tick = now;
+
+	/* round up, the current tick is already partly gone */
+	attrib->lv_expire = now + 1 +
+	    (MRP_LVTIMER_VAL + MRP_LV_WHEEL_TICK - 1) / MRP_LV_WHEEL_TICK;
+
+	slot = attrib->lv_expire % MRP_LV_WHEEL_SLOTS;
+	attrib->lv_prev = NULL;
+	attrib->lv_next = mrp_db->lv_wheel[slot];
+	if (NULL != attrib->lv_next)
+		attrib->lv_next->lv_prev = attrib;
+	mrp_db->lv_wheel[slot] = attrib;
+	attrib->lv_queued = 1;
+	mrp_db->lv_count++;
+
+	if (!mrp_db->lv_timer_running ||
+	    (attrib->lv_expire < mrp_db->lv_timer_tick))
+		return mrp_lvtimer_arm(mrp_db, attrib->lv_expire);
+	return 0;
 }
 
-int mrp_lvtimer_stop(struct mrp_database *mrp_db)
+int mrp_lvtimer_stop(struct mrp_database *mrp_db,
+		     mrp_registrar_attribute_t * attrib)
 {
+	if (!attrib->lv_queued)
+		return 0;
 #if LOG_TIMERS
 	mrpd_log_printf("MRP stop leave timer\n");
 #endif
-	mrp_db->lv_timer_running = 0;
-	return mrpd_timer_stop(mrp_db->lv_timer);
+	if (NULL != attrib->lv_prev)
+		attrib->lv_prev->lv_next = attrib->lv_next;
+	else
+		mrp_db->lv_wheel[attrib->lv_expire % MRP_LV_WHEEL_SLOTS] =
+		    attrib->lv_next;
+	if (NULL != attrib->lv_next)
+		attrib->lv_next->lv_prev = attrib->lv_prev;
+	attrib->lv_next = NULL;
+	attrib->lv_prev = NULL;
+	attrib->lv_queued = 0;
+	mrp_db->lv_count--;
+
+	/* an early expiry with nothing due just re-arms, so only idle it */
+	if ((0 == mrp_db->lv_count) && mrp_db->lv_timer_running) {
+		mrp_db->lv_timer_running = 0;
+		return mrpd_timer_stop(mrp_db->lv_timer);
+	}
+	return 0;
+}
+
+/*
+ * Turn the wheel up to the current tick. Returns the registrars whose
+ * leave timer ran out, unlinked and chained through lv_next, and re-arms
+ * lv_timer for the next non-empty slot.
+ */
+mrp_registrar_attribute_t *mrp_lvtimer_expired(struct mrp_database *mrp_db)
+{
+	mrp_registrar_attribute_t *expired = NULL;
+	mrp_registrar_attribute_t *attrib;
+	mrp_registrar_attribute_t *next;
+	unsigned long now;
+	unsigned int slot;
+
+	now = mrpd_clock_ms() / MRP_LV_WHEEL_TICK;
+
+	if (mrp_db->lv_timer_running) {
+		mrp_db->lv_timer_running = 0;
+		mrpd_timer_stop(mrp_db->lv_timer);
+	}
+
+	while ((mrp_db->lv_count > 0) && (mrp_db->lv_tick <= now)) {
+		slot = mrp_db->lv_tick % MRP_LV_WHEEL_SLOTS;
+		attrib = mrp_db->lv_wheel[slot];
+		while (NULL != attrib) {
+			next = attrib->lv_next;
+			if (attrib->lv_expire <= now) {
+				mrp_lvtimer_stop(mrp_db, attrib);
+				attrib->lv_next = expired;
+				expired = attrib;
+			}
+			attrib = next;
+		}
+		mrp_db->lv_tick++;
+	}
+
+	if (0 == mrp_db->lv_count)
+		return expired;
+
+	/* the wheel spans more than a leave time, so the first busy slot is due first */
+	for (;;) {
+		if (NULL != mrp_db->lv_wheel[mrp_db->lv_tick % MRP_LV_WHEEL_SLOTS])
+			break;
+		mrp_db->lv_tick++;
+	}
+	mrp_lvtimer_arm(mrp_db, mrp_db->lv_tick);
+
+	return expired;
 }
 
 static unsigned long lva_next;
@@ -515,6 +1306,25 @@ int mrp_periodictimer_fsm(struct mrp_periodictimer_state *periodic_state, int ev
 	return 0;
 }
 
+/*
+ * The anxious and quiet variants of a state only differ in whether the
+ * next transmit opportunity sends, which the periodic timer and the
+ * transmits flip every second. They resume alike, so only a change of
+ * class is a change of the -c snapshot.
+ */
+static int mrp_applicant_restore_class(int mrp_state)
+{
+	switch (mrp_state) {
+	case MRP_AA_STATE:
+		return MRP_QA_STATE;
+	case MRP_AP_STATE:
+		return MRP_QP_STATE;
+	case MRP_AO_STATE:
+		return MRP_QO_STATE;
+	}
+	return mrp_state;
+}
+
 /*
  * per-attribute MRP FSM
  */
@@ -527,7 +1337,8 @@ int mrp_applicant_fsm(struct mrp_database *mrp_db,
 	int optional = 0;
 	int mrp_state = attrib->mrp_state;
 	int sndmsg = MRP_SND_NULL;
-	(void)mrp_db;
+
+	mrp_stats_event(mrp_db->stats.applicant_events, event);
 
 	switch (event) {
 	case MRP_EVENT_BEGIN:
@@ -867,14 +1678,300 @@ int mrp_applicant_fsm(struct mrp_database *mrp_db,
 		break;
 	}
 
+	if ((mrp_state != attrib->mrp_state) &&
+	    ((MRP_VO_STATE == mrp_state) || (MRP_AO_STATE == mrp_state) ||
+	     (MRP_QO_STATE == mrp_state))) {
+		mrp_gc_push(mrp_db, &attrib->gc, 0);
+	}
+
+	if (mrp_applicant_restore_class(attrib->mrp_state) !=
+	    mrp_applicant_restore_class(mrp_state))
+		MRP_STAT_INC(mrp_db->state_gen);
 	attrib->mrp_previous_state = attrib->mrp_state;
 	attrib->tx = tx;
 	attrib->mrp_state = mrp_state;
 	attrib->sndmsg = sndmsg;
 	attrib->encode = (optional ? MRP_ENCODE_OPTIONAL : MRP_ENCODE_YES);
+	if (tx || mrp_applicant_tx_ready(mrp_state))
+		mrp_tx_enqueue(mrp_db, attrib);
+	else
+		mrp_tx_dequeue(mrp_db, attrib);
 	return 0;
 }
 
+/*
+ * The pending transmit set holds the attributes with something to send
+ * at the next transmit opportunity, so the TX event visits only these.
+ * The applicant FSM adds an attribute when it enters a state that sends
+ * on tx! and drops it when it leaves that state otherwise; the tx! and
+ * txLA! events add every attribute they flag for the encoders, and
+ * mrp_tx_pending_retire() drops those once the PDU has been built.
+ */
+void mrp_tx_enqueue(struct mrp_database *mrp_db,
+		    mrp_applicant_attribute_t * attrib)
+{
+	if ((NULL == mrp_db) || attrib->tx_queued)
+		return;
+
+	attrib->tx_queued = 1;
+	attrib->tx_next = NULL;
+	attrib->tx_prev = mrp_db->tx_pending_last;
+	if (NULL == mrp_db->tx_pending_last)
+		mrp_db->tx_pending = attrib;
+	else
+		mrp_db->tx_pending_last->tx_next = attrib;
+	mrp_db->tx_pending_last = attrib;
+}
+
+void mrp_tx_dequeue(struct mrp_database *mrp_db,
+		    mrp_applicant_attribute_t * attrib)
+{
+	if ((NULL == mrp_db) || !attrib->tx_queued)
+		return;
+
+	if (NULL != attrib->tx_prev)
+		attrib->tx_prev->tx_next = attrib->tx_next;
+	else
+		mrp_db->tx_pending = attrib->tx_next;
+	if (NULL != attrib->tx_next)
+		attrib->tx_next->tx_prev = attrib->tx_prev;
+	else
+		mrp_db->tx_pending_last = attrib->tx_prev;
+	attrib->tx_next = NULL;
+	attrib->tx_prev = NULL;
+	attrib->tx_queued = 0;
+}
+
+/*
+ * Sort the pending transmit set, e.g. by attribute value so that the
+ * encoders find the runs of consecutive values. A bottom up merge sort
+ * of the list, O(n log n) in the size of the set only.
+ */
+void mrp_tx_pending_sort(struct mrp_database *mrp_db,
+			 int (*cmp) (mrp_applicant_attribute_t * a,
+				     mrp_applicant_attribute_t * b))
+{
+	mrp_applicant_attribute_t *list = mrp_db->tx_pending;
+	mrp_applicant_attribute_t *p, *q, *e, *tail;
+	int insize = 1;
+	int nmerges, psize, qsize, i;
+
+	if (NULL == list)
+		return;
+
+	for (;;) {
+		p = list;
+		list = NULL;
+		tail = NULL;
+		nmerges = 0;
+
+		while (NULL != p) {
+			nmerges++;
+			q = p;
+			psize = 0;
+			for (i = 0; (i < insize) && (NULL != q); i++) {
+				psize++;
+				q = q->tx_next;
+			}
+			qsize = insize;
+
+			while ((psize > 0) || ((qsize > 0) && (NULL != q))) {
+				if (0 == psize) {
+					e = q;
+					q = q->tx_next;
+					qsize--;
+				} else if ((0 == qsize) || (NULL == q) ||
+					   (cmp(p, q) <= 0)) {
+					e = p;
+					p = p->tx_next;
+					psize--;
+				} else {
+					e = q;
+					q = q->tx_next;
+					qsize--;
+				}
+				e->tx_prev = tail;
+				if (NULL != tail)
+					tail->tx_next = e;
+				else
+					list = e;
+				tail = e;
+			}
+			p = q;
+		}
+		tail->tx_next = NULL;
+
+		if (nmerges <= 1)
+			break;
+		insize *= 2;
+	}
+
+	mrp_db->tx_pending = list;
+	mrp_db->tx_pending_last = tail;
+}
+
+/*
+ * After the PDU has been built, keep only the attributes that have to
+ * send again at the next opportunity. Returns their number.
+ */
+int mrp_tx_pending_retire(struct mrp_database *mrp_db)
+{
+	mrp_applicant_attribute_t *attrib;
+	mrp_applicant_attribute_t *next;
+	int count = 0;
+
+	for (attrib = mrp_db->tx_pending; NULL != attrib; attrib = next) {
+		next = attrib->tx_next;
+		if (mrp_applicant_tx_ready(attrib->mrp_state))
+			count++;
+		else
+			mrp_tx_dequeue(mrp_db, attrib);
+	}
+	return count;
+}
+
+void mrp_gc_push(struct mrp_database *mrp_db, struct mrp_gc_link *link,
+		 int registrar)
+{
+	if (NULL != link->pprev)
+		return;		/* queued already */
+
+	link->registrar = registrar;
+	link->next = mrp_db->gc_queue;
+	if (NULL != link->next)
+		link->next->pprev = &link->next;
+	link->pprev = &mrp_db->gc_queue;
+	mrp_db->gc_queue = link;
+	mrp_db->gc_count++;
+}
+
+void mrp_gc_remove(struct mrp_database *mrp_db, struct mrp_gc_link *link)
+{
+	if (NULL == link->pprev)
+		return;
+
+	*link->pprev = link->next;
+	if (NULL != link->next)
+		link->next->pprev = link->pprev;
+	link->next = NULL;
+	link->pprev = NULL;
+	mrp_db->gc_count--;
+}
+
+struct mrp_gc_link *mrp_gc_pop(struct mrp_database *mrp_db)
+{
+	struct mrp_gc_link *link = mrp_db->gc_queue;
+
+	if (NULL != link)
+		mrp_gc_remove(mrp_db, link);
+	return link;
+}
+
+int mrp_reclaimable(mrp_applicant_attribute_t * app,
+		    mrp_registrar_attribute_t * reg)
+{
+	return (MRP_MT_STATE == reg->mrp_state) &&
+	    ((MRP_VO_STATE == app->mrp_state) ||
+	     (MRP_AO_STATE == app->mrp_state) ||
+	     (MRP_QO_STATE == app->mrp_state));
+}
+
+/* carve another block into free objects, lowest address handed out first */
+static int mrp_slab_grow(struct mrp_slab *slab)
+{
+	struct mrp_slab_block *block;
+	unsigned int count;
+	char *obj;
+
+	/* keep every object aligned for the pointer the free list puts in it */
+	slab->size = (slab->size + sizeof(uint64_t) - 1) &
+	    ~(sizeof(uint64_t) - 1);
+	count = (MRP_SLAB_BLOCK_SIZE - sizeof(*block)) / slab->size;
+	if (0 == count)
+		count = 1;
+
+	block = (struct mrp_slab_block *)malloc(sizeof(*block) +
+						count * slab->size);
+	if (NULL == block)
+		return -1;
+
+	block->next = slab->blocks;
+	slab->blocks = block;
+	slab->block_count++;
+	slab->capacity += count;
+
+	obj = (char *)block->objects + count * slab->size;
+	while (count--) {
+		obj -= slab->size;
+		*(void **)obj = slab->free_list;
+		slab->free_list = obj;
+	}
+	return 0;
+}
+
+void *mrp_slab_alloc(struct mrp_slab *slab)
+{
+	void *obj;
+
+	if ((NULL == slab->free_list) && mrp_slab_grow(slab)) {
+		slab->fails++;
+		return NULL;
+	}
+
+	obj = slab->free_list;
+	slab->free_list = *(void **)obj;
+	memset(obj, 0, slab->size);
+
+	slab->allocs++;
+	if (++slab->used > slab->peak)
+		slab->peak = slab->used;
+
+	return obj;
+}
+
+void mrp_slab_free(struct mrp_slab *slab, void *obj)
+{
+	if (NULL == obj)
+		return;
+
+	*(void **)obj = slab->free_list;
+	slab->free_list = obj;
+	slab->frees++;
+	slab->used--;
+}
+
+/* every object of the slab must have been freed, or be abandoned */
+void mrp_slab_destroy(struct mrp_slab *slab)
+{
+	struct mrp_slab_block *block;
+
+	while (NULL != slab->blocks) {
+		block = slab->blocks;
+		slab->blocks = block->next;
+		free(block);
+	}
+	slab->free_list = NULL;
+	slab->block_count = 0;
+	slab->capacity = 0;
+	slab->used = 0;
+}
+
+int mrp_slab_report(struct mrp_slab *slab, const char *name,
+		    struct sockaddr_in *client)
+{
+	char respbuf[160];
+
+	memset(respbuf, 0, sizeof(respbuf));
+	snprintf(respbuf, sizeof(respbuf) - 1,
+		 "SLB %s size=%u blocks=%u objects=%u used=%u peak=%u "
+		 "allocs=%lu frees=%lu fails=%lu\n", name,
+		 (unsigned int)slab->size, slab->block_count, slab->capacity,
+		 slab->used, slab->peak, slab->allocs, slab->frees,
+		 slab->fails);
+
+	return mrpd_send_ctl_msg(client, respbuf, sizeof(respbuf));
+}
+
 int mrp_applicant_state_transition_implies_tx(mrp_applicant_attribute_t * attrib)
 {
 	if (attrib->mrp_previous_state == attrib->mrp_state) {
@@ -908,6 +2005,8 @@ mrp_registrar_fsm(mrp_registrar_attribute_t * attrib,
 	int mrp_state = attrib->mrp_state;
 	int notify = MRP_NOTIFY_NONE;
 
+	mrp_stats_event(mrp_db->stats.registrar_events, event);
+
 	switch (event) {
 	case MRP_EVENT_BEGIN:
 		mrp_state = MRP_MT_STATE;
@@ -925,7 +2024,7 @@ mrp_registrar_fsm(mrp_registrar_attribute_t * attrib,
 		 */
 		switch (mrp_state) {
 		case MRP_IN_STATE:
-			mrp_lvtimer_start(mrp_db);
+			mrp_lvtimer_start(mrp_db, attrib);
 			mrp_state = MRP_LV_STATE;
 		default:
 			break;
@@ -939,10 +2038,7 @@ mrp_registrar_fsm(mrp_registrar_attribute_t * attrib,
 			mrp_state = MRP_IN_STATE;
 			break;
 		case MRP_LV_STATE:
-			/* should stop leavetimer - but we have only 1 lvtimer
-			 * for all attributes, and recieving a LVTIMER event
-			 * is a don't-care if the attribute is in the IN state.
-			 */
+			mrp_lvtimer_stop(mrp_db, attrib);
 			mrp_state = MRP_IN_STATE;
 			break;
 		default:
@@ -960,10 +2056,7 @@ mrp_registrar_fsm(mrp_registrar_attribute_t * attrib,
 			mrp_state = MRP_IN_STATE;
 			break;
 		case MRP_LV_STATE:
-			/* should stop leavetimer - but we have only 1 lvtimer
-			 * for all attributes, and receiving a LVTIMER event
-			 * is a don't-care if the attribute is in the IN state.
-			 */
+			mrp_lvtimer_stop(mrp_db, attrib);
 			notify = MRP_NOTIFY_JOIN;
 			mrp_state = MRP_IN_STATE;
 			break;
@@ -990,6 +2083,7 @@ mrp_registrar_fsm(mrp_registrar_attribute_t * attrib,
 		notify = MRP_NOTIFY_LV;
 		switch (mrp_state) {
 		case MRP_LV_STATE:
+			mrp_lvtimer_stop(mrp_db, attrib);
 			mrp_state = MRP_MT_STATE;
 			break;
 		case MRP_MT_STATE:
@@ -1017,9 +2111,15 @@ mrp_registrar_fsm(mrp_registrar_attribute_t * attrib,
 		return -1;
 		break;
 	}
+	if ((MRP_MT_STATE == mrp_state) && (mrp_state != attrib->mrp_state)) {
+		mrp_gc_push(mrp_db, &attrib->gc, 1);
+	}
 #if LOG_MRP
 	attrib->mrp_previous_state = attrib->mrp_state;
 #endif
+	/* IN and LV are both registered and restored alike */
+	if ((MRP_MT_STATE == attrib->mrp_state) != (MRP_MT_STATE == mrp_state))
+		MRP_STAT_INC(mrp_db->state_gen);
 	attrib->mrp_state = mrp_state;
 	attrib->notify = notify;
 	return 0;
@@ -1096,6 +2196,89 @@ int mrp_decode_state(mrp_registrar_attribute_t * rattrib,
 	return 0;
 }
 
+/*
+ * ThreePackedEvents and FourPackedEvents codec (802.1Q 10.8.2.10/11),
+ * shared by all applications. The decode tables are spelled out at
+ * compile time, one row per possible byte.
+ */
+#define MRPDU_3PACK_ROW(b)	{ (b) / 36, ((b) / 6) % 6, (b) % 6 }
+#define MRPDU_4PACK_ROW(b)	{ (b) >> 6, ((b) >> 4) & 3, ((b) >> 2) & 3, (b) & 3 }
+
+#define MRPDU_ROWS_4(row, b)	row(b), row((b) + 1), row((b) + 2), row((b) + 3)
+#define MRPDU_ROWS_16(row, b)	MRPDU_ROWS_4(row, b), \
+				MRPDU_ROWS_4(row, (b) + 4), \
+				MRPDU_ROWS_4(row, (b) + 8), \
+				MRPDU_ROWS_4(row, (b) + 12)
+#define MRPDU_ROWS_64(row, b)	MRPDU_ROWS_16(row, b), \
+				MRPDU_ROWS_16(row, (b) + 16), \
+				MRPDU_ROWS_16(row, (b) + 32), \
+				MRPDU_ROWS_16(row, (b) + 48)
+#define MRPDU_ROWS_256(row)	MRPDU_ROWS_64(row, 0), \
+				MRPDU_ROWS_64(row, 64), \
+				MRPDU_ROWS_64(row, 128), \
+				MRPDU_ROWS_64(row, 192)
+
+const uint8_t mrpdu_3pack_events[256][3] = {
+	MRPDU_ROWS_256(MRPDU_3PACK_ROW)
+};
+
+const uint8_t mrpdu_4pack_events[256][4] = {
+	MRPDU_ROWS_256(MRPDU_4PACK_ROW)
+};
+
+/*
+ * Pack numvalues events four to a byte, zero filling the last one.
+ * Returns the number of bytes written.
+ */
+int mrpdu_4pack_encode(const int *events, int numvalues, uint8_t *out)
+{
+	uint8_t *ptr = out;
+	int i;
+
+	for (i = 0; i + 4 <= numvalues; i += 4)
+		*ptr++ = MRPDU_4PACK_ENCODE(events[i], events[i + 1],
+					    events[i + 2], events[i + 3]);
+
+	switch (numvalues - i) {
+	case 3:
+		*ptr++ = MRPDU_4PACK_ENCODE(events[i], events[i + 1],
+					    events[i + 2], 0);
+		break;
+	case 2:
+		*ptr++ = MRPDU_4PACK_ENCODE(events[i], events[i + 1], 0, 0);
+		break;
+	case 1:
+		*ptr++ = MRPDU_4PACK_ENCODE(events[i], 0, 0, 0);
+		break;
+	default:
+		break;
+	}
+
+	return ptr - out;
+}
+
+/*
+ * Unpack numvalues events from FourPackedEvents into events[], which must
+ * have room for numvalues rounded up to a multiple of four. Returns the
+ * number of bytes consumed.
+ */
+int mrpdu_4pack_decode(const uint8_t *in, int numvalues, int *events)
+{
+	const uint8_t *e;
+	int nbytes = (numvalues + 3) / 4;
+	int i;
+
+	for (i = 0; i < nbytes; i++) {
+		e = mrpdu_4pack_events[in[i]];
+		events[4 * i] = e[0];
+		events[4 * i + 1] = e[1];
+		events[4 * i + 2] = e[2];
+		events[4 * i + 3] = e[3];
+	}
+
+	return nbytes;
+}
+
 int mrp_init(void)
 {
 	p2pmac = MRP_DEFAULT_POINT_TO_POINT_MAC;	/* operPointToPointMAC */
@@ -48,12 +48,31 @@
 #define MRP_ENCODE_YES		0	/* must send */
 #define MRP_ENCODE_OPTIONAL	1	/* send if smaller */
 
+/*
+ * Reclaim candidate queue. The FSMs queue an attribute when its
+ * applicant enters VO, AO or QO or its registrar enters MT, which are
+ * the only moments it can become reclaimable; the gc tick then checks
+ * just the queued attributes instead of walking the whole database.
+ */
+struct mrp_gc_link {
+	struct mrp_gc_link *next;
+	struct mrp_gc_link **pprev;	/* NULL while not queued */
+	int registrar;		/* embedded in the registrar, else applicant */
+};
+
+/* attributes checked by one gc tick, the rest wait for a quick re-run */
+#define MRP_GC_BUDGET		256
+
 typedef struct mrp_applicant_attribute {
 	int mrp_state;
 	int tx;			/* tx=1 means transmit on next TX event */
 	int sndmsg;		/* sndmsg={NEW,IN,JOININ,JOINMT,MT, or LV} */
 	int encode;		/* when tx=1, NO, YES or OPTIONAL */
 	int mrp_previous_state; /* for identifying state transitions */
+	struct mrp_applicant_attribute *tx_next; /* pending transmit set */
+	struct mrp_applicant_attribute *tx_prev;
+	int tx_queued;
+	struct mrp_gc_link gc;
 } mrp_applicant_attribute_t;
 
 typedef struct mrp_registrar_attribute {
@@ -64,6 +83,12 @@ typedef struct mrp_registrar_attribute {
 #ifdef LOG_MRP
 	int mrp_previous_state; /* for identifying state transitions for debug */
 #endif
+	/* leave timer wheel linkage */
+	struct mrp_registrar_attribute *lv_next;
+	struct mrp_registrar_attribute *lv_prev;
+	unsigned long lv_expire;	/* wheel tick the leave timer ends on */
+	int lv_queued;
+	struct mrp_gc_link gc;
 } mrp_registrar_attribute_t;
 
 /* MRP Application Notifications */
@@ -142,6 +167,21 @@ typedef struct mrp_registrar_attribute {
 #define MRP_LVATIMER_VAL	10000	/* leaveall timeout in msec */
 #define MRP_PERIODTIMER_VAL	1000	/* periodic timeout in msec */
 
+/*
+ * 10.7.4.1 - no more than MRP_TXOPP_MAX transmit opportunities in any
+ * MRP_TXOPP_WINDOW, per application and port.
+ */
+#define MRP_TXOPP_MAX		3
+#define MRP_TXOPP_WINDOW	300	/* msec */
+
+/*
+ * Each registrar in the LV state has its own leave timer, kept on a
+ * wheel of MRP_LV_WHEEL_SLOTS ticks. The wheel must span more than one
+ * leave time so a slot never holds timers from two different rounds.
+ */
+#define MRP_LV_WHEEL_TICK	50	/* wheel granularity in msec */
+#define MRP_LV_WHEEL_SLOTS	32
+
 typedef struct mrp_timer {
 	int state;
 	int tx;			/* tx=1 means transmit on next TX event */
@@ -178,6 +218,21 @@ typedef struct mrp_periodictimer_state {
 #define MRPDU_4PACK_ENCODE(w, x, y, z)	(((w) * 64) + ((x) * 16) + \
 						((y) * 4) + (z))
 
+/*
+ * Decoding goes through 256-entry tables instead of the /36, /6 and %6
+ * arithmetic. Bytes above 215 decode to a first event > MRPDU_LV, which
+ * the receivers discard as an out of range encoding.
+ */
+extern const uint8_t mrpdu_3pack_events[256][3];
+extern const uint8_t mrpdu_4pack_events[256][4];
+
+#define MRPDU_3PACK_DECODE(b, evt)	do { \
+		const uint8_t *__e = mrpdu_3pack_events[(uint8_t)(b)]; \
+		(evt)[0] = __e[0]; \
+		(evt)[1] = __e[1]; \
+		(evt)[2] = __e[2]; \
+	} while (0)
+
 typedef struct mrpdu_vectorattrib {
 	uint16_t VectorHeader;	/* LVA << 13 | NumberOfValues */
 	uint8_t FirstValue_VectorEvents[];
@@ -187,26 +242,257 @@ typedef struct mrpdu_vectorattrib {
 #define MRPDU_VECT_LVA(x)	(((x) & (7 << 13)) == (1 << 13))
 #define MRPDU_VECT_LVA_FLAG	(1 << 13)
 
+#define MRP_CLIENT_BINARY	0x01	/* client asked for binary notifications */
+
 typedef struct client_s {
 	struct client_s *next;
 	struct sockaddr_in client;
+	int flags;
+	/* binary notifications queued until mrp_client_notify_flush() */
+	unsigned char *notify_buf;
+	int notify_count;
+	/* notification filter; no types and no keys means everything */
+	uint32_t type_mask;	/* bit n set: attribute type n wanted */
+	int sub_count;		/* key subscriptions in the database index */
+	unsigned int match_gen;
 } client_t;
 
+#define MRP_SUB_HASH_SIZE	64	/* power of 2 */
+
+/*
+ * A key subscription: events whose key (StreamID, VID, MAC) lies in
+ * lo..hi reach 'client'. Exact keys (lo == hi) are hashed, ranges are
+ * kept on a list.
+ */
+struct mrp_subscription {
+	struct mrp_subscription *next;
+	client_t *client;
+	uint64_t lo;
+	uint64_t hi;
+};
+
+/* MRP_EVENT_BEGIN .. MRP_EVENT_LVATIMER */
+#define MRP_EVENT_COUNT		21
+
+/*
+ * The counters below and state_gen have one writer, the thread running
+ * the application, but with -t are read by D?M and the snapshot on the
+ * main thread. Relaxed atomic loads and stores keep those reads defined
+ * and cost no more than plain ones.
+ */
+#if defined __GNUC__
+#define MRP_STAT_READ(c)	__atomic_load_n(&(c), __ATOMIC_RELAXED)
+#define MRP_STAT_SET(c, v)	__atomic_store_n(&(c), (v), __ATOMIC_RELAXED)
+#else
+#define MRP_STAT_READ(c)	(c)
+#define MRP_STAT_SET(c, v)	((c) = (v))
+#endif
+#define MRP_STAT_ADD(c, n)	MRP_STAT_SET(c, MRP_STAT_READ(c) + (n))
+#define MRP_STAT_INC(c)		MRP_STAT_ADD(c, 1)
+
+/*
+ * Latency histogram of an event loop handler. Bucket n > 0 counts the
+ * samples of 2^(n-1) to 2^n - 1 usec, bucket 0 those under 1 usec and
+ * the last bucket everything slower.
+ */
+#define MRP_HIST_BUCKETS	20
+
+struct mrp_histogram {
+	unsigned long count;
+	unsigned long long sum_us;
+	unsigned long max_us;
+	unsigned long bucket[MRP_HIST_BUCKETS];
+};
+
+/* counters of one application on one port, reported by D?M */
+struct mrp_stats {
+	unsigned long pdu_rx;
+	unsigned long pdu_rx_errors;	/* PDUs discarded or cut short */
+	unsigned long pdu_tx;
+	unsigned long pdu_tx_errors;
+	unsigned long notify_sent;	/* text messages and binary records */
+	unsigned long applicant_events[MRP_EVENT_COUNT];
+	unsigned long registrar_events[MRP_EVENT_COUNT];
+};
+
+/*
+ * Room a paged dump (S??, V?? and M?? with O=<offset>) keeps at the end
+ * of its message for the "xxRP:More O=<next>" trailer.
+ */
+#define MRP_DUMP_TRAILER_SZ	32
+
 struct mrp_database {
 	mrp_timer_t lva;
 	HTIMER join_timer;
 	int join_timer_running;
-	HTIMER lv_timer;
+	HTIMER lv_timer;		/* armed for the next non-empty wheel slot */
 	int lv_timer_running;
+	unsigned long lv_timer_tick;	/* tick lv_timer is armed for */
+	mrp_registrar_attribute_t *lv_wheel[MRP_LV_WHEEL_SLOTS];
+	unsigned long lv_tick;		/* next wheel tick to expire */
+	unsigned int lv_count;
 	HTIMER lva_timer;
 	int lva_timer_running;
 	client_t *clients;
+	struct mrp_subscription *sub_hash[MRP_SUB_HASH_SIZE];
+	struct mrp_subscription *sub_ranges;
+	unsigned int sub_gen;
+	/*
+	 * clients selected by mrp_client_match() for the current event,
+	 * sized for all clients by mrp_client_add()
+	 */
+	client_t **notify_set;
+	int notify_set_count;
+	int notify_set_size;
 	int registration;
 	int participant;
+	/*
+	 * attributes with something to send at the next transmit
+	 * opportunity, see mrp_tx_enqueue(); sorted by the application
+	 * before the encoders walk it
+	 */
+	mrp_applicant_attribute_t *tx_pending;
+	mrp_applicant_attribute_t *tx_pending_last;
+	struct mrp_gc_link *gc_queue;	/* reclaim candidates */
+	unsigned int gc_count;
+	/* transmit scheduler, see mrp_tx_opportunity() */
+	unsigned long txopp_ms[MRP_TXOPP_MAX];	/* last opportunities taken */
+	unsigned int txopp_next;
+	unsigned int txopp_count;
+	int lva_deferred;	/* a LeaveAll waits for the next opportunity */
+	unsigned long tx_opportunities;
+	unsigned long tx_suppressed;
+	unsigned long tx_merged;
+	struct mrp_stats stats;
+	/* bumped by the changes a -c snapshot records, see mrpd.c */
+	unsigned long state_gen;
+};
+
+/*
+ * Snapshot of the applicant and registrar states and the clients of the
+ * applications, checkpointed by mrpd to the file given with -c and
+ * restored from it on the next start. The file is a header followed by
+ * fixed size records, so it is used in place through mmap().
+ */
+#define MRP_SNAPSHOT_MAGIC	0x4d525053	/* "MRPS" */
+#define MRP_SNAPSHOT_VERSION	1
+
+#define MRP_SNAP_ATTRIB		1
+#define MRP_SNAP_CLIENT		2
+#define MRP_SNAP_SUB		3	/* key subscription of a client */
+
+#define MRP_SNAP_VALUE_SZ	48
+
+/*
+ * A snapshot older than this has outlived the LeaveAll period of the
+ * neighbours: their registrations are restored no more and our own
+ * declarations are made again instead of resumed.
+ */
+#define MRP_SNAPSHOT_MAX_AGE	(MRP_LVATIMER_VAL * 3 / 2 + MRP_LVTIMER_VAL)
+
+struct mrp_snapshot_hdr {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t rec_size;	/* sizeof(struct mrp_snapshot_rec) */
+	uint32_t count;
+	uint32_t ports;
+	uint64_t written_ms;	/* CLOCK_REALTIME */
+};
+
+struct mrp_snapshot_rec {
+	uint8_t kind;
+	uint8_t app;		/* 'M', 'V' or 'S' */
+	uint8_t port;
+	uint8_t applicant;	/* applicant state */
+	uint8_t registrar;	/* registrar state */
+	uint8_t macaddr[6];	/* registrar: source of the last registration */
+	uint8_t rsvd;
+	uint32_t type;		/* attribute type, client flags */
+	uint32_t substate;	/* MSRP listener, client type mask */
+	uint32_t direction;
+	uint32_t map_declared;
+	uint64_t lo;		/* subscription keys */
+	uint64_t hi;
+	union {
+		uint8_t value[MRP_SNAP_VALUE_SZ];	/* the attribute */
+		struct sockaddr_in client;
+	} u;
+};
+
+/* records collected for one checkpoint */
+struct mrp_snapshot {
+	struct mrp_snapshot_rec *recs;
+	unsigned int count;
+	unsigned int size;
+	int app;		/* of the records added next */
+	int port;
 };
 
-int mrp_client_add(client_t ** list, struct sockaddr_in *newclient);
-int mrp_client_delete(client_t ** list, struct sockaddr_in *newclient);
+/*
+ * Attribute slab. The attributes of an application are carved out of
+ * blocks of MRP_SLAB_BLOCK_SIZE bytes and recycled through a free list
+ * threaded through the free objects, so alloc and free are O(1) and
+ * neighbouring attributes share cache lines. Blocks are kept for reuse
+ * once allocated and only mrp_slab_destroy() returns them to the heap.
+ */
+#define MRP_SLAB_BLOCK_SIZE	16384
+
+struct mrp_slab_block {
+	struct mrp_slab_block *next;
+	uint64_t objects[0];
+};
+
+struct mrp_slab {
+	size_t size;		/* of one object */
+	void *free_list;
+	struct mrp_slab_block *blocks;
+	unsigned int block_count;
+	unsigned int capacity;	/* objects in all blocks */
+	unsigned int used;
+	unsigned int peak;
+	unsigned long allocs;
+	unsigned long frees;
+	unsigned long fails;
+};
+
+#define MRP_SLAB_INIT(type)	{ .size = sizeof(type) }
+
+void *mrp_slab_alloc(struct mrp_slab *slab);
+void mrp_slab_free(struct mrp_slab *slab, void *obj);
+void mrp_slab_destroy(struct mrp_slab *slab);
+int mrp_slab_report(struct mrp_slab *slab, const char *name,
+		    struct sockaddr_in *client);
+
+/* recover the application attribute from its embedded applicant */
+#define MRP_APPLICANT_OWNER(app, type) \
+	((type *)((char *)(app) - offsetof(type, applicant)))
+#define MRP_REGISTRAR_OWNER(reg, type) \
+	((type *)((char *)(reg) - offsetof(type, registrar)))
+/* recover the application attribute from a queued reclaim candidate */
+#define MRP_GC_OWNER(link, type) \
+	((link)->registrar ? \
+	 MRP_REGISTRAR_OWNER((char *)(link) - \
+			     offsetof(mrp_registrar_attribute_t, gc), type) : \
+	 MRP_APPLICANT_OWNER((char *)(link) - \
+			     offsetof(mrp_applicant_attribute_t, gc), type))
+
+int mrp_client_add(struct mrp_database *mrp_db,
+		   struct sockaddr_in *newclient);
+int mrp_client_delete(struct mrp_database *mrp_db,
+		      struct sockaddr_in *newclient);
+int mrp_client_set_binary(struct mrp_database *mrp_db,
+			  struct sockaddr_in *client, int app, int enable);
+int mrp_client_filter_type(struct mrp_database *mrp_db,
+			   struct sockaddr_in *client, int type);
+int mrp_client_filter_key(struct mrp_database *mrp_db,
+			  struct sockaddr_in *client, uint64_t lo, uint64_t hi);
+void mrp_client_filter_clear(struct mrp_database *mrp_db,
+			     struct sockaddr_in *client);
+int mrp_client_match(struct mrp_database *mrp_db, int type, int keyed,
+		     uint64_t key);
+int mrp_client_notify_post(struct mrp_database *mrp_db,
+			   struct mrpd_notify_rec *rec);
+void mrp_client_notify_flush(client_t * list);
 
 int mrp_init(void);
 char *mrp_event_string(int e);
@@ -215,8 +501,11 @@ int mrp_periodictimer_stop();
 int mrp_periodictimer_fsm(struct mrp_periodictimer_state *periodic_state, int event);
 int mrp_jointimer_stop(struct mrp_database *mrp_db);
 int mrp_jointimer_start(struct mrp_database *mrp_db);
-int mrp_lvtimer_start(struct mrp_database *mrp_db);
-int mrp_lvtimer_stop(struct mrp_database *mrp_db);
+int mrp_lvtimer_start(struct mrp_database *mrp_db,
+		      mrp_registrar_attribute_t * attrib);
+int mrp_lvtimer_stop(struct mrp_database *mrp_db,
+		     mrp_registrar_attribute_t * attrib);
+mrp_registrar_attribute_t *mrp_lvtimer_expired(struct mrp_database *mrp_db);
 int mrp_lvatimer_start(struct mrp_database *mrp_db);
 int mrp_lvatimer_stop(struct mrp_database *mrp_db);
 int mrp_lvatimer_fsm(struct mrp_database *mrp_db, int event);
@@ -229,7 +518,45 @@ int mrp_decode_state(mrp_registrar_attribute_t * rattrib,
 		     mrp_applicant_attribute_t * aattrib, char *str,
 		     int strlen);
 int mrp_applicant_state_transition_implies_tx(mrp_applicant_attribute_t * attrib);
-void mrp_schedule_tx_event(struct mrp_database *mrp_db);
+void mrp_tx_enqueue(struct mrp_database *mrp_db,
+		    mrp_applicant_attribute_t * attrib);
+void mrp_tx_dequeue(struct mrp_database *mrp_db,
+		    mrp_applicant_attribute_t * attrib);
+void mrp_tx_pending_sort(struct mrp_database *mrp_db,
+			 int (*cmp) (mrp_applicant_attribute_t * a,
+				     mrp_applicant_attribute_t * b));
+int mrp_tx_pending_retire(struct mrp_database *mrp_db);
+int mrp_tx_opportunity(struct mrp_database *mrp_db, int event);
+int mrp_tx_report(struct mrp_database *mrp_db, const char *name,
+		  struct sockaddr_in *client);
+void mrp_gc_push(struct mrp_database *mrp_db, struct mrp_gc_link *link,
+		 int registrar);
+struct mrp_gc_link *mrp_gc_pop(struct mrp_database *mrp_db);
+void mrp_gc_remove(struct mrp_database *mrp_db, struct mrp_gc_link *link);
+int mrp_reclaimable(mrp_applicant_attribute_t * app,
+		    mrp_registrar_attribute_t * reg);
+void mrp_histogram_add(struct mrp_histogram *hist, unsigned long us);
+int mrp_histogram_report(struct mrp_histogram *hist, const char *name,
+			 int port, struct sockaddr_in *client);
+int mrp_stats_report(struct mrp_database *mrp_db, const char *name,
+		     int port, struct sockaddr_in *client);
+int mrp_dump_offset(char *buf, int buflen);
+struct mrp_snapshot_rec *mrp_snapshot_attrib(struct mrp_snapshot *snap,
+					     mrp_applicant_attribute_t * app,
+					     mrp_registrar_attribute_t * reg,
+					     uint32_t type, const void *value,
+					     size_t len);
+int mrp_snapshot_clients(struct mrp_snapshot *snap,
+			 struct mrp_database *mrp_db);
+int mrp_restore_wanted(const struct mrp_snapshot_rec *rec, int fresh);
+void mrp_restore_attrib(struct mrp_database *mrp_db,
+			const struct mrp_snapshot_rec *rec,
+			mrp_applicant_attribute_t * app,
+			mrp_registrar_attribute_t * reg, int fresh);
+int mrp_restore_client(struct mrp_database *mrp_db,
+		       const struct mrp_snapshot_rec *rec);
+int mrpdu_4pack_encode(const int *events, int numvalues, uint8_t *out);
+int mrpdu_4pack_decode(const uint8_t *in, int numvalues, int *events);
 
 #if LOG_MVRP || LOG_MSRP || LOG_MMRP || LOG_MRP
 char *mrp_event_string(int e);
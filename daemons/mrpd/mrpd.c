@@ -35,6 +35,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stddef.h>
 #include <stdarg.h>
@@ -42,10 +43,13 @@
 #include <syslog.h>
 #include <signal.h>
 #include <errno.h>
+#include <pthread.h>
+#include <sched.h>
 #include <sys/ioctl.h>
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/timerfd.h>
 #include <sys/user.h>
 #include <sys/socket.h>
@@ -56,14 +60,19 @@
 #include <net/ethernet.h>
 #include <sys/un.h>
 #include <sys/eventfd.h>
+#include <sys/epoll.h>
 
 #include "mrpd.h"
 #include "mrp.h"
 #include "mvrp.h"
 #include "msrp.h"
 #include "mmrp.h"
+#include "rt_setup.h"
 
-static void mrpd_log_timer_event(char *src, int event);
+static void mrpd_log_timer_event(const char *src, int event);
+static void mrpd_snapshot_update(void);
+static int mrpd_unix_send(struct sockaddr_in *client_addr, char *data,
+			  int len);
 
 /* global mgmt parameters */
 int daemonize;
@@ -73,7 +82,7 @@ int msrp_enable;
 int logging_enable;
 int mrpd_port;
 
-char *interface;
+MRPD_THREAD_LOCAL char *interface;
 int interface_fd;
 
 /* state machine controls */
@@ -95,22 +104,229 @@ int participant;
 static const char *version_str =
     "mrpd v" VERSION_STR "\n" "Copyright (c) 2012, Intel Corporation\n";
 
-unsigned char STATION_ADDR[] = { 0x00, 0x88, 0x77, 0x66, 0x55, 0x44 };
+MRPD_THREAD_LOCAL unsigned char STATION_ADDR[] = { 0x00, 0x88, 0x77, 0x66, 0x55, 0x44 };
 
 /* global variables */
 SOCKET control_socket;
-extern SOCKET mmrp_socket;
-extern SOCKET mvrp_socket;
-extern SOCKET msrp_socket;
+extern MRPD_THREAD_LOCAL SOCKET mmrp_socket;
+extern MRPD_THREAD_LOCAL SOCKET mvrp_socket;
+extern MRPD_THREAD_LOCAL SOCKET msrp_socket;
 
-int periodic_timer;
-int gc_timer;
+/* with -t each application thread runs its own periodic and gc timer */
+MRPD_THREAD_LOCAL int periodic_timer;
+MRPD_THREAD_LOCAL int gc_timer;
 unsigned int gc_ctl_msg_count = 0;
-static struct mrp_periodictimer_state mrp_periodic_state;
+static MRPD_THREAD_LOCAL struct mrp_periodictimer_state mrp_periodic_state;
 
-extern struct mmrp_database *MMRP_db;
-extern struct mvrp_database *MVRP_db;
-extern struct msrp_database *MSRP_db;
+/*
+ * One-shot timer deadlines are rounded up to this granule so timers of
+ * different applications that fall due close together expire in the
+ * same wakeup of the event loop.
+ */
+#define MRPD_TIMER_SLACK_MS	4
+
+/* gc re-run delay while reclaim candidates exceed MRP_GC_BUDGET */
+#define MRPD_GC_BACKLOG_MS	100
+
+/* upper bound of frames/messages drained from one socket per wakeup */
+#define MRPD_RX_BATCH		64
+
+#define MRPD_MAX_EVENTS		16
+
+/*
+ * control socket, periodic, gc, the Unix listener, the Unix shared memory
+ * doorbell and the -t snapshot doorbell, ring doorbell, periodic and gc of
+ * each application thread,
+ * then socket + 3 timers per application and port; Unix connections
+ * carry their own source
+ */
+#define MRPD_MAX_SOURCES	(6 + 3 * 3 + 3 * 4 * MRPD_MAX_PORTS)
+
+/* set by the receive helpers when a non-blocking read finds no data */
+static MRPD_THREAD_LOCAL int mrpd_rx_would_block;
+
+/* -c: state checkpoint, rewritten when a declaration or client changed */
+static char *snapshot_path;
+static unsigned long mrpd_snapshot_gen;
+static int mrpd_snapshot_dirty;
+static unsigned long mrpd_snapshot_ms;	/* last rewrite started */
+
+/* changes within this time of a rewrite wait for the next one */
+#define MRPD_SNAPSHOT_INTERVAL_MS	5000
+
+/* SIGTERM/SIGINT: leave the event loop and write a last snapshot */
+static volatile sig_atomic_t mrpd_stop;
+
+/*
+ * -t: each enabled application runs on a thread of its own, with its
+ * sockets, timers and databases of all ports. The main thread keeps the
+ * control channels and hands client commands over through a single
+ * producer, single consumer ring per application thread; it is the only
+ * producer. Replies go straight to the clients, under mrpd_unix_mutex
+ * for the Unix connections.
+ */
+#define MRPD_APP_MMRP		0x01
+#define MRPD_APP_MVRP		0x02
+#define MRPD_APP_MSRP		0x04
+#define MRPD_APP_ALL		(MRPD_APP_MMRP | MRPD_APP_MVRP | MRPD_APP_MSRP)
+
+#define MRPD_WORK_CMD		1	/* client command for 'port' */
+#define MRPD_WORK_BYE		2	/* client gone, forget it on every port */
+#define MRPD_WORK_SNAPSHOT	3	/* collect the records for -c */
+#define MRPD_WORK_STOP		4
+
+struct mrpd_worker {
+	int app;		/* MRPD_APP_xxx */
+	const char *const *names;	/* of the sources the thread adds */
+	pthread_t thread;
+	int running;
+	int stop;
+	int epoll_fd;
+	int doorbell;		/* eventfd, rung when the ring gets non empty */
+	int periodic_timer;
+	int gc_timer;
+	/* records of the last MRPD_WORK_SNAPSHOT, taken by the main thread */
+	struct mrp_snapshot *snap;
+	int snap_rc;
+	struct mrpd_work_ring ring;
+};
+
+static int mrpd_threaded;
+static struct mrpd_worker *mrpd_workers[3];
+static int mrpd_worker_count;
+
+/* the thread's own worker, NULL on the main thread */
+static MRPD_THREAD_LOCAL struct mrpd_worker *mrpd_worker_self;
+/* the applications whose state the calling thread works on */
+static MRPD_THREAD_LOCAL int mrpd_apps = MRPD_APP_ALL;
+
+/* application threads answer Unix clients too */
+static pthread_mutex_t mrpd_unix_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* -c with -t: the application threads are asked for their records */
+static int mrpd_snapshot_doorbell = -1;
+static int mrpd_snapshot_pending;
+static unsigned long mrpd_snapshot_pending_gen;
+
+static void mrpd_unix_lock(void)
+{
+	if (mrpd_threaded)
+		pthread_mutex_lock(&mrpd_unix_mutex);
+}
+
+static void mrpd_unix_unlock(void)
+{
+	if (mrpd_threaded)
+		pthread_mutex_unlock(&mrpd_unix_mutex);
+}
+
+/* counters bumped by the application threads as well */
+#define MRPD_COUNT(counter)	__atomic_fetch_add(&(counter), 1, \
+						   __ATOMIC_RELAXED)
+
+/* a descriptor watched by the event loop and its dispatch callback */
+struct mrpd_source {
+	int fd;
+	void (*handler) (struct mrpd_source *src);
+	const char *name;
+	int (*rx) (void);
+	int (*timer_event) (int event);
+	int event;
+	int port;		/* bridge port selected before dispatch */
+	uint32_t revents;	/* epoll events of the current wakeup */
+	struct mrp_histogram *hist;	/* handler latency */
+};
+
+static struct mrpd_source mrpd_sources[MRPD_MAX_SOURCES];
+static struct mrp_histogram mrpd_source_hist[MRPD_MAX_SOURCES];
+static int mrpd_source_count;
+static int mrpd_epoll_fd = -1;
+
+/* control channel counters, reported by D?M with the handler latencies */
+static unsigned long mrpd_ctl_rx;
+static unsigned long mrpd_ctl_errors;	/* commands that were refused */
+static unsigned long mrpd_ctl_dropped;	/* messages to clients not sent */
+
+/* Unix domain control transport, see mrpd.h */
+#define MRPD_UNIX_MAX_CONNS	32
+
+/* a client further behind than this is disconnected */
+#define MRPD_UNIX_BACKLOG_MAX	4096
+
+/* the handler latency of all Unix connections, old and new */
+static struct mrp_histogram mrpd_unix_hist;
+
+SOCKET unix_socket;
+char *unix_path;
+
+struct mrpd_unix_msg {
+	struct mrpd_unix_msg *next;
+	int len;
+	char data[0];
+};
+
+struct mrpd_unix_conn {
+	struct mrpd_source src;
+	int in_use;
+	int dead;		/* closed once the current wakeup is done */
+	uint32_t gen;		/* tells the users of a slot apart */
+	struct mrpd_shm *shm;
+	int shm_more;		/* commands left in the ring after a batch */
+	struct mrpd_unix_msg *backlog;
+	struct mrpd_unix_msg **backlog_tail;
+	int backlog_count;
+};
+
+static struct mrpd_unix_conn mrpd_unix_conns[MRPD_UNIX_MAX_CONNS];
+
+/* rung when a cmd ring is left with commands after MRPD_RX_BATCH */
+static int mrpd_unix_shm_doorbell = -1;
+
+/*
+ * Per protocol socket receive buffers. recvmmsg() fills the whole array
+ * in one call and mrpd_recvmsgbuf() then hands out the frames one at a
+ * time, so a burst of PDUs costs one syscall and no allocation.
+ */
+struct mrpd_rx_ring {
+	SOCKET sock;
+	int count;		/* frames returned by the last recvmmsg */
+	int next;		/* next frame to hand out */
+	struct mmsghdr hdr[MRPD_RX_BATCH];
+	struct iovec iov[MRPD_RX_BATCH];
+	struct sockaddr_ll addr[MRPD_RX_BATCH];
+	char frame[MRPD_RX_BATCH][MAX_FRAME_SIZE];
+};
+
+/* one each for MMRP, MVRP and MSRP on every port */
+#define MRPD_RX_RINGS		(3 * MRPD_MAX_PORTS)
+
+static struct mrpd_rx_ring *mrpd_rx_rings[MRPD_RX_RINGS];
+
+extern MRPD_THREAD_LOCAL struct mmrp_database *MMRP_db;
+extern MRPD_THREAD_LOCAL struct mvrp_database *MVRP_db;
+extern MRPD_THREAD_LOCAL struct msrp_database *MSRP_db;
+
+/*
+ * Per port state. The applications work on the globals above, so the
+ * state of one port at a time is swapped in by mrpd_port_select().
+ */
+struct mrpd_port {
+	char *interface;
+	unsigned char station_addr[6];
+	uint32_t latency;	/* ns, added to a forwarded talker's latency */
+	SOCKET mmrp_socket;
+	SOCKET mvrp_socket;
+	SOCKET msrp_socket;
+	struct mmrp_database *mmrp_db;
+	struct mvrp_database *mvrp_db;
+	struct msrp_database *msrp_db;
+};
+
+static struct mrpd_port mrpd_ports[MRPD_MAX_PORTS];
+static int mrpd_port_num;
+/* set once the applications are up, the table is read only from then on */
+static int mrpd_ports_sealed;
+static MRPD_THREAD_LOCAL int mrpd_port_cur;
 
 int mrpd_timer_create(void)
 {
@@ -133,6 +349,9 @@ int mrpd_timer_start_interval(int timerfd,
 	struct itimerspec itimerspec_new;
 	struct itimerspec itimerspec_old;
 	unsigned long ns_per_ms = 1000000;
+	struct timespec now;
+	unsigned long long now_ms;
+	unsigned long long deadline_ms;
 
 	memset(&itimerspec_new, 0, sizeof(itimerspec_new));
 	memset(&itimerspec_old, 0, sizeof(itimerspec_old));
@@ -143,10 +362,24 @@ int mrpd_timer_start_interval(int timerfd,
 		    (interval_ms % 1000) * ns_per_ms;
 	}
 
-	itimerspec_new.it_value.tv_sec = value_ms / 1000;
-	itimerspec_new.it_value.tv_nsec = (value_ms % 1000) * ns_per_ms;
+	if (0 == value_ms) {
+		/* an all-zero it_value disarms the timer */
+		rc = timerfd_settime(timerfd, 0, &itimerspec_new,
+				     &itimerspec_old);
+		return (rc);
+	}
 
-	rc = timerfd_settime(timerfd, 0, &itimerspec_new, &itimerspec_old);
+	/* absolute deadline, rounded up to the coalescing granule */
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	now_ms = (unsigned long long)now.tv_sec * 1000 + now.tv_nsec / ns_per_ms;
+	deadline_ms = now_ms + value_ms + MRPD_TIMER_SLACK_MS - 1;
+	deadline_ms -= deadline_ms % MRPD_TIMER_SLACK_MS;
+
+	itimerspec_new.it_value.tv_sec = deadline_ms / 1000;
+	itimerspec_new.it_value.tv_nsec = (deadline_ms % 1000) * ns_per_ms;
+
+	rc = timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &itimerspec_new,
+			     &itimerspec_old);
 
 	return (rc);
 }
@@ -170,6 +403,22 @@ int mrpd_timer_stop(int timerfd)
 	return (rc);
 }
 
+unsigned long mrpd_clock_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static unsigned long mrpd_clock_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 int gctimer_start()
 {
 	/* reclaim memory every 30 seconds */
@@ -232,6 +481,49 @@ int init_local_ctl(void)
 	return -1;
 }
 
+int init_unix_ctl(void)
+{
+	struct sockaddr_un addr;
+	int sock_fd = -1;
+	int rc;
+
+	if (strlen(unix_path) >= sizeof(addr.sun_path))
+		goto out;
+
+	sock_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK |
+			 SOCK_CLOEXEC, 0);
+	if (sock_fd < 0)
+		goto out;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, unix_path);
+
+	/* a socket file left behind by a previous instance */
+	unlink(unix_path);
+
+	rc = bind(sock_fd, (struct sockaddr *)&addr, sizeof(addr));
+	if (rc < 0) {
+#if LOG_ERRORS
+		fprintf(stderr, "%s - Error on bind %s", __FUNCTION__, strerror(errno));
+#endif
+		goto out;
+	}
+
+	rc = listen(sock_fd, MRPD_UNIX_MAX_CONNS);
+	if (rc < 0)
+		goto out;
+
+	unix_socket = sock_fd;
+
+	return 0;
+ out:
+	if (sock_fd != -1)
+		close(sock_fd);
+
+	return -1;
+}
+
 int
 mrpd_send_ctl_msg(struct sockaddr_in *client_addr, char *notify_data,
 		  int notify_len)
@@ -239,6 +531,15 @@ mrpd_send_ctl_msg(struct sockaddr_in *client_addr, char *notify_data,
 
 	int rc;
 
+	if (AF_UNIX == client_addr->sin_family) {
+		mrpd_unix_lock();
+		rc = mrpd_unix_send(client_addr, notify_data, notify_len);
+		mrpd_unix_unlock();
+		if (rc < 0)
+			MRPD_COUNT(mrpd_ctl_dropped);
+		return rc;
+	}
+
 	if (-1 == control_socket)
 		return 0;
 
@@ -252,9 +553,299 @@ mrpd_send_ctl_msg(struct sockaddr_in *client_addr, char *notify_data,
 #endif
 	rc = sendto(control_socket, notify_data, notify_len,
 		    0, (struct sockaddr *)client_addr, sizeof(struct sockaddr));
+	if (rc < 0)
+		MRPD_COUNT(mrpd_ctl_dropped);
+	return rc;
+}
+
+int mrpd_port_count(void)
+{
+	return mrpd_port_num;
+}
+
+int mrpd_port_current(void)
+{
+	return mrpd_port_cur;
+}
+
+uint32_t mrpd_port_latency(void)
+{
+	return mrpd_ports[mrpd_port_cur].latency;
+}
+
+/* write back what the applications may have set up */
+static void mrpd_port_save(void)
+{
+	struct mrpd_port *p = &mrpd_ports[mrpd_port_cur];
+
+	memcpy(p->station_addr, STATION_ADDR, sizeof(p->station_addr));
+	p->mmrp_socket = mmrp_socket;
+	p->mvrp_socket = mvrp_socket;
+	p->msrp_socket = msrp_socket;
+	p->mmrp_db = MMRP_db;
+	p->mvrp_db = MVRP_db;
+	p->msrp_db = MSRP_db;
+}
+
+void mrpd_port_select(int port)
+{
+	struct mrpd_port *p;
+
+	if (port == mrpd_port_cur)
+		return;
+
+	if (!mrpd_ports_sealed)
+		mrpd_port_save();
+
+	p = &mrpd_ports[port];
+	interface = p->interface;
+	memcpy(STATION_ADDR, p->station_addr, sizeof(p->station_addr));
+	mmrp_socket = p->mmrp_socket;
+	mvrp_socket = p->mvrp_socket;
+	msrp_socket = p->msrp_socket;
+	MMRP_db = p->mmrp_db;
+	MVRP_db = p->mvrp_db;
+	MSRP_db = p->msrp_db;
+	mrpd_port_cur = port;
+}
+
+static int mrpd_port_add(char *name, uint32_t latency)
+{
+	struct mrpd_port *p;
+
+	if (mrpd_port_num >= MRPD_MAX_PORTS)
+		return -1;
+
+	p = &mrpd_ports[mrpd_port_num++];
+	memset(p, 0, sizeof(*p));
+	p->interface = name;
+	p->latency = latency;
+	p->mmrp_socket = INVALID_SOCKET;
+	p->mvrp_socket = INVALID_SOCKET;
+	p->msrp_socket = INVALID_SOCKET;
+
+	return 0;
+}
+
+/*
+ * Called on the main thread only. A full ring is waited out rather than
+ * dropped, the application thread never waits on the main thread.
+ */
+static void mrpd_worker_post(struct mrpd_worker *w, int kind, int port,
+			     struct sockaddr_in *client, const char *data,
+			     int len)
+{
+	uint64_t one = 1;
+	int rc;
+
+	if (len < 0)
+		len = 0;
+	if (len > MAX_MRPD_CMDSZ)
+		len = MAX_MRPD_CMDSZ;
+
+	while ((rc = mrpd_work_push(&w->ring, kind, port, client, data,
+				    len)) < 0)
+		sched_yield();
+
+	if ((rc > 0) && (write(w->doorbell, &one, sizeof(one)) < 0)) {
+#if LOG_ERRORS
+		fprintf(stderr, "doorbell %s\r\n", strerror(errno));
+#endif
+	}
+}
+
+/* a client leaving is forgotten on every port */
+static void mrpd_bye(struct sockaddr_in *client)
+{
+	int cur = mrpd_port_cur;
+	int port;
+	int i;
+
+	for (port = 0; port < mrpd_port_num; port++) {
+		mrpd_port_select(port);
+		if (mrpd_apps & MRPD_APP_MMRP)
+			mmrp_bye(client);
+		if (mrpd_apps & MRPD_APP_MVRP)
+			mvrp_bye(client);
+		if (mrpd_apps & MRPD_APP_MSRP)
+			msrp_bye(client);
+	}
+	mrpd_port_select(cur);
+
+	if (NULL != mrpd_worker_self)
+		return;
+	for (i = 0; i < mrpd_worker_count; i++)
+		mrpd_worker_post(mrpd_workers[i], MRPD_WORK_BYE, 0, client,
+				 NULL, 0);
+}
+
+/* the thread serving an application command, NULL to run it here */
+static struct mrpd_worker *mrpd_worker_find(char app)
+{
+	int mask;
+	int i;
+
+	switch (app) {
+	case 'M':
+		mask = MRPD_APP_MMRP;
+		break;
+	case 'V':
+		mask = MRPD_APP_MVRP;
+		break;
+	case 'S':
+		mask = MRPD_APP_MSRP;
+		break;
+	default:
+		return NULL;
+	}
+
+	for (i = 0; i < mrpd_worker_count; i++) {
+		if (mrpd_workers[i]->app == mask)
+			return mrpd_workers[i];
+	}
+	return NULL;
+}
+
+static int mrpd_app_recv_cmd(char *buf, int buflen,
+			     struct sockaddr_in *client)
+{
+	struct mrpd_worker *w;
+
+	w = mrpd_worker_find(buf[0]);
+	if ((NULL != w) && (w != mrpd_worker_self)) {
+		/* the result is counted by the application thread */
+		mrpd_worker_post(w, MRPD_WORK_CMD, mrpd_port_cur, client, buf,
+				 buflen);
+		return 0;
+	}
+
+	switch (buf[0]) {
+	case 'M':
+		return mmrp_recv_cmd(buf, buflen, client);
+	case 'V':
+		return mvrp_recv_cmd(buf, buflen, client);
+	default:
+		return msrp_recv_cmd(buf, buflen, client);
+	}
+}
+
+int process_ctl_msg(char *buf, int buflen, struct sockaddr_in *client);
+
+static int mrpd_port_ctl_msg(char *buf, int buflen,
+			     struct sockaddr_in *client)
+{
+	char respbuf[64];
+	int cur = mrpd_port_cur;
+	int port = 0;
+	int rc;
+	int i;
+
+	for (i = 1; (i < buflen) && (buf[i] >= '0') && (buf[i] <= '9'); i++)
+		port = port * 10 + buf[i] - '0';
+
+	if ((1 == i) || (i > 4) || (i >= buflen) || (':' != buf[i]) ||
+	    (port >= mrpd_port_num)) {
+		memset(respbuf, 0, sizeof(respbuf));
+		snprintf(respbuf, sizeof(respbuf) - 1, "ERP MRP port %.*s",
+			 i, buf);
+		mrpd_send_ctl_msg(client, respbuf, sizeof(respbuf));
+		return -1;
+	}
+
+	mrpd_port_select(port);
+	rc = process_ctl_msg(buf + i + 1, buflen - i - 1, client);
+	mrpd_port_select(cur);
+
 	return rc;
 }
 
+/* the application timers are told apart by the event they fire */
+static void mrpd_source_label(struct mrpd_source *src, char *buf, int size)
+{
+	const char *timer = NULL;
+
+	if (src->timer_event) {
+		switch (src->event) {
+		case MRP_EVENT_LVATIMER:
+			timer = "lva";
+			break;
+		case MRP_EVENT_LVTIMER:
+			timer = "lv";
+			break;
+		case MRP_EVENT_TX:
+			timer = "join";
+			break;
+		default:
+			break;
+		}
+	}
+	if (timer)
+		snprintf(buf, size, "%s/%s", src->name, timer);
+	else
+		snprintf(buf, size, "%s", src->name);
+}
+
+/*
+ * D?M - the control channel counters, the counters of every
+ * application on every port and the latency of each event loop
+ * handler, one line per message, closed by "OK+ N=<lines>".
+ */
+static int mrpd_metrics_report(struct sockaddr_in *client)
+{
+	char respbuf[128];
+	char name[32];
+	struct mrpd_source *src;
+	int cur = mrpd_port_cur;
+	int lines = 0;
+	int port;
+	int i;
+
+	memset(respbuf, 0, sizeof(respbuf));
+	snprintf(respbuf, sizeof(respbuf) - 1,
+		 "MET mrpd ctl_rx=%lu ctl_err=%lu ctl_drop=%lu\n",
+		 mrpd_ctl_rx, MRP_STAT_READ(mrpd_ctl_errors),
+		 MRP_STAT_READ(mrpd_ctl_dropped));
+	mrpd_send_ctl_msg(client, respbuf, sizeof(respbuf));
+	lines++;
+
+	for (port = 0; port < mrpd_port_num; port++) {
+		mrpd_port_select(port);
+		if (mmrp_enable && MMRP_db) {
+			mrp_stats_report(&(MMRP_db->mrp_db), "MMRP", port,
+					 client);
+			lines += 2;
+		}
+		if (mvrp_enable && MVRP_db) {
+			mrp_stats_report(&(MVRP_db->mrp_db), "MVRP", port,
+					 client);
+			lines += 2;
+		}
+		if (msrp_enable && MSRP_db) {
+			mrp_stats_report(&(MSRP_db->mrp_db), "MSRP", port,
+					 client);
+			lines += 2;
+		}
+	}
+	mrpd_port_select(cur);
+
+	for (i = 0; i < mrpd_source_count; i++) {
+		src = &mrpd_sources[i];
+		mrpd_source_label(src, name, sizeof(name));
+		mrp_histogram_report(src->hist, name, src->port, client);
+		lines++;
+	}
+	if (INVALID_SOCKET != unix_socket) {
+		mrp_histogram_report(&mrpd_unix_hist, "unix_conn", 0, client);
+		lines++;
+	}
+
+	memset(respbuf, 0, sizeof(respbuf));
+	snprintf(respbuf, sizeof(respbuf) - 1, "OK+ N=%d", lines);
+	mrpd_send_ctl_msg(client, respbuf, sizeof(respbuf));
+
+	return 0;
+}
+
 int process_ctl_msg(char *buf, int buflen, struct sockaddr_in *client)
 {
 
@@ -279,6 +870,18 @@ int process_ctl_msg(char *buf, int buflen, struct sockaddr_in *client)
 	 * S+? - JOIN_MT a Stream
 	 * S++ - JOIN_IN a Stream
 	 * S-- - LV a Stream
+	 * M+B, V+B, S+B - switch notifications to the binary protocol
+	 * M-B, V-B, S-B - switch notifications back to text
+	 * M+F, V+F, S+F - notify only of an attribute type or key (range)
+	 * M-F, V-F, S-F - remove the notification filters
+	 * V and S declarations and queries also take ';' separated records
+	 * (and V ranges L=xxxx,H=xxxx of VIDs 1-4094), answered with one
+	 * OK+ N=<count>
+	 * P<n>: - prefix addressing any of the above to bridge port n
+	 *         (in -i order); without it port 0 is meant
+	 * D?M - report the daemon metrics: PDU, FSM event and notification
+	 *       counters per application and port, control message counters
+	 *       and event loop handler latencies
 	 *
 	 * Outbound messages
 	 * ERC - error, unrecognized command
@@ -324,19 +927,20 @@ int process_ctl_msg(char *buf, int buflen, struct sockaddr_in *client)
 
 	switch (buf[0]) {
 	case 'M':
-		return mmrp_recv_cmd(buf, buflen, client);
-		break;
 	case 'V':
-		return mvrp_recv_cmd(buf, buflen, client);
-		break;
 	case 'S':
-		return msrp_recv_cmd(buf, buflen, client);
+		return mrpd_app_recv_cmd(buf, buflen, client);
 		break;
 	case 'B':
-		mmrp_bye(client);
-		mvrp_bye(client);
-		msrp_bye(client);
+		mrpd_bye(client);
 		break;
+	case 'P':
+		return mrpd_port_ctl_msg(buf, buflen, client);
+		break;
+	case 'D':
+		if (strncmp(buf, "D?M", 3) == 0)
+			return mrpd_metrics_report(client);
+		/* fall thru */
 	default:
 		printf("unrecognized command %s\n", buf);
 		snprintf(respbuf, sizeof(respbuf) - 1, "ERC MRP parse %s", buf);
@@ -348,7 +952,16 @@ int process_ctl_msg(char *buf, int buflen, struct sockaddr_in *client)
 	return 0;
 }
 
-int recv_ctl_msg()
+/* a control message from any of the transports */
+static void mrpd_ctl_dispatch(char *buf, int buflen,
+			      struct sockaddr_in *client)
+{
+	mrpd_ctl_rx++;
+	if (process_ctl_msg(buf, buflen, client) < 0)
+		MRPD_COUNT(mrpd_ctl_errors);
+}
+
+int recv_ctl_msg(void)
 {
 	char *msgbuf;
 	struct sockaddr_in client_addr;
@@ -371,84 +984,586 @@ int recv_ctl_msg()
 	msg.msg_iov = &iov;
 	msg.msg_iovlen = 1;
 
-	bytes = recvmsg(control_socket, &msg, 0);
-	if (bytes <= 0)
+	bytes = recvmsg(control_socket, &msg, MSG_DONTWAIT);
+	if (bytes <= 0) {
+		if ((bytes < 0) && (EAGAIN == errno))
+			mrpd_rx_would_block = 1;
 		goto out;
+	}
 
-	process_ctl_msg(msgbuf, bytes, &client_addr);
+	mrpd_ctl_dispatch(msgbuf, bytes, &client_addr);
  out:
 	free(msgbuf);
 
-	return -1;
+	return bytes;
 }
 
-int mrpd_recvmsgbuf(int sock, char **buf)
+/*
+ * Unix domain clients are identified to the applications by a
+ * sockaddr_in carrying AF_UNIX, the connection number in sin_port and
+ * the generation of the slot in sin_addr, so that a reply still under
+ * way from an application thread can not reach the next client.
+ */
+static void mrpd_unix_client_addr(struct mrpd_unix_conn *conn,
+				  struct sockaddr_in *client_addr)
 {
-	struct sockaddr_ll client_addr;
-	struct msghdr msg;
-	struct iovec iov;
-	int bytes = 0;
+	memset(client_addr, 0, sizeof(*client_addr));
+	client_addr->sin_family = AF_UNIX;
+	client_addr->sin_port = (conn - mrpd_unix_conns) + 1;
+	client_addr->sin_addr.s_addr = conn->gen;
+}
 
-	*buf = (char *)malloc(MAX_FRAME_SIZE);
-	if (NULL == *buf)
-		return -1;
+static struct mrpd_unix_conn *mrpd_unix_conn_lookup(struct sockaddr_in
+						    *client_addr)
+{
+	int i = client_addr->sin_port - 1;
 
-	memset(&msg, 0, sizeof(msg));
-	memset(&client_addr, 0, sizeof(client_addr));
-	memset(*buf, 0, MAX_FRAME_SIZE);
+	if ((i < 0) || (i >= MRPD_UNIX_MAX_CONNS))
+		return NULL;
+	if (!mrpd_unix_conns[i].in_use || mrpd_unix_conns[i].dead ||
+	    (mrpd_unix_conns[i].gen != client_addr->sin_addr.s_addr))
+		return NULL;
 
-	iov.iov_len = MAX_FRAME_SIZE;
-	iov.iov_base = *buf;
-	msg.msg_name = &client_addr;
-	msg.msg_namelen = sizeof(client_addr);
-	msg.msg_iov = &iov;
-	msg.msg_iovlen = 1;
-	/* Non-blocking sockets. */
-	bytes = recvmsg(sock, &msg, MSG_DONTWAIT);
+	return &mrpd_unix_conns[i];
+}
 
-	if ( (bytes < 0) && (errno != EAGAIN) ) {
-#if LOG_ERRORS
-		fprintf(stderr, "recvmsg sock %d: %s\r\n", sock, strerror(errno));
-#endif
-		return(-1);
-	}
-	else if (bytes == 0) {
-#if LOG_ERRORS
-		fprintf(stderr, "Closed socket!\r\n");
-#endif
-		return(-1);
-	}
+static void mrpd_unix_set_events(struct mrpd_unix_conn *conn, uint32_t events)
+{
+	struct epoll_event ev;
 
-	return bytes;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.ptr = &conn->src;
+	epoll_ctl(mrpd_epoll_fd, EPOLL_CTL_MOD, conn->src.fd, &ev);
 }
 
-int
-mrpd_init_protocol_socket(u_int16_t etype, int *sock,
-			  unsigned char *multicast_addr)
+static void mrpd_unix_doorbell(struct mrpd_unix_conn *conn)
 {
-	struct sockaddr_ll addr;
-	struct ifreq if_request;
-	int lsock;
-	int rc;
-	struct packet_mreq multicast_req;
+	/* a doorbell still unread by the client serves as well */
+	send(conn->src.fd, "", 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
 
-	if (NULL == sock)
-		return -1;
-	if (NULL == multicast_addr)
-		return -1;
+static int mrpd_unix_queue(struct mrpd_unix_conn *conn, char *data, int len)
+{
+	struct mrpd_unix_msg *msg;
 
-	memset(&multicast_req, 0, sizeof(multicast_req));
-	*sock = -1;
+	if (conn->backlog_count >= MRPD_UNIX_BACKLOG_MAX) {
+#if LOG_ERRORS
+		fprintf(stderr, "unix client %d backlog full, disconnecting\n",
+			(int)(conn - mrpd_unix_conns) + 1);
+#endif
+		conn->dead = 1;
+		return -1;
+	}
 
-	lsock = socket(PF_PACKET, SOCK_RAW, htons(etype));
-	if (lsock < 0)
+	msg = malloc(sizeof(*msg) + len);
+	if (NULL == msg) {
+		conn->dead = 1;
 		return -1;
+	}
+	msg->next = NULL;
+	msg->len = len;
+	memcpy(msg->data, data, len);
 
-	memset(&if_request, 0, sizeof(if_request));
+	*conn->backlog_tail = msg;
+	conn->backlog_tail = &msg->next;
+	conn->backlog_count++;
 
-	strncpy(if_request.ifr_name, interface, sizeof(if_request.ifr_name) - 1);
+	return 0;
+}
 
-	rc = ioctl(lsock, SIOCGIFHWADDR, &if_request);
+static void mrpd_unix_dequeue(struct mrpd_unix_conn *conn)
+{
+	struct mrpd_unix_msg *msg = conn->backlog;
+
+	conn->backlog = msg->next;
+	if (NULL == conn->backlog)
+		conn->backlog_tail = &conn->backlog;
+	conn->backlog_count--;
+	free(msg);
+}
+
+/* move queued messages into the notify ring as far as they fit */
+static void mrpd_unix_shm_flush(struct mrpd_unix_conn *conn)
+{
+	struct mrpd_shm_ring *ring = &conn->shm->notify;
+	int doorbell = 0;
+	int rc;
+
+	while (conn->backlog) {
+		rc = mrpd_shm_push_wakeup(ring, conn->backlog->data,
+					  conn->backlog->len);
+		if (rc < 0)
+			break;
+		doorbell |= rc;
+		mrpd_unix_dequeue(conn);
+	}
+	if (doorbell)
+		mrpd_unix_doorbell(conn);
+}
+
+/* send queued messages on the socket until it would block */
+static void mrpd_unix_sock_flush(struct mrpd_unix_conn *conn)
+{
+	int rc;
+
+	while (conn->backlog) {
+		rc = send(conn->src.fd, conn->backlog->data,
+			  conn->backlog->len, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (rc < 0) {
+			if ((EAGAIN != errno) && (EINTR != errno))
+				conn->dead = 1;
+			return;
+		}
+		mrpd_unix_dequeue(conn);
+	}
+	mrpd_unix_set_events(conn, EPOLLIN);
+}
+
+static int mrpd_unix_send(struct sockaddr_in *client_addr, char *data,
+			  int len)
+{
+	struct mrpd_unix_conn *conn;
+	int rc;
+
+	conn = mrpd_unix_conn_lookup(client_addr);
+	if (NULL == conn)
+		return -1;
+	if (len > MAX_MRPD_CMDSZ)
+		return -1;
+
+	if (conn->shm) {
+		/* messages stay in order behind anything already queued */
+		if (NULL == conn->backlog) {
+			rc = mrpd_shm_push(&conn->shm->notify, data, len);
+			if (rc > 0)
+				mrpd_unix_doorbell(conn);
+			if (rc >= 0)
+				return len;
+		}
+		if (mrpd_unix_queue(conn, data, len))
+			return -1;
+		mrpd_unix_shm_flush(conn);
+		return len;
+	}
+
+	if (NULL == conn->backlog) {
+		rc = send(conn->src.fd, data, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (rc >= 0)
+			return rc;
+		if ((EAGAIN != errno) && (EINTR != errno)) {
+			conn->dead = 1;
+			return -1;
+		}
+		mrpd_unix_set_events(conn, EPOLLIN | EPOLLOUT);
+	}
+	if (mrpd_unix_queue(conn, data, len))
+		return -1;
+
+	return len;
+}
+
+static void mrpd_unix_shm_detach(struct mrpd_unix_conn *conn)
+{
+	if (NULL == conn->shm)
+		return;
+
+	munmap(conn->shm, sizeof(struct mrpd_shm));
+	conn->shm = NULL;
+	/* whatever did not fit into the ring now goes to the socket */
+	if (conn->backlog)
+		mrpd_unix_set_events(conn, EPOLLIN | EPOLLOUT);
+}
+
+static void mrpd_unix_shm_attach(struct mrpd_unix_conn *conn)
+{
+	char cbuf[CMSG_SPACE(sizeof(int))];
+	struct sockaddr_in client_addr;
+	struct mrpd_shm *shm = MAP_FAILED;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	char respbuf[] = "OK+";
+	int fd = -1;
+
+	/* the reply can not overtake messages still queued for the socket */
+	mrpd_unix_lock();
+	if (conn->shm || conn->backlog)
+		goto out;
+
+	fd = memfd_create("mrpd", MFD_CLOEXEC);
+	if (fd < 0)
+		goto out;
+	if (ftruncate(fd, sizeof(struct mrpd_shm)) < 0)
+		goto out;
+	shm = mmap(NULL, sizeof(struct mrpd_shm), PROT_READ | PROT_WRITE,
+		   MAP_SHARED, fd, 0);
+	if (MAP_FAILED == shm)
+		goto out;
+
+	shm->magic = MRPD_SHM_MAGIC;
+	shm->version = MRPD_SHM_VERSION;
+	shm->slots = MRPD_SHM_SLOTS;
+	shm->slot_size = MAX_MRPD_CMDSZ;
+
+	memset(&msg, 0, sizeof(msg));
+	memset(cbuf, 0, sizeof(cbuf));
+	iov.iov_base = respbuf;
+	iov.iov_len = sizeof(respbuf);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+	if (sendmsg(conn->src.fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL) < 0)
+		goto out;
+
+	/* the client holds its own reference to the memory now */
+	close(fd);
+	conn->shm = shm;
+	mrpd_unix_unlock();
+
+	return;
+ out:
+	mrpd_unix_unlock();
+	if (MAP_FAILED != shm)
+		munmap(shm, sizeof(struct mrpd_shm));
+	if (fd != -1)
+		close(fd);
+	mrpd_unix_client_addr(conn, &client_addr);
+	mrpd_send_ctl_msg(&client_addr, "ERI", sizeof("ERI"));
+}
+
+/* commands written to the cmd ring, then notifications that were held back */
+static void mrpd_unix_shm_service(struct mrpd_unix_conn *conn)
+{
+	char msgbuf[MAX_MRPD_CMDSZ + 1];
+	struct sockaddr_in client_addr;
+	uint64_t one = 1;
+	int bytes;
+	int i;
+
+	if (NULL == conn->shm)
+		return;
+
+	/*
+	 * The ring is written by the client, so it is drained in batches
+	 * like a socket; the rest waits for our own doorbell, after the
+	 * other sources of this wakeup.
+	 */
+	mrpd_unix_client_addr(conn, &client_addr);
+	for (i = 0; conn->shm && !conn->dead; i++) {
+		if (MRPD_RX_BATCH == i) {
+			if (!conn->shm_more &&
+			    (write(mrpd_unix_shm_doorbell, &one,
+				   sizeof(one)) == sizeof(one)))
+				conn->shm_more = 1;
+			break;
+		}
+		bytes = mrpd_shm_pop(&conn->shm->cmd, msgbuf, sizeof(msgbuf));
+		if (-1 == bytes)
+			break;
+		if (bytes < 0) {
+			/* a slot longer than any command, skipped */
+			MRPD_COUNT(mrpd_ctl_errors);
+			continue;
+		}
+		mrpd_ctl_dispatch(msgbuf, bytes, &client_addr);
+	}
+
+	mrpd_unix_lock();
+	if (conn->shm && conn->backlog)
+		mrpd_unix_shm_flush(conn);
+	mrpd_unix_unlock();
+}
+
+static void mrpd_unix_shm_more_handler(struct mrpd_source *src)
+{
+	uint64_t count;
+	int i;
+
+	if (read(src->fd, &count, sizeof(count)) != sizeof(count))
+		return;
+
+	for (i = 0; i < MRPD_UNIX_MAX_CONNS; i++) {
+		if (!mrpd_unix_conns[i].in_use || !mrpd_unix_conns[i].shm_more)
+			continue;
+		mrpd_unix_conns[i].shm_more = 0;
+		mrpd_unix_shm_service(&mrpd_unix_conns[i]);
+	}
+}
+
+static void mrpd_unix_recv(struct mrpd_unix_conn *conn, char *buf, int len)
+{
+	struct sockaddr_in client_addr;
+
+	mrpd_unix_client_addr(conn, &client_addr);
+
+	if (1 == len) {
+		mrpd_unix_shm_service(conn);
+	} else if (0 == strncmp(buf, "U+R", 3)) {
+		mrpd_unix_shm_attach(conn);
+	} else if (0 == strncmp(buf, "U-R", 3)) {
+		mrpd_unix_lock();
+		mrpd_unix_shm_detach(conn);
+		mrpd_unix_unlock();
+		mrpd_send_ctl_msg(&client_addr, "OK+", sizeof("OK+"));
+	} else {
+		mrpd_ctl_dispatch(buf, len, &client_addr);
+	}
+}
+
+static void mrpd_unix_conn_handler(struct mrpd_source *src)
+{
+	struct mrpd_unix_conn *conn = &mrpd_unix_conns[src->event];
+	char msgbuf[MAX_MRPD_CMDSZ + 1];
+	int bytes;
+	int i;
+
+	if (src->revents & EPOLLOUT) {
+		mrpd_unix_lock();
+		mrpd_unix_sock_flush(conn);
+		mrpd_unix_unlock();
+	}
+
+	for (i = 0; i < MRPD_RX_BATCH && !conn->dead; i++) {
+		bytes = recv(src->fd, msgbuf, MAX_MRPD_CMDSZ, MSG_DONTWAIT);
+		if (bytes < 0) {
+			if ((EAGAIN != errno) && (EINTR != errno))
+				conn->dead = 1;
+			break;
+		}
+		if (0 == bytes) {
+			/* hangup */
+			conn->dead = 1;
+			break;
+		}
+		msgbuf[bytes] = '\0';
+		mrpd_unix_recv(conn, msgbuf, bytes);
+	}
+}
+
+static void mrpd_unix_accept_handler(struct mrpd_source *src)
+{
+	struct mrpd_unix_conn *conn = NULL;
+	struct epoll_event ev;
+	uint32_t gen;
+	int fd;
+	int i;
+
+	fd = accept4(src->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	/* only the main thread claims and frees slots */
+	for (i = 0; i < MRPD_UNIX_MAX_CONNS; i++) {
+		if (!mrpd_unix_conns[i].in_use) {
+			conn = &mrpd_unix_conns[i];
+			break;
+		}
+	}
+	if (NULL == conn) {
+#if LOG_ERRORS
+		fprintf(stderr, "too many unix clients\n");
+#endif
+		close(fd);
+		return;
+	}
+
+	mrpd_unix_lock();
+	gen = conn->gen + 1;
+	memset(conn, 0, sizeof(*conn));
+	conn->gen = gen;
+	conn->src.fd = fd;
+	conn->src.handler = mrpd_unix_conn_handler;
+	conn->src.name = "unix_conn";
+	conn->src.event = i;
+	conn->src.hist = &mrpd_unix_hist;
+	conn->backlog_tail = &conn->backlog;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = &conn->src;
+	if (epoll_ctl(mrpd_epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+		close(fd);
+	else
+		conn->in_use = 1;
+	mrpd_unix_unlock();
+}
+
+static void mrpd_unix_close(struct mrpd_unix_conn *conn)
+{
+	struct sockaddr_in client_addr;
+
+	/* dead already, so nothing more is sent to it while it says bye */
+	mrpd_unix_client_addr(conn, &client_addr);
+	mrpd_bye(&client_addr);
+
+	mrpd_unix_lock();
+	epoll_ctl(mrpd_epoll_fd, EPOLL_CTL_DEL, conn->src.fd, NULL);
+	close(conn->src.fd);
+	while (conn->backlog)
+		mrpd_unix_dequeue(conn);
+	mrpd_unix_shm_detach(conn);
+	conn->in_use = 0;
+	mrpd_unix_unlock();
+}
+
+/*
+ * Connections are closed only between wakeups, as a send from any
+ * handler may find its client gone.
+ */
+static void mrpd_unix_reap(void)
+{
+	int dead;
+	int i;
+
+	for (i = 0; i < MRPD_UNIX_MAX_CONNS; i++) {
+		/* an application thread may find a client dead as well */
+		mrpd_unix_lock();
+		dead = mrpd_unix_conns[i].in_use && mrpd_unix_conns[i].dead;
+		mrpd_unix_unlock();
+		if (dead)
+			mrpd_unix_close(&mrpd_unix_conns[i]);
+	}
+}
+
+static struct mrpd_rx_ring *mrpd_rx_ring_find(SOCKET sock)
+{
+	int i;
+
+	for (i = 0; i < MRPD_RX_RINGS; i++) {
+		if (mrpd_rx_rings[i] && (mrpd_rx_rings[i]->sock == sock))
+			return mrpd_rx_rings[i];
+	}
+	return NULL;
+}
+
+static int mrpd_rx_ring_create(SOCKET sock)
+{
+	struct mrpd_rx_ring *ring;
+	int slot;
+	int i;
+
+	for (slot = 0; slot < MRPD_RX_RINGS; slot++) {
+		if (NULL == mrpd_rx_rings[slot])
+			break;
+	}
+	if (MRPD_RX_RINGS == slot)
+		return -1;
+
+	ring = (struct mrpd_rx_ring *)malloc(sizeof(*ring));
+	if (NULL == ring)
+		return -1;
+
+	memset(ring, 0, sizeof(*ring));
+	ring->sock = sock;
+	for (i = 0; i < MRPD_RX_BATCH; i++) {
+		ring->iov[i].iov_base = ring->frame[i];
+		ring->iov[i].iov_len = MAX_FRAME_SIZE;
+		ring->hdr[i].msg_hdr.msg_iov = &ring->iov[i];
+		ring->hdr[i].msg_hdr.msg_iovlen = 1;
+		ring->hdr[i].msg_hdr.msg_name = &ring->addr[i];
+	}
+
+	mrpd_rx_rings[slot] = ring;
+
+	return 0;
+}
+
+static void mrpd_rx_ring_destroy(SOCKET sock)
+{
+	int i;
+
+	for (i = 0; i < MRPD_RX_RINGS; i++) {
+		if (mrpd_rx_rings[i] && (mrpd_rx_rings[i]->sock == sock)) {
+			free(mrpd_rx_rings[i]);
+			mrpd_rx_rings[i] = NULL;
+		}
+	}
+}
+
+int mrpd_recvmsgbuf(int sock, char **buf)
+{
+	struct mrpd_rx_ring *ring;
+	int bytes = 0;
+	int i;
+
+	ring = mrpd_rx_ring_find(sock);
+	if (NULL == ring)
+		return -1;
+
+	if (ring->next >= ring->count) {
+		ring->next = 0;
+		ring->count = 0;
+		for (i = 0; i < MRPD_RX_BATCH; i++)
+			ring->hdr[i].msg_hdr.msg_namelen =
+			    sizeof(ring->addr[i]);
+
+		/* Non-blocking sockets. */
+		bytes = recvmmsg(sock, ring->hdr, MRPD_RX_BATCH,
+				 MSG_DONTWAIT, NULL);
+		if (bytes < 0) {
+			if (EAGAIN == errno) {
+				mrpd_rx_would_block = 1;
+			} else {
+#if LOG_ERRORS
+				fprintf(stderr, "recvmmsg sock %d: %s\r\n", sock,
+					strerror(errno));
+#endif
+			}
+			return(-1);
+		}
+		ring->count = bytes;
+		if (0 == ring->count)
+			return(-1);
+	}
+
+	i = ring->next++;
+	*buf = ring->frame[i];
+	bytes = ring->hdr[i].msg_len;
+	if (bytes == 0) {
+#if LOG_ERRORS
+		fprintf(stderr, "Closed socket!\r\n");
+#endif
+		return(-1);
+	}
+
+	return bytes;
+}
+
+int
+mrpd_init_protocol_socket(u_int16_t etype, int *sock,
+			  unsigned char *multicast_addr)
+{
+	struct sockaddr_ll addr;
+	struct ifreq if_request;
+	int lsock;
+	int rc;
+	struct packet_mreq multicast_req;
+
+	if (NULL == sock)
+		return -1;
+	if (NULL == multicast_addr)
+		return -1;
+
+	memset(&multicast_req, 0, sizeof(multicast_req));
+	*sock = -1;
+
+	lsock = socket(PF_PACKET, SOCK_RAW, htons(etype));
+	if (lsock < 0)
+		return -1;
+
+	memset(&if_request, 0, sizeof(if_request));
+
+	strncpy(if_request.ifr_name, interface, sizeof(if_request.ifr_name) - 1);
+
+	rc = ioctl(lsock, SIOCGIFHWADDR, &if_request);
 	if (rc < 0) {
 		close(lsock);
 		return -1;
@@ -467,325 +1582,1081 @@ mrpd_init_protocol_socket(u_int16_t etype, int *sock,
 		return -1;
 	}
 
-	memset(&addr, 0, sizeof(addr));
-	addr.sll_ifindex = if_request.ifr_ifindex;
-	addr.sll_family = AF_PACKET;
-	addr.sll_protocol = htons(etype);
+	memset(&addr, 0, sizeof(addr));
+	addr.sll_ifindex = if_request.ifr_ifindex;
+	addr.sll_family = AF_PACKET;
+	addr.sll_protocol = htons(etype);
+
+	rc = bind(lsock, (struct sockaddr *)&addr, sizeof(addr));
+	if (0 != rc) {
+#if LOG_ERRORS
+		fprintf(stderr, "%s - Error on bind %s", __FUNCTION__, strerror(errno));
+#endif
+		close(lsock);
+		return -1;
+	}
+
+	rc = setsockopt(lsock, SOL_SOCKET, SO_BINDTODEVICE, interface,
+			strlen(interface));
+	if (0 != rc) {
+		close(lsock);
+		return -1;
+	}
+
+	multicast_req.mr_ifindex = if_request.ifr_ifindex;
+	multicast_req.mr_type = PACKET_MR_MULTICAST;
+	multicast_req.mr_alen = 6;
+	memcpy(multicast_req.mr_address, multicast_addr, 6);
+
+	rc = setsockopt(lsock, SOL_PACKET, PACKET_ADD_MEMBERSHIP,
+			&multicast_req, sizeof(multicast_req));
+	if (0 != rc) {
+		close(lsock);
+		return -1;
+	}
+
+	if (mrpd_rx_ring_create(lsock) < 0) {
+		close(lsock);
+		return -1;
+	}
+
+	*sock = lsock;
+
+	return 0;
+}
+
+int mrpd_close_socket(SOCKET sock)
+{
+	mrpd_rx_ring_destroy(sock);
+	return close(sock);
+}
+
+int mrpd_init_timers(struct mrp_database *mrp_db)
+{
+	mrp_db->join_timer = mrpd_timer_create();
+	mrp_db->lv_timer = mrpd_timer_create();
+	mrp_db->lva_timer = mrpd_timer_create();
+	mrp_db->join_timer_running = 0;
+	mrp_db->lv_timer_running = 0;
+	mrp_db->lva_timer_running = 0;
+
+	if (-1 == mrp_db->join_timer)
+		goto out;
+	if (-1 == mrp_db->lv_timer)
+		goto out;
+	if (-1 == mrp_db->lva_timer)
+		goto out;
+	return 0;
+ out:
+	mrpd_timer_close(mrp_db->join_timer);
+	mrpd_timer_close(mrp_db->lv_timer);
+	mrpd_timer_close(mrp_db->lva_timer);
+
+	return -1;
+}
+
+int init_timers(void)
+{
+	/*
+	 * primarily whether to schedule the periodic timer as the
+	 * rest are self-scheduling as a side-effect of state transitions
+	 * of the various attributes
+	 */
+
+	periodic_timer = mrpd_timer_create();
+	gc_timer = mrpd_timer_create();
+
+	if (-1 == periodic_timer)
+		goto out;
+	if (-1 == gc_timer)
+		goto out;
+
+	gctimer_start();
+
+	return 0;
+ out:
+	return -1;
+}
+
+int mrpd_reclaim()
+{
+
+	/*
+	 * if the local applications have neither registered interest
+	 * by joining, and the remote node has quit advertising the attribute
+	 * and allowing it to go into the MT state, delete the attribute 
+	 */
+	int cur = mrpd_port_cur;
+	int backlog = 0;
+	int port;
+
+	for (port = 0; port < mrpd_port_num; port++) {
+		mrpd_port_select(port);
+		if (mrpd_apps & MRPD_APP_MMRP)
+			backlog += mmrp_reclaim();
+		if (mrpd_apps & MRPD_APP_MVRP)
+			backlog += mvrp_reclaim();
+		if (mrpd_apps & MRPD_APP_MSRP)
+			backlog += msrp_reclaim();
+	}
+	mrpd_port_select(cur);
+
+	/* candidates beyond the per tick budget are not left for 30s */
+	if (backlog)
+		mrpd_timer_start(gc_timer, MRPD_GC_BACKLOG_MS);
+	else
+		gctimer_start();
+
+	return 0;
+
+}
+
+static int mmrp_timer_event(int event)
+{
+	return mmrp_event(event, NULL);
+}
+
+static int mvrp_timer_event(int event)
+{
+	return mvrp_event(event, NULL);
+}
+
+static int msrp_timer_event(int event)
+{
+	return msrp_event(event, NULL);
+}
+
+/*
+ * Consume the expiration count of a timerfd. Returns 0 if the timer
+ * really expired; a timer re-armed earlier in the same batch of events
+ * has its readiness cleared and reads EAGAIN.
+ */
+static int mrpd_timer_ack(int timerfd)
+{
+	uint64_t expirations;
+
+	if (read(timerfd, &expirations, sizeof(expirations)) !=
+	    sizeof(expirations))
+		return -1;
+
+	return 0;
+}
+
+static void mrpd_rx_handler(struct mrpd_source *src)
+{
+	int i;
+
+#if LOG_POLL_EVENTS
+	mrpd_log_printf("== EVENT %s ==\n", src->name);
+#endif
+	/*
+	 * Drain what is queued on the socket, bounded so that a flood on
+	 * one socket cannot starve the timers; the loop is level-triggered
+	 * so any remainder is picked up on the next wakeup.
+	 */
+	mrpd_rx_would_block = 0;
+	for (i = 0; i < MRPD_RX_BATCH && !mrpd_rx_would_block; i++)
+		src->rx();
+}
+
+static void mrpd_app_timer_handler(struct mrpd_source *src)
+{
+	if (mrpd_timer_ack(src->fd))
+		return;
+
+	mrpd_log_timer_event(src->name, src->event);
+	src->timer_event(src->event);
+}
+
+static void mrpd_periodic_handler(struct mrpd_source *src)
+{
+	int port;
+
+	if (mrpd_timer_ack(src->fd))
+		return;
+
+#if LOG_POLL_EVENTS && LOG_TIMERS
+	mrpd_log_printf("== EVENT periodic_timer ==\n");
+#endif
+	mrp_periodictimer_fsm(&mrp_periodic_state, MRP_EVENT_PERIODIC);
+	for (port = 0; port < mrpd_port_num; port++) {
+		mrpd_port_select(port);
+		if (mmrp_enable && (mrpd_apps & MRPD_APP_MMRP)) {
+			mmrp_event(MRP_EVENT_PERIODIC, NULL);
+		}
+		if (mvrp_enable && (mrpd_apps & MRPD_APP_MVRP)) {
+			mvrp_event(MRP_EVENT_PERIODIC, NULL);
+		}
+		if (msrp_enable && (mrpd_apps & MRPD_APP_MSRP)) {
+			msrp_event(MRP_EVENT_PERIODIC, NULL);
+		}
+	}
+	if (NULL == mrpd_worker_self)
+		mrpd_snapshot_update();
+}
+
+static void mrpd_gc_handler(struct mrpd_source *src)
+{
+	if (mrpd_timer_ack(src->fd))
+		return;
+
+	mrpd_reclaim();
+}
+
+static int mrpd_add_source(int epoll_fd, int fd,
+			   void (*handler) (struct mrpd_source *),
+			   const char *name)
+{
+	struct mrpd_source *src;
+	struct epoll_event ev;
+
+	if (mrpd_source_count >= MRPD_MAX_SOURCES)
+		return -1;
+
+	src = &mrpd_sources[mrpd_source_count];
+	memset(src, 0, sizeof(*src));
+	src->fd = fd;
+	src->handler = handler;
+	src->name = name;
+	src->port = mrpd_port_cur;
+	src->hist = &mrpd_source_hist[mrpd_source_count];
+	memset(src->hist, 0, sizeof(*src->hist));
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = src;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+#if LOG_ERRORS
+		fprintf(stderr, "epoll_ctl %s: %s\r\n", name, strerror(errno));
+#endif
+		return -1;
+	}
+	mrpd_source_count++;
+
+	return 0;
+}
+
+static int mrpd_add_rx_source(int epoll_fd, int fd, int (*rx) (void),
+			      const char *name)
+{
+	if (mrpd_add_source(epoll_fd, fd, mrpd_rx_handler, name))
+		return -1;
+	mrpd_sources[mrpd_source_count - 1].rx = rx;
+
+	return 0;
+}
+
+static int mrpd_add_app_timer(int epoll_fd, int fd,
+			      int (*timer_event) (int), int event,
+			      const char *name)
+{
+	if (mrpd_add_source(epoll_fd, fd, mrpd_app_timer_handler, name))
+		return -1;
+	mrpd_sources[mrpd_source_count - 1].timer_event = timer_event;
+	mrpd_sources[mrpd_source_count - 1].event = event;
+
+	return 0;
+}
+
+static int mrpd_register_app(int epoll_fd, SOCKET sock,
+			     struct mrp_database *mrp_db, int (*rx) (void),
+			     int (*timer_event) (int), const char *name)
+{
+	if (mrpd_add_rx_source(epoll_fd, sock, rx, name))
+		return -1;
+	if (mrpd_add_app_timer(epoll_fd, mrp_db->lva_timer, timer_event,
+			       MRP_EVENT_LVATIMER, name))
+		return -1;
+	if (mrpd_add_app_timer(epoll_fd, mrp_db->lv_timer, timer_event,
+			       MRP_EVENT_LVTIMER, name))
+		return -1;
+	if (mrpd_add_app_timer(epoll_fd, mrp_db->join_timer, timer_event,
+			       MRP_EVENT_TX, name))
+		return -1;
+
+	return 0;
+}
+
+static void mrpd_flush_notifications(void)
+{
+	int port;
+
+	for (port = 0; port < mrpd_port_num; port++) {
+		mrpd_port_select(port);
+		if ((mrpd_apps & MRPD_APP_MMRP) && MMRP_db)
+			mrp_client_notify_flush(MMRP_db->mrp_db.clients);
+		if ((mrpd_apps & MRPD_APP_MVRP) && MVRP_db)
+			mrp_client_notify_flush(MVRP_db->mrp_db.clients);
+		if ((mrpd_apps & MRPD_APP_MSRP) && MSRP_db)
+			mrp_client_notify_flush(MSRP_db->mrp_db.clients);
+	}
+}
+
+/* sum of the state generations, changes when the snapshot would */
+static unsigned long mrpd_snapshot_state(void)
+{
+	unsigned long gen = 0;
+	int cur = mrpd_port_cur;
+	int port;
+
+	for (port = 0; port < mrpd_port_num; port++) {
+		mrpd_port_select(port);
+		if (mmrp_enable && MMRP_db)
+			gen += MRP_STAT_READ(MMRP_db->mrp_db.state_gen);
+		if (mvrp_enable && MVRP_db)
+			gen += MRP_STAT_READ(MVRP_db->mrp_db.state_gen);
+		if (msrp_enable && MSRP_db)
+			gen += MRP_STAT_READ(MSRP_db->mrp_db.state_gen);
+	}
+	mrpd_port_select(cur);
+	return gen;
+}
+
+/* add the records of the applications of this thread on every port */
+static int mrpd_snapshot_build(struct mrp_snapshot *snap)
+{
+	int cur = mrpd_port_cur;
+	int port;
+	int rc = 0;
+
+	for (port = 0; (port < mrpd_port_num) && !rc; port++) {
+		mrpd_port_select(port);
+		snap->port = port;
+		if (mmrp_enable && (mrpd_apps & MRPD_APP_MMRP))
+			rc = mmrp_snapshot(snap);
+		if (!rc && mvrp_enable && (mrpd_apps & MRPD_APP_MVRP))
+			rc = mvrp_snapshot(snap);
+		if (!rc && msrp_enable && (mrpd_apps & MRPD_APP_MSRP))
+			rc = msrp_snapshot(snap);
+	}
+	mrpd_port_select(cur);
+	return rc;
+}
+
+/*
+ * Write the records to snapshot_path. They go to a temporary file
+ * through a shared mapping, which is renamed over the old snapshot once
+ * synced, so a crash leaves either the old or the new snapshot behind.
+ */
+static int mrpd_snapshot_write(struct mrp_snapshot *snap)
+{
+	struct mrp_snapshot_hdr *hdr;
+	struct timespec ts;
+	char tmp_path[PATH_MAX];
+	size_t size;
+	void *map;
+	int rc = -1;
+	int fd;
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", snapshot_path);
+	fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0)
+		goto out;
+
+	size = sizeof(*hdr) + snap->count * sizeof(*snap->recs);
+	if (ftruncate(fd, size) < 0)
+		goto out_close;
+
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (MAP_FAILED == map)
+		goto out_close;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	hdr = (struct mrp_snapshot_hdr *)map;
+	hdr->magic = MRP_SNAPSHOT_MAGIC;
+	hdr->version = MRP_SNAPSHOT_VERSION;
+	hdr->rec_size = sizeof(*snap->recs);
+	hdr->count = snap->count;
+	hdr->ports = mrpd_port_num;
+	hdr->written_ms = (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+	if (snap->count)
+		memcpy(hdr + 1, snap->recs, snap->count * sizeof(*snap->recs));
+
+	if (0 == msync(map, size, MS_SYNC))
+		rc = 0;
+	munmap(map, size);
+ out_close:
+	close(fd);
+	if (0 == rc)
+		rc = rename(tmp_path, snapshot_path);
+	if (rc)
+		unlink(tmp_path);
+ out:
+#if LOG_ERRORS
+	if (rc)
+		fprintf(stderr, "snapshot %s not written\n", snapshot_path);
+#endif
+	return rc;
+}
+
+/* the applicant and registrar states and the clients of every port */
+static int mrpd_snapshot_save(void)
+{
+	struct mrp_snapshot snap;
+	int rc;
+
+	memset(&snap, 0, sizeof(snap));
+	rc = mrpd_snapshot_build(&snap);
+	if (0 == rc)
+		rc = mrpd_snapshot_write(&snap);
+	free(snap.recs);
+	return rc;
+}
+
+/* handed in by an application thread that could not allocate its records */
+static struct mrp_snapshot mrpd_snapshot_failed;
+
+/* MRPD_WORK_SNAPSHOT: hand the records of this thread to the main thread */
+static void mrpd_worker_snapshot(struct mrpd_worker *w)
+{
+	struct mrp_snapshot *snap;
+	uint64_t one = 1;
+
+	w->snap_rc = -1;
+	snap = (struct mrp_snapshot *)malloc(sizeof(*snap));
+	if (NULL == snap) {
+		snap = &mrpd_snapshot_failed;
+	} else {
+		memset(snap, 0, sizeof(*snap));
+		w->snap_rc = mrpd_snapshot_build(snap);
+	}
+	__atomic_store_n(&w->snap, snap, __ATOMIC_RELEASE);
+	if (write(mrpd_snapshot_doorbell, &one, sizeof(one)) < 0)
+		w->snap_rc = -1;
+}
+
+/*
+ * The snapshot doorbell: once every application thread has handed in
+ * its records, they are written as one snapshot.
+ */
+static void mrpd_snapshot_collect_handler(struct mrpd_source *src)
+{
+	struct mrp_snapshot snap;
+	struct mrp_snapshot *part;
+	struct mrp_snapshot_rec *recs;
+	uint64_t count;
+	int rc = 0;
+	int i;
+
+	if (read(src->fd, &count, sizeof(count)) != sizeof(count))
+		return;
+
+	for (i = 0; i < mrpd_worker_count; i++) {
+		part = __atomic_load_n(&mrpd_workers[i]->snap, __ATOMIC_ACQUIRE);
+		if (NULL == part)
+			return;
+	}
+
+	memset(&snap, 0, sizeof(snap));
+	for (i = 0; i < mrpd_worker_count; i++) {
+		part = mrpd_workers[i]->snap;
+		mrpd_workers[i]->snap = NULL;
+		if (mrpd_workers[i]->snap_rc)
+			rc = -1;
+		if (!rc && part->count) {
+			recs = (struct mrp_snapshot_rec *)
+			    realloc(snap.recs, (snap.count + part->count) *
+				    sizeof(*recs));
+			if (NULL == recs) {
+				rc = -1;
+			} else {
+				memcpy(&recs[snap.count], part->recs,
+				       part->count * sizeof(*recs));
+				snap.recs = recs;
+				snap.count += part->count;
+			}
+		}
+		if (&mrpd_snapshot_failed != part) {
+			free(part->recs);
+			free(part);
+		}
+	}
+
+	if (0 == rc)
+		rc = mrpd_snapshot_write(&snap);
+	free(snap.recs);
+
+	mrpd_snapshot_pending = 0;
+	if (0 == rc)
+		mrpd_snapshot_gen = mrpd_snapshot_pending_gen;
+	else
+		mrpd_snapshot_dirty = 1;
+}
+
+static void mrpd_snapshot_update(void)
+{
+	unsigned long now_ms;
+	unsigned long gen;
+	int i;
 
-	rc = bind(lsock, (struct sockaddr *)&addr, sizeof(addr));
-	if (0 != rc) {
-#if LOG_ERRORS
-		fprintf(stderr, "%s - Error on bind %s", __FUNCTION__, strerror(errno));
-#endif
-		close(lsock);
-		return -1;
+	if ((NULL == snapshot_path) || mrpd_snapshot_pending)
+		return;
+
+	/* read while the application threads run, a hint only */
+	gen = mrpd_snapshot_state();
+	if (!mrpd_snapshot_dirty && (gen == mrpd_snapshot_gen))
+		return;
+
+	now_ms = mrpd_clock_ms();
+	if (now_ms - mrpd_snapshot_ms < MRPD_SNAPSHOT_INTERVAL_MS)
+		return;
+	mrpd_snapshot_ms = now_ms;
+
+	if (mrpd_worker_count) {
+		mrpd_snapshot_dirty = 0;
+		mrpd_snapshot_pending = 1;
+		mrpd_snapshot_pending_gen = gen;
+		for (i = 0; i < mrpd_worker_count; i++)
+			mrpd_worker_post(mrpd_workers[i], MRPD_WORK_SNAPSHOT, 0,
+					 NULL, NULL, 0);
+		return;
 	}
 
-	rc = setsockopt(lsock, SOL_SOCKET, SO_BINDTODEVICE, interface,
-			strlen(interface));
-	if (0 != rc) {
-		close(lsock);
-		return -1;
+	if (0 == mrpd_snapshot_save()) {
+		mrpd_snapshot_dirty = 0;
+		mrpd_snapshot_gen = gen;
 	}
+}
 
-	multicast_req.mr_ifindex = if_request.ifr_ifindex;
-	multicast_req.mr_type = PACKET_MR_MULTICAST;
-	multicast_req.mr_alen = 6;
-	memcpy(multicast_req.mr_address, multicast_addr, 6);
+/*
+ * Resume the declarations and registrations of the snapshot a previous
+ * mrpd left in snapshot_path. Records of ports beyond the -i options
+ * given now are dropped; a missing or foreign file is no error.
+ */
+static int mrpd_snapshot_restore(void)
+{
+	const struct mrp_snapshot_hdr *hdr;
+	const struct mrp_snapshot_rec *rec;
+	struct timespec ts;
+	struct stat st;
+	uint64_t now_ms;
+	unsigned int restored = 0;
+	unsigned int i;
+	void *map;
+	int fresh;
+	int rc = 0;
+	int fd;
 
-	rc = setsockopt(lsock, SOL_PACKET, PACKET_ADD_MEMBERSHIP,
-			&multicast_req, sizeof(multicast_req));
-	if (0 != rc) {
-		close(lsock);
-		return -1;
+	fd = open(snapshot_path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+
+	if ((fstat(fd, &st) < 0) || (st.st_size < (off_t)sizeof(*hdr)))
+		goto out_close;
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (MAP_FAILED == map)
+		goto out_close;
+
+	hdr = (const struct mrp_snapshot_hdr *)map;
+	if ((MRP_SNAPSHOT_MAGIC != hdr->magic) ||
+	    (MRP_SNAPSHOT_VERSION != hdr->version) ||
+	    (sizeof(*rec) != hdr->rec_size) ||
+	    ((off_t)(sizeof(*hdr) + (uint64_t)hdr->count * sizeof(*rec)) >
+	     st.st_size)) {
+		printf("snapshot %s ignored, not written by this mrpd\n",
+		       snapshot_path);
+		goto out_unmap;
 	}
 
-	*sock = lsock;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	now_ms = (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+	fresh = (now_ms >= hdr->written_ms) &&
+	    (now_ms - hdr->written_ms < MRP_SNAPSHOT_MAX_AGE);
+
+	rec = (const struct mrp_snapshot_rec *)(hdr + 1);
+	for (i = 0; i < hdr->count; i++, rec++) {
+		if (rec->port >= mrpd_port_num)
+			continue;
+		mrpd_port_select(rec->port);
+		switch (rec->app) {
+		case 'M':
+			if (mmrp_enable)
+				rc = mmrp_restore(rec, fresh);
+			break;
+		case 'V':
+			if (mvrp_enable)
+				rc = mvrp_restore(rec, fresh);
+			break;
+		case 'S':
+			if (msrp_enable)
+				rc = msrp_restore(rec, fresh);
+			break;
+		default:
+			continue;
+		}
+		if (rc)
+			break;
+		restored++;
+	}
+	mrpd_port_select(0);
+
+	printf("snapshot %s: %u of %u records restored (%s)\n",
+	       snapshot_path, restored, hdr->count,
+	       fresh ? "resumed" : "stale, declarations only");
+	mrpd_snapshot_gen = mrpd_snapshot_state();
+ out_unmap:
+	munmap(map, st.st_size);
+ out_close:
+	close(fd);
+	return rc;
+}
 
-	return 0;
+static void mrpd_app_close(struct mrp_database *mrp_db, SOCKET sock)
+{
+	mrpd_timer_close(mrp_db->join_timer);
+	mrpd_timer_close(mrp_db->lv_timer);
+	mrpd_timer_close(mrp_db->lva_timer);
+	if (INVALID_SOCKET != sock)
+		mrpd_close_socket(sock);
 }
 
-int mrpd_close_socket(SOCKET sock)
+/*
+ * Undo a failed restore: the applications of every port are torn down,
+ * with their clients, and set up again empty.
+ */
+static int mrpd_apps_restart(void)
 {
-	return close(sock);
+	struct sockaddr_in client;
+	int port;
+	int rc = 0;
+
+	for (port = 0; (port < mrpd_port_num) && !rc; port++) {
+		mrpd_port_select(port);
+		if (MMRP_db) {
+			while (MMRP_db->mrp_db.clients) {
+				client = MMRP_db->mrp_db.clients->client;
+				mmrp_bye(&client);
+			}
+			mrpd_app_close(&(MMRP_db->mrp_db), mmrp_socket);
+			mmrp_reset();
+		}
+		if (MVRP_db) {
+			while (MVRP_db->mrp_db.clients) {
+				client = MVRP_db->mrp_db.clients->client;
+				mvrp_bye(&client);
+			}
+			mrpd_app_close(&(MVRP_db->mrp_db), mvrp_socket);
+			mvrp_reset();
+		}
+		if (MSRP_db) {
+			while (MSRP_db->mrp_db.clients) {
+				client = MSRP_db->mrp_db.clients->client;
+				msrp_bye(&client);
+			}
+			mrpd_app_close(&(MSRP_db->mrp_db), msrp_socket);
+			msrp_reset();
+		}
+		rc = mmrp_init(mmrp_enable);
+		if (!rc)
+			rc = mvrp_init(mvrp_enable);
+		if (!rc)
+			rc = msrp_init(msrp_enable);
+	}
+	mrpd_port_select(0);
+	return rc;
 }
 
-int mrpd_init_timers(struct mrp_database *mrp_db)
+/*
+ * A snapshot that could not be restored is moved aside, for a look at
+ * it later, and mrpd starts as if there was none.
+ */
+static int mrpd_snapshot_discard(void)
 {
-	mrp_db->join_timer = mrpd_timer_create();
-	mrp_db->lv_timer = mrpd_timer_create();
-	mrp_db->lva_timer = mrpd_timer_create();
-	mrp_db->join_timer_running = 0;
-	mrp_db->lv_timer_running = 0;
-	mrp_db->lva_timer_running = 0;
+	char bad_path[PATH_MAX];
 
-	if (-1 == mrp_db->join_timer)
-		goto out;
-	if (-1 == mrp_db->lv_timer)
-		goto out;
-	if (-1 == mrp_db->lva_timer)
-		goto out;
-	return 0;
- out:
-	mrpd_timer_close(mrp_db->join_timer);
-	mrpd_timer_close(mrp_db->lv_timer);
-	mrpd_timer_close(mrp_db->lva_timer);
+	snprintf(bad_path, sizeof(bad_path), "%s.bad", snapshot_path);
+	if (rename(snapshot_path, bad_path) < 0)
+		printf("snapshot %s not moved aside: %s\n", snapshot_path,
+		       strerror(errno));
+	else
+		printf("snapshot %s moved to %s, starting empty\n",
+		       snapshot_path, bad_path);
 
-	return -1;
+	if (mrpd_apps_restart())
+		return -1;
+
+	mrpd_snapshot_gen = mrpd_snapshot_state();
+	mrpd_snapshot_dirty = 1;
+	return 0;
 }
 
-int init_timers(void)
+static void mrpd_stop_handler(int sig)
 {
-	/*
-	 * primarily whether to schedule the periodic timer as the
-	 * rest are self-scheduling as a side-effect of state transitions
-	 * of the various attributes
-	 */
+	(void)sig;
+	mrpd_stop = 1;
+}
 
-	periodic_timer = mrpd_timer_create();
-	gc_timer = mrpd_timer_create();
+/*
+ * Wait for and dispatch one batch of events. Returns -1 once the loop
+ * should end.
+ */
+static int mrpd_dispatch(int epoll_fd)
+{
+	struct epoll_event events[MRPD_MAX_EVENTS];
+	struct mrpd_source *src;
+	unsigned long start_us;
+	int rc;
+	int i;
 
-	if (-1 == periodic_timer)
-		goto out;
-	if (-1 == gc_timer)
-		goto out;
+	rc = epoll_wait(epoll_fd, events, MRPD_MAX_EVENTS, -1);
 
-	gctimer_start();
+	if (-1 == rc) {
+		if (mrpd_stop)
+			return -1;
+		if (EINTR == errno)
+			return 0;
+#if LOG_ERRORS
+		fprintf(stderr, "Error on epoll_wait %s\r\n", strerror(errno));
+#endif
+		return -1;	/* exit on error */
+	}
 
+	for (i = 0; i < rc; i++) {
+		src = events[i].data.ptr;
+		src->revents = events[i].events;
+		mrpd_port_select(src->port);
+		start_us = mrpd_clock_us();
+		src->handler(src);
+		mrp_histogram_add(src->hist, mrpd_clock_us() - start_us);
+	}
+	/* binary notifications are batched per wakeup */
+	mrpd_flush_notifications();
+	if (NULL == mrpd_worker_self)
+		mrpd_unix_reap();
+#if LOG_POLL_EVENTS
+	mrpd_log_printf("== EVENT DONE ==\n");
+#endif
 	return 0;
- out:
-	return -1;
 }
 
-int mrp_register_timers(struct mrp_database *mrp_db, fd_set * fds)
+static void mrpd_worker_run(struct mrpd_worker *w, struct mrpd_work *work)
 {
-	int max_fd;
+	switch (work->kind) {
+	case MRPD_WORK_CMD:
+		mrpd_port_select(work->port);
+		if (mrpd_app_recv_cmd(work->data, work->len, &work->client) < 0)
+			MRPD_COUNT(mrpd_ctl_errors);
+		break;
+	case MRPD_WORK_BYE:
+		mrpd_bye(&work->client);
+		break;
+	case MRPD_WORK_SNAPSHOT:
+		mrpd_worker_snapshot(w);
+		break;
+	case MRPD_WORK_STOP:
+		w->stop = 1;
+		break;
+	default:
+		break;
+	}
+}
 
-	FD_SET(mrp_db->join_timer, fds);
-	FD_SET(mrp_db->lv_timer, fds);
-	FD_SET(mrp_db->lva_timer, fds);
+static void mrpd_worker_queue_handler(struct mrpd_source *src)
+{
+	struct mrpd_worker *w = mrpd_worker_self;
+	struct mrpd_work *work;
+	uint64_t count;
 
-	max_fd = mrp_db->join_timer;
-	if (mrp_db->lv_timer > max_fd)
-		max_fd = mrp_db->lv_timer;
-	if (mrp_db->lva_timer > max_fd)
-		max_fd = mrp_db->lva_timer;
+	if (read(src->fd, &count, sizeof(count)) != sizeof(count))
+		return;
 
-	return max_fd;
+	while (NULL != (work = mrpd_work_peek(&w->ring))) {
+		mrpd_worker_run(w, work);
+		mrpd_work_done(&w->ring);
+	}
 }
 
-int mrpd_reclaim()
+static void *mrpd_worker_main(void *arg)
 {
+	struct mrpd_worker *w = (struct mrpd_worker *)arg;
+	int rc;
 
-	/*
-	 * if the local applications have neither registered interest
-	 * by joining, and the remote node has quit advertising the attribute
-	 * and allowing it to go into the MT state, delete the attribute 
-	 */
-
-	mmrp_reclaim();
-	mvrp_reclaim();
-	msrp_reclaim();
+	mrpd_worker_self = w;
+	mrpd_apps = w->app;
+	periodic_timer = w->periodic_timer;
+	gc_timer = w->gc_timer;
+	mrp_periodic_state.state = -1;
+	mrpd_port_cur = -1;
+	mrpd_port_select(0);
 
-	gctimer_start();
+	rc = mrp_periodictimer_fsm(&mrp_periodic_state, MRP_EVENT_BEGIN);
+	if (0 == rc)
+		rc = gctimer_start();
 
-	return 0;
+	while ((0 == rc) && !w->stop)
+		rc = mrpd_dispatch(w->epoll_fd);
 
+	return NULL;
 }
 
-void process_events(void)
+static const char *const mrpd_worker_names[][3] = {
+	{"MMRP/queue", "MMRP/periodic", "MMRP/gc"},
+	{"MVRP/queue", "MVRP/periodic", "MVRP/gc"},
+	{"MSRP/queue", "MSRP/periodic", "MSRP/gc"},
+};
+
+/* the epoll set of an application thread, with its sources of all ports */
+static struct mrpd_worker *mrpd_worker_create(int app,
+					       const char *const *names)
 {
+	struct mrpd_worker *w;
+	int port;
+	int rc = 0;
 
-	fd_set fds, sel_fds;
-	int rc;
-	int max_fd;
+	w = (struct mrpd_worker *)malloc(sizeof(*w));
+	if (NULL == w)
+		return NULL;
+	memset(w, 0, sizeof(*w));
+	w->app = app;
+	w->names = names;
+	w->doorbell = -1;
+	w->periodic_timer = -1;
+	w->gc_timer = -1;
+
+	w->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (w->epoll_fd < 0)
+		goto out_free;
+	w->doorbell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	w->periodic_timer = mrpd_timer_create();
+	w->gc_timer = mrpd_timer_create();
+	if ((w->doorbell < 0) || (-1 == w->periodic_timer) ||
+	    (-1 == w->gc_timer))
+		goto out_close;
+
+	for (port = 0; (port < mrpd_port_num) && !rc; port++) {
+		mrpd_port_select(port);
+		switch (app) {
+		case MRPD_APP_MMRP:
+			rc = mrpd_register_app(w->epoll_fd, mmrp_socket,
+					       &(MMRP_db->mrp_db),
+					       mmrp_recv_msg, mmrp_timer_event,
+					       "MMRP");
+			break;
+		case MRPD_APP_MVRP:
+			rc = mrpd_register_app(w->epoll_fd, mvrp_socket,
+					       &(MVRP_db->mrp_db),
+					       mvrp_recv_msg, mvrp_timer_event,
+					       "MVRP");
+			break;
+		default:
+			rc = mrpd_register_app(w->epoll_fd, msrp_socket,
+					       &(MSRP_db->mrp_db),
+					       msrp_recv_msg, msrp_timer_event,
+					       "MSRP");
+			break;
+		}
+	}
+	mrpd_port_select(0);
+	if (rc)
+		goto out_close;
+
+	if (mrpd_add_source(w->epoll_fd, w->doorbell,
+			    mrpd_worker_queue_handler, w->names[0]) ||
+	    mrpd_add_source(w->epoll_fd, w->periodic_timer,
+			    mrpd_periodic_handler, w->names[1]) ||
+	    mrpd_add_source(w->epoll_fd, w->gc_timer, mrpd_gc_handler,
+			    w->names[2]))
+		goto out_close;
+
+	return w;
+ out_close:
+	if (w->doorbell >= 0)
+		close(w->doorbell);
+	mrpd_timer_close(w->periodic_timer);
+	mrpd_timer_close(w->gc_timer);
+	close(w->epoll_fd);
+ out_free:
+	free(w);
+	return NULL;
+}
 
-	/* wait for events, demux the received packets, process packets */
+static void mrpd_worker_destroy(struct mrpd_worker *w)
+{
+	if (w->snap && (&mrpd_snapshot_failed != w->snap)) {
+		free(w->snap->recs);
+		free(w->snap);
+	}
+	close(w->doorbell);
+	mrpd_timer_close(w->periodic_timer);
+	mrpd_timer_close(w->gc_timer);
+	close(w->epoll_fd);
+	free(w);
+}
 
-	FD_ZERO(&fds);
-	FD_SET(control_socket, &fds);
+/*
+ * -t: move each enabled application to a thread of its own. The main
+ * thread keeps the control channels and, with -c, collects the snapshot.
+ */
+static int mrpd_workers_start(int epoll_fd)
+{
+	static const int apps[] = { MRPD_APP_MMRP, MRPD_APP_MVRP,
+		MRPD_APP_MSRP
+	};
+	const int enabled[] = { mmrp_enable, mvrp_enable, msrp_enable };
+	sigset_t set, old;
+	struct mrpd_worker *w;
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		if (!enabled[i])
+			continue;
+		w = mrpd_worker_create(apps[i], mrpd_worker_names[i]);
+		if (NULL == w)
+			return -1;
+		mrpd_workers[mrpd_worker_count++] = w;
+	}
 
-	max_fd = control_socket;
+	if (snapshot_path) {
+		mrpd_snapshot_doorbell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if ((mrpd_snapshot_doorbell < 0) ||
+		    mrpd_add_source(epoll_fd, mrpd_snapshot_doorbell,
+				    mrpd_snapshot_collect_handler,
+				    "snapshot"))
+			return -1;
+	}
 
-	if (mmrp_enable) {
-		FD_SET(mmrp_socket, &fds);
-		if (mmrp_socket > max_fd)
-			max_fd = mmrp_socket;
+	/* SIGTERM and SIGINT are left to the main thread */
+	sigemptyset(&set);
+	sigaddset(&set, SIGTERM);
+	sigaddset(&set, SIGINT);
+	pthread_sigmask(SIG_BLOCK, &set, &old);
+	for (i = 0; i < mrpd_worker_count; i++) {
+		w = mrpd_workers[i];
+		if (pthread_create(&w->thread, NULL, mrpd_worker_main, w))
+			break;
+		w->running = 1;
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
 
-		if (NULL == MMRP_db)
-			return;
+	/* from here on the main thread leaves the applications alone */
+	mrpd_apps = 0;
+	return (i < mrpd_worker_count) ? -1 : 0;
+}
 
-		rc = mrp_register_timers(&(MMRP_db->mrp_db), &fds);
-		if (rc > max_fd)
-			max_fd = rc;
+static void mrpd_workers_stop(void)
+{
+	struct mrpd_worker *w;
+	int i;
+
+	for (i = 0; i < mrpd_worker_count; i++) {
+		w = mrpd_workers[i];
+		if (w->running) {
+			mrpd_worker_post(w, MRPD_WORK_STOP, 0, NULL, NULL, 0);
+			pthread_join(w->thread, NULL);
+		}
+		mrpd_worker_destroy(w);
+		mrpd_workers[i] = NULL;
 	}
-	if (mvrp_enable) {
-		FD_SET(mvrp_socket, &fds);
-		if (mvrp_socket > max_fd)
-			max_fd = mvrp_socket;
+	mrpd_worker_count = 0;
+	if (mrpd_snapshot_doorbell >= 0)
+		close(mrpd_snapshot_doorbell);
+	mrpd_snapshot_doorbell = -1;
+	mrpd_snapshot_pending = 0;
+	mrpd_apps = MRPD_APP_ALL;
+}
 
-		if (NULL == MVRP_db)
-			return;
-		rc = mrp_register_timers(&(MVRP_db->mrp_db), &fds);
-		if (rc > max_fd)
-			max_fd = rc;
+void process_events(void)
+{
+	int epoll_fd;
+	int port;
+	int rc;
+
+	/* wait for events, demux the received packets, process packets */
 
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0) {
+#if LOG_ERRORS
+		fprintf(stderr, "Error on epoll_create %s\r\n", strerror(errno));
+#endif
+		return;
 	}
-	if (msrp_enable) {
-		FD_SET(msrp_socket, &fds);
-		if (msrp_socket > max_fd)
-			max_fd = msrp_socket;
+	mrpd_epoll_fd = epoll_fd;
+	mrpd_source_count = 0;
+	/* the application threads select ports from the table alone */
+	mrpd_port_save();
+	mrpd_ports_sealed = 1;
+
+	if (mrpd_add_rx_source(epoll_fd, control_socket, recv_ctl_msg,
+			       "recv_ctl_msg"))
+		goto out;
 
-		if (NULL == MSRP_db)
-			return;
-		rc = mrp_register_timers(&(MSRP_db->mrp_db), &fds);
-		if (rc > max_fd)
-			max_fd = rc;
+	if ((INVALID_SOCKET != unix_socket) &&
+	    mrpd_add_source(epoll_fd, unix_socket, mrpd_unix_accept_handler,
+			    "unix_listen"))
+		goto out;
+
+	if (INVALID_SOCKET != unix_socket) {
+		mrpd_unix_shm_doorbell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if ((mrpd_unix_shm_doorbell < 0) ||
+		    mrpd_add_source(epoll_fd, mrpd_unix_shm_doorbell,
+				    mrpd_unix_shm_more_handler, "unix_shm"))
+			goto out;
+	}
 
+	for (port = 0; port < mrpd_port_num; port++) {
+		mrpd_port_select(port);
+		if (mmrp_enable && (NULL == MMRP_db))
+			goto out;
+		if (mvrp_enable && (NULL == MVRP_db))
+			goto out;
+		if (msrp_enable && (NULL == MSRP_db))
+			goto out;
+		if (mrpd_threaded)
+			continue;
+		if (mmrp_enable &&
+		    mrpd_register_app(epoll_fd, mmrp_socket,
+				      &(MMRP_db->mrp_db), mmrp_recv_msg,
+				      mmrp_timer_event, "MMRP"))
+			goto out;
+		if (mvrp_enable &&
+		    mrpd_register_app(epoll_fd, mvrp_socket,
+				      &(MVRP_db->mrp_db), mvrp_recv_msg,
+				      mvrp_timer_event, "MVRP"))
+			goto out;
+		if (msrp_enable &&
+		    mrpd_register_app(epoll_fd, msrp_socket,
+				      &(MSRP_db->mrp_db), msrp_recv_msg,
+				      msrp_timer_event, "MSRP"))
+			goto out;
 	}
+	mrpd_port_select(0);
 
-	FD_SET(periodic_timer, &fds);
-	if (periodic_timer > max_fd)
-		max_fd = periodic_timer;
+	/* with -t it only paces the snapshot on the main thread */
+	if (mrpd_add_source(epoll_fd, periodic_timer, mrpd_periodic_handler,
+			    "periodic_timer"))
+		goto out;
 
 	rc = mrp_periodictimer_fsm(&mrp_periodic_state, MRP_EVENT_BEGIN);
 	if (rc)
-		return;
+		goto out;
 
-	FD_SET(gc_timer, &fds);
-	if (gc_timer > max_fd)
-		max_fd = gc_timer;
+	if (!mrpd_threaded &&
+	    mrpd_add_source(epoll_fd, gc_timer, mrpd_gc_handler, "gc_timer"))
+		goto out;
 
-	do {
+	if (mrpd_threaded && mrpd_workers_start(epoll_fd))
+		goto out;
 
-		sel_fds = fds;
-		rc = select(max_fd + 1, &sel_fds, NULL, NULL, NULL);
+	do {
+		rc = mrpd_dispatch(epoll_fd);
+	} while (!rc && !mrpd_stop);
 
-		if (-1 == rc) {
-#if LOG_ERRORS
-			fprintf(stderr, "Error on select %s\r\n", strerror(errno));
-#endif
-			return;	/* exit on error */
-		}
-		else {
-			if (FD_ISSET(control_socket, &sel_fds)) {
-#if LOG_POLL_EVENTS
-				mrpd_log_printf("== EVENT recv_ctl_msg ==\n");
-#endif
-				recv_ctl_msg();
-			}
-			if (mmrp_enable) {
-				if FD_ISSET
-					(mmrp_socket, &sel_fds) {
-#if LOG_POLL_EVENTS
-					mrpd_log_printf("== EVENT mmrp_recv_msg ==\n");
-#endif
-					mmrp_recv_msg();
-					}
-				if FD_ISSET
-					(MMRP_db->mrp_db.lva_timer, &sel_fds) {
-					mrpd_log_timer_event("MMRP",
-							     MRP_EVENT_LVATIMER);
-					mmrp_event(MRP_EVENT_LVATIMER, NULL);
-					}
-				if FD_ISSET
-					(MMRP_db->mrp_db.lv_timer, &sel_fds) {
-					mrpd_log_timer_event("MMRP",
-							     MRP_EVENT_LVTIMER);
-					mmrp_event(MRP_EVENT_LVTIMER, NULL);
-					}
-				if FD_ISSET
-					(MMRP_db->mrp_db.join_timer, &sel_fds) {
-					mrpd_log_timer_event("MMRP",
-							     MRP_EVENT_TX);
-					mmrp_event(MRP_EVENT_TX, NULL);
-					}
-			}
-			if (mvrp_enable) {
-				if FD_ISSET
-					(mvrp_socket, &sel_fds) {
-#if LOG_POLL_EVENTS
-					mrpd_log_printf("== EVENT mvrp_recv_msg ==\n");
-#endif
-					mvrp_recv_msg();
-					}
-				if FD_ISSET
-					(MVRP_db->mrp_db.lva_timer, &sel_fds) {
-					mrpd_log_timer_event("MVRP",
-							     MRP_EVENT_LVATIMER);
-					mvrp_event(MRP_EVENT_LVATIMER, NULL);
-					}
-				if FD_ISSET
-					(MVRP_db->mrp_db.lv_timer, &sel_fds) {
-					mrpd_log_timer_event("MVRP",
-							     MRP_EVENT_LVTIMER);
-					mvrp_event(MRP_EVENT_LVTIMER, NULL);
-					}
-				if FD_ISSET
-					(MVRP_db->mrp_db.join_timer, &sel_fds) {
-					mrpd_log_timer_event("MVRP",
-							     MRP_EVENT_TX);
-					mvrp_event(MRP_EVENT_TX, NULL);
-					}
-			}
-			if (msrp_enable) {
-				if FD_ISSET
-					(msrp_socket, &sel_fds) {
-#if LOG_POLL_EVENTS
-					mrpd_log_printf("== EVENT msrp_recv_msg ==\n");
-#endif
-					msrp_recv_msg();
-				}
-				if FD_ISSET
-					(MSRP_db->mrp_db.lva_timer, &sel_fds) {
-					mrpd_log_timer_event("MSRP",
-							     MRP_EVENT_LVATIMER);
-					msrp_event(MRP_EVENT_LVATIMER, NULL);
-					}
-				if FD_ISSET
-					(MSRP_db->mrp_db.lv_timer, &sel_fds) {
-					mrpd_log_timer_event("MSRP",
-							     MRP_EVENT_LVTIMER);
-					msrp_event(MRP_EVENT_LVTIMER, NULL);
-					}
-				if FD_ISSET
-					(MSRP_db->mrp_db.join_timer, &sel_fds) {
-					mrpd_log_timer_event("MSRP",
-							     MRP_EVENT_TX);
-					msrp_event(MRP_EVENT_TX, NULL);
-					}
-			}
-			if (FD_ISSET(periodic_timer, &sel_fds)) {
-#if LOG_POLL_EVENTS && LOG_TIMERS
-				mrpd_log_printf("== EVENT periodic_timer ==\n");
-#endif
-				
-				mrp_periodictimer_fsm(&mrp_periodic_state, MRP_EVENT_PERIODIC);
-				if (mmrp_enable) {
-					mmrp_event(MRP_EVENT_PERIODIC, NULL);
-				}
-				if (mvrp_enable) {
-					mvrp_event(MRP_EVENT_PERIODIC, NULL);
-				}
-				if (msrp_enable) {
-					msrp_event(MRP_EVENT_PERIODIC, NULL);
-				}
-			}
-			if (FD_ISSET(gc_timer, &sel_fds)) {
-				mrpd_reclaim();
-			}
-#if LOG_POLL_EVENTS
-		mrpd_log_printf("== EVENT DONE ==\n");
-#endif
-		}
-	} while (1);
+ out:
+	mrpd_workers_stop();
+	if (mrpd_unix_shm_doorbell >= 0)
+		close(mrpd_unix_shm_doorbell);
+	mrpd_unix_shm_doorbell = -1;
+	close(epoll_fd);
 }
 
 void usage(void)
 {
 	fprintf(stderr,
 		"\n"
-		"usage: mrpd [-hdlmvsp] -i interface-name"
+		"usage: mrpd [-hdlmvspt] [-u unix-socket-path] [-L latency-ns]\n"
+		"            [-c snapshot-path] [-r priority] [-a cpu]\n"
+		"            -i interface-name [-i interface-name ...]"
 		"\n"
 		"options:\n"
 		"    -h  show this message\n"
@@ -794,15 +2665,31 @@ void usage(void)
 		"    -m  enable MMRP Registrar and Participant\n"
 		"    -v  enable MVRP Registrar and Participant\n"
 		"    -s  enable MSRP Registrar and Participant\n"
-		"    -i  specify interface to monitor\n"
+		"    -i  specify interface to monitor; given more than once, the\n"
+		"        interfaces are bridge ports and MSRP/MVRP declarations\n"
+		"        are propagated between them\n"
+		"    -L  latency (ns) a bridge port adds to forwarded talker\n"
+		"        declarations, for the -i options that follow\n"
+		"    -u  also accept clients on a Unix socket (e.g. "
+		MRPD_UNIX_PATH_DEFAULT ")\n"
+		"    -c  checkpoint the declarations, registrations and UDP\n"
+		"        clients to snapshot-path and resume from it on start\n"
+		"    -t  run each enabled application on a thread of its own\n"
+		"    -r  run at this SCHED_FIFO priority with memory locked\n"
+		"    -a  pin to this CPU with memory locked\n"
 		"\n" "%s" "\n", version_str);
 	exit(1);
 }
 
 int main(int argc, char *argv[])
 {
+	struct timeval tv;
+	uint32_t latency = 0;
+	int port;
 	int c;
 	int rc = 0;
+	struct rt_config rt = RT_CONFIG_INIT;
+	int rt_enable = 0;
 
 	daemonize = 0;
 	mmrp_enable = 0;
@@ -815,6 +2702,8 @@ int main(int argc, char *argv[])
 	registration = MRP_REGISTRAR_CTL_NORMAL;	/* default */
 	participant = MRP_APPLICANT_CTL_NORMAL;	/* default */
 	control_socket = INVALID_SOCKET;
+	unix_socket = INVALID_SOCKET;
+	unix_path = NULL;
 	mmrp_socket = INVALID_SOCKET;
 	mvrp_socket = INVALID_SOCKET;
 	msrp_socket = INVALID_SOCKET;
@@ -823,7 +2712,7 @@ int main(int argc, char *argv[])
 	gc_timer = -1;
 
 	for (;;) {
-		c = getopt(argc, argv, "hdlmvspi:");
+		c = getopt(argc, argv, "hdlmvspi:u:L:c:tr:a:");
 
 		if (c < 0)
 			break;
@@ -845,12 +2734,31 @@ int main(int argc, char *argv[])
 			daemonize = 1;
 			break;
 		case 'i':
-			if (interface) {
-				printf
-				    ("only one interface per daemon is supported\n");
+			if (mrpd_port_add(strdup(optarg), latency)) {
+				printf("at most %d interfaces are supported\n",
+				       MRPD_MAX_PORTS);
 				usage();
 			}
-			interface = strdup(optarg);
+			break;
+		case 'L':
+			latency = strtoul(optarg, NULL, 0);
+			break;
+		case 'u':
+			unix_path = strdup(optarg);
+			break;
+		case 'c':
+			snapshot_path = strdup(optarg);
+			break;
+		case 't':
+			mrpd_threaded = 1;
+			break;
+		case 'r':
+			rt.priority = strtol(optarg, NULL, 0);
+			rt_enable = 1;
+			break;
+		case 'a':
+			rt.cpu = strtol(optarg, NULL, 0);
+			rt_enable = 1;
 			break;
 		case 'h':
 		default:
@@ -861,7 +2769,7 @@ int main(int argc, char *argv[])
 	if (optind < argc)
 		usage();
 
-	if (NULL == interface)
+	if (0 == mrpd_port_num)
 		usage();
 
 	if (!mmrp_enable && !mvrp_enable && !msrp_enable)
@@ -874,6 +2782,21 @@ int main(int argc, char *argv[])
 		if (rc)
 			goto out;
 	}
+
+	/*
+	 * after daemon(), as memory locks are not inherited across fork();
+	 * the application threads of -t inherit the CPU and the policy
+	 */
+	if (rt_enable && rt_setup(&rt))
+		printf("real-time setup incomplete\n");
+
+	/*
+	 * LeaveAll timers are drawn from random(), so that stations started
+	 * together do not send their LeaveAlls in step.
+	 */
+	gettimeofday(&tv, NULL);
+	srandom(tv.tv_sec ^ tv.tv_usec ^ getpid());
+
 	rc = mrp_init();
 	if (rc)
 		goto out;
@@ -882,23 +2805,38 @@ int main(int argc, char *argv[])
 	if (rc)
 		goto out;
 
-	rc = mmrp_init(mmrp_enable);
-	if (rc) {
-		printf("mmrp_enable failed\n");
-		goto out;
+	if (unix_path) {
+		rc = init_unix_ctl();
+		if (rc) {
+			printf("unix socket %s failed\n", unix_path);
+			goto out;
+		}
 	}
 
-	rc = mvrp_init(mvrp_enable);
-	if (rc) {
-		printf("mvrp_enable failed\n");
-		goto out;
-	}
+	/* selecting the next port saves what the inits set up */
+	for (port = 0; port < mrpd_port_num; port++) {
+		mrpd_port_select(port);
+		interface = mrpd_ports[port].interface;
 
-	rc = msrp_init(msrp_enable);
-	if (rc) {
-		printf("msrp_enable failed\n");
-		goto out;
+		rc = mmrp_init(mmrp_enable);
+		if (rc) {
+			printf("mmrp_enable failed on %s\n", interface);
+			goto out;
+		}
+
+		rc = mvrp_init(mvrp_enable);
+		if (rc) {
+			printf("mvrp_enable failed on %s\n", interface);
+			goto out;
+		}
+
+		rc = msrp_init(msrp_enable);
+		if (rc) {
+			printf("msrp_enable failed on %s\n", interface);
+			goto out;
+		}
 	}
+	mrpd_port_select(0);
 
 	rc = init_timers();
 	if (rc) {
@@ -906,8 +2844,23 @@ int main(int argc, char *argv[])
 		goto out;
 	}
 
+	if (snapshot_path) {
+		rc = mrpd_snapshot_restore();
+		if (rc) {
+			printf("snapshot %s restore failed\n", snapshot_path);
+			rc = mrpd_snapshot_discard();
+			if (rc)
+				goto out;
+		}
+		signal(SIGTERM, mrpd_stop_handler);
+		signal(SIGINT, mrpd_stop_handler);
+	}
+
 	printf("process_events()\n");
 	process_events();
+
+	if (snapshot_path && mrpd_stop)
+		mrpd_snapshot_save();
  out:
 	if (rc)
 		printf("Error starting. Run as sudo?\n");
@@ -916,7 +2869,7 @@ int main(int argc, char *argv[])
 
 }
 
-static void mrpd_log_timer_event(char *src, int event)
+static void mrpd_log_timer_event(const char *src, int event)
 {
 #if LOG_POLL_EVENTS && LOG_TIMERS
 	if (event == MRP_EVENT_LVATIMER) {
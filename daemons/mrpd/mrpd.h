@@ -59,6 +59,17 @@ size_t mrpd_send(SOCKET sockfd, const void *buf, size_t len, int flags);
 #endif
 #endif
 
+/*
+ * The globals mrpd_port_select() swaps (databases, sockets, station
+ * address) exist once per thread, so that with -t every application
+ * thread works on its own port.
+ */
+#if defined __linux__ && !defined MRP_CPPUTEST
+#define MRPD_THREAD_LOCAL	__thread
+#else
+#define MRPD_THREAD_LOCAL
+#endif
+
 #ifdef __cplusplus
 #define __STDC_CONSTANT_MACROS
 #ifdef _STDINT_H
@@ -120,17 +131,314 @@ typedef struct mrpdu {
 #define MRPD_PORT_DEFAULT	7500
 #define MAX_MRPD_CMDSZ		(1500)
 
+/*
+ * Binary notification protocol
+ *
+ * Notifications are sent as text lines (e.g. "SJO T:S=...") unless a
+ * client selects the binary form for an application with M+B, V+B or
+ * S+B; M-B, V-B or S-B switch it back to text. A binary datagram is an
+ * mrpd_notify_hdr followed by 'count' mrpd_notify_rec, so several
+ * events arrive in one datagram. Multi-byte fields are in network
+ * byte order.
+ */
+#define MRPD_NOTIFY_MAGIC	0x4d52	/* "MR" */
+#define MRPD_NOTIFY_VERSION	1
+
+/* mrpd_notify_rec.type - the attribute type used in the application PDU */
+#define MRPD_NOTIFY_MMRP_SVCREQ		1
+#define MRPD_NOTIFY_MMRP_MAC		2
+#define MRPD_NOTIFY_MVRP_VID		1
+#define MRPD_NOTIFY_MSRP_TALKER		1
+#define MRPD_NOTIFY_MSRP_TALKER_FAILED	2
+#define MRPD_NOTIFY_MSRP_LISTENER	3
+#define MRPD_NOTIFY_MSRP_DOMAIN		4
+
+struct mrpd_notify_hdr {
+	uint16_t magic;
+	uint8_t version;
+	uint8_t app;		/* 'M', 'V' or 'S' */
+	uint16_t count;		/* number of records that follow */
+	uint16_t reserved;
+};
+
+struct mrpd_notify_rec {
+	uint8_t notify;		/* 1 new, 2 join, 3 leave */
+	uint8_t type;		/* MRPD_NOTIFY_xxx */
+	uint8_t applicant_state;	/* 0 (VO) .. 11 (LO) */
+	uint8_t registrar_state;	/* 16 IN, 17 LV, 18 MT */
+	uint8_t registrar[6];	/* source address of the registration */
+	uint8_t reserved[2];
+	union {
+		uint8_t macaddr[6];
+		uint8_t svcreq;
+		uint16_t vid;
+		struct {
+			uint8_t class_id;
+			uint8_t priority;
+			uint16_t vid;
+			uint8_t neighbor_priority;
+		} domain;
+		struct {
+			uint8_t stream_id[8];
+			uint8_t substate;
+		} listener;
+		struct {
+			uint8_t stream_id[8];
+			uint8_t bridge_id[8];	/* talker failed only */
+			uint8_t dest_addr[6];
+			uint16_t vid;
+			uint16_t max_frame_size;
+			uint16_t max_interval_frames;
+			uint32_t accumulated_latency;
+			uint8_t priority_and_rank;
+			uint8_t failure_code;	/* talker failed only */
+			uint8_t reserved[2];
+		} talker;
+	} u;
+};
+
+#define MRPD_NOTIFY_MAX_RECS \
+	((MAX_MRPD_CMDSZ - sizeof(struct mrpd_notify_hdr)) / \
+	 sizeof(struct mrpd_notify_rec))
+
+/*
+ * Unix domain control transport
+ *
+ * Started with -u <path>, mrpd also accepts SOCK_SEQPACKET connections
+ * on a Unix socket. Each packet carries one command in the same grammar
+ * as the UDP channel and each notification comes back as one packet.
+ * Unlike UDP, messages to a slow client are queued rather than dropped.
+ *
+ * A connected client may request a shared memory ring with "U+R". The
+ * "OK+" reply carries a memfd (SCM_RIGHTS) mapping a struct mrpd_shm.
+ * From then on notifications and replies are written to the notify ring
+ * and commands may be written to the cmd ring. A one byte packet on the
+ * socket is a doorbell: it is sent when a ring goes from empty to non
+ * empty, and by the client after draining the notify ring if mrpd set
+ * need_wakeup because the ring was full. "U-R" detaches the ring.
+ */
+#define MRPD_UNIX_PATH_DEFAULT	"/var/run/mrpd.sock"
+
+#define MRPD_SHM_MAGIC		0x4d525348	/* "MRSH" */
+#define MRPD_SHM_VERSION	1
+#define MRPD_SHM_SLOTS		128	/* power of 2 */
+
+struct mrpd_shm_slot {
+	uint32_t len;
+	char data[MAX_MRPD_CMDSZ];
+};
+
+/* single producer, single consumer; head and tail only ever increase */
+struct mrpd_shm_ring {
+	uint32_t head;		/* written by the producer */
+	uint8_t pad0[60];
+	uint32_t tail;		/* written by the consumer */
+	uint32_t need_wakeup;	/* producer waits for a doorbell */
+	uint8_t pad1[56];
+	struct mrpd_shm_slot slot[MRPD_SHM_SLOTS];
+};
+
+struct mrpd_shm {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t slots;
+	uint32_t slot_size;
+	uint8_t pad[48];
+	struct mrpd_shm_ring notify;	/* mrpd to client */
+	struct mrpd_shm_ring cmd;	/* client to mrpd */
+};
+
+#if defined __linux__
+#include <string.h>
+
+/*
+ * Returns 1 if the ring was empty before this message, so the consumer
+ * may be asleep and needs a doorbell, 0 if not, -1 if the ring is full.
+ */
+static inline int mrpd_shm_push(struct mrpd_shm_ring *ring, const char *data,
+				int len)
+{
+	uint32_t head = ring->head;
+	uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	struct mrpd_shm_slot *slot;
+
+	if (len < 0 || len > MAX_MRPD_CMDSZ)
+		return -1;
+	if (head - tail >= MRPD_SHM_SLOTS)
+		return -1;
+
+	slot = &ring->slot[head & (MRPD_SHM_SLOTS - 1)];
+	memcpy(slot->data, data, len);
+	slot->len = len;
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+	/* pairs with the fence in mrpd_shm_pop() */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	return __atomic_load_n(&ring->tail, __ATOMIC_RELAXED) == head;
+}
+
+/*
+ * mrpd_shm_push() that, on a full ring, asks the consumer for a doorbell
+ * once it has made room, then retries in case the consumer drained the
+ * ring before it could see the flag.
+ */
+static inline int mrpd_shm_push_wakeup(struct mrpd_shm_ring *ring,
+				       const char *data, int len)
+{
+	int rc;
+
+	rc = mrpd_shm_push(ring, data, len);
+	if (rc >= 0)
+		return rc;
+
+	__atomic_store_n(&ring->need_wakeup, 1, __ATOMIC_SEQ_CST);
+	return mrpd_shm_push(ring, data, len);
+}
+
+/*
+ * Copies the oldest message to buf and NUL terminates it. Returns its
+ * length, -1 if the ring is empty, or -2 if the slot claimed more than
+ * MAX_MRPD_CMDSZ bytes; such a slot is dropped without being copied.
+ */
+static inline int mrpd_shm_pop(struct mrpd_shm_ring *ring, char *buf,
+			       int size)
+{
+	uint32_t tail = ring->tail;
+	uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	struct mrpd_shm_slot *slot;
+	uint32_t len;
+	int rc;
+
+	if (head == tail)
+		return -1;
+
+	slot = &ring->slot[tail & (MRPD_SHM_SLOTS - 1)];
+	/* the other side may rewrite it at any time, read it once */
+	len = __atomic_load_n(&slot->len, __ATOMIC_RELAXED);
+	if ((len > MAX_MRPD_CMDSZ) || (size < 1)) {
+		rc = -2;
+	} else {
+		if (len > (uint32_t)size - 1)
+			len = size - 1;
+		memcpy(buf, slot->data, len);
+		buf[len] = '\0';
+		rc = len;
+	}
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+
+	/* a producer that saw the ring non empty relies on us re-checking */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	return rc;
+}
+
+/*
+ * With -t the main thread hands work to each application thread through
+ * a ring of its own, single producer and single consumer like the shm
+ * rings; see mrpd.c.
+ */
+#define MRPD_WORK_SLOTS		128	/* power of 2 */
+
+struct mrpd_work {
+	int kind;		/* MRPD_WORK_xxx */
+	int port;
+	int len;
+	struct sockaddr_in client;
+	char data[MAX_MRPD_CMDSZ + 1];
+};
+
+/* as struct mrpd_shm_ring, head and tail only ever increase */
+struct mrpd_work_ring {
+	uint32_t head;		/* written by the main thread */
+	uint8_t pad0[60];
+	uint32_t tail;		/* written by the application thread */
+	uint8_t pad1[60];
+	struct mrpd_work slot[MRPD_WORK_SLOTS];
+};
+
+/*
+ * Queues len (at most MAX_MRPD_CMDSZ) bytes of data. Returns 1 if the
+ * ring was empty before this work, so the application thread may be
+ * asleep and needs its doorbell rung, 0 if not, -1 if the ring is full.
+ */
+static inline int mrpd_work_push(struct mrpd_work_ring *ring, int kind,
+				 int port, struct sockaddr_in *client,
+				 const char *data, int len)
+{
+	uint32_t head = ring->head;
+	uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	struct mrpd_work *work;
+
+	if (head - tail >= MRPD_WORK_SLOTS)
+		return -1;
+
+	work = &ring->slot[head & (MRPD_WORK_SLOTS - 1)];
+	work->kind = kind;
+	work->port = port;
+	work->len = len;
+	if (client)
+		work->client = *client;
+	if (len)
+		memcpy(work->data, data, len);
+	work->data[len] = '\0';
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+	/* pairs with the fence in mrpd_work_done() */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	return __atomic_load_n(&ring->tail, __ATOMIC_RELAXED) == head;
+}
+
+/* the oldest work, left in its slot until mrpd_work_done() */
+static inline struct mrpd_work *mrpd_work_peek(struct mrpd_work_ring *ring)
+{
+	uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+	if (head == ring->tail)
+		return NULL;
+
+	return &ring->slot[ring->tail & (MRPD_WORK_SLOTS - 1)];
+}
+
+static inline void mrpd_work_done(struct mrpd_work_ring *ring)
+{
+	__atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+
+	/* a producer that saw the ring non empty relies on us re-checking */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+#endif
+
 /* forward declare */
 struct mrp_database;
 
 int mrpd_init_timers(struct mrp_database *mrp_db);
 int mrpd_timer_start(HTIMER timerfd, unsigned long value_ms);
 int mrpd_timer_stop(HTIMER timerfd);
+unsigned long mrpd_clock_ms(void);
 int mrpd_send_ctl_msg(struct sockaddr_in *client_addr, char *notify_data,
 		      int notify_len);
 int mrpd_init_protocol_socket(uint16_t etype, SOCKET * sock,
 			      unsigned char *multicast_addr);
 int mrpd_close_socket(SOCKET sock);
+/*
+ * *buf points at a receive buffer owned by mrpd; it stays valid until
+ * the next mrpd_recvmsgbuf() call on the same socket and is not freed
+ * by the caller.
+ */
 int mrpd_recvmsgbuf(SOCKET sock, char **buf);
 
+/*
+ * Bridge ports, one per -i option. Each port has its own protocol
+ * sockets and MMRP/MVRP/MSRP databases; mrpd_port_select() swaps the
+ * state of a port into the application globals (MSRP_db, msrp_socket,
+ * STATION_ADDR, ...) so the applications keep working on one database
+ * at a time. Event handlers run with their own port selected.
+ */
+#define MRPD_MAX_PORTS		32
+
+int mrpd_port_count(void);
+int mrpd_port_current(void);
+void mrpd_port_select(int port);
+/* latency (ns) the current port adds to talkers declared through it */
+uint32_t mrpd_port_latency(void);
+
 void mrpd_log_printf(const char *fmt, ...);
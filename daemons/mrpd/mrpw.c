@@ -346,6 +346,11 @@ unsigned int clock_monotonic_in_ms(void)
 			      (double)clock_monotonic_freq.QuadPart);
 }
 
+unsigned long mrpd_clock_ms(void)
+{
+	return clock_monotonic_in_ms();
+}
+
 HTIMER mrpd_timer_create(void)
 {
 	return (struct wtimer *)calloc(1, sizeof(struct wtimer));
@@ -572,13 +577,12 @@ int process_ctl_msg(char *buf, int buflen, struct sockaddr_in *client)
 
 static uint8_t *last_pdu_buffer;
 static int last_pdu_buffer_size;
+static char rx_frame[MAX_FRAME_SIZE];
 
 int mrpd_recvmsgbuf(SOCKET sock, char **buf)
 {
 
-	*buf = (char *)malloc(MAX_FRAME_SIZE);
-	if (NULL == *buf)
-		return -1;
+	*buf = rx_frame;
 
 	memcpy(*buf, last_pdu_buffer, last_pdu_buffer_size);
 	return last_pdu_buffer_size;
@@ -697,6 +701,27 @@ DWORD WINAPI ctl_thread(LPVOID lpParam)
 	return 0;
 }
 
+/* the pcap port is the only bridge port */
+int mrpd_port_count(void)
+{
+	return 1;
+}
+
+int mrpd_port_current(void)
+{
+	return 0;
+}
+
+void mrpd_port_select(int port)
+{
+	(void)port;
+}
+
+uint32_t mrpd_port_latency(void)
+{
+	return 0;
+}
+
 int mrpd_reclaim()
 {
 
@@ -774,6 +799,16 @@ int mrpw_init_threads(void)
 	return 0;
 }
 
+static void mrpd_flush_notifications(void)
+{
+	if (mmrp_enable && MMRP_db)
+		mrp_client_notify_flush(MMRP_db->mrp_db.clients);
+	if (mvrp_enable && MVRP_db)
+		mrp_client_notify_flush(MVRP_db->mrp_db.clients);
+	if (msrp_enable && MSRP_db)
+		mrp_client_notify_flush(MSRP_db->mrp_db.clients);
+}
+
 int mrpw_run_once(void)
 {
 	struct netif_thread_data wpcap_pkt;
@@ -899,6 +934,7 @@ int mrpw_run_once(void)
 	default:
 		printf("Unknown event %d\n", dwEvent);
 	}
+	mrpd_flush_notifications();
 	return 0;
 }
 
@@ -46,7 +46,6 @@
 #include "mmrp.h"
 
 int msrp_txpdu(void);
-static struct msrp_attribute *msrp_alloc(void);
 int msrp_send_notifications(struct msrp_attribute *attrib, int notify);
 static struct msrp_attribute *msrp_conditional_reclaim(struct msrp_attribute *sattrib);
 
@@ -54,11 +53,29 @@ int msrp_event(int event, struct msrp_attribute *rattrib);
 
 unsigned char MSRP_ADDR[] = { 0x01, 0x80, 0xC2, 0x00, 0x00, 0x0E };
 
-extern unsigned char STATION_ADDR[];
+extern MRPD_THREAD_LOCAL unsigned char STATION_ADDR[];
 
 /* global variables */
-SOCKET msrp_socket;
-struct msrp_database *MSRP_db;
+MRPD_THREAD_LOCAL SOCKET msrp_socket;
+
+/* frame buffer reused by every transmitted PDU */
+static unsigned char msrp_tx_frame[MAX_FRAME_SIZE];
+MRPD_THREAD_LOCAL struct msrp_database *MSRP_db;
+
+/* attributes of all ports */
+static struct mrp_slab msrp_slab = MRP_SLAB_INIT(struct msrp_attribute);
+
+/* set while a bulk command applies its records, see msrp_cmd_bulk() */
+static int msrp_notify_deferred;
+
+/* one parsed record of a bulk command */
+struct msrp_cmd_record {
+	int index;		/* position in the command */
+	int attrib_type;
+	uint32_t substate;
+	struct msrpdu_talker_fail talker;
+	struct msrpdu_domain domain;
+};
 
 char *msrp_attrib_type_string(int t)
 {
@@ -106,127 +123,220 @@ void msrp_print_debug_info(int evt, const struct msrp_attribute *attrib)
 }
 #endif
 
+#define MSRP_HASH_MIN	64
+
+/* talker advertise and talker failed share one key space */
+static int msrp_key_class(int type)
+{
+	if (MSRP_TALKER_FAILED_TYPE == type)
+		return MSRP_TALKER_ADV_TYPE;
+	return type;
+}
+
+static uint64_t msrp_key_id(const struct msrp_attribute *attrib)
+{
+	const uint8_t *id = attrib->attribute.talk_listen.StreamID;
+
+	if (MSRP_DOMAIN_TYPE == attrib->type)
+		return attrib->attribute.domain.SRclassID;
+
+	return ((uint64_t) id[0] << 56) | ((uint64_t) id[1] << 48) |
+	    ((uint64_t) id[2] << 40) | ((uint64_t) id[3] << 32) |
+	    ((uint64_t) id[4] << 24) | ((uint64_t) id[5] << 16) |
+	    ((uint64_t) id[6] << 8) | (uint64_t) id[7];
+}
+
+static int msrp_key_equal(const struct msrp_attribute *a,
+			  const struct msrp_attribute *b)
+{
+	if (msrp_key_class(a->type) != msrp_key_class(b->type))
+		return 0;
+	if (MSRP_DOMAIN_TYPE == a->type)
+		return a->attribute.domain.SRclassID ==
+		    b->attribute.domain.SRclassID;
+	return 0 == memcmp(a->attribute.talk_listen.StreamID,
+			   b->attribute.talk_listen.StreamID, 8);
+}
+
+/* the order of attributes of the same type in attrib_list */
+static int msrp_key_cmp(const struct msrp_attribute *a,
+			const struct msrp_attribute *b)
+{
+	if (MSRP_DOMAIN_TYPE == a->type)
+		return memcmp(&(a->attribute.domain), &(b->attribute.domain),
+			      sizeof(msrpdu_domain_t));
+	return memcmp(a->attribute.talk_listen.StreamID,
+		      b->attribute.talk_listen.StreamID, 8);
+}
+
+static unsigned int msrp_hash_slot(const struct msrp_attribute *attrib,
+				   unsigned int size)
+{
+	uint64_t key;
+
+	key = msrp_key_id(attrib) ^ (uint64_t) msrp_key_class(attrib->type);
+	/* Fibonacci hashing - StreamIDs mostly differ in the unique ID */
+	return (unsigned int)((key * 0x9E3779B97F4A7C15ULL) >> 32) &
+	    (size - 1);
+}
+
+static void msrp_hash_put(struct msrp_attribute **hash, unsigned int size,
+			  struct msrp_attribute *attrib)
+{
+	unsigned int i;
+
+	i = msrp_hash_slot(attrib, size);
+	while (NULL != hash[i])
+		i = (i + 1) & (size - 1);
+	hash[i] = attrib;
+}
+
+/* keep the hash at most half full */
+static int msrp_hash_reserve(unsigned int count)
+{
+	struct msrp_attribute **hash;
+	struct msrp_attribute *attrib;
+	unsigned int size;
+
+	if (2 * count <= MSRP_db->attrib_hash_size)
+		return 0;
+
+	size = MSRP_db->attrib_hash_size ?
+	    2 * MSRP_db->attrib_hash_size : MSRP_HASH_MIN;
+	hash = calloc(size, sizeof(*hash));
+	if (NULL == hash)
+		return -1;
+	/* every attribute on the list is indexed */
+	for (attrib = MSRP_db->attrib_list; NULL != attrib;
+	     attrib = attrib->next)
+		msrp_hash_put(hash, size, attrib);
+	free(MSRP_db->attrib_hash);
+	MSRP_db->attrib_hash = hash;
+	MSRP_db->attrib_hash_size = size;
+	return 0;
+}
+
+static void msrp_hash_remove(struct msrp_attribute *attrib)
+{
+	struct msrp_attribute **hash = MSRP_db->attrib_hash;
+	unsigned int mask = MSRP_db->attrib_hash_size - 1;
+	unsigned int i, j, home;
+
+	if (MSRP_db->add_hint == attrib)
+		MSRP_db->add_hint = NULL;
+
+	if (0 == MSRP_db->attrib_count)
+		return;
+
+	i = msrp_hash_slot(attrib, MSRP_db->attrib_hash_size);
+	while (hash[i] != attrib) {
+		if (NULL == hash[i])
+			return;		/* not indexed */
+		i = (i + 1) & mask;
+	}
+	MSRP_db->attrib_count--;
+
+	/* backward shift deletion, no tombstones needed */
+	j = i;
+	for (;;) {
+		hash[i] = NULL;
+		do {
+			j = (j + 1) & mask;
+			if (NULL == hash[j])
+				return;
+			home = msrp_hash_slot(hash[j],
+					      MSRP_db->attrib_hash_size);
+		} while ((i <= j) ? ((i < home) && (home <= j))
+			 : ((i < home) || (home <= j)));
+		hash[i] = hash[j];
+		i = j;
+	}
+}
+
 struct msrp_attribute *msrp_lookup(struct msrp_attribute *rattrib)
 {
 	struct msrp_attribute *attrib;
-	int mac_eq;
+	unsigned int mask;
+	unsigned int i;
 
-	attrib = MSRP_db->attrib_list;
-	while (NULL != attrib) {
-		if (	(rattrib->type == attrib->type) ||
-			((MSRP_TALKER_ADV_TYPE == rattrib->type) && (MSRP_TALKER_FAILED_TYPE == attrib->type)) ||
-			((MSRP_TALKER_FAILED_TYPE == rattrib->type) && (MSRP_TALKER_ADV_TYPE == attrib->type)))
-			{
-			if (MSRP_DOMAIN_TYPE == attrib->type) {
-				if (attrib->attribute.domain.SRclassID ==
-				   rattrib->attribute.domain.SRclassID)
-					return attrib;
-			} else {
-				/* compare on the stream ID */
-				mac_eq =
-				    memcmp(attrib->attribute.talk_listen.
-					   StreamID,
-					   rattrib->attribute.talk_listen.
-					   StreamID, 8);
-				if (0 == mac_eq)
-					return attrib;
-			}
-		}
-		attrib = attrib->next;
+	if (0 == MSRP_db->attrib_count)
+		return NULL;
+
+	mask = MSRP_db->attrib_hash_size - 1;
+	i = msrp_hash_slot(rattrib, MSRP_db->attrib_hash_size);
+	while (NULL != (attrib = MSRP_db->attrib_hash[i])) {
+		if (msrp_key_equal(attrib, rattrib))
+			return attrib;
+		i = (i + 1) & mask;
 	}
 	return NULL;
 }
 
+static void msrp_link_before(struct msrp_attribute *rattrib,
+			     struct msrp_attribute *attrib)
+{
+	rattrib->next = attrib;
+	rattrib->prev = attrib->prev;
+	attrib->prev = rattrib;
+	if (NULL != rattrib->prev)
+		rattrib->prev->next = rattrib;
+	else
+		MSRP_db->attrib_list = rattrib;
+}
+
+static void msrp_link_after(struct msrp_attribute *rattrib,
+			    struct msrp_attribute *attrib)
+{
+	rattrib->prev = attrib;
+	rattrib->next = attrib->next;
+	attrib->next = rattrib;
+	if (NULL != rattrib->next)
+		rattrib->next->prev = rattrib;
+}
+
 int msrp_add(struct msrp_attribute *rattrib)
 {
 	struct msrp_attribute *attrib;
 	struct msrp_attribute *attrib_tail;
-	int mac_eq;
+	struct msrp_attribute *hint;
 
 	/* XXX do a lookup first to guarantee uniqueness? */
 
+	if (msrp_hash_reserve(MSRP_db->attrib_count + 1) < 0)
+		return -1;
+	msrp_hash_put(MSRP_db->attrib_hash, MSRP_db->attrib_hash_size,
+		      rattrib);
+	MSRP_db->attrib_count++;
+
 	attrib_tail = attrib = MSRP_db->attrib_list;
 
+	/*
+	 * Ascending adds, e.g. the sorted records of a bulk command,
+	 * continue the walk where the previous add stopped, so merging
+	 * them into the list costs no more than one pass.
+	 */
+	hint = MSRP_db->add_hint;
+	if ((NULL != hint) && (hint->type == rattrib->type) &&
+	    (msrp_key_cmp(hint, rattrib) < 0))
+		attrib_tail = attrib = hint;
+	MSRP_db->add_hint = rattrib;
+
 	while (NULL != attrib) {
 		/* sort list into types, then sorted in order within types */
 		if (rattrib->type == attrib->type) {
-			if (MSRP_DOMAIN_TYPE == attrib->type) {
-				mac_eq = memcmp(&(attrib->attribute.domain),
-						&(rattrib->attribute.domain),
-						sizeof(msrpdu_domain_t));
-
-				if (mac_eq < 0) {
-					/* possible tail insertion ... */
-
-					/*
-					 * see if there is a another of the same following
-					 * not likely since valid values are only 0 and 1
-					 */
-					if (NULL != attrib->next) {
-						if (attrib->type ==
-						    attrib->next->type) {
-							attrib = attrib->next;
-							continue;
-						}
-					}
-
-					rattrib->next = attrib->next;
-					rattrib->prev = attrib;
-					attrib->next = rattrib;
-					if (rattrib->next)
-						rattrib->next->prev = rattrib;
-					return 0;
-
-				} else {
-					/* head insertion ... */
-					rattrib->next = attrib;
-					rattrib->prev = attrib->prev;
-					attrib->prev = rattrib;
-					if (NULL != rattrib->prev)
-						rattrib->prev->next = rattrib;
-					else
-						MSRP_db->attrib_list = rattrib;
-
-					return 0;
+			if (msrp_key_cmp(attrib, rattrib) < 0) {
+				/* possible tail insertion ... */
+				if ((NULL != attrib->next) &&
+				    (attrib->type == attrib->next->type)) {
+					attrib = attrib->next;
+					continue;
 				}
+				msrp_link_after(rattrib, attrib);
 			} else {
-				mac_eq =
-				    memcmp(attrib->attribute.talk_listen.
-					   StreamID,
-					   rattrib->attribute.talk_listen.
-					   StreamID, 8);
-
-				if (mac_eq < 0) {
-					/* possible tail insertion ... */
-
-					if (NULL != attrib->next) {
-						if (attrib->type ==
-						    attrib->next->type) {
-							attrib = attrib->next;
-							continue;
-						}
-					}
-
-					rattrib->next = attrib->next;
-					rattrib->prev = attrib;
-					attrib->next = rattrib;
-					if (rattrib->next)
-						rattrib->next->prev = rattrib;
-					return 0;
-
-				} else {
-					/* head insertion ... */
-					rattrib->next = attrib;
-					rattrib->prev = attrib->prev;
-					attrib->prev = rattrib;
-					if (NULL != rattrib->prev)
-						rattrib->prev->next = rattrib;
-					else
-						MSRP_db->attrib_list = rattrib;
-
-					return 0;
-				}
+				/* head insertion ... */
+				msrp_link_before(rattrib, attrib);
 			}
+			return 0;
 		}
 		attrib_tail = attrib;
 		attrib = attrib->next;
@@ -309,7 +419,7 @@ int msrp_merge(struct msrp_attribute *rattrib)
 				       attrib->attribute.
 				       talk_listen.StreamID, 8);
 				talker_missing = (NULL == msrp_lookup(talker_attrib));
-				free(talker_attrib);
+				msrp_free(talker_attrib);
 				if (talker_missing)
 					break;
 			}
@@ -344,6 +454,208 @@ int msrp_merge(struct msrp_attribute *rattrib)
 	return 0;
 }
 
+/* pending transmit set order: by type, then as in attrib_list */
+static int msrp_tx_cmp(mrp_applicant_attribute_t * a,
+		       mrp_applicant_attribute_t * b)
+{
+	struct msrp_attribute *aa = MRP_APPLICANT_OWNER(a, struct msrp_attribute);
+	struct msrp_attribute *ba = MRP_APPLICANT_OWNER(b, struct msrp_attribute);
+
+	if (aa->type != ba->type)
+		return aa->type - ba->type;
+	return msrp_key_cmp(aa, ba);
+}
+
+/* walk the pending transmit set, sorted by msrp_tx_cmp() */
+static struct msrp_attribute *msrp_tx_next(struct msrp_attribute *attrib)
+{
+	mrp_applicant_attribute_t *app;
+
+	if (NULL == attrib)
+		app = MSRP_db->mrp_db.tx_pending;
+	else
+		app = attrib->applicant.tx_next;
+
+	if (NULL == app)
+		return NULL;
+	return MRP_APPLICANT_OWNER(app, struct msrp_attribute);
+}
+
+/*
+ * If we have a listener type registered, send out an update with the
+ * LeaveAll, so every listener joins the pending transmit set.
+ */
+static void msrp_tx_listener(struct msrp_attribute *attrib)
+{
+	if (MSRP_LISTENER_TYPE != attrib->type)
+		return;
+
+	attrib->applicant.tx = 1;
+	mrp_tx_enqueue(&(MSRP_db->mrp_db), &(attrib->applicant));
+}
+
+/*
+ * MAP context propagation (802.1Q 35.2.4) between the bridge ports of
+ * mrpd. A talker registered on one port is declared on all the others
+ * with the latency of the outbound port added, a listener only on the
+ * ports its talker is registered on. Such declarations only drive the
+ * applicant, so they never count as registrations themselves, and are
+ * flagged map_declared to be withdrawn once no other port registers
+ * the attribute any longer.
+ */
+static struct msrp_attribute *msrp_map_registered(struct msrp_attribute *key)
+{
+	struct msrp_attribute *attrib;
+
+	if (NULL == MSRP_db)
+		return NULL;
+
+	attrib = msrp_lookup(key);
+	if ((NULL == attrib) || !mrp_registrar_in(&(attrib->registrar)))
+		return NULL;
+
+	return attrib;
+}
+
+static void msrp_map_declare(struct msrp_attribute *decl, int declare)
+{
+	struct msrp_attribute *attrib;
+	int event = MRP_EVENT_JOIN;
+
+	attrib = msrp_lookup(decl);
+
+	if (!declare) {
+		if ((NULL == attrib) || !attrib->map_declared)
+			return;
+		attrib->map_declared = 0;
+		mrp_applicant_fsm(&(MSRP_db->mrp_db), &(attrib->applicant),
+				  MRP_EVENT_LV,
+				  mrp_registrar_in(&(attrib->registrar)));
+		mrp_jointimer_start(&(MSRP_db->mrp_db));
+		return;
+	}
+
+	if (NULL == attrib) {
+		attrib = msrp_alloc();
+		if (NULL == attrib)
+			return;
+		/* the key must be set before it is indexed */
+		attrib->type = decl->type;
+		attrib->attribute = decl->attribute;
+		if (msrp_add(attrib) < 0) {
+			msrp_free(attrib);
+			return;
+		}
+	} else if (!attrib->map_declared &&
+		   (MRP_VO_STATE != attrib->applicant.mrp_state) &&
+		   (MRP_AO_STATE != attrib->applicant.mrp_state) &&
+		   (MRP_QO_STATE != attrib->applicant.mrp_state)) {
+		return;		/* a local client declares it already */
+	} else if (attrib->map_declared) {
+		if ((attrib->type == decl->type) &&
+		    (attrib->substate == decl->substate) &&
+		    (0 == memcmp(&(attrib->attribute), &(decl->attribute),
+				 sizeof(attrib->attribute))))
+			return;
+		/* changed values are declared as new */
+		event = MRP_EVENT_NEW;
+	}
+
+	attrib->type = decl->type;
+	attrib->attribute = decl->attribute;
+	attrib->substate = decl->substate;
+	attrib->direction = decl->direction;
+	attrib->map_declared = 1;
+	mrp_applicant_fsm(&(MSRP_db->mrp_db), &(attrib->applicant), event,
+			  mrp_registrar_in(&(attrib->registrar)));
+	mrp_jointimer_start(&(MSRP_db->mrp_db));
+}
+
+/* re-evaluate the declarations of key on every port */
+static void msrp_map_update(struct msrp_attribute *key)
+{
+	struct msrp_attribute regs[2];
+	struct msrp_attribute *reg;
+	struct msrp_attribute talker;
+	struct msrp_attribute decl;
+	int reg_port[2] = { -1, -1 };
+	int self = mrpd_port_current();
+	int declare;
+	int port;
+	int n = 0;
+	int i;
+
+	/* a port declares what any port but itself registers */
+	for (port = 0; (port < mrpd_port_count()) && (n < 2); port++) {
+		mrpd_port_select(port);
+		reg = msrp_map_registered(key);
+		if (NULL != reg) {
+			regs[n] = *reg;
+			reg_port[n++] = port;
+		}
+	}
+
+	talker = *key;
+	talker.type = MSRP_TALKER_ADV_TYPE;
+
+	for (port = 0; port < mrpd_port_count(); port++) {
+		mrpd_port_select(port);
+		if (NULL == MSRP_db)
+			continue;
+
+		i = (reg_port[0] == port) ? 1 : 0;
+		declare = (reg_port[i] >= 0);
+		decl = declare ? regs[i] : *key;
+
+		if (MSRP_LISTENER_TYPE == key->type)
+			declare = declare && msrp_map_registered(&talker);
+		else if (declare)
+			decl.attribute.talk_listen.AccumulatedLatency +=
+			    mrpd_port_latency();
+
+		msrp_map_declare(&decl, declare);
+	}
+	mrpd_port_select(self);
+}
+
+static void msrp_map_propagate(struct msrp_attribute *attrib)
+{
+	struct msrp_attribute key;
+
+	if ((mrpd_port_count() < 2) || (MSRP_DOMAIN_TYPE == attrib->type))
+		return;
+
+	memset(&key, 0, sizeof(key));
+	memcpy(key.attribute.talk_listen.StreamID,
+	       attrib->attribute.talk_listen.StreamID, 8);
+
+	if (MSRP_LISTENER_TYPE != attrib->type) {
+		key.type = MSRP_TALKER_ADV_TYPE;
+		msrp_map_update(&key);
+	}
+	/* where the talker is decides where its listeners go */
+	key.type = MSRP_LISTENER_TYPE;
+	msrp_map_update(&key);
+}
+
+/* generate local notifications */
+static void msrp_notify_pending(void)
+{
+	struct msrp_attribute *attrib;
+
+	attrib = MSRP_db->attrib_list;
+
+	while (NULL != attrib) {
+		if (MRP_NOTIFY_NONE != attrib->registrar.notify) {
+			msrp_send_notifications(attrib,
+						attrib->registrar.notify);
+			attrib->registrar.notify = MRP_NOTIFY_NONE;
+			msrp_map_propagate(attrib);
+		}
+		attrib = attrib->next;
+	}
+}
+
 #ifdef MRP_CPPUTEST /* MSRP_PDU_TEST */
 int msrp_event_orig(int event, struct msrp_attribute *rattrib)
 #else
@@ -351,9 +663,15 @@ int msrp_event(int event, struct msrp_attribute *rattrib)
 #endif
 {
 	struct msrp_attribute *attrib;
-	int count = 0;
+	mrp_registrar_attribute_t *reg, *next_reg;
 	int rc;
 
+	if ((MRP_EVENT_TX == event) || (MRP_EVENT_LVATIMER == event)) {
+		event = mrp_tx_opportunity(&(MSRP_db->mrp_db), event);
+		if (0 == event)
+			return 0;
+	}
+
 	switch (event) {
 	case MRP_EVENT_LVATIMER:
 		mrp_lvatimer_stop(&(MSRP_db->mrp_db));
@@ -367,6 +685,7 @@ int msrp_event(int event, struct msrp_attribute *rattrib)
 					  mrp_registrar_in(&(attrib->registrar)));
 			mrp_registrar_fsm(&(attrib->registrar),
 					  &(MSRP_db->mrp_db), MRP_EVENT_TXLA);
+			msrp_tx_listener(attrib);
 #if LOG_MSRP
 			msrp_print_debug_info(event, attrib);
 #endif
@@ -383,7 +702,9 @@ int msrp_event(int event, struct msrp_attribute *rattrib)
 		 * LSM is back to the passive state.
 		 */
 		mrp_lvatimer_fsm(&(MSRP_db->mrp_db), MRP_EVENT_TX);
+		mrp_tx_pending_sort(&(MSRP_db->mrp_db), msrp_tx_cmp);
 		msrp_txpdu();
+		mrp_tx_pending_retire(&(MSRP_db->mrp_db));
 		MSRP_db->send_empty_LeaveAll_flag = 0;
 		break;
 	case MRP_EVENT_RLA:
@@ -413,17 +734,15 @@ int msrp_event(int event, struct msrp_attribute *rattrib)
 		break;
 	case MRP_EVENT_TX:
 		mrp_jointimer_stop(&(MSRP_db->mrp_db));
-		attrib = MSRP_db->attrib_list;
-
-		while (NULL != attrib) {
+		/* only the attributes with something to send */
+		for (attrib = msrp_tx_next(NULL); NULL != attrib;
+		     attrib = msrp_tx_next(attrib)) {
 			mrp_applicant_fsm(&(MSRP_db->mrp_db),
 					  &(attrib->applicant), MRP_EVENT_TX,
 					  mrp_registrar_in(&(attrib->registrar)));
 #if LOG_MSRP
 			msrp_print_debug_info(event, attrib);
 #endif
-			count += mrp_applicant_state_transition_implies_tx(&(attrib->applicant));
-			attrib = attrib->next;
 		}
 
 		/*
@@ -432,30 +751,33 @@ int msrp_event(int event, struct msrp_attribute *rattrib)
 		 * lva FSM when the start is active, and it is only active
 		 * momentarily after a LVATIMER event.
 		 */
+		mrp_tx_pending_sort(&(MSRP_db->mrp_db), msrp_tx_cmp);
 		msrp_txpdu();
 
 		/*
 		 * Certain state transitions imply we need to request another tx
 		 * opportunity.
 		 */
-		if (count) {
+		if (mrp_tx_pending_retire(&(MSRP_db->mrp_db))) {
 			mrp_jointimer_start(&(MSRP_db->mrp_db));
 		}
 
 		break;
 	case MRP_EVENT_LVTIMER:
-		mrp_lvtimer_stop(&(MSRP_db->mrp_db));
-		attrib = MSRP_db->attrib_list;
+		/* only the registrars whose own leave timer ran out */
+		reg = mrp_lvtimer_expired(&(MSRP_db->mrp_db));
 
-		while (NULL != attrib) {
-			mrp_registrar_fsm(&(attrib->registrar),
-					  &(MSRP_db->mrp_db),
+		while (NULL != reg) {
+			next_reg = reg->lv_next;
+			attrib = MRP_REGISTRAR_OWNER(reg, struct msrp_attribute);
+			mrp_registrar_fsm(reg, &(MSRP_db->mrp_db),
 					  MRP_EVENT_LVTIMER);
 
 #if LOG_MSRP
 			msrp_print_debug_info(event, attrib);
 #endif
-			attrib = msrp_conditional_reclaim(attrib);
+			msrp_conditional_reclaim(attrib);
+			reg = next_reg;
 		}
 		break;
 	case MRP_EVENT_PERIODIC:
@@ -480,11 +802,14 @@ int msrp_event(int event, struct msrp_attribute *rattrib)
 		attrib = msrp_lookup(rattrib);
 
 		if (NULL == attrib) {
-			msrp_add(rattrib);
+			if (msrp_add(rattrib) < 0) {
+				msrp_free(rattrib);
+				return -1;
+			}
 			attrib = rattrib;
 		} else {
 			msrp_merge(rattrib);
-			free(rattrib);
+			msrp_free(rattrib);
 		}
 
 		mrp_applicant_fsm(&(MSRP_db->mrp_db), &(attrib->applicant),
@@ -538,31 +863,20 @@ int msrp_event(int event, struct msrp_attribute *rattrib)
 	 * MSRP_db->mrp_db.participant controls
 	 */
 
-	/* generate local notifications */
-	attrib = MSRP_db->attrib_list;
-
-	while (NULL != attrib) {
-		if (MRP_NOTIFY_NONE != attrib->registrar.notify) {
-			msrp_send_notifications(attrib,
-						attrib->registrar.notify);
-			attrib->registrar.notify = MRP_NOTIFY_NONE;
-		}
-		attrib = attrib->next;
-	}
+	if (!msrp_notify_deferred)
+		msrp_notify_pending();
 
 	return 0;
 }
 
-static struct msrp_attribute *msrp_alloc()
+struct msrp_attribute *msrp_alloc(void)
 {
 	struct msrp_attribute *attrib;
 
-	attrib = (struct msrp_attribute *) malloc(sizeof(struct msrp_attribute));
+	attrib = (struct msrp_attribute *)mrp_slab_alloc(&msrp_slab);
 	if (NULL == attrib)
 		return NULL;
 
-	memset(attrib, 0, sizeof(struct msrp_attribute));
-
 	attrib->applicant.mrp_state = MRP_VO_STATE;
 	attrib->applicant.tx = 0;
 	attrib->applicant.sndmsg = MRP_SND_NULL;
@@ -579,6 +893,16 @@ static struct msrp_attribute *msrp_alloc()
 	return attrib;
 }
 
+void msrp_free(struct msrp_attribute *attrib)
+{
+	if (NULL != MSRP_db) {
+		mrp_gc_remove(&(MSRP_db->mrp_db), &(attrib->applicant.gc));
+		mrp_gc_remove(&(MSRP_db->mrp_db), &(attrib->registrar.gc));
+		mrp_tx_dequeue(&(MSRP_db->mrp_db), &(attrib->applicant));
+	}
+	mrp_slab_free(&msrp_slab, attrib);
+}
+
 void msrp_increment_streamid(uint8_t * streamid)
 {
 
@@ -668,7 +992,6 @@ int msrp_recv_msg()
 	uint16_t numvalues_processed;
 	int numvectorbytes;
 	uint8_t vect_3pack;
-	uint8_t vect_4pack;
 	int vectidx;
 	int vectevt[4];
 	int vectevt_idx;
@@ -691,6 +1014,7 @@ int msrp_recv_msg()
 	bytes = mrpd_recvmsgbuf(msrp_socket, &msgbuf);
 	if (bytes <= 0)
 		goto out;
+	MRP_STAT_INC(MSRP_db->mrp_db.stats.pdu_rx);
 	if ((unsigned int)bytes < (sizeof(eth_hdr_t) + sizeof(mrpdu_t) +
 				   sizeof(mrpdu_message_t)))
 		goto out;
@@ -805,7 +1129,7 @@ int msrp_recv_msg()
 
 					attrib->type = 	MSRP_DOMAIN_TYPE;				
 					msrp_event(MRP_EVENT_RLA, attrib);
-					free(attrib);
+					msrp_free(attrib);
 				}
 
 
@@ -848,12 +1172,7 @@ int msrp_recv_msg()
 					vect_3pack =
 					    mrpdu_vectorptr->
 					    FirstValue_VectorEvents[vectidx];
-					vectevt[0] = vect_3pack / 36;
-					vectevt[1] =
-					    (vect_3pack - vectevt[0] * 36) / 6;
-					vectevt[2] =
-					    vect_3pack - (36 * vectevt[0]) -
-					    (6 * vectevt[1]);
+					MRPDU_3PACK_DECODE(vect_3pack, vectevt);
 
 					numvalues_processed =
 					    (numvalues > 3 ? 3 : numvalues);
@@ -928,7 +1247,7 @@ int msrp_recv_msg()
 							     attrib);
 							break;
 						default:
-							free(attrib);
+							msrp_free(attrib);
 							break;
 						}
 					}
@@ -998,7 +1317,7 @@ int msrp_recv_msg()
 
 					attrib->type = 	MSRP_LISTENER_TYPE;				
 					msrp_event(MRP_EVENT_RLA, attrib);
-					free(attrib);
+					msrp_free(attrib);
 				}
 
 
@@ -1048,8 +1367,12 @@ int msrp_recv_msg()
 				     [listener_endbyte]) >= mrpdu_msg_eof)
 					goto out;
 
-				if (NULL == listener_vectevt) {
-					listener_vectevt_sz = 64;
+				/* room for numvalues rounded up to a whole byte */
+				if (listener_vectevt_sz < numvectorbytes * 4) {
+					listener_vectevt_sz = numvectorbytes * 4;
+					if (listener_vectevt_sz < 64)
+						listener_vectevt_sz = 64;
+					free(listener_vectevt);
 					listener_vectevt =
 					    (int *)malloc(listener_vectevt_sz *
 							  sizeof(int));
@@ -1057,58 +1380,10 @@ int msrp_recv_msg()
 						goto out;
 				}
 
-				listener_vectevt_idx = 0;
-
-				for (; vectidx < listener_endbyte; vectidx++) {
-					vect_4pack =
-					    mrpdu_vectorptr->
-					    FirstValue_VectorEvents[vectidx];
-
-					vectevt[3] =
-					    vect_4pack -
-					    ((vect_4pack >> 2) << 2);
-					vect_4pack = vect_4pack >> 2;
-					vectevt[2] =
-					    vect_4pack -
-					    ((vect_4pack >> 2) << 2);
-					vect_4pack = vect_4pack >> 2;
-					vectevt[1] =
-					    vect_4pack -
-					    ((vect_4pack >> 2) << 2);
-					vect_4pack = vect_4pack >> 2;
-					vectevt[0] =
-					    vect_4pack -
-					    ((vect_4pack >> 2) << 2);
-					vect_4pack = vect_4pack >> 2;
-
-					numvalues_processed =
-					    (numvalues > 4 ? 4 : numvalues);
-
-					for (vectevt_idx = 0;
-					     vectevt_idx < numvalues_processed;
-					     vectevt_idx++) {
-						if (listener_vectevt_idx ==
-						    listener_vectevt_sz) {
-							listener_vectevt =
-							    (int*)realloc
-							    (listener_vectevt,
-							     (listener_vectevt_sz
-							      +
-							      64) *
-							     sizeof(int));
-							if (NULL ==
-							    listener_vectevt)
-								goto out;
-							listener_vectevt_sz +=
-							    64;
-						}
-						listener_vectevt
-						    [listener_vectevt_idx] =
-						    vectevt[vectevt_idx];
-						listener_vectevt_idx++;
-					}
-					numvalues -= numvalues_processed;
-				}
+				mrpdu_4pack_decode(&(mrpdu_vectorptr->
+						     FirstValue_VectorEvents
+						     [vectidx]), numvalues,
+						   listener_vectevt);
 
 				numvalues =
 				    MRPDU_VECT_NUMVALUES(ntohs
@@ -1129,12 +1404,7 @@ int msrp_recv_msg()
 					vect_3pack =
 					    mrpdu_vectorptr->
 					    FirstValue_VectorEvents[vectidx];
-					vectevt[0] = vect_3pack / 36;
-					vectevt[1] =
-					    (vect_3pack - vectevt[0] * 36) / 6;
-					vectevt[2] =
-					    vect_3pack - (36 * vectevt[0]) -
-					    (6 * vectevt[1]);
+					MRPDU_3PACK_DECODE(vect_3pack, vectevt);
 
 					numvalues_processed =
 					    (numvalues > 3 ? 3 : numvalues);
@@ -1221,7 +1491,7 @@ int msrp_recv_msg()
 							     attrib);
 							break;
 						default:
-							free(attrib);
+							msrp_free(attrib);
 							break;
 						}
 					}
@@ -1311,7 +1581,7 @@ int msrp_recv_msg()
 
 					attrib->type = 	MSRP_TALKER_ADV_TYPE;				
 					msrp_event(MRP_EVENT_RLA, attrib);
-					free(attrib);
+					msrp_free(attrib);
 				}
 
 				if (0 == numvalues) {
@@ -1352,12 +1622,7 @@ int msrp_recv_msg()
 					vect_3pack =
 					    mrpdu_vectorptr->
 					    FirstValue_VectorEvents[vectidx];
-					vectevt[0] = vect_3pack / 36;
-					vectevt[1] =
-					    (vect_3pack - vectevt[0] * 36) / 6;
-					vectevt[2] =
-					    vect_3pack - (36 * vectevt[0]) -
-					    (6 * vectevt[1]);
+					MRPDU_3PACK_DECODE(vect_3pack, vectevt);
 
 					numvalues_processed =
 					    (numvalues > 3 ? 3 : numvalues);
@@ -1508,7 +1773,7 @@ int msrp_recv_msg()
 							     attrib);
 							break;
 						default:
-							free(attrib);
+							msrp_free(attrib);
 							break;
 						}
 					}
@@ -1576,7 +1841,7 @@ int msrp_recv_msg()
 
 					attrib->type = 	MSRP_TALKER_FAILED_TYPE;				
 					msrp_event(MRP_EVENT_RLA, attrib);
-					free(attrib);
+					msrp_free(attrib);
 				}
 
 				if (0 == numvalues) {
@@ -1614,12 +1879,7 @@ int msrp_recv_msg()
 					vect_3pack =
 					    mrpdu_vectorptr->
 					    FirstValue_VectorEvents[vectidx];
-					vectevt[0] = vect_3pack / 36;
-					vectevt[1] =
-					    (vect_3pack - vectevt[0] * 36) / 6;
-					vectevt[2] =
-					    vect_3pack - (36 * vectevt[0]) -
-					    (6 * vectevt[1]);
+					MRPDU_3PACK_DECODE(vect_3pack, vectevt);
 
 					numvalues_processed =
 					    (numvalues > 3 ? 3 : numvalues);
@@ -1777,7 +2037,7 @@ int msrp_recv_msg()
 							     attrib);
 							break;
 						default:
-							free(attrib);
+							msrp_free(attrib);
 							break;
 						}
 					}
@@ -1809,17 +2069,35 @@ int msrp_recv_msg()
 	if (listener_vectevt)
 		free(listener_vectevt);
 
-	free(msgbuf);
 	return 0;
  out:
+	if (bytes > 0)
+		MRP_STAT_INC(MSRP_db->mrp_db.stats.pdu_rx_errors);
 	if (listener_vectevt)
 		free(listener_vectevt);
 
-	free(msgbuf);
-
 	return -1;
 }
 
+/*
+ * Check that a vector of numvalues values starting at vect, together with
+ * the endmark of its message, still fits into the frame. The emitters stop
+ * a vector (or the message) short when this fails and leave the tx flag
+ * set on whatever did not fit, so msrp_txpdu() can resume it in the next
+ * PDU.
+ */
+static int msrp_vector_fits(mrpdu_vectorattrib_t *vect, unsigned char *eof,
+			    int attrib_len, int numvalues, int fourpacked)
+{
+	int len;
+
+	len = attrib_len + (numvalues + 2) / 3;
+	if (fourpacked)
+		len += (numvalues + 3) / 4;
+
+	return &(vect->FirstValue_VectorEvents[len]) <= eof - MRPDU_ENDMARK_SZ;
+}
+
 int
 msrp_emit_domainvectors(unsigned char *msgbuf, unsigned char *msgbuf_eof,
 			int *bytes_used, int lva)
@@ -1843,34 +2121,36 @@ msrp_emit_domainvectors(unsigned char *msgbuf, unsigned char *msgbuf_eof,
 	unsigned char *mrpdu_msg_ptr = msgbuf;
 	unsigned char *mrpdu_msg_eof = msgbuf_eof;
 	unsigned int attrib_found_flag = 0;
-	unsigned int vector_size = 5;
-
-	/* need at least 5 bytes for a single vector */
-	if (mrpdu_msg_ptr > (mrpdu_msg_eof - vector_size))
-		goto oops;
 
 	mrpdu_msg = (mrpdu_message_t *) mrpdu_msg_ptr;
+	mrpdu_vectorptr = (mrpdu_vectorattrib_t *) & (mrpdu_msg->Data[2]);
+
+	/* no room left in this PDU for a single vector */
+	if (!msrp_vector_fits(mrpdu_vectorptr, mrpdu_msg_eof, 4, 1, 0)) {
+		*bytes_used = 0;
+		return 0;
+	}
+
 	mrpdu_msg->AttributeType = MSRP_DOMAIN_TYPE;
 	mrpdu_msg->AttributeLength = 4;
 
-	attrib = MSRP_db->attrib_list;
-
-	mrpdu_vectorptr = (mrpdu_vectorattrib_t *) & (mrpdu_msg->Data[2]);
+	attrib = msrp_tx_next(NULL);
 
-	while ((mrpdu_msg_ptr < (mrpdu_msg_eof - vector_size - MRPDU_ENDMARK_SZ)) && (NULL != attrib)) {
+	while ((NULL != attrib) &&
+	       msrp_vector_fits(mrpdu_vectorptr, mrpdu_msg_eof, 4, 1, 0)) {
 
 		if (MSRP_DOMAIN_TYPE != attrib->type) {
-			attrib = attrib->next;
+			attrib = msrp_tx_next(attrib);
 			continue;
 		}
 
 		if (0 == attrib->applicant.tx) {
-			attrib = attrib->next;
+			attrib = msrp_tx_next(attrib);
 			continue;
 		}
 		attrib->applicant.tx = 0;
 		if (MRP_ENCODE_OPTIONAL == attrib->applicant.encode) {
-			attrib = attrib->next;
+			attrib = msrp_tx_next(attrib);
 			continue;
 		}
 
@@ -1938,7 +2218,7 @@ msrp_emit_domainvectors(unsigned char *msgbuf, unsigned char *msgbuf_eof,
 
 /* pending review and deletion */
 #ifdef MSRP_AGGREGATE_DOMAINS_VECTORS
-		vattrib = attrib->next;
+		vattrib = msrp_tx_next(attrib);
 
 		while (NULL != vattrib) {
 			if (MSRP_DOMAIN_TYPE != vattrib->type)
@@ -1947,6 +2227,11 @@ msrp_emit_domainvectors(unsigned char *msgbuf, unsigned char *msgbuf_eof,
 			if (0 == vattrib->applicant.tx)
 				break;
 
+			/* resume the rest of the run in the next PDU */
+			if (!msrp_vector_fits(mrpdu_vectorptr, mrpdu_msg_eof,
+					      4, numvalues + 1, 0))
+				break;
+
 			srclassID_firstval++;
 			srclassprio_firstval++;
 
@@ -2014,7 +2299,7 @@ msrp_emit_domainvectors(unsigned char *msgbuf, unsigned char *msgbuf_eof,
 			    > (mrpdu_msg_eof - MRPDU_ENDMARK_SZ))
 				goto oops;
 
-			vattrib = vattrib->next;
+			vattrib = msrp_tx_next(vattrib);
 		}
 #endif
 
@@ -2046,7 +2331,7 @@ msrp_emit_domainvectors(unsigned char *msgbuf, unsigned char *msgbuf_eof,
 		    &(mrpdu_vectorptr->FirstValue_VectorEvents[vectidx]);
 		mrpdu_vectorptr = (mrpdu_vectorattrib_t *) mrpdu_msg_ptr;
 
-		attrib = attrib->next;
+		attrib = msrp_tx_next(attrib);
 
 	}
 
@@ -2137,21 +2422,23 @@ msrp_emit_talkervectors(unsigned char *msgbuf, unsigned char *msgbuf_eof,
 	unsigned char *mrpdu_msg_ptr = msgbuf;
 	unsigned char *mrpdu_msg_eof = msgbuf_eof;
 	unsigned int attrib_found_flag = 0;
-	unsigned int vector_size = 0;
 	unsigned int attrib_len = 0;
 
 	/* MSRP_TALKER_ADV_TYPE */
-	vector_size = 28;
 	attrib_len = 25;
 	if (MSRP_TALKER_FAILED_TYPE == type) {
 		/* talker failed */
-		vector_size += 9;
-		attrib_len += 9;		
+		attrib_len += 9;
 	}
 
-	/* need at least 28 bytes for a single vector */
-	if (mrpdu_msg_ptr > (mrpdu_msg_eof - vector_size))
-		goto oops;
+	mrpdu_msg = (mrpdu_message_t *) mrpdu_msg_ptr;
+	mrpdu_vectorptr = (mrpdu_vectorattrib_t *) & (mrpdu_msg->Data[2]);
+
+	/* no room left in this PDU for a single vector */
+	if (!msrp_vector_fits(mrpdu_vectorptr, mrpdu_msg_eof, attrib_len, 1, 0)) {
+		*bytes_used = 0;
+		return 0;
+	}
 
 	/*
 	 * as an endpoint, we don't advertise talker failed attributes (which
@@ -2160,33 +2447,31 @@ msrp_emit_talkervectors(unsigned char *msgbuf, unsigned char *msgbuf_eof,
 	 * station - we only advertise the talker vectors for declared streams,
 	 * not those we know about as a listener ...
 	 */
-	mrpdu_msg = (mrpdu_message_t *) mrpdu_msg_ptr;
 	mrpdu_msg->AttributeType = type;
 	mrpdu_msg->AttributeLength = attrib_len;
 
-	attrib = MSRP_db->attrib_list;
+	attrib = msrp_tx_next(NULL);
 
-	mrpdu_vectorptr = (mrpdu_vectorattrib_t *) & (mrpdu_msg->Data[2]);
-
-	while ((mrpdu_msg_ptr < (mrpdu_msg_eof - vector_size - MRPDU_ENDMARK_SZ)) && (NULL != attrib)) {
+	while ((NULL != attrib) &&
+	       msrp_vector_fits(mrpdu_vectorptr, mrpdu_msg_eof, attrib_len, 1, 0)) {
 
 		if (type != attrib->type) {
-			attrib = attrib->next;
+			attrib = msrp_tx_next(attrib);
 			continue;
 		}
 #ifdef CHECK
 		if (MSRP_DIRECTION_LISTENER == attrib->direction) {
-			attrib = attrib->next;
+			attrib = msrp_tx_next(attrib);
 			continue;
 		}
 #endif
 		if (0 == attrib->applicant.tx) {
-			attrib = attrib->next;
+			attrib = msrp_tx_next(attrib);
 			continue;
 		}
 		attrib->applicant.tx = 0;
 		if (MRP_ENCODE_OPTIONAL == attrib->applicant.encode) {
-			attrib = attrib->next;
+			attrib = msrp_tx_next(attrib);
 			continue;
 		}
 
@@ -2286,7 +2571,7 @@ msrp_emit_talkervectors(unsigned char *msgbuf, unsigned char *msgbuf_eof,
 		 */
 
 		vectidx = attrib_len;
-		vattrib = attrib->next;
+		vattrib = msrp_tx_next(attrib);
 
 		while (NULL != vattrib) {
 			if (type != vattrib->type)
@@ -2295,6 +2580,11 @@ msrp_emit_talkervectors(unsigned char *msgbuf, unsigned char *msgbuf_eof,
 			if (0 == vattrib->applicant.tx)
 				break;
 
+			/* resume the rest of the run in the next PDU */
+			if (!msrp_vector_fits(mrpdu_vectorptr, mrpdu_msg_eof,
+					      attrib_len, numvalues + 1, 0))
+				break;
+
 			msrp_increment_streamid(streamid_firstval);
 			mmrp_increment_macaddr(destmac_firstval);
 
@@ -2364,7 +2654,7 @@ msrp_emit_talkervectors(unsigned char *msgbuf, unsigned char *msgbuf_eof,
 			    > (mrpdu_msg_eof - MRPDU_ENDMARK_SZ))
 				goto oops;
 
-			vattrib = vattrib->next;
+			vattrib = msrp_tx_next(vattrib);
 		}
 
 		/* handle any trailers */
@@ -2395,7 +2685,7 @@ msrp_emit_talkervectors(unsigned char *msgbuf, unsigned char *msgbuf_eof,
 		    &(mrpdu_vectorptr->FirstValue_VectorEvents[vectidx]);
 		mrpdu_vectorptr = (mrpdu_vectorattrib_t *) mrpdu_msg_ptr;
 
-		attrib = attrib->next;
+		attrib = msrp_tx_next(attrib);
 
 	}
 
@@ -2448,7 +2738,6 @@ msrp_emit_listenvectors(unsigned char *msgbuf, unsigned char *msgbuf_eof,
 	unsigned char *mrpdu_msg_eof = msgbuf_eof;
 	uint16_t numvalues;
 	uint8_t vect_3pack;
-	uint8_t vect_4pack;
 	int vectidx;
 	int attriblistlen;
 	int vectevt[4];
@@ -2456,18 +2745,20 @@ msrp_emit_listenvectors(unsigned char *msgbuf, unsigned char *msgbuf_eof,
 	int *listen_declare = NULL;
 	int listen_declare_sz = 64;
 	int listen_declare_idx = 0;
-	int listen_declare_end = 0;
 	uint8_t streamid_firstval[8];
 	struct msrp_attribute *attrib, *vattrib;
-	unsigned int vector_size = 13;
 	int mac_eq;
 	unsigned int attrib_found_flag = 0;
 
-	/* need at least 13 bytes for a single vector */
-	if (mrpdu_msg_ptr > (mrpdu_msg_eof - vector_size))
-		goto oops;
-
 	mrpdu_msg = (mrpdu_message_t *) mrpdu_msg_ptr;
+	mrpdu_vectorptr = (mrpdu_vectorattrib_t *) & (mrpdu_msg->Data[2]);
+
+	/* no room left in this PDU for a single vector */
+	if (!msrp_vector_fits(mrpdu_vectorptr, mrpdu_msg_eof, 8, 1, 1)) {
+		*bytes_used = 0;
+		return 0;
+	}
+
 	mrpdu_msg->AttributeType = MSRP_LISTENER_TYPE;
 	mrpdu_msg->AttributeLength = 8;
 
@@ -2475,35 +2766,24 @@ msrp_emit_listenvectors(unsigned char *msgbuf, unsigned char *msgbuf_eof,
 	if (NULL == listen_declare)
 		goto oops;
 
-	/* if we have a listener type registered, always send out an update,
-	 * so mark all as ready.
-	 */
-	attrib = MSRP_db->attrib_list;
-	while (attrib) {
-		if (MSRP_LISTENER_TYPE == attrib->type) {
-			attrib->applicant.tx = 1;
-		}
-		attrib = attrib->next;
-	}
-
-	attrib = MSRP_db->attrib_list;
-	mrpdu_vectorptr = (mrpdu_vectorattrib_t *) & (mrpdu_msg->Data[2]);
+	attrib = msrp_tx_next(NULL);
 
-	while ((mrpdu_msg_ptr < (mrpdu_msg_eof - vector_size -MRPDU_ENDMARK_SZ)) && (NULL != attrib)) {
+	while ((NULL != attrib) &&
+	       msrp_vector_fits(mrpdu_vectorptr, mrpdu_msg_eof, 8, 1, 1)) {
 
 		if (MSRP_LISTENER_TYPE != attrib->type) {
-			attrib = attrib->next;
+			attrib = msrp_tx_next(attrib);
 			continue;
 		}
 
 		if (0 == attrib->applicant.tx) {
-			attrib = attrib->next;
+			attrib = msrp_tx_next(attrib);
 			continue;
 		}
 
 		attrib->applicant.tx = 0;
 		if (MRP_ENCODE_OPTIONAL == attrib->applicant.encode) {
-			attrib = attrib->next;
+			attrib = msrp_tx_next(attrib);
 			continue;
 		}
 
@@ -2582,7 +2862,7 @@ msrp_emit_listenvectors(unsigned char *msgbuf, unsigned char *msgbuf_eof,
 		 */
 
 		vectidx = 8;
-		vattrib = attrib->next;
+		vattrib = msrp_tx_next(attrib);
 
 		while (NULL != vattrib) {
 			if (MSRP_LISTENER_TYPE != vattrib->type)
@@ -2591,6 +2871,11 @@ msrp_emit_listenvectors(unsigned char *msgbuf, unsigned char *msgbuf_eof,
 			if (0 == vattrib->applicant.tx)
 				break;
 
+			/* resume the rest of the run in the next PDU */
+			if (!msrp_vector_fits(mrpdu_vectorptr, mrpdu_msg_eof,
+					      8, numvalues + 1, 1))
+				break;
+
 			msrp_increment_streamid(streamid_firstval);
 
 			mac_eq = memcmp(vattrib->attribute.talk_listen.StreamID,
@@ -2671,7 +2956,7 @@ msrp_emit_listenvectors(unsigned char *msgbuf, unsigned char *msgbuf_eof,
 			    > (mrpdu_msg_eof - MRPDU_ENDMARK_SZ))
 				goto oops;
 
-			vattrib = vattrib->next;
+			vattrib = msrp_tx_next(vattrib);
 		}
 
 		/* handle any trailers */
@@ -2685,57 +2970,10 @@ msrp_emit_listenvectors(unsigned char *msgbuf, unsigned char *msgbuf_eof,
 		}
 
 		/* now emit the 4-packed events */
-
-		listen_declare_end = listen_declare_idx;
-
-		for (listen_declare_idx = 0;
-		     listen_declare_idx < ((listen_declare_end / 4) * 4);
-		     listen_declare_idx += 4) {
-
-			if (&(mrpdu_vectorptr->FirstValue_VectorEvents[vectidx])
-			    > (mrpdu_msg_eof - MRPDU_ENDMARK_SZ))
-				goto oops;
-
-			vect_4pack =
-			    MRPDU_4PACK_ENCODE(listen_declare
-					       [listen_declare_idx],
-					       listen_declare
-					       [listen_declare_idx + 1],
-					       listen_declare
-					       [listen_declare_idx + 2],
-					       listen_declare
-					       [listen_declare_idx + 3]);
-
-			mrpdu_vectorptr->FirstValue_VectorEvents
-			    [vectidx] = vect_4pack;
-			vectidx++;
-
-			if (&(mrpdu_vectorptr->FirstValue_VectorEvents[vectidx])
-			    > (mrpdu_msg_eof - 3))
-				goto oops;
-		}
-
-		/* handle any trailers */
-		vectevt_idx = 0;
-		vectevt[0] = 0;
-		vectevt[1] = 0;
-		vectevt[2] = 0;
-		vectevt[3] = 0;
-		while (listen_declare_idx < listen_declare_end) {
-			vectevt[vectevt_idx] =
-			    listen_declare[listen_declare_idx];
-			listen_declare_idx++;
-			vectevt_idx++;
-		}
-		if (vectevt_idx) {
-			vect_4pack = MRPDU_4PACK_ENCODE(vectevt[0],
-							vectevt[1],
-							vectevt[2], vectevt[3]);
-
-			mrpdu_vectorptr->FirstValue_VectorEvents[vectidx] =
-			    vect_4pack;
-			vectidx++;
-		}
+		vectidx += mrpdu_4pack_encode(listen_declare,
+					      listen_declare_idx,
+					      &(mrpdu_vectorptr->
+						FirstValue_VectorEvents[vectidx]));
 
 		if (&(mrpdu_vectorptr->FirstValue_VectorEvents[vectidx]) >
 		    (mrpdu_msg_eof - MRPDU_ENDMARK_SZ))
@@ -2754,7 +2992,7 @@ msrp_emit_listenvectors(unsigned char *msgbuf, unsigned char *msgbuf_eof,
 		mrpdu_msg_ptr =
 		    &(mrpdu_vectorptr->FirstValue_VectorEvents[vectidx]);
 
-		attrib = attrib->next;
+		attrib = msrp_tx_next(attrib);
 
 		mrpdu_vectorptr = (mrpdu_vectorattrib_t *) mrpdu_msg_ptr;
 	}
@@ -2805,8 +3043,50 @@ msrp_emit_listenvectors(unsigned char *msgbuf, unsigned char *msgbuf_eof,
 	return -1;
 }
 
+static int msrp_emit_vectors(unsigned char *msgbuf, unsigned char *msgbuf_eof,
+			     int *bytes_used, int lva, unsigned int type)
+{
+	switch (type) {
+	case MSRP_LISTENER_TYPE:
+		return msrp_emit_listenvectors(msgbuf, msgbuf_eof, bytes_used,
+					       lva);
+	case MSRP_DOMAIN_TYPE:
+		return msrp_emit_domainvectors(msgbuf, msgbuf_eof, bytes_used,
+					       lva);
+	default:
+		return msrp_emit_talkervectors(msgbuf, msgbuf_eof, bytes_used,
+					       lva, type);
+	}
+}
+
+/* is anything on the pending transmit set still waiting to be encoded? */
+static int msrp_tx_remaining(void)
+{
+	struct msrp_attribute *attrib;
+
+	for (attrib = msrp_tx_next(NULL); NULL != attrib;
+	     attrib = msrp_tx_next(attrib)) {
+		if (attrib->applicant.tx)
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Encode the pending transmit set into as many PDUs as it takes. Each
+ * frame is filled across all attribute types in turn, and whatever did not
+ * fit keeps its tx flag and is resumed at the start of the next frame. The
+ * LeaveAll is signalled once per attribute type, in the first frame that
+ * carries a vector of that type.
+ */
 int msrp_txpdu(void)
 {
+	static const unsigned int types[] = {
+		MSRP_TALKER_ADV_TYPE,
+		MSRP_TALKER_FAILED_TYPE,
+		MSRP_LISTENER_TYPE,
+		MSRP_DOMAIN_TYPE
+	};
 	unsigned char *msgbuf, *msgbuf_wrptr;
 	int msgbuf_len;
 	int bytes = 0;
@@ -2814,96 +3094,137 @@ int msrp_txpdu(void)
 	mrpdu_t *mrpdu;
 	unsigned char *mrpdu_msg_ptr;
 	unsigned char *mrpdu_msg_eof;
-	int rc;
-	int lva = 0;
-
-	msgbuf = (unsigned char *)malloc(MAX_FRAME_SIZE);
-	if (NULL == msgbuf)
-		return -1;
-	memset(msgbuf, 0, MAX_FRAME_SIZE);
-	msgbuf_len = 0;
-
-	msgbuf_wrptr = msgbuf;
-
-	eth = (eth_hdr_t *) msgbuf_wrptr;
-
-	/* note that MSRP frames should always be untagged (no vlan) */
-	eth->typelen = htons(MSRP_ETYPE);
-	memcpy(eth->destaddr, MSRP_ADDR, sizeof(eth->destaddr));
-	memcpy(eth->srcaddr, STATION_ADDR, sizeof(eth->srcaddr));
-
-	msgbuf_wrptr += sizeof(eth_hdr_t);
-
-	mrpdu = (mrpdu_t *) msgbuf_wrptr;
-
-	mrpdu->ProtocolVersion = MSRP_PROT_VER;
-	mrpdu_msg_ptr = MRPD_GET_MRPDU_MESSAGE_LIST(mrpdu);
-	mrpdu_msg_eof = (unsigned char *)msgbuf + MAX_FRAME_SIZE;
+	int send_empty_LeaveAll;
+	int lva_pending = 0;
+	int ntypes = sizeof(types) / sizeof(types[0]);
+	int rc = 0;
+	int i;
 
 	if (MSRP_db->mrp_db.lva.tx) {
-		lva = 1;
+		lva_pending = (1 << ntypes) - 1;
 		MSRP_db->mrp_db.lva.tx = 0;
 	}
+	send_empty_LeaveAll = MSRP_db->send_empty_LeaveAll_flag;
 
-	rc = msrp_emit_talkervectors(mrpdu_msg_ptr, mrpdu_msg_eof, &bytes, lva, MSRP_TALKER_ADV_TYPE);
-	if (-1 == rc)
-		goto out;
+	do {
+		msgbuf = msrp_tx_frame;
+		memset(msgbuf, 0, MAX_FRAME_SIZE);
+		msgbuf_len = 0;
 
-	mrpdu_msg_ptr += bytes;
+		msgbuf_wrptr = msgbuf;
 
-	rc = msrp_emit_talkervectors(mrpdu_msg_ptr, mrpdu_msg_eof, &bytes, lva, MSRP_TALKER_FAILED_TYPE);
-	if (-1 == rc)
-		goto out;
+		eth = (eth_hdr_t *) msgbuf_wrptr;
 
-	mrpdu_msg_ptr += bytes;
+		/* note that MSRP frames should always be untagged (no vlan) */
+		eth->typelen = htons(MSRP_ETYPE);
+		memcpy(eth->destaddr, MSRP_ADDR, sizeof(eth->destaddr));
+		memcpy(eth->srcaddr, STATION_ADDR, sizeof(eth->srcaddr));
 
-	if (mrpdu_msg_ptr >= (mrpdu_msg_eof - MRPDU_ENDMARK_SZ))
-		goto out;
+		msgbuf_wrptr += sizeof(eth_hdr_t);
 
-	rc = msrp_emit_listenvectors(mrpdu_msg_ptr, mrpdu_msg_eof, &bytes, lva);
-	if (-1 == rc)
-		goto out;
+		mrpdu = (mrpdu_t *) msgbuf_wrptr;
 
-	mrpdu_msg_ptr += bytes;
+		mrpdu->ProtocolVersion = MSRP_PROT_VER;
+		mrpdu_msg_ptr = MRPD_GET_MRPDU_MESSAGE_LIST(mrpdu);
+		/* keep room for the endmark of the PDU itself */
+		mrpdu_msg_eof = (unsigned char *)msgbuf + MAX_FRAME_SIZE -
+		    MRPDU_ENDMARK_SZ;
 
-	rc = msrp_emit_domainvectors(mrpdu_msg_ptr, mrpdu_msg_eof, &bytes, lva);
-	if (-1 == rc)
-		goto out;
+		for (i = 0; i < ntypes; i++) {
+			/* an empty LeaveAll is only owed once per type too */
+			MSRP_db->send_empty_LeaveAll_flag = send_empty_LeaveAll &&
+			    (lva_pending & (1 << i));
 
-	mrpdu_msg_ptr += bytes;
+			rc = msrp_emit_vectors(mrpdu_msg_ptr, mrpdu_msg_eof,
+					       &bytes, lva_pending & (1 << i),
+					       types[i]);
+			if (-1 == rc)
+				goto out;
 
-	if (mrpdu_msg_ptr == MRPD_GET_MRPDU_MESSAGE_LIST(mrpdu)) {
-		goto out;	/* nothing to send */
-	}
+			if (bytes)
+				lva_pending &= ~(1 << i);
+			mrpdu_msg_ptr += bytes;
+		}
 
-	/* endmark */
-	if (mrpdu_msg_ptr < (mrpdu_msg_eof - MRPDU_ENDMARK_SZ)) {
+		if (mrpdu_msg_ptr == MRPD_GET_MRPDU_MESSAGE_LIST(mrpdu))
+			break;	/* nothing (more) to send */
+
+		/* endmark */
 		*mrpdu_msg_ptr = 0;
 		mrpdu_msg_ptr++;
 		*mrpdu_msg_ptr = 0;
 		mrpdu_msg_ptr++;
-	} else
-		goto out;
 
-	msgbuf_len = mrpdu_msg_ptr - msgbuf;
+		msgbuf_len = mrpdu_msg_ptr - msgbuf;
 
-	bytes = mrpd_send(msrp_socket, msgbuf, msgbuf_len, 0);
+		bytes = mrpd_send(msrp_socket, msgbuf, msgbuf_len, 0);
 #if LOG_MSRP
-	mrpd_log_printf("MSRP send PDU\n");
+		mrpd_log_printf("MSRP send PDU\n");
 #endif
-	if (bytes <= 0) {
+		if (bytes <= 0) {
 #if LOG_ERRORS
-		fprintf(stderr, "%s - Error on send %s", __FUNCTION__, strerror(errno));
+			fprintf(stderr, "%s - Error on send %s", __FUNCTION__,
+				strerror(errno));
 #endif
-		goto out;
-	}
+			MRP_STAT_INC(MSRP_db->mrp_db.stats.pdu_tx_errors);
+			rc = -1;
+			goto out;
+		}
+		MRP_STAT_INC(MSRP_db->mrp_db.stats.pdu_tx);
+	} while (msrp_tx_remaining());
 
-	free(msgbuf);
-	return 0;
  out:
-	free(msgbuf);
-	/* caller should assume TXLAF */
-	return -1;
+	MSRP_db->send_empty_LeaveAll_flag = send_empty_LeaveAll;
+	/* on error the caller should assume TXLAF */
+	return rc;
+}
+
+static void msrp_notify_rec(struct msrp_attribute *attrib, int notify,
+			    struct mrpd_notify_rec *rec)
+{
+	memset(rec, 0, sizeof(*rec));
+	rec->notify = (uint8_t)notify;
+	rec->type = (uint8_t)attrib->type;
+	rec->applicant_state = (uint8_t)attrib->applicant.mrp_state;
+	rec->registrar_state = (uint8_t)attrib->registrar.mrp_state;
+	memcpy(rec->registrar, attrib->registrar.macaddr, sizeof(rec->registrar));
+
+	if (MSRP_LISTENER_TYPE == attrib->type) {
+		memcpy(rec->u.listener.stream_id,
+		       attrib->attribute.talk_listen.StreamID,
+		       sizeof(rec->u.listener.stream_id));
+		rec->u.listener.substate = (uint8_t)attrib->substate;
+	} else if (MSRP_DOMAIN_TYPE == attrib->type) {
+		rec->u.domain.class_id = attrib->attribute.domain.SRclassID;
+		rec->u.domain.priority = attrib->attribute.domain.SRclassPriority;
+		rec->u.domain.vid = htons(attrib->attribute.domain.SRclassVID);
+		rec->u.domain.neighbor_priority =
+		    attrib->attribute.domain.neighborSRclassPriority;
+	} else {
+		memcpy(rec->u.talker.stream_id,
+		       attrib->attribute.talk_listen.StreamID,
+		       sizeof(rec->u.talker.stream_id));
+		memcpy(rec->u.talker.dest_addr,
+		       attrib->attribute.talk_listen.DataFrameParameters.Dest_Addr,
+		       sizeof(rec->u.talker.dest_addr));
+		rec->u.talker.vid =
+		    htons(attrib->attribute.talk_listen.DataFrameParameters.Vlan_ID);
+		rec->u.talker.max_frame_size =
+		    htons(attrib->attribute.talk_listen.TSpec.MaxFrameSize);
+		rec->u.talker.max_interval_frames =
+		    htons(attrib->attribute.talk_listen.TSpec.MaxIntervalFrames);
+		rec->u.talker.accumulated_latency =
+		    htonl(attrib->attribute.talk_listen.AccumulatedLatency);
+		rec->u.talker.priority_and_rank =
+		    attrib->attribute.talk_listen.PriorityAndRank;
+		if (MSRP_TALKER_FAILED_TYPE == attrib->type) {
+			memcpy(rec->u.talker.bridge_id,
+			       attrib->attribute.talk_listen.FailureInformation.BridgeID,
+			       sizeof(rec->u.talker.bridge_id));
+			rec->u.talker.failure_code =
+			    attrib->attribute.talk_listen.FailureInformation.FailureCode;
+		}
+	}
 }
 
 int msrp_send_notifications(struct msrp_attribute *attrib, int notify)
@@ -2914,10 +3235,31 @@ int msrp_send_notifications(struct msrp_attribute *attrib, int notify)
 	char mrp_state[8];
 	client_t *client;
 	size_t sub_str_len = 128;
+	struct mrpd_notify_rec rec;
+	uint64_t key = 0;
+	int i;
 
 	if (NULL == attrib)
 		return -1;
 
+	if ((MRP_NOTIFY_NEW != notify) && (MRP_NOTIFY_JOIN != notify) &&
+	    (MRP_NOTIFY_LV != notify))
+		return 0;
+
+	/* talkers and listeners are keyed by StreamID */
+	if (MSRP_DOMAIN_TYPE != attrib->type) {
+		for (i = 0; i < 8; i++)
+			key = (key << 8) |
+			    attrib->attribute.talk_listen.StreamID[i];
+	}
+	if (0 == mrp_client_match(&MSRP_db->mrp_db, attrib->type,
+				  MSRP_DOMAIN_TYPE != attrib->type, key))
+		return 0;	/* nobody subscribed */
+
+	msrp_notify_rec(attrib, notify, &rec);
+	if (0 == mrp_client_notify_post(&MSRP_db->mrp_db, &rec))
+		return 0;	/* no text clients, skip formatting */
+
 	msgbuf = (char *)malloc(MAX_MRPD_CMDSZ);
 	if (NULL == msgbuf)
 		return -1;
@@ -3065,10 +3407,12 @@ int msrp_send_notifications(struct msrp_attribute *attrib, int notify)
 		break;
 	}
 
-	client = MSRP_db->mrp_db.clients;
-	while (NULL != client) {
+	for (i = 0; i < MSRP_db->mrp_db.notify_set_count; i++) {
+		client = MSRP_db->mrp_db.notify_set[i];
+		if (client->flags & MRP_CLIENT_BINARY)
+			continue;
 		mrpd_send_ctl_msg(&(client->client), msgbuf, MAX_MRPD_CMDSZ);
-		client = client->next;
+		MRP_STAT_INC(MSRP_db->mrp_db.stats.notify_sent);
 	}
 
  free_msgbuf:
@@ -3080,7 +3424,31 @@ int msrp_send_notifications(struct msrp_attribute *attrib, int notify)
 	return 0;
 }
 
-int msrp_dumptable(struct sockaddr_in *client)
+/* a talker or listener for one of the StreamIDs of a bulk query */
+static int msrp_dump_match(struct msrp_attribute *attrib,
+			   struct msrp_cmd_record *recs, int nrecs)
+{
+	int i;
+
+	if (MSRP_DOMAIN_TYPE == attrib->type)
+		return 0;
+
+	for (i = 0; i < nrecs; i++) {
+		if (0 == memcmp(attrib->attribute.talk_listen.StreamID,
+				recs[i].talker.StreamID,
+				sizeof(recs[i].talker.StreamID)))
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * The whole database, or only the streams in recs if nrecs is not 0,
+ * starting with entry 'offset'. A full message ends with the offset
+ * the next page starts at.
+ */
+static int msrp_dump(struct sockaddr_in *client,
+		     struct msrp_cmd_record *recs, int nrecs, int offset)
 {
 	char *msgbuf;
 	char *msgbuf_wrptr;
@@ -3089,6 +3457,7 @@ int msrp_dumptable(struct sockaddr_in *client)
 	char *regsrc;
 	struct msrp_attribute *attrib;
 	char mrp_state[8];
+	int index = 0;
 
 	msgbuf = (char *)malloc(MAX_MRPD_CMDSZ);
 	if (NULL == msgbuf)
@@ -3108,11 +3477,13 @@ int msrp_dumptable(struct sockaddr_in *client)
 	msgbuf_wrptr = msgbuf;
 
 	attrib = MSRP_db->attrib_list;
-	if (attrib == NULL) {
-		sprintf(msgbuf, "MSRP:Empty\n");
-	}
 
 	while (NULL != attrib) {
+		if ((nrecs && !msrp_dump_match(attrib, recs, nrecs)) ||
+		    (index++ < offset)) {
+			attrib = attrib->next;
+			continue;
+		}
 		if (MSRP_LISTENER_TYPE == attrib->type) {
 			sprintf(variant,
 				"L:D=%d,S=%02x%02x%02x%02x%02x%02x%02x%02x",
@@ -3203,11 +3574,20 @@ int msrp_dumptable(struct sockaddr_in *client)
 
 		sprintf(stage, "%s %s\n", variant, regsrc);
 
+		if (msgbuf_wrptr + strlen(stage) >=
+		    msgbuf + MAX_MRPD_CMDSZ - MRP_DUMP_TRAILER_SZ) {
+			sprintf(msgbuf_wrptr, "MSRP:More O=%d\n", index - 1);
+			msgbuf_wrptr += strlen(msgbuf_wrptr);
+			break;
+		}
 		sprintf(msgbuf_wrptr, "%s", stage);
 		msgbuf_wrptr += strlen(stage);
 		attrib = attrib->next;
 	}
 
+	if (msgbuf_wrptr == msgbuf)
+		sprintf(msgbuf, "MSRP:Empty\n");
+
 	mrpd_send_ctl_msg(client, msgbuf, MAX_MRPD_CMDSZ);
 
  free_msgbuf:
@@ -3222,6 +3602,11 @@ int msrp_dumptable(struct sockaddr_in *client)
 
 }
 
+int msrp_dumptable(struct sockaddr_in *client)
+{
+	return msrp_dump(client, NULL, 0, 0);
+}
+
 /* S+? - (re)JOIN a stream */
 /* S++ - NEW a stream      */
 static int msrp_cmd_parse_join_or_new_stream(char *buf, int buflen,
@@ -3447,6 +3832,204 @@ static int msrp_cmd_report_domain_status(struct msrpdu_domain *domain,
 	return 0;
 }
 
+/* S+F:T=3 or S+F:S=<StreamID> - narrow the notifications */
+static int msrp_cmd_filter(char *buf, int buflen, struct sockaddr_in *client,
+			   int *err_index)
+{
+	uint8_t type;
+	uint64_t stream_id;
+	struct parse_param type_specs[] = {
+		{"T" PARSE_ASSIGN, parse_u8, &type},
+		{0, parse_null, 0}
+	};
+	struct parse_param stream_specs[] = {
+		{"S" PARSE_ASSIGN, parse_h64, &stream_id},
+		{0, parse_null, 0}
+	};
+
+	if (buflen < 7)
+		return -1;
+
+	if (strstr(buf + 4, "T" PARSE_ASSIGN)) {
+		if (parse(buf + 4, buflen - 4, type_specs, err_index))
+			return -1;
+		return mrp_client_filter_type(&MSRP_db->mrp_db, client, type);
+	}
+	if (parse(buf + 4, buflen - 4, stream_specs, err_index))
+		return -1;
+	return mrp_client_filter_key(&MSRP_db->mrp_db, client, stream_id,
+				     stream_id);
+}
+
+static int msrp_cmd_is_bulk(char *buf, int buflen)
+{
+	static const char *const cmds[] = {
+		"S??", "S++", "S+?", "S--", "S+L", "S-L", "S+D", "S-D"
+	};
+	unsigned int i;
+
+	if ((buflen <= 4) || (NULL == strchr(buf + 4, PARSE_RECORD_SEPARATOR)))
+		return 0;
+
+	for (i = 0; i < sizeof(cmds) / sizeof(cmds[0]); i++) {
+		if (strncmp(buf, cmds[i], 3) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+static int msrp_cmd_parse_record(char *buf, int buflen,
+				 struct msrp_cmd_record *rec, int *err_index)
+{
+	if ((strncmp(buf, "S++", 3) == 0) || (strncmp(buf, "S+?", 3) == 0)) {
+		if (strstr(buf, "B=")) {
+			rec->attrib_type = MSRP_TALKER_FAILED_TYPE;
+			return msrp_cmd_parse_join_or_new_stream_failure(buf,
+					buflen, &rec->talker, err_index);
+		}
+		rec->attrib_type = MSRP_TALKER_ADV_TYPE;
+		return msrp_cmd_parse_join_or_new_stream(buf, buflen,
+							 &rec->talker,
+							 err_index);
+	}
+	if ((strncmp(buf, "S--", 3) == 0) || (strncmp(buf, "S??", 3) == 0)) {
+		rec->attrib_type = MSRP_TALKER_ADV_TYPE;
+		return msrp_cmd_parse_leave_stream(buf, buflen, &rec->talker,
+						   err_index);
+	}
+	if (strncmp(buf, "S+L", 3) == 0) {
+		rec->attrib_type = MSRP_LISTENER_TYPE;
+		return msrp_cmd_parse_report_listener_status(buf, buflen,
+							     &rec->talker,
+							     &rec->substate,
+							     err_index);
+	}
+	if (strncmp(buf, "S-L", 3) == 0) {
+		rec->attrib_type = MSRP_LISTENER_TYPE;
+		return msrp_cmd_parse_withdraw_listener_status(buf, buflen,
+							       &rec->talker,
+							       err_index);
+	}
+	/* S+D and S-D */
+	rec->attrib_type = MSRP_DOMAIN_TYPE;
+	return msrp_cmd_parse_domain_status(buf, buflen, &rec->domain,
+					    err_index);
+}
+
+static int msrp_cmd_apply_record(char *buf, struct msrp_cmd_record *rec)
+{
+	if (strncmp(buf, "S++", 3) == 0)
+		return msrp_cmd_join_or_new_stream(&rec->talker,
+						   rec->attrib_type,
+						   MRP_EVENT_NEW);
+	if (strncmp(buf, "S+?", 3) == 0)
+		return msrp_cmd_join_or_new_stream(&rec->talker,
+						   rec->attrib_type,
+						   MRP_EVENT_JOIN);
+	if (strncmp(buf, "S--", 3) == 0)
+		return msrp_cmd_leave_stream(&rec->talker);
+	if (strncmp(buf, "S+L", 3) == 0)
+		return msrp_cmd_report_listener_status(&rec->talker,
+						       rec->substate);
+	if (strncmp(buf, "S-L", 3) == 0)
+		return msrp_cmd_withdraw_listener_status(&rec->talker);
+	return msrp_cmd_report_domain_status(&rec->domain, '+' == buf[1]);
+}
+
+/* database order, records of the same stream keep their command order */
+static int msrp_cmd_record_cmp(const void *a, const void *b)
+{
+	const struct msrp_cmd_record *ra = a;
+	const struct msrp_cmd_record *rb = b;
+	int rc;
+
+	if (ra->attrib_type != rb->attrib_type)
+		return ra->attrib_type - rb->attrib_type;
+	if (MSRP_DOMAIN_TYPE == ra->attrib_type)
+		rc = memcmp(&ra->domain, &rb->domain, sizeof(ra->domain));
+	else
+		rc = memcmp(ra->talker.StreamID, rb->talker.StreamID,
+			    sizeof(ra->talker.StreamID));
+	if (rc)
+		return rc;
+	return ra->index - rb->index;
+}
+
+/*
+ * S??, S++, S+?, S--, S+L, S-L, S+D and S-D with several ';' separated
+ * records, e.g. "S--:S=0011223344556677;S=0011223344556678". All records
+ * are parsed before any is applied, the local notifications go out in
+ * one sweep and the client gets one "OK+ N=<records>" - or a single
+ * dump of the listed streams for S??. The records are applied in
+ * StreamID order, so new streams merge into the sorted database in a
+ * single pass instead of one list walk each.
+ */
+static int msrp_cmd_bulk(char *buf, int buflen, struct sockaddr_in *client)
+{
+	struct msrp_cmd_record *recs;
+	char rec[MAX_MRPD_CMDSZ];
+	char respbuf[32];
+	int nrecs;
+	int err_index;
+	int reclen;
+	int count = 0;
+	int pos = 4;
+	int rc = 0;
+	int i;
+
+	nrecs = 1;
+	for (i = 4; (i < buflen) && buf[i]; i++)
+		if (PARSE_RECORD_SEPARATOR == buf[i])
+			nrecs++;
+
+	recs = malloc(nrecs * sizeof(*recs));
+	if (NULL == recs) {
+		snprintf(respbuf, sizeof(respbuf) - 1, "ERI N=0");
+		goto out;
+	}
+
+	for (i = 0; i < nrecs; i++) {
+		reclen = parse_next_record(buf, buflen, 4, &pos, rec,
+					   sizeof(rec));
+		if (reclen <= 0)
+			break;
+		if (msrp_cmd_parse_record(rec, reclen, &recs[i], &err_index))
+			break;
+		recs[i].index = i;
+	}
+	if (i < nrecs) {
+		/* nothing has been applied */
+		snprintf(respbuf, sizeof(respbuf) - 1, "ERP R=%d", i);
+		rc = -1;
+		goto out;
+	}
+
+	if (strncmp(buf, "S??", 3) == 0) {
+		rc = msrp_dump(client, recs, nrecs, 0);
+		free(recs);
+		return rc;
+	}
+
+	qsort(recs, nrecs, sizeof(*recs), msrp_cmd_record_cmp);
+
+	msrp_notify_deferred = 1;
+	for (i = 0; i < nrecs; i++) {
+		rc = msrp_cmd_apply_record(buf, &recs[i]);
+		if (rc)
+			break;
+		count++;
+	}
+	msrp_notify_deferred = 0;
+	msrp_notify_pending();
+
+	snprintf(respbuf, sizeof(respbuf) - 1, "%s N=%d", rc ? "ERI" : "OK+",
+		 count);
+ out:
+	free(recs);
+	mrpd_send_ctl_msg(client, respbuf, sizeof(respbuf));
+	return rc;
+}
+
 int msrp_recv_cmd(char *buf, int buflen, struct sockaddr_in *client)
 {
 	int rc;
@@ -3464,7 +4047,9 @@ int msrp_recv_cmd(char *buf, int buflen, struct sockaddr_in *client)
 		goto out;
 	}
 
-	rc = mrp_client_add(&(MSRP_db->mrp_db.clients), client);
+	rc = mrp_client_add(&(MSRP_db->mrp_db), client);
+	if (rc)
+		goto out_ERI;
 
 	if (buflen < 3)
 		return -1;
@@ -3473,7 +4058,7 @@ int msrp_recv_cmd(char *buf, int buflen, struct sockaddr_in *client)
 		return -1;
 
 	/*
-	 * S?? - query MSRP Registrar database
+	 * S?? - query MSRP Registrar database, S??:O=<n> from entry n on
 	 * S+? - (re)JOIN a stream
 	 * S++   NEW a stream
 	 * S-- - LV a stream
@@ -3481,10 +4066,41 @@ int msrp_recv_cmd(char *buf, int buflen, struct sockaddr_in *client)
 	 * S-L   Withdraw a listener status
 	 * S+D   Report a domain status
 	 * S-D   Withdraw a domain status
+	 * S+B   Send notifications to this client in binary form
+	 * S-B   Send notifications to this client as text (default)
+	 * S+F   Only notify this client of an attribute type or StreamID
+	 * S-F   Remove the notification filters of this client
+	 * S?A   Report the occupancy of the MSRP attribute slab
+	 * S?T   Report the transmit opportunities taken and held back
+	 *
+	 * S??, S++, S+?, S--, S+L, S-L, S+D and S-D also take several
+	 * records separated by ';', answered with one response.
 	 */
 
-	if (strncmp(buf, "S??", 3) == 0) {
-		msrp_dumptable(client);
+	if (msrp_cmd_is_bulk(buf, buflen)) {
+		return msrp_cmd_bulk(buf, buflen, client);
+	} else if (strncmp(buf, "S??", 3) == 0) {
+		rc = mrp_dump_offset(buf, buflen);
+		if (rc < 0)
+			goto out_ERP;
+		msrp_dump(client, NULL, 0, rc);
+	} else if (strncmp(buf, "S?A", 3) == 0) {
+		mrp_slab_report(&msrp_slab, "MSRP", client);
+	} else if (strncmp(buf, "S?T", 3) == 0) {
+		mrp_tx_report(&(MSRP_db->mrp_db), "MSRP", client);
+
+	} else if ((strncmp(buf, "S+B", 3) == 0)
+		   || (strncmp(buf, "S-B", 3) == 0)) {
+		rc = mrp_client_set_binary(&(MSRP_db->mrp_db), client,
+					   'S', '+' == buf[1]);
+		if (rc)
+			goto out_ERI;
+	} else if (strncmp(buf, "S+F", 3) == 0) {
+		rc = msrp_cmd_filter(buf, buflen, client, &err_index);
+		if (rc)
+			goto out_ERP;
+	} else if (strncmp(buf, "S-F", 3) == 0) {
+		mrp_client_filter_clear(&MSRP_db->mrp_db, client);
 
 	} else if (strncmp(buf, "S-L", 3) == 0) {
 
@@ -3672,15 +4288,18 @@ void msrp_reset(void)
 	while (NULL != sattrib) {
 		free_sattrib = sattrib;
 		sattrib = sattrib->next;
-		free(free_sattrib);
+		msrp_free(free_sattrib);
     }
+	free(MSRP_db->attrib_hash);
 	free(MSRP_db);
 }
 
 void msrp_bye(struct sockaddr_in *client)
 {
-	if (NULL != MSRP_db)
-		mrp_client_delete(&(MSRP_db->mrp_db.clients), client);
+	if (NULL != MSRP_db) {
+		mrp_client_filter_clear(&MSRP_db->mrp_db, client);
+		mrp_client_delete(&(MSRP_db->mrp_db), client);
+	}
 }
 
 static struct msrp_attribute *msrp_conditional_reclaim(struct msrp_attribute *sattrib)
@@ -3697,6 +4316,8 @@ static struct msrp_attribute *msrp_conditional_reclaim(struct msrp_attribute *sa
 			MSRP_db->attrib_list = sattrib->next;
 		if (NULL != sattrib->next)
 			sattrib->next->prev = sattrib->prev;
+		msrp_hash_remove(sattrib);
+		mrp_lvtimer_stop(&(MSRP_db->mrp_db), &(sattrib->registrar));
 		free_sattrib = sattrib;
 		sattrib = sattrib->next;
 #if LOG_MSRP_GARBAGE_COLLECTION
@@ -3705,7 +4326,8 @@ static struct msrp_attribute *msrp_conditional_reclaim(struct msrp_attribute *sa
 				free_sattrib, sattrib);
 #endif
 		msrp_send_notifications(free_sattrib, MRP_NOTIFY_LV);
-		free(free_sattrib);
+		msrp_map_propagate(free_sattrib);
+		msrp_free(free_sattrib);
 		return sattrib;
 	} else {
 		return sattrib->next;
@@ -3713,16 +4335,78 @@ static struct msrp_attribute *msrp_conditional_reclaim(struct msrp_attribute *sa
 
 }
 
+/* returns the number of candidates left for the next tick */
 int msrp_reclaim(void)
 {
-	struct msrp_attribute *sattrib;
+	struct mrp_gc_link *link;
+	int budget = MRP_GC_BUDGET;
 
 	if (NULL == MSRP_db)
 		return 0;
 
-	sattrib = MSRP_db->attrib_list;
-	while (NULL != sattrib) {
-		sattrib = msrp_conditional_reclaim(sattrib);
+	while (budget-- && (NULL != (link = mrp_gc_pop(&(MSRP_db->mrp_db)))))
+		msrp_conditional_reclaim(MRP_GC_OWNER(link,
+						      struct msrp_attribute));
+
+	return MSRP_db->mrp_db.gc_count;
+}
+
+/* add the attributes worth keeping to a checkpoint, see mrpd -c */
+int msrp_snapshot(struct mrp_snapshot *snap)
+{
+	struct msrp_attribute *attrib;
+	struct mrp_snapshot_rec *rec;
+
+	if (NULL == MSRP_db)
+		return 0;
+
+	snap->app = 'S';
+	for (attrib = MSRP_db->attrib_list; NULL != attrib;
+	     attrib = attrib->next) {
+		if (mrp_reclaimable(&(attrib->applicant), &(attrib->registrar)))
+			continue;
+		rec = mrp_snapshot_attrib(snap, &(attrib->applicant),
+					  &(attrib->registrar), attrib->type,
+					  &(attrib->attribute),
+					  sizeof(attrib->attribute));
+		if (NULL == rec)
+			return -1;
+		rec->substate = attrib->substate;
+		rec->direction = attrib->direction;
+		rec->map_declared = attrib->map_declared;
+	}
+
+	return mrp_snapshot_clients(snap, &(MSRP_db->mrp_db));
+}
+
+int msrp_restore(const struct mrp_snapshot_rec *rec, int fresh)
+{
+	struct msrp_attribute *attrib;
+
+	if (NULL == MSRP_db)
+		return -1;
+
+	if (MRP_SNAP_ATTRIB != rec->kind)
+		return mrp_restore_client(&(MSRP_db->mrp_db), rec);
+
+	if (!mrp_restore_wanted(rec, fresh))
+		return 0;
+
+	attrib = msrp_alloc();
+	if (NULL == attrib)
+		return -1;
+
+	attrib->type = rec->type;
+	memcpy(&(attrib->attribute), rec->u.value, sizeof(attrib->attribute));
+	attrib->substate = rec->substate;
+	attrib->direction = rec->direction;
+	attrib->map_declared = rec->map_declared;
+
+	if ((NULL != msrp_lookup(attrib)) || (msrp_add(attrib) < 0)) {
+		msrp_free(attrib);
+		return 0;
 	}
+	mrp_restore_attrib(&(MSRP_db->mrp_db), rec, &(attrib->applicant),
+			   &(attrib->registrar), fresh);
 	return 0;
 }
@@ -147,6 +147,7 @@ struct msrp_attribute {
 	} attribute;
 	uint32_t substate;	/*for listener events */
 	uint32_t direction;	/*for listener events */
+	uint32_t map_declared;	/* declared on behalf of another port */
 	mrp_applicant_attribute_t applicant;
 	mrp_registrar_attribute_t registrar;
 };
@@ -155,6 +156,11 @@ struct msrp_database {
 	struct mrp_database mrp_db;
 	struct msrp_attribute *attrib_list;
 	int send_empty_LeaveAll_flag;
+	/* open addressing index of attrib_list by type and StreamID/class */
+	struct msrp_attribute **attrib_hash;
+	unsigned int attrib_hash_size;	/* power of 2 */
+	unsigned int attrib_count;
+	struct msrp_attribute *add_hint;	/* where the last add stopped */
 };
 
 int msrp_init(int msrp_enable);
@@ -163,8 +169,12 @@ int msrp_event(int event, struct msrp_attribute *rattrib);
 int msrp_recv_cmd(char *buf, int buflen, struct sockaddr_in *client);
 int msrp_send_notifications(struct msrp_attribute *attrib, int notify);
 int msrp_reclaim(void);
+int msrp_snapshot(struct mrp_snapshot *snap);
+int msrp_restore(const struct mrp_snapshot_rec *rec, int fresh);
 void msrp_bye(struct sockaddr_in *client);
 int msrp_recv_msg(void);
+struct msrp_attribute *msrp_alloc(void);
+void msrp_free(struct msrp_attribute *attrib);
 
 #ifdef MRP_CPPUTEST
 struct msrp_attribute *msrp_lookup(struct msrp_attribute *rattrib);
@@ -51,11 +51,26 @@ int mvrp_txpdu(void);
 unsigned char MVRP_CUSTOMER_BRIDGE_ADDR[] = { 0x01, 0x80, 0xC2, 0x00, 0x00, 0x21 };	/* 81-00 */
 unsigned char MVRP_PROVIDER_BRIDGE_ADDR[] = { 0x01, 0x80, 0xC2, 0x00, 0x00, 0x0D };	/* 88-A8 */
 
-extern unsigned char STATION_ADDR[];
+extern MRPD_THREAD_LOCAL unsigned char STATION_ADDR[];
 
 /* global variables */
-SOCKET mvrp_socket;
-struct mvrp_database *MVRP_db;
+MRPD_THREAD_LOCAL SOCKET mvrp_socket;
+
+/* frame buffer reused by every transmitted PDU */
+static unsigned char mvrp_tx_frame[MAX_FRAME_SIZE];
+MRPD_THREAD_LOCAL struct mvrp_database *MVRP_db;
+
+/* attributes of all ports */
+static struct mrp_slab mvrp_slab = MRP_SLAB_INIT(struct mvrp_attribute);
+
+/* set while a bulk command applies its records, see mvrp_cmd_bulk() */
+static int mvrp_notify_deferred;
+
+/* an inclusive range of VIDs from a bulk command */
+struct mvrp_vid_range {
+	uint16_t lo;
+	uint16_t hi;
+};
 
 /* MVRP */
 #if LOG_MVRP && LOG_MRP
@@ -71,10 +86,193 @@ void mvrp_print_debug_info(int evt, const struct mvrp_attribute *attrib)
 }
 #endif
 
+static inline int mvrp_bit_first(unsigned long w)
+{
+#if defined(__GNUC__)
+	return __builtin_ctzl(w);
+#else
+	int n = 0;
+
+	while (0 == (w & 1UL)) {
+		w >>= 1;
+		n++;
+	}
+	return n;
+#endif
+}
+
+static inline int mvrp_bit_last(unsigned long w)
+{
+#if defined(__GNUC__)
+	return (int)MVRP_VID_MAP_BITS - 1 - __builtin_clzl(w);
+#else
+	int n = -1;
+
+	while (0 != w) {
+		w >>= 1;
+		n++;
+	}
+	return n;
+#endif
+}
+
+static inline int mvrp_vid_test(const unsigned long *map, int vid)
+{
+	return (map[vid / MVRP_VID_MAP_BITS] >>
+		(vid % MVRP_VID_MAP_BITS)) & 1UL;
+}
+
+/* lowest set VID at or above vid, MVRP_VID_TABLE_SIZE if none */
+static int mvrp_vid_next(const unsigned long *map, int vid)
+{
+	int idx;
+	unsigned long w;
+
+	if (vid >= MVRP_VID_TABLE_SIZE)
+		return MVRP_VID_TABLE_SIZE;
+
+	idx = vid / MVRP_VID_MAP_BITS;
+	w = map[idx] & (~0UL << (vid % MVRP_VID_MAP_BITS));
+	while (0 == w) {
+		if (++idx == MVRP_VID_MAP_WORDS)
+			return MVRP_VID_TABLE_SIZE;
+		w = map[idx];
+	}
+	return idx * MVRP_VID_MAP_BITS + mvrp_bit_first(w);
+}
+
+/* highest set VID below vid, -1 if none */
+static int mvrp_vid_prev(const unsigned long *map, int vid)
+{
+	int idx;
+	unsigned long w;
+
+	if (vid <= 0)
+		return -1;
+	if (vid > MVRP_VID_TABLE_SIZE)
+		vid = MVRP_VID_TABLE_SIZE;
+
+	vid--;
+	idx = vid / MVRP_VID_MAP_BITS;
+	w = map[idx] & (~0UL >> (MVRP_VID_MAP_BITS - 1 - vid % MVRP_VID_MAP_BITS));
+	while (0 == w) {
+		if (0 == idx--)
+			return -1;
+		w = map[idx];
+	}
+	return idx * MVRP_VID_MAP_BITS + mvrp_bit_last(w);
+}
+
+static void mvrp_vid_insert(struct mvrp_attribute *attrib)
+{
+	int vid = attrib->attribute;
+
+	if (vid >= MVRP_VID_TABLE_SIZE) {
+		MVRP_db->vid_overflow++;
+		return;
+	}
+	MVRP_db->vid_table[vid] = attrib;
+	MVRP_db->vid_map[vid / MVRP_VID_MAP_BITS] |=
+	    1UL << (vid % MVRP_VID_MAP_BITS);
+}
+
+static void mvrp_vid_remove(struct mvrp_attribute *attrib)
+{
+	int vid = attrib->attribute;
+
+	if (vid >= MVRP_VID_TABLE_SIZE) {
+		MVRP_db->vid_overflow--;
+		return;
+	}
+	MVRP_db->vid_table[vid] = NULL;
+	MVRP_db->vid_map[vid / MVRP_VID_MAP_BITS] &=
+	    ~(1UL << (vid % MVRP_VID_MAP_BITS));
+	MVRP_db->tx_map[vid / MVRP_VID_MAP_BITS] &=
+	    ~(1UL << (vid % MVRP_VID_MAP_BITS));
+}
+
+/* fold the pending transmit set into tx_map for bit-scanned run finding */
+/* pending transmit set order, by VID */
+static int mvrp_tx_cmp(mrp_applicant_attribute_t * a,
+		       mrp_applicant_attribute_t * b)
+{
+	return (int)MRP_APPLICANT_OWNER(a, struct mvrp_attribute)->attribute -
+	    (int)MRP_APPLICANT_OWNER(b, struct mvrp_attribute)->attribute;
+}
+
+static void mvrp_tx_map_load(void)
+{
+	mrp_applicant_attribute_t *app;
+	struct mvrp_attribute *attrib;
+	int vid;
+
+	memset(MVRP_db->tx_map, 0, sizeof(MVRP_db->tx_map));
+
+	app = MVRP_db->mrp_db.tx_pending;
+	while (NULL != app) {
+		attrib = MRP_APPLICANT_OWNER(app, struct mvrp_attribute);
+		vid = attrib->attribute;
+		if (app->tx && (vid < MVRP_VID_TABLE_SIZE))
+			MVRP_db->tx_map[vid / MVRP_VID_MAP_BITS] |=
+			    1UL << (vid % MVRP_VID_MAP_BITS);
+		app = app->tx_next;
+	}
+}
+
+/* first attribute at or above vid with a pending tx */
+static struct mvrp_attribute *mvrp_tx_first(int vid)
+{
+	mrp_applicant_attribute_t *app;
+	struct mvrp_attribute *attrib;
+	int tx_vid;
+
+	tx_vid = mvrp_vid_next(MVRP_db->tx_map, vid);
+	if (tx_vid < MVRP_VID_TABLE_SIZE)
+		return MVRP_db->vid_table[tx_vid];
+
+	if (0 == MVRP_db->vid_overflow)
+		return NULL;
+
+	app = MVRP_db->mrp_db.tx_pending;
+	while (NULL != app) {
+		attrib = MRP_APPLICANT_OWNER(app, struct mvrp_attribute);
+		if ((attrib->attribute >= vid) &&
+		    (attrib->attribute >= MVRP_VID_TABLE_SIZE) &&
+		    attrib->applicant.tx)
+			return attrib;
+		app = app->tx_next;
+	}
+	return NULL;
+}
+
+/* the attribute following attrib in VID order if it also has a pending tx */
+static struct mvrp_attribute *mvrp_tx_adjacent(struct mvrp_attribute *attrib)
+{
+	int vid = attrib->attribute + 1;
+
+	if (vid < MVRP_VID_TABLE_SIZE) {
+		if (mvrp_vid_test(MVRP_db->tx_map, vid))
+			return MVRP_db->vid_table[vid];
+		return NULL;
+	}
+
+	attrib = attrib->next;
+	if ((NULL != attrib) && attrib->applicant.tx &&
+	    (attrib->attribute == vid))
+		return attrib;
+	return NULL;
+}
+
 struct mvrp_attribute *mvrp_lookup(struct mvrp_attribute *rattrib)
 {
 	struct mvrp_attribute *attrib;
 
+	if (rattrib->attribute < MVRP_VID_TABLE_SIZE)
+		return MVRP_db->vid_table[rattrib->attribute];
+
+	if (0 == MVRP_db->vid_overflow)
+		return NULL;
+
 	attrib = MVRP_db->attrib_list;
 	while (NULL != attrib) {
 		if (attrib->attribute == rattrib->attribute)
@@ -88,9 +286,30 @@ int mvrp_add(struct mvrp_attribute *rattrib)
 {
 	struct mvrp_attribute *attrib;
 	struct mvrp_attribute *attrib_tail;
+	int vid;
 
 	/* XXX do a lookup first to guarantee uniqueness? */
 
+	mvrp_vid_insert(rattrib);
+
+	if (rattrib->attribute < MVRP_VID_TABLE_SIZE) {
+		/* stitch in after the nearest lower VID, no list walk needed */
+		vid = mvrp_vid_prev(MVRP_db->vid_map, rattrib->attribute);
+		if (vid < 0) {
+			rattrib->prev = NULL;
+			rattrib->next = MVRP_db->attrib_list;
+			MVRP_db->attrib_list = rattrib;
+		} else {
+			attrib = MVRP_db->vid_table[vid];
+			rattrib->prev = attrib;
+			rattrib->next = attrib->next;
+			attrib->next = rattrib;
+		}
+		if (NULL != rattrib->next)
+			rattrib->next->prev = rattrib;
+		return 0;
+	}
+
 	attrib_tail = attrib = MVRP_db->attrib_list;
 
 	while (NULL != attrib) {
@@ -152,16 +371,127 @@ int mvrp_merge(struct mvrp_attribute *rattrib)
 	return 0;
 }
 
+/*
+ * MAP context propagation between the bridge ports of mrpd: a VID
+ * registered on any port is declared on all the others. As in MSRP,
+ * see msrp_map_declare(), such declarations only drive the applicant.
+ */
+static int mvrp_map_registered(struct mvrp_attribute *key)
+{
+	struct mvrp_attribute *attrib;
+
+	if (NULL == MVRP_db)
+		return 0;
+
+	attrib = mvrp_lookup(key);
+
+	return (NULL != attrib) && mrp_registrar_in(&(attrib->registrar));
+}
+
+static void mvrp_map_declare(struct mvrp_attribute *key, int declare)
+{
+	struct mvrp_attribute *attrib;
+
+	attrib = mvrp_lookup(key);
+
+	if (!declare) {
+		if ((NULL == attrib) || !attrib->map_declared)
+			return;
+		attrib->map_declared = 0;
+		mrp_applicant_fsm(&(MVRP_db->mrp_db), &(attrib->applicant),
+				  MRP_EVENT_LV,
+				  mrp_registrar_in(&(attrib->registrar)));
+		mrp_jointimer_start(&(MVRP_db->mrp_db));
+		return;
+	}
+
+	if (NULL == attrib) {
+		attrib = mvrp_alloc();
+		if (NULL == attrib)
+			return;
+		attrib->attribute = key->attribute;
+		mvrp_add(attrib);
+	} else if (attrib->map_declared ||
+		   ((MRP_VO_STATE != attrib->applicant.mrp_state) &&
+		    (MRP_AO_STATE != attrib->applicant.mrp_state) &&
+		    (MRP_QO_STATE != attrib->applicant.mrp_state))) {
+		return;		/* declared already */
+	}
+
+	attrib->map_declared = 1;
+	mrp_applicant_fsm(&(MVRP_db->mrp_db), &(attrib->applicant),
+			  MRP_EVENT_JOIN,
+			  mrp_registrar_in(&(attrib->registrar)));
+	mrp_jointimer_start(&(MVRP_db->mrp_db));
+}
+
+static void mvrp_map_propagate(struct mvrp_attribute *attrib)
+{
+	struct mvrp_attribute key;
+	int reg_port[2] = { -1, -1 };
+	int self = mrpd_port_current();
+	int port;
+	int n = 0;
+	int i;
+
+	if (mrpd_port_count() < 2)
+		return;
+
+	memset(&key, 0, sizeof(key));
+	key.attribute = attrib->attribute;
+
+	/* a port declares what any port but itself registers */
+	for (port = 0; (port < mrpd_port_count()) && (n < 2); port++) {
+		mrpd_port_select(port);
+		if (mvrp_map_registered(&key))
+			reg_port[n++] = port;
+	}
+
+	for (port = 0; port < mrpd_port_count(); port++) {
+		mrpd_port_select(port);
+		if (NULL == MVRP_db)
+			continue;
+		i = (reg_port[0] == port) ? 1 : 0;
+		mvrp_map_declare(&key, reg_port[i] >= 0);
+	}
+	mrpd_port_select(self);
+}
+
+/* generate local notifications */
+static void mvrp_notify_pending(void)
+{
+	struct mvrp_attribute *attrib;
+
+	attrib = MVRP_db->attrib_list;
+
+	while (NULL != attrib) {
+		if (MRP_NOTIFY_NONE != attrib->registrar.notify) {
+			mvrp_send_notifications(attrib,
+						attrib->registrar.notify);
+			attrib->registrar.notify = MRP_NOTIFY_NONE;
+			mvrp_map_propagate(attrib);
+		}
+		attrib = attrib->next;
+	}
+}
+
 int mvrp_event(int event, struct mvrp_attribute *rattrib)
 {
 	struct mvrp_attribute *attrib;
-	int count = 0;
+	mrp_applicant_attribute_t *app;
+	mrp_registrar_attribute_t *reg, *next_reg;
 	int rc;
 
 #if LOG_MVRP
 	mrpd_log_printf("MVRP event %s\n", mrp_event_string(event));
 #endif
 
+	if ((MRP_EVENT_TX == event) || (MRP_EVENT_LVATIMER == event)) {
+		event = mrp_tx_opportunity(&(MVRP_db->mrp_db), event);
+		if (0 == event)
+			return 0;
+	}
+
 	switch (event) {
 	case MRP_EVENT_LVATIMER:
 		mrp_lvatimer_stop(&(MVRP_db->mrp_db));
@@ -185,7 +515,9 @@ int mvrp_event(int event, struct mvrp_attribute *rattrib)
 
 		MVRP_db->send_empty_LeaveAll_flag = 1;
 		mrp_lvatimer_fsm(&(MVRP_db->mrp_db), MRP_EVENT_TX);
+		mrp_tx_pending_sort(&(MVRP_db->mrp_db), mvrp_tx_cmp);
 		mvrp_txpdu();
+		mrp_tx_pending_retire(&(MVRP_db->mrp_db));
 		MVRP_db->send_empty_LeaveAll_flag = 0;
 		break;
 	case MRP_EVENT_RLA:
@@ -210,42 +542,44 @@ int mvrp_event(int event, struct mvrp_attribute *rattrib)
 		break;
 	case MRP_EVENT_TX:
 		mrp_jointimer_stop(&(MVRP_db->mrp_db));
-		attrib = MVRP_db->attrib_list;
-
-		while (NULL != attrib) {
+		/* only the attributes with something to send */
+		for (app = MVRP_db->mrp_db.tx_pending; NULL != app;
+		     app = app->tx_next) {
+			attrib = MRP_APPLICANT_OWNER(app, struct mvrp_attribute);
 			mrp_applicant_fsm(&(MVRP_db->mrp_db),
 					  &(attrib->applicant), MRP_EVENT_TX,
 					  mrp_registrar_in(&(attrib->registrar)));
 #if LOG_MVRP
 			mvrp_print_debug_info(event, attrib);
 #endif
-			count += mrp_applicant_state_transition_implies_tx(&(attrib->applicant));
-			attrib = attrib->next;
 		}
 
+		mrp_tx_pending_sort(&(MVRP_db->mrp_db), mvrp_tx_cmp);
 		mvrp_txpdu();
 
 		/*
 		 * Certain state transitions imply we need to request another tx
 		 * opportunity.
 		 */
-		if (count) {
+		if (mrp_tx_pending_retire(&(MVRP_db->mrp_db))) {
 			mrp_jointimer_start(&(MVRP_db->mrp_db));
 		}
 		break;
 	case MRP_EVENT_LVTIMER:
-		mrp_lvtimer_stop(&(MVRP_db->mrp_db));
-		attrib = MVRP_db->attrib_list;
+		/* only the registrars whose own leave timer ran out */
+		reg = mrp_lvtimer_expired(&(MVRP_db->mrp_db));
 
-		while (NULL != attrib) {
-			mrp_registrar_fsm(&(attrib->registrar),
-					  &(MVRP_db->mrp_db),
+		while (NULL != reg) {
+			next_reg = reg->lv_next;
+			attrib = MRP_REGISTRAR_OWNER(reg, struct mvrp_attribute);
+			mrp_registrar_fsm(reg, &(MVRP_db->mrp_db),
 					  MRP_EVENT_LVTIMER);
 
 #if LOG_MVRP
 			mvrp_print_debug_info(event, attrib);
 #endif
-			attrib = mvrp_conditional_reclaim(attrib);
+			mvrp_conditional_reclaim(attrib);
+			reg = next_reg;
 		}
 		break;
 	case MRP_EVENT_PERIODIC:
@@ -287,7 +621,7 @@ int mvrp_event(int event, struct mvrp_attribute *rattrib)
 			attrib = rattrib;
 		} else {
 			mvrp_merge(rattrib);
-			free(rattrib);
+			mvrp_free(rattrib);
 		}
 
 		mrp_applicant_fsm(&(MVRP_db->mrp_db), &(attrib->applicant),
@@ -338,31 +672,20 @@ int mvrp_event(int event, struct mvrp_attribute *rattrib)
 	 * MVRP_db->mrp_db.participant controls
 	 */
 
-	/* generate local notifications */
-	attrib = MVRP_db->attrib_list;
-
-	while (NULL != attrib) {
-		if (MRP_NOTIFY_NONE != attrib->registrar.notify) {
-			mvrp_send_notifications(attrib,
-						attrib->registrar.notify);
-			attrib->registrar.notify = MRP_NOTIFY_NONE;
-		}
-		attrib = attrib->next;
-	}
+	if (!mvrp_notify_deferred)
+		mvrp_notify_pending();
 
 	return 0;
 }
 
-struct mvrp_attribute *mvrp_alloc()
+struct mvrp_attribute *mvrp_alloc(void)
 {
 	struct mvrp_attribute *attrib;
 
-	attrib = (struct mvrp_attribute*) malloc(sizeof(struct mvrp_attribute));
+	attrib = (struct mvrp_attribute *)mrp_slab_alloc(&mvrp_slab);
 	if (NULL == attrib)
 		return NULL;
 
-	memset(attrib, 0, sizeof(struct mvrp_attribute));
-
 	attrib->applicant.mrp_state = MRP_VO_STATE;
 	attrib->applicant.tx = 0;
 	attrib->applicant.sndmsg = MRP_SND_NULL;
@@ -380,6 +703,16 @@ struct mvrp_attribute *mvrp_alloc()
 	return attrib;
 }
 
+void mvrp_free(struct mvrp_attribute *attrib)
+{
+	if (NULL != MVRP_db) {
+		mrp_gc_remove(&(MVRP_db->mrp_db), &(attrib->applicant.gc));
+		mrp_gc_remove(&(MVRP_db->mrp_db), &(attrib->registrar.gc));
+		mrp_tx_dequeue(&(MVRP_db->mrp_db), &(attrib->applicant));
+	}
+	mrp_slab_free(&mvrp_slab, attrib);
+}
+
 int mvrp_recv_msg(void)
 {
 	char *msgbuf;
@@ -405,6 +738,7 @@ int mvrp_recv_msg(void)
 	bytes = mrpd_recvmsgbuf(mvrp_socket, &msgbuf);
 	if (bytes <= 0)
 		goto out;
+	MRP_STAT_INC(MVRP_db->mrp_db.stats.pdu_rx);
 
 	if ((unsigned int)bytes < (sizeof(eth_hdr_t) + sizeof(mrpdu_t) +
 				   sizeof(mrpdu_message_t)))
@@ -529,12 +863,7 @@ int mvrp_recv_msg(void)
 					vect_3pack =
 					    mrpdu_vectorptr->
 					    FirstValue_VectorEvents[vectidx];
-					vectevt[0] = vect_3pack / 36;
-					vectevt[1] =
-					    (vect_3pack - vectevt[0] * 36) / 6;
-					vectevt[2] =
-					    vect_3pack - (36 * vectevt[0]) -
-					    (6 * vectevt[1]);
+					MRPDU_3PACK_DECODE(vect_3pack, vectevt);
 
 					numvalues_processed =
 					    (numvalues > 3 ? 3 : numvalues);
@@ -589,7 +918,7 @@ int mvrp_recv_msg(void)
 							     attrib);
 							break;
 						default:
-							free(attrib);
+							mvrp_free(attrib);
 							break;
 						}
 					}
@@ -629,11 +958,10 @@ int mvrp_recv_msg(void)
 		}
 	}
 
-	free(msgbuf);
 	return 0;
  out:
-	free(msgbuf);
-
+	if (bytes > 0)
+		MRP_STAT_INC(MVRP_db->mrp_db.stats.pdu_rx_errors);
 	return -1;
 }
 
@@ -647,8 +975,7 @@ mvrp_emit_vidvectors(unsigned char *msgbuf, unsigned char *msgbuf_eof,
 	int vectidx;
 	unsigned int vectevt[3];
 	int vectevt_idx;
-	uint16_t vid_firstval;
-	struct mvrp_attribute *attrib, *vattrib;
+	struct mvrp_attribute *attrib, *vattrib, *vattrib_last;
 	mrpdu_message_t *mrpdu_msg;
 	unsigned int attrib_found_flag = 0;
 	unsigned int vector_size = 6;
@@ -664,25 +991,21 @@ mvrp_emit_vidvectors(unsigned char *msgbuf, unsigned char *msgbuf_eof,
 	mrpdu_msg->AttributeType = MVRP_VID_TYPE;
 	mrpdu_msg->AttributeLength = 2;
 
-	attrib = MVRP_db->attrib_list;
+	mvrp_tx_map_load();
+	attrib = mvrp_tx_first(0);
 
 	mrpdu_vectorptr = (mrpdu_vectorattrib_t *) mrpdu_msg->Data;
 
 	while ((mrpdu_msg_ptr < (mrpdu_msg_eof - vector_size - MRPDU_ENDMARK_SZ)) && (NULL != attrib)) {
 
-		if (0 == attrib->applicant.tx) {
-			attrib = attrib->next;
-			continue;
-		}
 		attrib->applicant.tx = 0;
 		if (MRP_ENCODE_OPTIONAL == attrib->applicant.encode) {
-			attrib = attrib->next;
+			attrib = mvrp_tx_first(attrib->attribute + 1);
 			continue;
 		}
 
 		attrib_found_flag = 1;
 		/* pointing to at least one attribute which needs to be transmitted */
-		vid_firstval = attrib->attribute;
 		mrpdu_vectorptr->FirstValue_VectorEvents[0] =
 		    (uint8_t) (attrib->attribute >> 8);
 		mrpdu_vectorptr->FirstValue_VectorEvents[1] =
@@ -739,17 +1062,10 @@ mvrp_emit_vidvectors(unsigned char *msgbuf, unsigned char *msgbuf_eof,
 		 */
 
 		vectidx = 2;
-		vattrib = attrib->next;
+		vattrib_last = attrib;
+		vattrib = mvrp_tx_adjacent(attrib);
 
 		while (NULL != vattrib) {
-			if (0 == vattrib->applicant.tx)
-				break;
-
-			vid_firstval++;
-
-			if (vattrib->attribute != vid_firstval)
-				break;
-
 			vattrib->applicant.tx = 0;
 
 			switch (vattrib->applicant.sndmsg) {
@@ -810,7 +1126,8 @@ mvrp_emit_vidvectors(unsigned char *msgbuf, unsigned char *msgbuf_eof,
 			    > (mrpdu_msg_eof - MRPDU_ENDMARK_SZ))
 				goto oops;
 
-			vattrib = vattrib->next;
+			vattrib_last = vattrib;
+			vattrib = mvrp_tx_adjacent(vattrib);
 		}
 
 		/* handle any trailers */
@@ -841,7 +1158,7 @@ mvrp_emit_vidvectors(unsigned char *msgbuf, unsigned char *msgbuf_eof,
 		mrpdu_msg_ptr =
 		    &(mrpdu_vectorptr->FirstValue_VectorEvents[vectidx]);
 
-		attrib = attrib->next;
+		attrib = mvrp_tx_first(vattrib_last->attribute + 1);
 
 		mrpdu_vectorptr = (mrpdu_vectorattrib_t *) mrpdu_msg_ptr;
 	}
@@ -894,9 +1211,7 @@ int mvrp_txpdu(void)
 	int rc;
 	int lva = 0;
 
-	msgbuf = (unsigned char *)malloc(MAX_FRAME_SIZE);
-	if (NULL == msgbuf)
-		return -1;
+	msgbuf = mvrp_tx_frame;
 	memset(msgbuf, 0, MAX_FRAME_SIZE);
 	msgbuf_len = 0;
 
@@ -991,13 +1306,13 @@ int mvrp_txpdu(void)
 #if LOG_ERRORS
 		fprintf(stderr, "%s - Error on send %s", __FUNCTION__, strerror(errno));
 #endif
+		MRP_STAT_INC(MVRP_db->mrp_db.stats.pdu_tx_errors);
 		goto out;
 	}
+	MRP_STAT_INC(MVRP_db->mrp_db.stats.pdu_tx);
 
-	free(msgbuf);
 	return 0;
  out:
-	free(msgbuf);
 	/* caller should assume TXLAF */
 	return -1;
 }
@@ -1009,10 +1324,30 @@ int mvrp_send_notifications(struct mvrp_attribute *attrib, int notify)
 	char *regsrc;
 	char mrp_state[8];
 	client_t *client;
+	struct mrpd_notify_rec rec;
+	int i;
 
 	if (NULL == attrib)
 		return -1;
 
+	if ((MRP_NOTIFY_NEW != notify) && (MRP_NOTIFY_JOIN != notify) &&
+	    (MRP_NOTIFY_LV != notify))
+		return 0;
+
+	if (0 == mrp_client_match(&MVRP_db->mrp_db, MVRP_VID_TYPE, 1,
+				  attrib->attribute))
+		return 0;	/* nobody subscribed */
+
+	memset(&rec, 0, sizeof(rec));
+	rec.notify = (uint8_t)notify;
+	rec.type = MRPD_NOTIFY_MVRP_VID;
+	rec.applicant_state = (uint8_t)attrib->applicant.mrp_state;
+	rec.registrar_state = (uint8_t)attrib->registrar.mrp_state;
+	memcpy(rec.registrar, attrib->registrar.macaddr, sizeof(rec.registrar));
+	rec.u.vid = htons(attrib->attribute);
+	if (0 == mrp_client_notify_post(&MVRP_db->mrp_db, &rec))
+		return 0;	/* no text clients, skip formatting */
+
 	msgbuf = (char *)malloc(MAX_MRPD_CMDSZ);
 	if (NULL == msgbuf)
 		return -1;
@@ -1055,10 +1390,12 @@ int mvrp_send_notifications(struct mvrp_attribute *attrib, int notify)
 		break;
 	}
 
-	client = MVRP_db->mrp_db.clients;
-	while (NULL != client) {
+	for (i = 0; i < MVRP_db->mrp_db.notify_set_count; i++) {
+		client = MVRP_db->mrp_db.notify_set[i];
+		if (client->flags & MRP_CLIENT_BINARY)
+			continue;
 		mrpd_send_ctl_msg(&(client->client), msgbuf, MAX_MRPD_CMDSZ);
-		client = client->next;
+		MRP_STAT_INC(MVRP_db->mrp_db.stats.notify_sent);
 	}
 
  free_msgbuf:
@@ -1070,7 +1407,28 @@ int mvrp_send_notifications(struct mvrp_attribute *attrib, int notify)
 	return 0;
 }
 
-int mvrp_dumptable(struct sockaddr_in *client)
+/* first attribute with a VID at or above vid */
+static struct mvrp_attribute *mvrp_first_at(int vid)
+{
+	struct mvrp_attribute *attrib;
+	int next;
+
+	next = mvrp_vid_next(MVRP_db->vid_map, vid);
+	if (next < MVRP_VID_TABLE_SIZE)
+		return MVRP_db->vid_table[next];
+
+	if (0 == MVRP_db->vid_overflow)
+		return NULL;
+
+	attrib = MVRP_db->attrib_list;
+	while ((NULL != attrib) && (attrib->attribute < vid))
+		attrib = attrib->next;
+	return attrib;
+}
+
+/* the VIDs in ranges from entry 'offset' on, as msrp_dump() pages */
+static int mvrp_dump(struct sockaddr_in *client,
+		     struct mvrp_vid_range *ranges, int nranges, int offset)
 {
 	char *msgbuf;
 	char *msgbuf_wrptr;
@@ -1079,6 +1437,8 @@ int mvrp_dumptable(struct sockaddr_in *client)
 	char *regsrc;
 	struct mvrp_attribute *attrib;
 	char mrp_state[8];
+	int index = 0;
+	int i;
 
 	msgbuf = (char *)malloc(MAX_MRPD_CMDSZ);
 	if (NULL == msgbuf)
@@ -1097,31 +1457,47 @@ int mvrp_dumptable(struct sockaddr_in *client)
 
 	msgbuf_wrptr = msgbuf;
 
-	attrib = MVRP_db->attrib_list;
-	if (attrib == NULL) {
-		sprintf(msgbuf, "MVRP:Empty\n");
-	}
-
-	while (NULL != attrib) {
-		sprintf(variant, "V:I=%04x", attrib->attribute);
-
-		mrp_decode_state(&attrib->registrar, &attrib->applicant,
-				 mrp_state, sizeof(mrp_state));
+	for (i = 0; i < nranges; i++) {
+		attrib = mvrp_first_at(ranges[i].lo);
 
-		sprintf(regsrc, "R=%02x%02x%02x%02x%02x%02x %s",
-			attrib->registrar.macaddr[0],
-			attrib->registrar.macaddr[1],
-			attrib->registrar.macaddr[2],
-			attrib->registrar.macaddr[3],
-			attrib->registrar.macaddr[4],
-			attrib->registrar.macaddr[5], mrp_state);
-
-		sprintf(stage, "%s %s\n", variant, regsrc);
-		sprintf(msgbuf_wrptr, "%s", stage);
-		msgbuf_wrptr += strnlen(stage, 128);
-		attrib = attrib->next;
+		while ((NULL != attrib) &&
+		       (attrib->attribute <= ranges[i].hi)) {
+			if (index++ < offset) {
+				attrib = attrib->next;
+				continue;
+			}
+			sprintf(variant, "V:I=%04x", attrib->attribute);
+
+			mrp_decode_state(&attrib->registrar,
+					 &attrib->applicant, mrp_state,
+					 sizeof(mrp_state));
+
+			sprintf(regsrc, "R=%02x%02x%02x%02x%02x%02x %s",
+				attrib->registrar.macaddr[0],
+				attrib->registrar.macaddr[1],
+				attrib->registrar.macaddr[2],
+				attrib->registrar.macaddr[3],
+				attrib->registrar.macaddr[4],
+				attrib->registrar.macaddr[5], mrp_state);
+
+			sprintf(stage, "%s %s\n", variant, regsrc);
+			if (msgbuf_wrptr + strnlen(stage, 128) >=
+			    msgbuf + MAX_MRPD_CMDSZ - MRP_DUMP_TRAILER_SZ) {
+				sprintf(msgbuf_wrptr, "MVRP:More O=%d\n",
+					index - 1);
+				msgbuf_wrptr += strlen(msgbuf_wrptr);
+				goto send;
+			}
+			sprintf(msgbuf_wrptr, "%s", stage);
+			msgbuf_wrptr += strnlen(stage, 128);
+			attrib = attrib->next;
+		}
 	}
 
+ send:
+	if (msgbuf_wrptr == msgbuf)
+		sprintf(msgbuf, "MVRP:Empty\n");
+
 	mrpd_send_ctl_msg(client, msgbuf, MAX_MRPD_CMDSZ);
 
  free_msgbuf:
@@ -1136,6 +1512,13 @@ int mvrp_dumptable(struct sockaddr_in *client)
 
 }
 
+int mvrp_dumptable(struct sockaddr_in *client)
+{
+	struct mvrp_vid_range all = { 0, 0xffff };
+
+	return mvrp_dump(client, &all, 1, 0);
+}
+
 /* V+? - JOIN a VID
  * V++   NEW a VID (XXX: note network disturbance) */
 int mvrp_cmd_parse_vid(char *buf, int buflen,
@@ -1163,6 +1546,155 @@ int mvrp_cmd_vid(uint16_t attribute, int mrp_event)
 	return 0;
 }
 
+/* V+F:T=1, V+F:I=0002 or V+F:L=0002,H=000f - narrow the notifications */
+static int mvrp_cmd_filter(char *buf, int buflen, struct sockaddr_in *client,
+			   int *err_index)
+{
+	uint8_t type;
+	uint16_t lo;
+	uint16_t hi;
+	struct parse_param type_specs[] = {
+		{"T" PARSE_ASSIGN, parse_u8, &type},
+		{0, parse_null, 0}
+	};
+	struct parse_param range_specs[] = {
+		{"L" PARSE_ASSIGN, parse_u16_04x, &lo},
+		{"H" PARSE_ASSIGN, parse_u16_04x, &hi},
+		{0, parse_null, 0}
+	};
+
+	if (buflen < 7)
+		return -1;
+
+	if (strstr(buf + 4, "T" PARSE_ASSIGN)) {
+		if (parse(buf + 4, buflen - 4, type_specs, err_index))
+			return -1;
+		return mrp_client_filter_type(&MVRP_db->mrp_db, client, type);
+	}
+	if (strstr(buf + 4, "L" PARSE_ASSIGN)) {
+		if (parse(buf + 4, buflen - 4, range_specs, err_index))
+			return -1;
+		return mrp_client_filter_key(&MVRP_db->mrp_db, client, lo, hi);
+	}
+	if (mvrp_cmd_parse_vid(buf, buflen, &lo, err_index))
+		return -1;
+	return mrp_client_filter_key(&MVRP_db->mrp_db, client, lo, lo);
+}
+
+/* V++:L=0002,H=00ff or V++:I=0002;I=0005 - more than one VID */
+static int mvrp_cmd_is_bulk(char *buf, int buflen)
+{
+	if (buflen <= 4)
+		return 0;
+	return (NULL != strchr(buf + 4, PARSE_RECORD_SEPARATOR)) ||
+	    (NULL != strstr(buf + 4, "L" PARSE_ASSIGN));
+}
+
+static int mvrp_cmd_parse_range(char *buf, int buflen,
+				struct mvrp_vid_range *range, int *err_index)
+{
+	struct parse_param specs[] = {
+		{"L" PARSE_ASSIGN, parse_u16_04x, &range->lo},
+		{"H" PARSE_ASSIGN, parse_u16_04x, &range->hi},
+		{0, parse_null, 0}
+	};
+
+	if (NULL == strstr(buf + 4, "L" PARSE_ASSIGN)) {
+		if (mvrp_cmd_parse_vid(buf, buflen, &range->lo, err_index))
+			return -1;
+		range->hi = range->lo;
+		return 0;
+	}
+	if (buflen < 15)
+		return -1;
+	if (parse(buf + 4, buflen - 4, specs, err_index))
+		return -1;
+	if ((range->lo > range->hi) || (range->lo < MVRP_VID_MIN) ||
+	    (range->hi > MVRP_VID_MAX))
+		return -1;
+	return 0;
+}
+
+/*
+ * V??, V++, V+? and V-- with VID ranges or several ';' separated
+ * records. All records are parsed before any is applied, the local
+ * notifications go out in one sweep and the client gets one
+ * "OK+ N=<VIDs>" - or a single dump of the ranges for V??.
+ */
+static int mvrp_cmd_bulk(char *buf, int buflen, struct sockaddr_in *client)
+{
+	struct mvrp_vid_range *ranges;
+	char rec[MAX_MRPD_CMDSZ];
+	char respbuf[32];
+	int nranges;
+	int mrp_event;
+	int err_index;
+	int reclen;
+	int count = 0;
+	int pos = 4;
+	int rc = 0;
+	int vid;
+	int i;
+
+	nranges = 1;
+	for (i = 4; (i < buflen) && buf[i]; i++)
+		if (PARSE_RECORD_SEPARATOR == buf[i])
+			nranges++;
+
+	ranges = malloc(nranges * sizeof(*ranges));
+	if (NULL == ranges) {
+		snprintf(respbuf, sizeof(respbuf) - 1, "ERI N=0");
+		goto out;
+	}
+
+	for (i = 0; i < nranges; i++) {
+		reclen = parse_next_record(buf, buflen, 4, &pos, rec,
+					   sizeof(rec));
+		if (reclen <= 0)
+			break;
+		if (mvrp_cmd_parse_range(rec, reclen, &ranges[i], &err_index))
+			break;
+	}
+	if (i < nranges) {
+		/* nothing has been applied */
+		snprintf(respbuf, sizeof(respbuf) - 1, "ERP R=%d", i);
+		rc = -1;
+		goto out;
+	}
+
+	if ('?' == buf[1]) {
+		rc = mvrp_dump(client, ranges, nranges, 0);
+		free(ranges);
+		return rc;
+	}
+
+	if ('-' == buf[1])
+		mrp_event = MRP_EVENT_LV;
+	else if ('?' == buf[2])
+		mrp_event = MRP_EVENT_JOIN;
+	else
+		mrp_event = MRP_EVENT_NEW;
+
+	mvrp_notify_deferred = 1;
+	for (i = 0; (i < nranges) && !rc; i++) {
+		for (vid = ranges[i].lo; vid <= ranges[i].hi; vid++) {
+			rc = mvrp_cmd_vid(vid, mrp_event);
+			if (rc)
+				break;
+			count++;
+		}
+	}
+	mvrp_notify_deferred = 0;
+	mvrp_notify_pending();
+
+	snprintf(respbuf, sizeof(respbuf) - 1, "%s N=%d", rc ? "ERI" : "OK+",
+		 count);
+ out:
+	free(ranges);
+	mrpd_send_ctl_msg(client, respbuf, sizeof(respbuf));
+	return rc;
+}
+
 int mvrp_recv_cmd(char *buf, int buflen, struct sockaddr_in *client)
 {
 	int rc;
@@ -1177,7 +1709,9 @@ int mvrp_recv_cmd(char *buf, int buflen, struct sockaddr_in *client)
 		goto out;
 	}
 
-	rc = mrp_client_add(&(MVRP_db->mrp_db.clients), client);
+	rc = mrp_client_add(&(MVRP_db->mrp_db), client);
+	if (rc)
+		goto out_ERI;
 
 	if (buflen < 3)
 		return -1;
@@ -1186,13 +1720,47 @@ int mvrp_recv_cmd(char *buf, int buflen, struct sockaddr_in *client)
 		return -1;
 
 	/*
-	 * V?? - query MVRP Registrar VID database
+	 * V?? - query MVRP Registrar VID database, V??:O=<n> from entry n on
 	 * V+? - JOIN a VID
 	 * V++   NEW a VID (XXX: note network disturbance)
 	 * V-- - LV a VID
+	 * V+B   Send notifications to this client in binary form
+	 * V-B   Send notifications to this client as text (default)
+	 * V+F   Only notify this client of a type, VID or VID range
+	 * V-F   Remove the notification filters of this client
+	 * V?A   Report the occupancy of the MVRP attribute slab
+	 * V?T   Report the transmit opportunities taken and held back
+	 *
+	 * V??, V+?, V++ and V-- also take L=xxxx,H=xxxx ranges and several
+	 * records separated by ';', answered with one response.
 	 */
-	if (strncmp(buf, "V??", 3) == 0) {
-		mvrp_dumptable(client);
+	if (((strncmp(buf, "V??", 3) == 0) || (strncmp(buf, "V++", 3) == 0)
+	     || (strncmp(buf, "V+?", 3) == 0) || (strncmp(buf, "V--", 3) == 0))
+	    && mvrp_cmd_is_bulk(buf, buflen)) {
+		return mvrp_cmd_bulk(buf, buflen, client);
+	} else if (strncmp(buf, "V??", 3) == 0) {
+		struct mvrp_vid_range all = { 0, 0xffff };
+
+		rc = mrp_dump_offset(buf, buflen);
+		if (rc < 0)
+			goto out_ERP;
+		mvrp_dump(client, &all, 1, rc);
+	} else if (strncmp(buf, "V?A", 3) == 0) {
+		mrp_slab_report(&mvrp_slab, "MVRP", client);
+	} else if (strncmp(buf, "V?T", 3) == 0) {
+		mrp_tx_report(&(MVRP_db->mrp_db), "MVRP", client);
+	} else if ((strncmp(buf, "V+B", 3) == 0)
+		   || (strncmp(buf, "V-B", 3) == 0)) {
+		rc = mrp_client_set_binary(&(MVRP_db->mrp_db), client,
+					   'V', '+' == buf[1]);
+		if (rc)
+			goto out_ERI;
+	} else if (strncmp(buf, "V+F", 3) == 0) {
+		rc = mvrp_cmd_filter(buf, buflen, client, &err_index);
+		if (rc)
+			goto out_ERP;
+	} else if (strncmp(buf, "V-F", 3) == 0) {
+		mrp_client_filter_clear(&MVRP_db->mrp_db, client);
 	} else if (strncmp(buf, "V--", 3) == 0) {
 		rc = mvrp_cmd_parse_vid(buf, buflen, &vid_param, &err_index);
 		if (rc)
@@ -1305,6 +1873,8 @@ static struct mvrp_attribute *mvrp_conditional_reclaim(struct mvrp_attribute *va
 			MVRP_db->attrib_list = vattrib->next;
 		if (NULL != vattrib->next)
 			vattrib->next->prev = vattrib->prev;
+		mvrp_vid_remove(vattrib);
+		mrp_lvtimer_stop(&(MVRP_db->mrp_db), &(vattrib->registrar));
 		free_vattrib = vattrib;
 		vattrib = vattrib->next;
 #if LOG_MVRP_GARBAGE_COLLECTION
@@ -1313,7 +1883,8 @@ static struct mvrp_attribute *mvrp_conditional_reclaim(struct mvrp_attribute *va
 				free_vattrib, vattrib);
 #endif
 		mvrp_send_notifications(free_vattrib, MRP_NOTIFY_LV);
-		free(free_vattrib);
+		mvrp_map_propagate(free_vattrib);
+		mvrp_free(free_vattrib);
 		return vattrib;
 	} else {
 		return vattrib->next;
@@ -1321,17 +1892,75 @@ static struct mvrp_attribute *mvrp_conditional_reclaim(struct mvrp_attribute *va
 
 }
 
+/* returns the number of candidates left for the next tick */
 int mvrp_reclaim(void)
 {
-	struct mvrp_attribute *vattrib;
+	struct mrp_gc_link *link;
+	int budget = MRP_GC_BUDGET;
+
 	if (NULL == MVRP_db)
 		return 0;
 
-	vattrib = MVRP_db->attrib_list;
-	while (NULL != vattrib) {
-		vattrib = mvrp_conditional_reclaim(vattrib);
+	while (budget-- && (NULL != (link = mrp_gc_pop(&(MVRP_db->mrp_db)))))
+		mvrp_conditional_reclaim(MRP_GC_OWNER(link,
+						      struct mvrp_attribute));
+
+	return MVRP_db->mrp_db.gc_count;
+}
 
+/* add the attributes worth keeping to a checkpoint, see mrpd -c */
+int mvrp_snapshot(struct mrp_snapshot *snap)
+{
+	struct mvrp_attribute *attrib;
+	struct mrp_snapshot_rec *rec;
+
+	if (NULL == MVRP_db)
+		return 0;
+
+	snap->app = 'V';
+	for (attrib = MVRP_db->attrib_list; NULL != attrib;
+	     attrib = attrib->next) {
+		if (mrp_reclaimable(&(attrib->applicant), &(attrib->registrar)))
+			continue;
+		rec = mrp_snapshot_attrib(snap, &(attrib->applicant),
+					  &(attrib->registrar), MVRP_VID_TYPE,
+					  &(attrib->attribute),
+					  sizeof(attrib->attribute));
+		if (NULL == rec)
+			return -1;
+		rec->map_declared = attrib->map_declared;
 	}
+
+	return mrp_snapshot_clients(snap, &(MVRP_db->mrp_db));
+}
+
+int mvrp_restore(const struct mrp_snapshot_rec *rec, int fresh)
+{
+	struct mvrp_attribute *attrib;
+
+	if (NULL == MVRP_db)
+		return -1;
+
+	if (MRP_SNAP_ATTRIB != rec->kind)
+		return mrp_restore_client(&(MVRP_db->mrp_db), rec);
+
+	if (!mrp_restore_wanted(rec, fresh))
+		return 0;
+
+	attrib = mvrp_alloc();
+	if (NULL == attrib)
+		return -1;
+
+	memcpy(&(attrib->attribute), rec->u.value, sizeof(attrib->attribute));
+	attrib->map_declared = (uint16_t)rec->map_declared;
+
+	if (NULL != mvrp_lookup(attrib)) {
+		mvrp_free(attrib);
+		return 0;
+	}
+	mvrp_add(attrib);
+	mrp_restore_attrib(&(MVRP_db->mrp_db), rec, &(attrib->applicant),
+			   &(attrib->registrar), fresh);
 	return 0;
 }
 
@@ -1347,14 +1976,16 @@ void mvrp_reset(void)
 	while (NULL != sattrib) {
 		free_sattrib = sattrib;
 		sattrib = sattrib->next;
-		free(free_sattrib);
+		mvrp_free(free_sattrib);
 	}
 	free(MVRP_db);
 }
 
 void mvrp_bye(struct sockaddr_in *client)
 {
-	if (NULL != MVRP_db)
-		mrp_client_delete(&(MVRP_db->mrp_db.clients), client);
+	if (NULL != MVRP_db) {
+		mrp_client_filter_clear(&MVRP_db->mrp_db, client);
+		mrp_client_delete(&(MVRP_db->mrp_db), client);
+	}
 
 }
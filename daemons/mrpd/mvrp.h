@@ -35,14 +35,31 @@ struct mvrp_attribute {
 	struct mvrp_attribute *prev;
 	struct mvrp_attribute *next;
 	uint16_t attribute;	/* 12-bit VID */
+	uint16_t map_declared;	/* declared on behalf of another port */
 	mrp_applicant_attribute_t applicant;
 	mrp_registrar_attribute_t registrar;
 };
 
+#define MVRP_VID_TABLE_SIZE	4096
+/* the VIDs a range command may declare, 0 and 0xfff are reserved */
+#define MVRP_VID_MIN		1
+#define MVRP_VID_MAX		4094
+#define MVRP_VID_MAP_BITS	(8 * sizeof(unsigned long))
+#define MVRP_VID_MAP_WORDS	(MVRP_VID_TABLE_SIZE / MVRP_VID_MAP_BITS)
+
 struct mvrp_database {
         struct mrp_database mrp_db;
         struct mvrp_attribute *attrib_list;
         int send_empty_LeaveAll_flag;
+        /*
+         * attrib_list indexed by VID - vid_map marks occupied slots, tx_map
+         * holds the pending transmit set while a PDU is being encoded.
+         * Attribute values beyond 12 bits only live on attrib_list.
+         */
+        struct mvrp_attribute *vid_table[MVRP_VID_TABLE_SIZE];
+        unsigned long vid_map[MVRP_VID_MAP_WORDS];
+        unsigned long tx_map[MVRP_VID_MAP_WORDS];
+        int vid_overflow;
 };
 
 #define MVRP_ETYPE	0x88F5
@@ -60,7 +77,11 @@ int mvrp_init(int mvrp_enable);
 void mvrp_reset(void);
 int mvrp_event(int event, struct mvrp_attribute *rattrib);
 int mvrp_recv_cmd(char *buf, int buflen, struct sockaddr_in *client);
+struct mvrp_attribute *mvrp_alloc(void);
+void mvrp_free(struct mvrp_attribute *attrib);
 struct mvrp_attribute *mvrp_lookup(struct mvrp_attribute *rattrib);
 int mvrp_reclaim(void);
+int mvrp_snapshot(struct mrp_snapshot *snap);
+int mvrp_restore(const struct mrp_snapshot_rec *rec, int fresh);
 void mvrp_bye(struct sockaddr_in *client);
 int mvrp_recv_msg(void);
@@ -0,0 +1,185 @@
+/*
+ * Micro benchmark of the ThreePackedEvents/FourPackedEvents decoders.
+ *
+ * Walks the vectors of the sample packets in sample_msrp_packets.h and
+ * decodes their event bytes over and over, once with the division based
+ * arithmetic the receivers used to do per byte and once through the
+ * shared tables in mrp.c, and reports vectors per second for each.
+ *
+ * usage: mrpd_codec_bench [iterations]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "mrp_doubles.h"
+#include "mrp.h"
+#include "msrp.h"
+
+#include "sample_msrp_packets.h"
+
+#define BENCH_MAX_VECTORS	1024
+
+struct bench_vector {
+	const uint8_t *events;	/* ThreePackedEvents */
+	int numvalues;
+	const uint8_t *fourpacked;	/* listener FourPackedEvents or NULL */
+};
+
+static struct bench_vector vectors[BENCH_MAX_VECTORS];
+static int vector_count;
+
+static volatile int sink;
+
+#define SAMPLE(pkt)	{ pkt, sizeof(pkt) }
+
+static const struct {
+	const uint8_t *data;
+	int len;
+} samples[] = {
+	SAMPLE(leave_all),
+	SAMPLE(pkt2),
+	SAMPLE(onlyIgnore),
+	SAMPLE(someIgnore),
+	SAMPLE(laTalker),
+	SAMPLE(laTalkerFail),
+	SAMPLE(laListener),
+	SAMPLE(laDomain),
+	SAMPLE(fullMsgOneEndmark),
+};
+
+/* collect the well formed vectors of an MSRP PDU */
+static void collect(const uint8_t *pdu, int len)
+{
+	const uint8_t *eof = pdu + len;
+	const uint8_t *msg = pdu + sizeof(eth_hdr_t) + 1;
+	const uint8_t *vect;
+	int type, attrlen, numvalues, vlen;
+
+	while (msg + 4 <= eof && (msg[0] || msg[1])) {
+		type = msg[0];
+		attrlen = msg[1];
+		vect = msg + 4;
+
+		while (vect + 2 <= eof && (vect[0] || vect[1])) {
+			numvalues = MRPDU_VECT_NUMVALUES((vect[0] << 8) |
+							 vect[1]);
+			vlen = 2 + attrlen + (numvalues + 2) / 3;
+			if (MSRP_LISTENER_TYPE == type)
+				vlen += (numvalues + 3) / 4;
+			if (vect + vlen > eof)
+				return;
+
+			if (numvalues && vector_count < BENCH_MAX_VECTORS) {
+				vectors[vector_count].events =
+				    vect + 2 + attrlen;
+				vectors[vector_count].numvalues = numvalues;
+				vectors[vector_count].fourpacked =
+				    (MSRP_LISTENER_TYPE == type) ?
+				    vect + 2 + attrlen + (numvalues + 2) / 3 :
+				    NULL;
+				vector_count++;
+			}
+			vect += vlen;
+		}
+		msg = vect + 2;
+	}
+}
+
+static int decode_arith(const struct bench_vector *v, int *evt)
+{
+	int i, n = 0;
+	int b;
+
+	for (i = 0; i < (v->numvalues + 2) / 3; i++) {
+		b = v->events[i];
+		evt[n] = b / 36;
+		evt[n + 1] = (b - evt[n] * 36) / 6;
+		evt[n + 2] = b - (36 * evt[n]) - (6 * evt[n + 1]);
+		n += 3;
+	}
+	if (NULL == v->fourpacked)
+		return n;
+
+	for (i = 0; i < (v->numvalues + 3) / 4; i++) {
+		b = v->fourpacked[i];
+		evt[n + 3] = b - ((b >> 2) << 2);
+		b >>= 2;
+		evt[n + 2] = b - ((b >> 2) << 2);
+		b >>= 2;
+		evt[n + 1] = b - ((b >> 2) << 2);
+		b >>= 2;
+		evt[n] = b - ((b >> 2) << 2);
+		n += 4;
+	}
+	return n;
+}
+
+static int decode_table(const struct bench_vector *v, int *evt)
+{
+	int i, n = 0;
+
+	for (i = 0; i < (v->numvalues + 2) / 3; i++) {
+		MRPDU_3PACK_DECODE(v->events[i], &evt[n]);
+		n += 3;
+	}
+	if (NULL == v->fourpacked)
+		return n;
+
+	mrpdu_4pack_decode(v->fourpacked, v->numvalues, &evt[n]);
+	return n + (v->numvalues + 3) / 4 * 4;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(const char *name, int (*decode)(const struct bench_vector *,
+						 int *), long iterations)
+{
+	/* 8191 values at most, three and four packed */
+	static int evt[2 * 8192 + 8];
+	double start, elapsed;
+	long it;
+	int i, sum = 0;
+
+	start = now();
+	for (it = 0; it < iterations; it++) {
+		for (i = 0; i < vector_count; i++)
+			sum += evt[decode(&vectors[i], evt) - 1];
+	}
+	elapsed = now() - start;
+	sink = sum;
+
+	printf("%-6s %12.0f vectors/s (%ld x %d vectors in %.3f s)\n",
+	       name, (double)iterations * vector_count / elapsed,
+	       iterations, vector_count, elapsed);
+}
+
+int main(int argc, char *argv[])
+{
+	long iterations = 200000;
+	unsigned int i;
+
+	if (argc > 1)
+		iterations = atol(argv[1]);
+
+	for (i = 0; i < sizeof(samples) / sizeof(samples[0]); i++)
+		collect(samples[i].data, samples[i].len);
+
+	if (0 == vector_count) {
+		fprintf(stderr, "no vectors in the sample packets\n");
+		return 1;
+	}
+
+	run("arith", decode_arith, iterations);
+	run("table", decode_table, iterations);
+
+	return 0;
+}
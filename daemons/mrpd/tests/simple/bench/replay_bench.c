@@ -0,0 +1,394 @@
+/*
+ * Offline throughput benchmark of mrpd, driven through the test doubles.
+ *
+ * Three phases run back to back:
+ *
+ *   cmd  declares n talkers and listeners, n VIDs and n MAC addresses
+ *        through the client command parsers;
+ *   tx   fires the LeaveAll timer of MSRP, MVRP and MMRP, which encodes
+ *        every declaration, and captures the PDUs passed to mrpd_send();
+ *   rx   resets the databases and replays the captured PDUs, plus any
+ *        frames read from pcap captures on the command line, through
+ *        msrp_recv_msg(), mvrp_recv_msg() and mmrp_recv_msg().
+ *
+ * Each phase reports operations per second and latency percentiles.
+ *
+ * usage: mrpd_replay_bench [-n declarations] [-r rounds] [capture.pcap ...]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "mrp_doubles.h"
+#include "mrp.h"
+#include "msrp.h"
+#include "mvrp.h"
+#include "mmrp.h"
+
+extern struct msrp_database *MSRP_db;
+extern struct mvrp_database *MVRP_db;
+extern struct mmrp_database *MMRP_db;
+
+#define PCAP_MAGIC		0xa1b2c3d4
+#define PCAP_MAGIC_NS		0xa1b23c4d
+#define PCAP_LINKTYPE_ETHERNET	1
+
+struct frame {
+	unsigned int len;
+	unsigned char *data;
+};
+
+struct bench_stats {
+	const char *name;
+	const char *unit;
+	uint64_t *ns;
+	size_t count;
+	size_t size;
+	uint64_t total_ns;
+	unsigned long items;
+};
+
+static struct frame *frames;
+static size_t frame_count;
+static size_t frame_size;
+static int capture;
+
+static struct sockaddr_in client;
+
+/* the replayed PDUs must not look like our own */
+static const unsigned char remote_addr[] = {
+	0x02, 0x00, 0x00, 0x00, 0x00, 0x01
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void stats_add(struct bench_stats *st, uint64_t ns, unsigned long items)
+{
+	if (st->count == st->size) {
+		st->size = st->size ? 2 * st->size : 1024;
+		st->ns = (uint64_t *)realloc(st->ns, st->size * sizeof(*st->ns));
+		if (NULL == st->ns) {
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+	}
+	st->ns[st->count++] = ns;
+	st->total_ns += ns;
+	st->items += items;
+}
+
+static int cmp_ns(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static double percentile_us(struct bench_stats *st, int pct)
+{
+	size_t idx = (st->count * pct) / 100;
+
+	if (idx >= st->count)
+		idx = st->count - 1;
+	return st->ns[idx] / 1000.0;
+}
+
+static void stats_report(struct bench_stats *st)
+{
+	double secs;
+
+	if (0 == st->count) {
+		printf("%-4s no operations\n", st->name);
+		return;
+	}
+
+	qsort(st->ns, st->count, sizeof(*st->ns), cmp_ns);
+	secs = st->total_ns / 1e9;
+
+	printf("%-4s %8lu ops %10.0f ops/s %10.0f %s/s  "
+	       "p50 %.1f p90 %.1f p99 %.1f max %.1f us\n",
+	       st->name, (unsigned long)st->count, st->count / secs,
+	       st->items / secs, st->unit,
+	       percentile_us(st, 50), percentile_us(st, 90),
+	       percentile_us(st, 99), st->ns[st->count - 1] / 1000.0);
+
+	free(st->ns);
+	st->ns = NULL;
+}
+
+static void frame_add(const void *buf, size_t len)
+{
+	if (!capture || len > MAX_FRAME_SIZE)
+		return;
+
+	if (frame_count == frame_size) {
+		frame_size = frame_size ? 2 * frame_size : 256;
+		frames = (struct frame *)realloc(frames,
+						 frame_size * sizeof(*frames));
+		if (NULL == frames) {
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+	}
+	frames[frame_count].data = (unsigned char *)malloc(len);
+	if (NULL == frames[frame_count].data) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	memcpy(frames[frame_count].data, buf, len);
+	frames[frame_count].len = len;
+	frame_count++;
+}
+
+static uint32_t pcap32(uint32_t v, int swapped)
+{
+	if (!swapped)
+		return v;
+	return ((v & 0xff) << 24) | ((v & 0xff00) << 8) |
+	    ((v >> 8) & 0xff00) | (v >> 24);
+}
+
+/* classic libpcap format only; pcapng is not understood */
+static int pcap_load(const char *path)
+{
+	unsigned char hdr[24];
+	unsigned char rec[16];
+	unsigned char buf[65536];
+	uint32_t magic, linktype, caplen;
+	int swapped;
+	int count = 0;
+	FILE *fp;
+
+	fp = fopen(path, "rb");
+	if (NULL == fp) {
+		perror(path);
+		return -1;
+	}
+
+	if (fread(hdr, sizeof(hdr), 1, fp) != 1)
+		goto bad;
+
+	memcpy(&magic, hdr, 4);
+	if (PCAP_MAGIC == magic || PCAP_MAGIC_NS == magic)
+		swapped = 0;
+	else if (PCAP_MAGIC == pcap32(magic, 1) ||
+		 PCAP_MAGIC_NS == pcap32(magic, 1))
+		swapped = 1;
+	else
+		goto bad;
+
+	memcpy(&linktype, &hdr[20], 4);
+	if (PCAP_LINKTYPE_ETHERNET != pcap32(linktype, swapped))
+		goto bad;
+
+	capture = 1;
+	while (fread(rec, sizeof(rec), 1, fp) == 1) {
+		memcpy(&caplen, &rec[8], 4);
+		caplen = pcap32(caplen, swapped);
+		if (caplen > sizeof(buf) || fread(buf, caplen, 1, fp) != 1)
+			break;
+		frame_add(buf, caplen);
+		count++;
+	}
+	capture = 0;
+
+	fclose(fp);
+	printf("%s: %d frames\n", path, count);
+	return 0;
+ bad:
+	fprintf(stderr, "%s: not an ethernet pcap capture\n", path);
+	fclose(fp);
+	return -1;
+}
+
+static void apps_init(void)
+{
+	mrpd_reset();
+	msrp_init(1);
+	mvrp_init(1);
+	mmrp_init(1);
+	test_state.tx_observe = frame_add;
+}
+
+static void apps_reset(void)
+{
+	msrp_reset();
+	mvrp_reset();
+	mmrp_reset();
+}
+
+static void timed_cmd(struct bench_stats *st,
+		      int (*recv_cmd)(char *, int, struct sockaddr_in *),
+		      char *cmd)
+{
+	uint64_t start;
+
+	start = now_ns();
+	recv_cmd(cmd, strlen(cmd) + 1, &client);
+	stats_add(st, now_ns() - start, 1);
+}
+
+static void bench_cmd(int n)
+{
+	struct bench_stats st = { .name = "cmd", .unit = "decl" };
+	uint64_t id = 0xbadc0ffee0000ull;
+	uint64_t da = 0x91e0f0000000ull;
+	char cmd[160];
+	int i;
+
+	for (i = 0; i < n; i++) {
+		/* stride 2 keeps the talkers from vectorizing */
+		snprintf(cmd, sizeof(cmd),
+			 "S++:S=%016llx,A=%012llx,V=0002,Z=576,I=8000,"
+			 "P=96,L=1000",
+			 (unsigned long long)(id + 2 * i),
+			 (unsigned long long)(da + 2 * i));
+		timed_cmd(&st, msrp_recv_cmd, cmd);
+
+		snprintf(cmd, sizeof(cmd), "S+L:L=%016llx,D=2",
+			 (unsigned long long)(id + 2 * i));
+		timed_cmd(&st, msrp_recv_cmd, cmd);
+
+		if (i < 4094) {
+			snprintf(cmd, sizeof(cmd), "V++:I=%04x", i + 1);
+			timed_cmd(&st, mvrp_recv_cmd, cmd);
+		}
+
+		snprintf(cmd, sizeof(cmd), "M++:M=91e0f001%04x", i & 0xffff);
+		timed_cmd(&st, mmrp_recv_cmd, cmd);
+	}
+
+	stats_report(&st);
+}
+
+static void bench_tx(int rounds)
+{
+	struct bench_stats st = { .name = "tx", .unit = "pdu" };
+	uint64_t start;
+	int sent;
+	int r;
+
+	for (r = 0; r < rounds; r++) {
+		/* one round of PDUs is enough to replay */
+		capture = (0 == r);
+		/* a fresh transmit opportunity window, or the LeaveAll waits */
+		test_state.clock_ms += MRP_TXOPP_WINDOW;
+
+		sent = test_state.sent_count;
+		start = now_ns();
+		msrp_event(MRP_EVENT_LVATIMER, NULL);
+		stats_add(&st, now_ns() - start, test_state.sent_count - sent);
+
+		sent = test_state.sent_count;
+		start = now_ns();
+		mvrp_event(MRP_EVENT_LVATIMER, NULL);
+		stats_add(&st, now_ns() - start, test_state.sent_count - sent);
+
+		sent = test_state.sent_count;
+		start = now_ns();
+		mmrp_event(MRP_EVENT_LVATIMER, NULL);
+		stats_add(&st, now_ns() - start, test_state.sent_count - sent);
+	}
+	capture = 0;
+
+	stats_report(&st);
+}
+
+static void bench_rx(int rounds)
+{
+	struct bench_stats st = { .name = "rx", .unit = "pdu" };
+	uint64_t start;
+	uint16_t etype;
+	size_t i;
+	int r;
+
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < frame_count; i++) {
+			if (frames[i].len < sizeof(eth_hdr_t))
+				continue;
+
+			memcpy(test_state.rx_PDU, frames[i].data,
+			       frames[i].len);
+			memcpy(((eth_hdr_t *)test_state.rx_PDU)->srcaddr,
+			       remote_addr, sizeof(remote_addr));
+			test_state.rx_PDU_len = frames[i].len;
+			etype = (test_state.rx_PDU[12] << 8) |
+			    test_state.rx_PDU[13];
+
+			start = now_ns();
+			switch (etype) {
+			case MSRP_ETYPE:
+				msrp_recv_msg();
+				break;
+			case MVRP_ETYPE:
+				mvrp_recv_msg();
+				break;
+			case MMRP_ETYPE:
+				mmrp_recv_msg();
+				break;
+			default:
+				continue;
+			}
+			stats_add(&st, now_ns() - start, 1);
+		}
+	}
+
+	stats_report(&st);
+}
+
+int main(int argc, char *argv[])
+{
+	int n = 1000;
+	int rounds = 20;
+	size_t i;
+	int c;
+
+	while ((c = getopt(argc, argv, "n:r:")) != -1) {
+		switch (c) {
+		case 'n':
+			n = atoi(optarg);
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n declarations] "
+				"[-r rounds] [capture.pcap ...]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (rounds < 1)
+		rounds = 1;
+
+	for (; optind < argc; optind++) {
+		if (pcap_load(argv[optind]) < 0)
+			return 1;
+	}
+
+	printf("%d declarations per application, %d rounds\n", n, rounds);
+
+	apps_init();
+	bench_cmd(n);
+	bench_tx(rounds);
+	apps_reset();
+
+	apps_init();
+	bench_rx(rounds);
+	apps_reset();
+
+	for (i = 0; i < frame_count; i++)
+		free(frames[i].data);
+	free(frames);
+
+	return 0;
+}
@@ -146,3 +146,91 @@ TEST(MmrpTestGroup, TxLVA_clear_tx_flag)
 	CHECK(mrpd_send_packet_count() > 0);
 	CHECK_EQUAL(0, tx_flag_count);
 }
+
+/*
+ * Declared in reverse order, three consecutive MACs still share one
+ * vector: the pending transmit set is walked in MAC order.
+ */
+TEST(MmrpTestGroup, TxPendingSetInMacOrder)
+{
+	char cmd_3[] = "M++:M=91e0f0000003";
+	char cmd_2[] = "M++:M=91e0f0000002";
+	char cmd_1[] = "M++:M=91e0f0000001";
+	char cmd_10[] = "M++:M=91e0f0000010";
+	unsigned char *vect;
+
+	CHECK(MMRP_db != NULL);
+
+	mmrp_recv_cmd(cmd_10, sizeof(cmd_10), &client);
+	mmrp_recv_cmd(cmd_3, sizeof(cmd_3), &client);
+	mmrp_recv_cmd(cmd_2, sizeof(cmd_2), &client);
+	mmrp_recv_cmd(cmd_1, sizeof(cmd_1), &client);
+
+	mmrp_event(MRP_EVENT_TX, NULL);
+	CHECK(mrpd_send_packet_count() > 0);
+
+	/* skip ethernet header, protocol version, attribute type and length */
+	vect = &test_state.tx_PDU[sizeof(eth_hdr_t) + 1 + 2];
+
+	/* ...01 to ...03 form one vector of three values */
+	LONGS_EQUAL(3, (vect[0] << 8) | vect[1]);
+	LONGS_EQUAL(0x01, vect[7]);
+	vect += 2 + 6 + 1;
+
+	/* ...10 stands alone */
+	LONGS_EQUAL(1, (vect[0] << 8) | vect[1]);
+	LONGS_EQUAL(0x10, vect[7]);
+}
+
+TEST(MmrpTestGroup, MacIndexSurvivesChurn)
+{
+	struct mmrp_attribute a_ref;
+	struct mmrp_attribute *attrib = NULL;
+	char cmd_string[64];
+	int i, n;
+	int count = 0;
+
+	CHECK(MMRP_db != NULL);
+
+	/* declare 300 addresses out of order, leave every third one */
+	for (i = 0; i < 300; i++) {
+		n = (i * 7) % 300;
+		snprintf(cmd_string, sizeof(cmd_string),
+			 "M++:M=91e0f000%04x", n);
+		mmrp_recv_cmd(cmd_string, strlen(cmd_string) + 1, &client);
+	}
+	for (i = 0; i < 300; i += 3) {
+		snprintf(cmd_string, sizeof(cmd_string),
+			 "M--:M=91e0f000%04x", i);
+		mmrp_recv_cmd(cmd_string, strlen(cmd_string) + 1, &client);
+	}
+	mmrp_event(MRP_EVENT_TX, NULL);
+	mmrp_event(MRP_EVENT_TX, NULL);
+	mmrp_reclaim();
+
+	/* the list must still be sorted and hold exactly the survivors */
+	attrib = MMRP_db->attrib_list;
+	while (NULL != attrib) {
+		if (NULL != attrib->next)
+			CHECK(memcmp(attrib->attribute.macaddr,
+				     attrib->next->attribute.macaddr, 6) < 0);
+		count++;
+		attrib = attrib->next;
+	}
+	LONGS_EQUAL(200, count);
+
+	a_ref.type = MMRP_MACVEC_TYPE;
+	a_ref.attribute.macaddr[0] = 0x91;
+	a_ref.attribute.macaddr[1] = 0xe0;
+	a_ref.attribute.macaddr[2] = 0xf0;
+	a_ref.attribute.macaddr[3] = 0x00;
+	for (i = 0; i < 300; i++) {
+		a_ref.attribute.macaddr[4] = (uint8_t)(i >> 8);
+		a_ref.attribute.macaddr[5] = (uint8_t)i;
+		attrib = mmrp_lookup(&a_ref);
+		if (i % 3)
+			CHECK(attrib != NULL);
+		else
+			CHECK(attrib == NULL);
+	}
+}
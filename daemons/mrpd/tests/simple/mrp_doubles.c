@@ -31,6 +31,8 @@ TRACE
 		test_state.timers[i].interval = 0;
 	}
 
+	test_state.clock_ms = 0;
+
 	memset(test_state.ctl_msg_data, 0, MAX_MRPD_CMDSZ);
 	test_state.ctl_msg_length = 0;
 
@@ -41,6 +43,7 @@ TRACE
 	memset(test_state.rx_PDU, 0, MAX_FRAME_SIZE);
 	memset(test_state.tx_PDU, 0, MAX_FRAME_SIZE);
 	test_state.sent_count = 0;
+	test_state.tx_observe = NULL;
 
 	memset(test_state.msrp_event_counts, 0, sizeof test_state.msrp_event_counts);
 	memset(test_state.msrp_event_counts_per_type, 0, sizeof test_state.msrp_event_counts_per_type);
@@ -48,6 +51,12 @@ TRACE
 	test_state.msrp_observe = NULL;
 
 	memset(test_state.mrpd_log, 0, MRPD_DOUBLE_LOG_SIZE);
+
+	test_state.port_count = 1;
+	test_state.port_current = 0;
+	test_state.port_latency = 0;
+	memset(test_state.msrp_dbs, 0, sizeof test_state.msrp_dbs);
+	memset(test_state.mvrp_dbs, 0, sizeof test_state.mvrp_dbs);
 }
 
 unsigned int mrpd_send_packet_count(void)
@@ -122,6 +131,12 @@ TRACE
         return 0;
 }
 
+unsigned long mrpd_clock_ms(void)
+{
+TRACE
+	return test_state.clock_ms;
+}
+
 int mrpd_init_timers(struct mrp_database *mrp_db)
 {
 TRACE
@@ -152,9 +167,10 @@ TRACE
 
 int mrpd_recvmsgbuf(SOCKET sock, char **buf)
 {
+	static char rx_frame[MAX_FRAME_SIZE];
 TRACE
 	(void)sock;
-	*buf = malloc(MAX_FRAME_SIZE);
+	*buf = rx_frame;
 	memcpy(*buf, test_state.rx_PDU, test_state.rx_PDU_len);
 
         return test_state.rx_PDU_len;
@@ -179,6 +195,8 @@ TRACE
 	(void)flags;  /* unused */
 	memcpy(test_state.tx_PDU, buf, len);
         test_state.sent_count++;
+	if (test_state.tx_observe)
+		test_state.tx_observe(buf, len);
         return len;
 }
 
@@ -204,7 +222,47 @@ TRACE
 }
 
 #include "msrp.h"
+#include "mvrp.h"
 extern int msrp_event_orig(int event, struct msrp_attribute *rattrib);
+extern struct msrp_database *MSRP_db;
+extern struct mvrp_database *MVRP_db;
+
+int mrpd_port_count(void)
+{
+TRACE
+	return test_state.port_count;
+}
+
+int mrpd_port_current(void)
+{
+TRACE
+	return test_state.port_current;
+}
+
+/*
+ * Swaps the MSRP and MVRP databases like mrpd does; a test sets up the
+ * databases of a second port by initializing them with that port
+ * selected.
+ */
+void mrpd_port_select(int port)
+{
+TRACE
+	assert(port < MRPD_DOUBLE_PORTS && "Out of mrpd test double ports");
+	if (port == test_state.port_current)
+		return;
+
+	test_state.msrp_dbs[test_state.port_current] = MSRP_db;
+	test_state.mvrp_dbs[test_state.port_current] = MVRP_db;
+	MSRP_db = test_state.msrp_dbs[port];
+	MVRP_db = test_state.mvrp_dbs[port];
+	test_state.port_current = port;
+}
+
+uint32_t mrpd_port_latency(void)
+{
+TRACE
+	return test_state.port_latency;
+}
 void dump_msrp_attrib(struct msrp_attribute *attr)
 {
 	printf("prev: %sNULL\n", attr->prev ? "Not " : "");
@@ -16,6 +16,7 @@
 
 #define MRPD_TIMER_COUNT 12
 #define MRPD_DOUBLE_LOG_SIZE 1024
+#define MRPD_DOUBLE_PORTS 2
 
 #define TIMER_UNDEF   -1
 #define TIMER_STOPPED  0
@@ -50,11 +51,17 @@ typedef struct {
  * stuff to a different file.
  */
 struct msrp_attribute;
+struct msrp_database;
+struct mvrp_database;
 /**
  * Callback function type that can be used to observe and validate
  * MSRP events
  */
 typedef void (*msrp_observer_t)(int event, struct msrp_attribute *attrib);
+/**
+ * Callback function type that sees every PDU passed to mrpd_send()
+ */
+typedef void (*mrpd_tx_observer_t)(const void *buf, size_t len);
 /**
  * Print the contents of a msrp_attribute structure to stdout for debugging.
  */
@@ -71,6 +78,7 @@ struct mrpd_test_state {
 	/* Timer State */
 	timer_double_t timers[MRPD_TIMER_COUNT];
 	HTIMER periodic_timer_id;
+	unsigned long clock_ms;	/* returned by mrpd_clock_ms() */
 
 	/* Control Message */
 	char ctl_msg_data[MAX_MRPD_CMDSZ];
@@ -86,6 +94,7 @@ struct mrpd_test_state {
 	unsigned char tx_PDU[MAX_FRAME_SIZE];
 	unsigned int rx_PDU_len;
 	int sent_count;
+	mrpd_tx_observer_t tx_observe;
 
 	/* MSRP Events */
 	uint16_t msrp_event_counts[21];
@@ -95,6 +104,13 @@ struct mrpd_test_state {
 
 	/* Log Buffer */
 	char mrpd_log[MRPD_DOUBLE_LOG_SIZE];
+
+	/* Bridge Ports, swapped in by mrpd_port_select() */
+	int port_count;
+	int port_current;
+	uint32_t port_latency;	/* returned by mrpd_port_latency() */
+	struct msrp_database *msrp_dbs[MRPD_DOUBLE_PORTS];
+	struct mvrp_database *mvrp_dbs[MRPD_DOUBLE_PORTS];
 };
 extern struct mrpd_test_state test_state;
 
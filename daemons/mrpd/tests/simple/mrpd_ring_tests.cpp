@@ -0,0 +1,327 @@
+/******************************************************************************
+
+  Copyright (c) 2014, AudioScience, Inc.
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+   3. Neither the name of the AudioScience, Inc nor the names of its
+      contributors may be used to endorse or promote products derived from
+      this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+
+******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+
+#include "CppUTest/TestHarness.h"
+
+extern "C"
+{
+
+#include "mrp_doubles.h"
+
+}
+
+/*
+ * The shared memory rings of the Unix transport, driven from one thread
+ * standing in for both mrpd and the client.
+ */
+static struct mrpd_shm *shm;
+
+TEST_GROUP(MrpdShmRingTestGroup)
+{
+    void setup()
+    {
+        shm = (struct mrpd_shm *)calloc(1, sizeof(*shm));
+        CHECK(shm != NULL);
+    }
+
+    void teardown()
+    {
+        free(shm);
+        shm = NULL;
+    }
+};
+
+TEST(MrpdShmRingTestGroup, PushPopWrapAround)
+{
+    struct mrpd_shm_ring *ring = &shm->cmd;
+    char msg[32];
+    char buf[MAX_MRPD_CMDSZ + 1];
+    int i;
+
+    /* start just short of the 32 bit wrap of head and tail */
+    ring->head = 0xfffffff0;
+    ring->tail = 0xfffffff0;
+
+    for (i = 0; i < 3 * MRPD_SHM_SLOTS; i++) {
+        snprintf(msg, sizeof(msg), "V++:I=%04x", i);
+        /* the consumer keeps up, every push finds the ring empty */
+        LONGS_EQUAL(1, mrpd_shm_push(ring, msg, strlen(msg)));
+        LONGS_EQUAL(strlen(msg), mrpd_shm_pop(ring, buf, sizeof(buf)));
+        STRCMP_EQUAL(msg, buf);
+    }
+    LONGS_EQUAL(-1, mrpd_shm_pop(ring, buf, sizeof(buf)));
+    LONGS_EQUAL(ring->head, ring->tail);
+}
+
+TEST(MrpdShmRingTestGroup, FullRingNeedWakeup)
+{
+    struct mrpd_shm_ring *ring = &shm->notify;
+    char buf[MAX_MRPD_CMDSZ + 1];
+    int i;
+
+    LONGS_EQUAL(1, mrpd_shm_push_wakeup(ring, "first", 5));
+    for (i = 1; i < MRPD_SHM_SLOTS; i++)
+        LONGS_EQUAL(0, mrpd_shm_push_wakeup(ring, "more", 4));
+    LONGS_EQUAL(0, ring->need_wakeup);
+
+    /* full: mrpd asks for a doorbell */
+    LONGS_EQUAL(-1, mrpd_shm_push_wakeup(ring, "late", 4));
+    LONGS_EQUAL(1, ring->need_wakeup);
+
+    /* the client drains, takes the flag and rings; the retry fits */
+    LONGS_EQUAL(5, mrpd_shm_pop(ring, buf, sizeof(buf)));
+    STRCMP_EQUAL("first", buf);
+    LONGS_EQUAL(1, __atomic_exchange_n(&ring->need_wakeup, 0,
+                                       __ATOMIC_SEQ_CST));
+    LONGS_EQUAL(0, mrpd_shm_push_wakeup(ring, "late", 4));
+    LONGS_EQUAL(0, ring->need_wakeup);
+
+    for (i = 1; i < MRPD_SHM_SLOTS; i++) {
+        LONGS_EQUAL(4, mrpd_shm_pop(ring, buf, sizeof(buf)));
+        STRCMP_EQUAL("more", buf);
+    }
+    LONGS_EQUAL(4, mrpd_shm_pop(ring, buf, sizeof(buf)));
+    STRCMP_EQUAL("late", buf);
+    LONGS_EQUAL(-1, mrpd_shm_pop(ring, buf, sizeof(buf)));
+}
+
+TEST(MrpdShmRingTestGroup, MalformedLength)
+{
+    struct mrpd_shm_ring *ring = &shm->cmd;
+    char buf[MAX_MRPD_CMDSZ + 1];
+
+    memset(buf, 0x5a, sizeof(buf));
+    LONGS_EQUAL(1, mrpd_shm_push(ring, "S??", 3));
+    LONGS_EQUAL(0, mrpd_shm_push(ring, "V??", 3));
+    LONGS_EQUAL(0, mrpd_shm_push(ring, "M??", 3));
+
+    /* a client rewrites the lengths behind our back */
+    ring->slot[0].len = 0x80000000;
+    ring->slot[1].len = MAX_MRPD_CMDSZ + 1;
+
+    LONGS_EQUAL(-2, mrpd_shm_pop(ring, buf, sizeof(buf)));
+    LONGS_EQUAL(-2, mrpd_shm_pop(ring, buf, sizeof(buf)));
+    /* nothing was copied for the dropped slots */
+    LONGS_EQUAL(0x5a, buf[0]);
+
+    LONGS_EQUAL(3, mrpd_shm_pop(ring, buf, sizeof(buf)));
+    STRCMP_EQUAL("M??", buf);
+    LONGS_EQUAL(-1, mrpd_shm_pop(ring, buf, sizeof(buf)));
+
+    /* a length the buffer can not take is cut short, not overrun */
+    LONGS_EQUAL(1, mrpd_shm_push(ring, "S++:S=0011223344556677", 22));
+    LONGS_EQUAL(7, mrpd_shm_pop(ring, buf, 8));
+    STRCMP_EQUAL("S++:S=0", buf);
+}
+
+/*
+ * The rings that hand work from the main thread to the application
+ * threads of -t.
+ */
+static struct mrpd_work_ring *work_ring;
+
+TEST_GROUP(MrpdWorkRingTestGroup)
+{
+    void setup()
+    {
+        work_ring = (struct mrpd_work_ring *)calloc(1, sizeof(*work_ring));
+        CHECK(work_ring != NULL);
+    }
+
+    void teardown()
+    {
+        free(work_ring);
+        work_ring = NULL;
+    }
+};
+
+static int work_push_cmd(const char *cmd, int port)
+{
+    struct sockaddr_in client;
+
+    memset(&client, 0, sizeof(client));
+    client.sin_port = port;
+    return mrpd_work_push(work_ring, 1, port, &client, cmd, strlen(cmd));
+}
+
+TEST(MrpdWorkRingTestGroup, WrapAround)
+{
+    struct mrpd_work *work;
+    char cmd[32];
+    int i;
+
+    work_ring->head = 0xffffffc0;
+    work_ring->tail = 0xffffffc0;
+
+    for (i = 0; i < 3 * MRPD_WORK_SLOTS; i++) {
+        snprintf(cmd, sizeof(cmd), "S??:O=%d", i);
+        LONGS_EQUAL(1, work_push_cmd(cmd, i & 3));
+        work = mrpd_work_peek(work_ring);
+        CHECK(work != NULL);
+        LONGS_EQUAL(1, work->kind);
+        LONGS_EQUAL(i & 3, work->port);
+        LONGS_EQUAL(i & 3, work->client.sin_port);
+        LONGS_EQUAL(strlen(cmd), work->len);
+        STRCMP_EQUAL(cmd, work->data);
+        mrpd_work_done(work_ring);
+    }
+    POINTERS_EQUAL(NULL, mrpd_work_peek(work_ring));
+}
+
+TEST(MrpdWorkRingTestGroup, FullRing)
+{
+    struct mrpd_work *work;
+    char cmd[32];
+    int i;
+
+    for (i = 0; i < MRPD_WORK_SLOTS; i++) {
+        snprintf(cmd, sizeof(cmd), "V++:I=%04x", i + 1);
+        CHECK(work_push_cmd(cmd, 0) >= 0);
+    }
+    LONGS_EQUAL(-1, work_push_cmd("V++:I=0fff", 0));
+    LONGS_EQUAL(-1, mrpd_work_push(work_ring, 4, 0, NULL, NULL, 0));
+
+    /* the slot under the consumer is not handed out before done */
+    work = mrpd_work_peek(work_ring);
+    STRCMP_EQUAL("V++:I=0001", work->data);
+    LONGS_EQUAL(-1, work_push_cmd("V++:I=0fff", 0));
+    mrpd_work_done(work_ring);
+
+    LONGS_EQUAL(0, work_push_cmd("V++:I=0ffe", 0));
+    LONGS_EQUAL(-1, work_push_cmd("V++:I=0fff", 0));
+
+    for (i = 1; i < MRPD_WORK_SLOTS; i++) {
+        snprintf(cmd, sizeof(cmd), "V++:I=%04x", i + 1);
+        work = mrpd_work_peek(work_ring);
+        STRCMP_EQUAL(cmd, work->data);
+        mrpd_work_done(work_ring);
+    }
+    work = mrpd_work_peek(work_ring);
+    STRCMP_EQUAL("V++:I=0ffe", work->data);
+    mrpd_work_done(work_ring);
+    POINTERS_EQUAL(NULL, mrpd_work_peek(work_ring));
+}
+
+TEST(MrpdWorkRingTestGroup, DoorbellOnlyWhenEmpty)
+{
+    LONGS_EQUAL(1, work_push_cmd("S??", 0));
+    LONGS_EQUAL(0, work_push_cmd("V??", 0));
+    LONGS_EQUAL(0, work_push_cmd("M??", 0));
+
+    /* a partly drained ring still has the consumer's attention */
+    CHECK(mrpd_work_peek(work_ring) != NULL);
+    mrpd_work_done(work_ring);
+    LONGS_EQUAL(0, work_push_cmd("D?M", 0));
+
+    while (mrpd_work_peek(work_ring))
+        mrpd_work_done(work_ring);
+    LONGS_EQUAL(1, work_push_cmd("S??", 0));
+}
+
+#define WORK_RING_COUNT     200000
+
+struct work_ring_consumer {
+    int doorbell;
+    int received;
+    int out_of_order;
+    int stalled;
+};
+
+/* an application thread: sleeps on the doorbell, drains the ring */
+static void *work_ring_consume(void *arg)
+{
+    struct work_ring_consumer *c = (struct work_ring_consumer *)arg;
+    struct pollfd pfd;
+    struct mrpd_work *work;
+    uint64_t count;
+
+    pfd.fd = c->doorbell;
+    pfd.events = POLLIN;
+    while (c->received < WORK_RING_COUNT) {
+        /* a doorbell lost between push and done never comes */
+        if (poll(&pfd, 1, 2000) <= 0) {
+            c->stalled = 1;
+            break;
+        }
+        if (read(c->doorbell, &count, sizeof(count)) != sizeof(count))
+            continue;
+        while (NULL != (work = mrpd_work_peek(work_ring))) {
+            if (work->port != c->received)
+                c->out_of_order++;
+            c->received++;
+            mrpd_work_done(work_ring);
+        }
+    }
+    return NULL;
+}
+
+TEST(MrpdWorkRingTestGroup, ThreadedDoorbell)
+{
+    struct work_ring_consumer c;
+    pthread_t thread;
+    uint64_t one = 1;
+    int rings = 0;
+    int rc;
+    int i;
+
+    memset(&c, 0, sizeof(c));
+    c.doorbell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    CHECK(c.doorbell >= 0);
+    LONGS_EQUAL(0, pthread_create(&thread, NULL, work_ring_consume, &c));
+
+    for (i = 0; i < WORK_RING_COUNT; i++) {
+        while ((rc = mrpd_work_push(work_ring, 1, i, NULL, NULL, 0)) < 0)
+            sched_yield();
+        if (rc > 0) {
+            rings++;
+            CHECK(write(c.doorbell, &one, sizeof(one)) == sizeof(one));
+        }
+    }
+    pthread_join(thread, NULL);
+    close(c.doorbell);
+
+    LONGS_EQUAL(0, c.stalled);
+    LONGS_EQUAL(WORK_RING_COUNT, c.received);
+    LONGS_EQUAL(0, c.out_of_order);
+    CHECK(rings >= 1);
+}
@@ -432,6 +432,111 @@ TEST(MsrpPDUTests, TruncatedPacketCompleteMessageOneEndmark)
 	LONGS_EQUAL(0, rv);
 }
 
+/* The packed event tables must agree with the encode macros */
+TEST(MsrpPDUTests, PackedEventCodecRoundTrips)
+{
+	int evt[8];
+	uint8_t packed[2];
+	int a, b, c, d;
+
+	for (a = 0; a <= MRPDU_LV; a++)
+		for (b = 0; b <= MRPDU_LV; b++)
+			for (c = 0; c <= MRPDU_LV; c++) {
+				MRPDU_3PACK_DECODE(MRPDU_3PACK_ENCODE(a, b, c), evt);
+				LONGS_EQUAL(a, evt[0]);
+				LONGS_EQUAL(b, evt[1]);
+				LONGS_EQUAL(c, evt[2]);
+			}
+
+	/* the first event of an out of range byte is rejected */
+	MRPDU_3PACK_DECODE(216, evt);
+	CHECK(evt[0] > MRPDU_LV);
+
+	for (a = 0; a < 256; a++) {
+		for (b = 0; b < 4; b++)
+			evt[b] = (a >> (6 - 2 * b)) & 3;
+		evt[4] = 3;
+		LONGS_EQUAL(2, mrpdu_4pack_encode(evt, 5, packed));
+		LONGS_EQUAL(a, packed[0]);
+		LONGS_EQUAL(0xc0, packed[1]);
+
+		for (d = 0; d < 8; d++)
+			evt[d] = -1;
+		LONGS_EQUAL(2, mrpdu_4pack_decode(packed, 5, evt));
+		for (b = 0; b < 4; b++)
+			LONGS_EQUAL((a >> (6 - 2 * b)) & 3, evt[b]);
+		LONGS_EQUAL(3, evt[4]);
+		LONGS_EQUAL(0, evt[5]);
+	}
+}
+
+
+/*
+ * A good PDU and one with the wrong DA are both counted as received,
+ * only the second as an error, and the events they caused show up in
+ * the registrar counters and the report.
+ */
+TEST(MsrpPDUTests, StatsCountPdusAndEvents)
+{
+	struct mrp_stats *stats = &MSRP_db->mrp_db.stats;
+	struct sockaddr_in client;
+	unsigned long registrar_events = 0;
+	int i;
+
+	/* let the events reach the state machines */
+	test_state.forward_msrp_events = 1;
+
+	memcpy(test_state.rx_PDU, pkt2, sizeof pkt2);
+	test_state.rx_PDU_len = sizeof pkt2;
+	LONGS_EQUAL(0, msrp_recv_msg());
+
+	memcpy(test_state.rx_PDU, badDA, sizeof badDA);
+	test_state.rx_PDU_len = sizeof badDA;
+	LONGS_EQUAL(-1, msrp_recv_msg());
+
+	LONGS_EQUAL(2, stats->pdu_rx);
+	LONGS_EQUAL(1, stats->pdu_rx_errors);
+	LONGS_EQUAL(0, stats->pdu_tx);
+	for (i = 0; i < MRP_EVENT_COUNT; i++)
+		registrar_events += stats->registrar_events[i];
+	CHECK(registrar_events > 0);
+
+	memset(&client, 0, sizeof(client));
+	mrp_stats_report(&MSRP_db->mrp_db, "MSRP", 0, &client);
+	CHECK(0 == strncmp(test_state.ctl_msg_data, "EVT MSRP P=0 A=", 15));
+}
+
+/*
+ * This test fills every event counter with more digits than the report
+ * line has room for, verifying that the line is cut short inside its
+ * buffer rather than written past it.
+ */
+TEST(MsrpPDUTests, StatsReportTruncates)
+{
+	struct mrp_stats *stats = &MSRP_db->mrp_db.stats;
+	struct mrp_histogram hist;
+	struct sockaddr_in client;
+	int i;
+
+	for (i = 0; i < MRP_EVENT_COUNT; i++) {
+		stats->applicant_events[i] = ~0UL - i;
+		stats->registrar_events[i] = ~0UL - i;
+	}
+	memset(&hist, 0, sizeof(hist));
+	for (i = 0; i < MRP_HIST_BUCKETS; i++)
+		hist.bucket[i] = ~0UL - i;
+	hist.count = ~0UL;
+	hist.max_us = ~0UL;
+
+	memset(&client, 0, sizeof(client));
+	mrp_stats_report(&MSRP_db->mrp_db, "MSRP", 0, &client);
+	CHECK(0 == strncmp(test_state.ctl_msg_data, "EVT MSRP P=0 A=", 15));
+	LONGS_EQUAL(510, strlen(test_state.ctl_msg_data));
+
+	mrp_histogram_report(&hist, "MSRP/periodic", 0, &client);
+	CHECK(0 == strncmp(test_state.ctl_msg_data, "HST MSRP/periodic", 17));
+	LONGS_EQUAL(318, strlen(test_state.ctl_msg_data));
+}
 
 
 /*
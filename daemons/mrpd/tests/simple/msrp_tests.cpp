@@ -337,3 +337,536 @@ TEST(MsrpTestGroup, TxLVA_TalkerAdv_count_64)
 	CHECK_EQUAL(0, tx_flag_count);
 	LONGS_EQUAL(count, event_counts_per_type(MSRP_TALKER_ADV_TYPE, MRP_EVENT_NEW));
 }
+
+/*
+ * 128 TalkerAdvertises do not fit into one frame. Verify that the
+ * encoder spills the rest into a second PDU instead of dropping them,
+ * and that the LeaveAll is only flagged in the first one.
+ */
+TEST(MsrpTestGroup, TxLVA_TalkerAdv_spill)
+{
+	char cmd_string[128];
+	uint64_t id = 0xbadc0ffeeull;
+	uint64_t da = 0xdeadbeefull;
+	int count = 128;
+	unsigned char *msg;
+	int listlen;
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		snprintf(cmd_string, sizeof(cmd_string),
+			"S++:S=%" PRIx64 ",A=%" PRIx64 ",V=" VLAN_ID ",Z=" TSPEC_MAX_FRAME_SIZE
+			",I=" TSPEC_MAX_FRAME_INTERVAL ",P=" PRIORITY_AND_RANK ",L=" ACCUMULATED_LATENCY,
+			id, da);
+		msrp_recv_cmd(cmd_string, strlen(cmd_string) + 1, &client);
+		/* add 2 to prevent vectorizing */
+		id += 2;
+		da += 2;
+	}
+
+	msrp_event(MRP_EVENT_LVATIMER, NULL);
+
+	/* 70 single-value vectors of 28 bytes fill the first frame */
+	LONGS_EQUAL(2, mrpd_send_packet_count());
+
+	/* the last frame leads with the remaining talkers */
+	msg = &test_state.tx_PDU[sizeof(eth_hdr_t) + 1];
+	LONGS_EQUAL(MSRP_TALKER_ADV_TYPE, msg[0]);
+	listlen = (msg[2] << 8) | msg[3];
+	LONGS_EQUAL((count - 70) * 28 + MRPDU_ENDMARK_SZ, listlen);
+
+	/* one value and no LeaveAll in the first vector */
+	LONGS_EQUAL(1, (msg[4] << 8) | msg[5]);
+}
+
+/*
+ * This test switches the client to binary notifications and verifies
+ * that notifications for two streams are held back until the flush
+ * and then delivered as one datagram with two fixed-layout records.
+ */
+TEST(MsrpTestGroup, BinaryNotificationsAreBatched)
+{
+	struct msrp_attribute *attrib;
+	struct mrpd_notify_hdr hdr;
+	struct mrpd_notify_rec rec[2];
+	char cmd_binary[] = "S+B";
+	char cmd_string[128];
+	uint64_t id = 0xbadc0ffeeull;
+	int i;
+
+	msrp_recv_cmd(cmd_binary, sizeof(cmd_binary), &client);
+
+	for (i = 0; i < 2; i++)
+	{
+		snprintf(cmd_string, sizeof(cmd_string),
+			"S++:S=%" PRIx64 ",A=" STREAM_DA ",V=" VLAN_ID ",Z=" TSPEC_MAX_FRAME_SIZE
+			",I=" TSPEC_MAX_FRAME_INTERVAL ",P=" PRIORITY_AND_RANK ",L=" ACCUMULATED_LATENCY,
+			id + i);
+		msrp_recv_cmd(cmd_string, strlen(cmd_string) + 1, &client);
+	}
+
+	/* discard the notifications raised by the declarations */
+	mrp_client_notify_flush(MSRP_db->mrp_db.clients);
+
+	memset(test_state.ctl_msg_data, 0, sizeof(test_state.ctl_msg_data));
+	for (attrib = MSRP_db->attrib_list; attrib; attrib = attrib->next)
+		msrp_send_notifications(attrib, MRP_NOTIFY_JOIN);
+
+	/* nothing is sent before the flush */
+	memcpy(&hdr, test_state.ctl_msg_data, sizeof(hdr));
+	LONGS_EQUAL(0, hdr.magic);
+
+	mrp_client_notify_flush(MSRP_db->mrp_db.clients);
+
+	memcpy(&hdr, test_state.ctl_msg_data, sizeof(hdr));
+	memcpy(rec, test_state.ctl_msg_data + sizeof(hdr), sizeof(rec));
+	LONGS_EQUAL(MRPD_NOTIFY_MAGIC, ntohs(hdr.magic));
+	LONGS_EQUAL('S', hdr.app);
+	LONGS_EQUAL(2, ntohs(hdr.count));
+	for (i = 0; i < 2; i++)
+	{
+		LONGS_EQUAL(MRP_NOTIFY_JOIN, rec[i].notify);
+		LONGS_EQUAL(MRPD_NOTIFY_MSRP_TALKER, rec[i].type);
+		LONGS_EQUAL(2, ntohs(rec[i].u.talker.vid));
+		LONGS_EQUAL(576, ntohs(rec[i].u.talker.max_frame_size));
+	}
+	LONGS_EQUAL(0xee, rec[0].u.talker.stream_id[7]);
+	LONGS_EQUAL(0xef, rec[1].u.talker.stream_id[7]);
+}
+
+/*
+ * This test subscribes one client to a single StreamID and another
+ * to domain attributes only, and verifies that each notification
+ * reaches only the clients whose filters match.
+ */
+TEST(MsrpTestGroup, NotificationFiltersSelectClients)
+{
+	struct msrp_attribute *attrib;
+	struct sockaddr_in stream_client;
+	struct sockaddr_in domain_client;
+	client_t *c;
+	char cmd_binary[] = "S+B";
+	char cmd_stream[] = "S+F:S=badc0ffee";
+	char cmd_domain[] = "S+F:T=4";
+	char cmd_string[128];
+	uint64_t id = 0xbadc0ffeeull;
+	int i;
+
+	memset(&stream_client, 0, sizeof(stream_client));
+	memset(&domain_client, 0, sizeof(domain_client));
+	stream_client.sin_port = htons(1);
+	domain_client.sin_port = htons(2);
+
+	msrp_recv_cmd(cmd_binary, sizeof(cmd_binary), &stream_client);
+	msrp_recv_cmd(cmd_stream, sizeof(cmd_stream), &stream_client);
+	strcpy(cmd_binary, "S+B");
+	msrp_recv_cmd(cmd_binary, sizeof(cmd_binary), &domain_client);
+	msrp_recv_cmd(cmd_domain, sizeof(cmd_domain), &domain_client);
+
+	for (i = 0; i < 2; i++)
+	{
+		snprintf(cmd_string, sizeof(cmd_string),
+			"S++:S=%" PRIx64 ",A=" STREAM_DA ",V=" VLAN_ID ",Z=" TSPEC_MAX_FRAME_SIZE
+			",I=" TSPEC_MAX_FRAME_INTERVAL ",P=" PRIORITY_AND_RANK ",L=" ACCUMULATED_LATENCY,
+			id + i);
+		msrp_recv_cmd(cmd_string, strlen(cmd_string) + 1, &stream_client);
+	}
+	mrp_client_notify_flush(MSRP_db->mrp_db.clients);
+
+	for (attrib = MSRP_db->attrib_list; attrib; attrib = attrib->next)
+		msrp_send_notifications(attrib, MRP_NOTIFY_JOIN);
+
+	for (c = MSRP_db->mrp_db.clients; c; c = c->next)
+	{
+		if (c->client.sin_port == stream_client.sin_port)
+			LONGS_EQUAL(1, c->notify_count);
+		else
+			LONGS_EQUAL(0, c->notify_count);
+	}
+
+	/* without filters every client hears about every stream */
+	strcpy(cmd_string, "S-F");
+	msrp_recv_cmd(cmd_string, strlen(cmd_string) + 1, &stream_client);
+	msrp_recv_cmd(cmd_string, strlen(cmd_string) + 1, &domain_client);
+	mrp_client_notify_flush(MSRP_db->mrp_db.clients);
+
+	for (attrib = MSRP_db->attrib_list; attrib; attrib = attrib->next)
+		msrp_send_notifications(attrib, MRP_NOTIFY_JOIN);
+
+	for (c = MSRP_db->mrp_db.clients; c; c = c->next)
+		LONGS_EQUAL(2, c->notify_count);
+}
+
+/*
+ * This test adds more clients than notify_set starts out with and
+ * verifies that adding them made room for every one, so that an
+ * unfiltered event selects all of them.
+ */
+TEST(MsrpTestGroup, NotifySetHoldsEveryClient)
+{
+	struct sockaddr_in udp;
+	int i;
+
+	memset(&udp, 0, sizeof(udp));
+	udp.sin_family = AF_INET;
+	for (i = 0; i < 20; i++)
+	{
+		udp.sin_port = htons(7000 + i);
+		LONGS_EQUAL(0, mrp_client_add(&MSRP_db->mrp_db, &udp));
+	}
+	/* adding a client again takes no more room */
+	LONGS_EQUAL(0, mrp_client_add(&MSRP_db->mrp_db, &udp));
+
+	CHECK(MSRP_db->mrp_db.notify_set_size >= 20);
+	LONGS_EQUAL(20, mrp_client_match(&MSRP_db->mrp_db,
+		MSRP_TALKER_ADV_TYPE, 0, 0));
+}
+
+/*
+ * This test declares three TalkerAdvs in one bulk command and verifies
+ * that they are all registered and acknowledged with a single response,
+ * and that a malformed record rejects the whole command.
+ */
+TEST(MsrpTestGroup, BulkDeclareStreams)
+{
+	struct msrp_attribute a_ref;
+	char cmd_string[512];
+	char bad_string[] = "S--:S=" STREAM_ID ";X=1";
+	int i;
+
+	snprintf(cmd_string, sizeof(cmd_string), "S++");
+	for (i = 0; i < 3; i++)
+	{
+		snprintf(cmd_string + strlen(cmd_string),
+			sizeof(cmd_string) - strlen(cmd_string),
+			"%cS=%" PRIx64 ",A=" STREAM_DA ",V=" VLAN_ID ",Z=" TSPEC_MAX_FRAME_SIZE
+			",I=" TSPEC_MAX_FRAME_INTERVAL ",P=" PRIORITY_AND_RANK ",L=" ACCUMULATED_LATENCY,
+			i ? ';' : ':', 0xDEADBEEFBADFCA11ull + i);
+	}
+	msrp_recv_cmd(cmd_string, strlen(cmd_string) + 1, &client);
+
+	STRCMP_EQUAL("OK+ N=3", test_state.ctl_msg_data);
+	LONGS_EQUAL(3, event_counts_per_type(MSRP_TALKER_ADV_TYPE, MRP_EVENT_NEW));
+	a_ref.type = MSRP_TALKER_ADV_TYPE;
+	for (i = 0; i < 3; i++)
+	{
+		uint64_to_id(0xDEADBEEFBADFCA11ull + i, a_ref.attribute.talk_listen.StreamID);
+		CHECK(msrp_lookup(&a_ref) != NULL);
+	}
+
+	msrp_recv_cmd(bad_string, sizeof(bad_string), &client);
+	STRCMP_EQUAL("ERP R=1", test_state.ctl_msg_data);
+	LONGS_EQUAL(0, event_counts_per_type(MSRP_TALKER_ADV_TYPE, MRP_EVENT_LV));
+}
+
+/*
+ * This test reports two bulks of listener statuses in scrambled StreamID
+ * order and verifies that every listener can be looked up, that the
+ * database stays sorted by StreamID and that a talker with the same
+ * StreamID is a different key.
+ */
+TEST(MsrpTestGroup, BulkListenersStaySorted)
+{
+	struct msrp_attribute a_ref;
+	struct msrp_attribute *attrib;
+	char cmd_string[1500];
+	uint64_t base = 0xDEADBEEFBADF0000ull;
+	uint64_t id;
+	uint64_t prev = 0;
+	int count = 0;
+	int bulk;
+	int i;
+
+	for (bulk = 0; bulk < 2; bulk++)
+	{
+		snprintf(cmd_string, sizeof(cmd_string), "S+L");
+		for (i = 0; i < 60; i++)
+		{
+			snprintf(cmd_string + strlen(cmd_string),
+				sizeof(cmd_string) - strlen(cmd_string),
+				"%cL=%" PRIx64 ",D=2", i ? ';' : ':',
+				base + 2 * ((i * 37) % 60) + bulk);
+		}
+		msrp_recv_cmd(cmd_string, strlen(cmd_string) + 1, &client);
+		STRCMP_EQUAL("OK+ N=60", test_state.ctl_msg_data);
+	}
+
+	for (attrib = MSRP_db->attrib_list; attrib; attrib = attrib->next)
+	{
+		LONGS_EQUAL(MSRP_LISTENER_TYPE, attrib->type);
+		id = 0;
+		for (i = 0; i < 8; i++)
+			id = (id << 8) | attrib->attribute.talk_listen.StreamID[i];
+		CHECK(id > prev);
+		prev = id;
+		count++;
+	}
+	LONGS_EQUAL(120, count);
+
+	memset(&a_ref, 0, sizeof(a_ref));
+	a_ref.type = MSRP_LISTENER_TYPE;
+	for (i = 0; i < 120; i++)
+	{
+		uint64_to_id(base + i, a_ref.attribute.talk_listen.StreamID);
+		attrib = msrp_lookup(&a_ref);
+		CHECK(attrib != NULL);
+		CHECK(0 == memcmp(attrib->attribute.talk_listen.StreamID,
+			a_ref.attribute.talk_listen.StreamID, 8));
+	}
+	a_ref.type = MSRP_TALKER_ADV_TYPE;
+	CHECK(msrp_lookup(&a_ref) == NULL);
+}
+
+/*
+ * 20 TalkerAdvs do not fit into one S?? response. Verify that each
+ * page ends with the offset of the next and that following the offsets
+ * with S??:O=<n> lists every talker exactly once.
+ */
+TEST(MsrpTestGroup, PagedDump)
+{
+	char cmd_string[128];
+	char *more;
+	char *line;
+	int count = 20;
+	int talkers = 0;
+	int pages = 0;
+	int offset = 0;
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		snprintf(cmd_string, sizeof(cmd_string),
+			"S++:S=%" PRIx64 ",A=" STREAM_DA ",V=" VLAN_ID ",Z=" TSPEC_MAX_FRAME_SIZE
+			",I=" TSPEC_MAX_FRAME_INTERVAL ",P=" PRIORITY_AND_RANK ",L=" ACCUMULATED_LATENCY,
+			0xDEADBEEFBADFCA11ull + i);
+		msrp_recv_cmd(cmd_string, strlen(cmd_string) + 1, &client);
+	}
+
+	do
+	{
+		snprintf(cmd_string, sizeof(cmd_string), "S??:O=%d", offset);
+		LONGS_EQUAL(0, msrp_recv_cmd(cmd_string, strlen(cmd_string) + 1, &client));
+		for (line = test_state.ctl_msg_data; (line = strstr(line, "T:S=")) != NULL; line++)
+			talkers++;
+		more = strstr(test_state.ctl_msg_data, "MSRP:More O=");
+		if (more)
+		{
+			CHECK(atoi(more + 12) > offset);
+			offset = atoi(more + 12);
+			LONGS_EQUAL(offset, talkers);
+		}
+		pages++;
+	} while (more && pages < count);
+
+	CHECK(pages > 1);
+	LONGS_EQUAL(count, talkers);
+
+	snprintf(cmd_string, sizeof(cmd_string), "S??:O=x");
+	msrp_recv_cmd(cmd_string, strlen(cmd_string) + 1, &client);
+	CHECK(0 == strncmp(test_state.ctl_msg_data, "ERP", 3));
+}
+
+static struct msrp_attribute *rx_attrib(int type, uint64_t id, uint32_t latency)
+{
+	struct msrp_attribute *attrib;
+
+	attrib = msrp_alloc();
+	attrib->type = type;
+	uint64_to_id(id, attrib->attribute.talk_listen.StreamID);
+	attrib->attribute.talk_listen.AccumulatedLatency = latency;
+	if (MSRP_LISTENER_TYPE == type)
+	{
+		attrib->substate = MSRP_LISTENER_READY;
+		attrib->direction = MSRP_DIRECTION_LISTENER;
+	}
+	return attrib;
+}
+
+/*
+ * This test sets up a second bridge port and verifies that a TalkerAdv
+ * registered on one port is declared on the other with the port latency
+ * added, that a Listener follows the talker back, and that both are
+ * withdrawn when the talker leaves.
+ */
+TEST(MsrpTestGroup, MapPropagatesBetweenPorts)
+{
+	struct msrp_attribute t_ref;
+	struct msrp_attribute l_ref;
+	struct msrp_attribute *attrib;
+
+	mrpd_port_select(1);
+	msrp_init(1);
+	mrpd_port_select(0);
+	test_state.port_count = 2;
+	test_state.port_latency = 500;
+
+	t_ref.type = MSRP_TALKER_ADV_TYPE;
+	uint64_to_id(0xDEADBEEFBADFCA11ull, t_ref.attribute.talk_listen.StreamID);
+	l_ref = t_ref;
+	l_ref.type = MSRP_LISTENER_TYPE;
+
+	msrp_event(MRP_EVENT_RJOININ, rx_attrib(MSRP_TALKER_ADV_TYPE,
+		0xDEADBEEFBADFCA11ull, 1000));
+
+	mrpd_port_select(1);
+	attrib = msrp_lookup(&t_ref);
+	CHECK(attrib != NULL);
+	CHECK(attrib->map_declared);
+	CHECK(!mrp_registrar_in(&attrib->registrar));
+	LONGS_EQUAL(1500, attrib->attribute.talk_listen.AccumulatedLatency);
+
+	msrp_event(MRP_EVENT_RJOININ, rx_attrib(MSRP_LISTENER_TYPE,
+		0xDEADBEEFBADFCA11ull, 0));
+	mrpd_port_select(0);
+	attrib = msrp_lookup(&l_ref);
+	CHECK(attrib != NULL);
+	CHECK(attrib->map_declared);
+	LONGS_EQUAL(MSRP_LISTENER_READY, attrib->substate);
+
+	msrp_event(MRP_EVENT_RLV, rx_attrib(MSRP_TALKER_ADV_TYPE,
+		0xDEADBEEFBADFCA11ull, 1000));
+	attrib = msrp_lookup(&l_ref);
+	CHECK(attrib == NULL || !attrib->map_declared);
+	mrpd_port_select(1);
+	attrib = msrp_lookup(&t_ref);
+	CHECK(attrib == NULL || !attrib->map_declared);
+
+	msrp_reset();
+	mrpd_port_select(0);
+}
+
+/*
+ * The periodic timer and the transmits flip a declaration between its
+ * anxious and quiet states every second, and a LeaveAll moves the
+ * registrations through LV. Verify that neither counts as a change of
+ * the snapshot, while a new UDP client does.
+ */
+TEST(MsrpTestGroup, SnapshotGenIgnoresChurn)
+{
+	struct msrp_attribute t_ref;
+	struct msrp_attribute l_ref;
+	struct msrp_attribute *talker;
+	struct msrp_attribute *listener;
+	struct sockaddr_in udp;
+	char cmd_string[] = ST_PLUS_PLUS;
+	char query_string[] = "S??";
+	unsigned long gen;
+
+	memset(&udp, 0, sizeof(udp));
+	udp.sin_family = AF_INET;
+	udp.sin_port = htons(7500);
+
+	t_ref.type = MSRP_TALKER_ADV_TYPE;
+	uint64_to_id(0xDEADBEEFBADFCA11ull, t_ref.attribute.talk_listen.StreamID);
+	l_ref.type = MSRP_LISTENER_TYPE;
+	uint64_to_id(0xDEADBEEFBADFCA12ull, l_ref.attribute.talk_listen.StreamID);
+
+	msrp_recv_cmd(cmd_string, sizeof(cmd_string), &client);
+	msrp_event(MRP_EVENT_RJOININ, rx_attrib(MSRP_LISTENER_TYPE,
+		0xDEADBEEFBADFCA12ull, 0));
+	talker = msrp_lookup(&t_ref);
+	listener = msrp_lookup(&l_ref);
+	CHECK(talker != NULL);
+	CHECK(listener != NULL);
+	talker->applicant.mrp_state = MRP_QA_STATE;
+	gen = MSRP_db->mrp_db.state_gen;
+
+	mrp_applicant_fsm(&MSRP_db->mrp_db, &talker->applicant,
+		MRP_EVENT_PERIODIC, 0);
+	LONGS_EQUAL(MRP_AA_STATE, talker->applicant.mrp_state);
+	mrp_applicant_fsm(&MSRP_db->mrp_db, &talker->applicant,
+		MRP_EVENT_TX, 0);
+	LONGS_EQUAL(MRP_QA_STATE, talker->applicant.mrp_state);
+
+	mrp_registrar_fsm(&listener->registrar, &MSRP_db->mrp_db, MRP_EVENT_RLA);
+	LONGS_EQUAL(MRP_LV_STATE, listener->registrar.mrp_state);
+	mrp_registrar_fsm(&listener->registrar, &MSRP_db->mrp_db,
+		MRP_EVENT_RJOININ);
+	LONGS_EQUAL(MRP_IN_STATE, listener->registrar.mrp_state);
+
+	msrp_recv_cmd(query_string, sizeof(query_string), &client);
+	LONGS_EQUAL(gen, MSRP_db->mrp_db.state_gen);
+
+	LONGS_EQUAL(0, mrp_client_add(&MSRP_db->mrp_db, &udp));
+	CHECK(MSRP_db->mrp_db.state_gen != gen);
+	gen = MSRP_db->mrp_db.state_gen;
+	LONGS_EQUAL(0, mrp_client_add(&MSRP_db->mrp_db, &udp));
+	LONGS_EQUAL(gen, MSRP_db->mrp_db.state_gen);
+
+	mrp_applicant_fsm(&MSRP_db->mrp_db, &talker->applicant,
+		MRP_EVENT_LV, 0);
+	CHECK(MSRP_db->mrp_db.state_gen != gen);
+}
+
+/*
+ * This test checkpoints a declared TalkerAdv, a registered Listener and
+ * a UDP client, restores them into a fresh database and verifies that
+ * the states resume without New events. A stale snapshot only brings
+ * back the declaration.
+ */
+TEST(MsrpTestGroup, SnapshotRestore)
+{
+	struct mrp_snapshot snap;
+	struct msrp_attribute t_ref;
+	struct msrp_attribute l_ref;
+	struct msrp_attribute *attrib;
+	struct sockaddr_in udp;
+	char cmd_string[] = ST_PLUS_PLUS;
+	int t_state;
+	unsigned int i;
+
+	memset(&snap, 0, sizeof(snap));
+	memset(&udp, 0, sizeof(udp));
+	udp.sin_family = AF_INET;
+	udp.sin_port = htons(7500);
+
+	t_ref.type = MSRP_TALKER_ADV_TYPE;
+	uint64_to_id(0xDEADBEEFBADFCA11ull, t_ref.attribute.talk_listen.StreamID);
+	l_ref.type = MSRP_LISTENER_TYPE;
+	uint64_to_id(0xDEADBEEFBADFCA12ull, l_ref.attribute.talk_listen.StreamID);
+
+	msrp_recv_cmd(cmd_string, sizeof(cmd_string), &client);
+	msrp_event(MRP_EVENT_RJOININ, rx_attrib(MSRP_LISTENER_TYPE,
+		0xDEADBEEFBADFCA12ull, 0));
+	LONGS_EQUAL(0, mrp_client_add(&MSRP_db->mrp_db, &udp));
+	LONGS_EQUAL(0, mrp_client_filter_key(&MSRP_db->mrp_db, &udp,
+		0xDEADBEEFBADFCA11ull, 0xDEADBEEFBADFCA11ull));
+
+	attrib = msrp_lookup(&t_ref);
+	CHECK(attrib != NULL);
+	t_state = attrib->applicant.mrp_state;
+
+	LONGS_EQUAL(0, msrp_snapshot(&snap));
+	CHECK(snap.count >= 4);
+
+	msrp_reset();
+	mrpd_reset();
+	msrp_init(1);
+	for (i = 0; i < snap.count; i++)
+		LONGS_EQUAL(0, msrp_restore(&snap.recs[i], 1));
+
+	attrib = msrp_lookup(&t_ref);
+	CHECK(attrib != NULL);
+	LONGS_EQUAL(t_state, attrib->applicant.mrp_state);
+	attrib = msrp_lookup(&l_ref);
+	CHECK(attrib != NULL);
+	CHECK(mrp_registrar_in(&attrib->registrar));
+	LONGS_EQUAL(MSRP_LISTENER_READY, attrib->substate);
+	LONGS_EQUAL(0, event_counts_per_type(MSRP_TALKER_ADV_TYPE, MRP_EVENT_NEW));
+	CHECK(MSRP_db->mrp_db.clients != NULL);
+	LONGS_EQUAL(1, MSRP_db->mrp_db.clients->sub_count);
+
+	msrp_reset();
+	mrpd_reset();
+	msrp_init(1);
+	for (i = 0; i < snap.count; i++)
+		LONGS_EQUAL(0, msrp_restore(&snap.recs[i], 0));
+
+	attrib = msrp_lookup(&t_ref);
+	CHECK(attrib != NULL);
+	CHECK(!mrp_registrar_in(&attrib->registrar));
+	CHECK(msrp_lookup(&l_ref) == NULL);
+
+	free(snap.recs);
+}
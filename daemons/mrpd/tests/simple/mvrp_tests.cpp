@@ -136,3 +136,341 @@ TEST(MvrpTestGroup, TxLVA_clear_tx_flag)
 	CHECK(mrpd_send_packet_count() > 0);
 	CHECK_EQUAL(0, tx_flag_count);
 }
+
+TEST(MvrpTestGroup, VidTableKeepsListSorted)
+{
+	struct mvrp_attribute a_ref;
+	struct mvrp_attribute *attrib = NULL;
+	char cmd_64[] = "V++:I=0064";
+	char cmd_5[] = "V++:I=0005";
+	char cmd_fa0[] = "V++:I=0fa0";
+	char cmd_65[] = "V++:I=0065";
+	uint16_t expected[] = { 0x5, 0x64, 0x65, 0xfa0 };
+	int i = 0;
+
+	CHECK(MVRP_db != NULL);
+
+	/* declare out of order, the list must still come out sorted */
+	mvrp_recv_cmd(cmd_64, sizeof(cmd_64), &client);
+	mvrp_recv_cmd(cmd_5, sizeof(cmd_5), &client);
+	mvrp_recv_cmd(cmd_fa0, sizeof(cmd_fa0), &client);
+	mvrp_recv_cmd(cmd_65, sizeof(cmd_65), &client);
+
+	attrib = MVRP_db->attrib_list;
+	while (NULL != attrib) {
+		CHECK(i < 4);
+		CHECK_EQUAL(expected[i], attrib->attribute);
+		if (NULL != attrib->next)
+			CHECK(attrib->next->prev == attrib);
+		attrib = attrib->next;
+		i++;
+	}
+	CHECK_EQUAL(4, i);
+
+	a_ref.attribute = 0x65;
+	attrib = mvrp_lookup(&a_ref);
+	CHECK(attrib != NULL);
+	CHECK(attrib == MVRP_db->vid_table[0x65]);
+
+	a_ref.attribute = 0x66;
+	CHECK(mvrp_lookup(&a_ref) == NULL);
+}
+
+TEST(MvrpTestGroup, TxContiguousVidsShareVector)
+{
+	char cmd_1[] = "V++:I=0001";
+	char cmd_2[] = "V++:I=0002";
+	char cmd_3[] = "V++:I=0003";
+	char cmd_a[] = "V++:I=000a";
+	unsigned char *vect;
+
+	CHECK(MVRP_db != NULL);
+
+	mvrp_recv_cmd(cmd_a, sizeof(cmd_a), &client);
+	mvrp_recv_cmd(cmd_3, sizeof(cmd_3), &client);
+	mvrp_recv_cmd(cmd_1, sizeof(cmd_1), &client);
+	mvrp_recv_cmd(cmd_2, sizeof(cmd_2), &client);
+
+	mvrp_event(MRP_EVENT_TX, NULL);
+	CHECK(mrpd_send_packet_count() > 0);
+
+	/* skip ethernet header, protocol version, attribute type and length */
+	vect = &test_state.tx_PDU[sizeof(eth_hdr_t) + 1 + 2];
+
+	/* VIDs 1..3 form one vector of three values */
+	LONGS_EQUAL(3, (vect[0] << 8) | vect[1]);
+	LONGS_EQUAL(1, (vect[2] << 8) | vect[3]);
+	vect += 5;
+
+	/* VID 10 stands alone */
+	LONGS_EQUAL(1, (vect[0] << 8) | vect[1]);
+	LONGS_EQUAL(0xa, (vect[2] << 8) | vect[3]);
+	vect += 5;
+
+	/* endmark */
+	LONGS_EQUAL(0, (vect[0] << 8) | vect[1]);
+}
+
+/*
+ * The pending transmit set holds the declarations with something to
+ * send: New twice, then a Join. It is empty once both are quiet, and
+ * the periodic timer brings them back for one more Join.
+ */
+TEST(MvrpTestGroup, TxPendingSetDrained)
+{
+	struct mvrp_attribute *attrib = NULL;
+	char cmd_1[] = "V++:I=0001";
+	char cmd_2[] = "V++:I=0002";
+	int i;
+
+	CHECK(MVRP_db != NULL);
+
+	mvrp_recv_cmd(cmd_1, sizeof(cmd_1), &client);
+	mvrp_recv_cmd(cmd_2, sizeof(cmd_2), &client);
+	CHECK(MVRP_db->mrp_db.tx_pending != NULL);
+
+	for (i = 0; i < 3; i++) {
+		test_state.clock_ms += 1000;
+		test_state.sent_count = 0;
+		mvrp_event(MRP_EVENT_TX, NULL);
+		LONGS_EQUAL(1, mrpd_send_packet_count());
+	}
+
+	CHECK(MVRP_db->mrp_db.tx_pending == NULL);
+	CHECK(MVRP_db->mrp_db.tx_pending_last == NULL);
+	attrib = MVRP_db->attrib_list;
+	while (NULL != attrib) {
+		LONGS_EQUAL(MRP_QA_STATE, attrib->applicant.mrp_state);
+		LONGS_EQUAL(0, attrib->applicant.tx_queued);
+		LONGS_EQUAL(0, attrib->applicant.tx);
+		attrib = attrib->next;
+	}
+
+	mvrp_event(MRP_EVENT_PERIODIC, NULL);
+	CHECK(MVRP_db->mrp_db.tx_pending != NULL);
+	CHECK(MVRP_db->mrp_db.tx_pending->tx_next != NULL);
+	test_state.clock_ms += 1000;
+	mvrp_event(MRP_EVENT_TX, NULL);
+	CHECK(MVRP_db->mrp_db.tx_pending == NULL);
+}
+
+/*
+ * Only three transmit opportunities fit in 300 msec. A LeaveAll beyond
+ * that is held back and sent by the join timer once the window allows.
+ */
+TEST(MvrpTestGroup, TxOpportunitiesAreRateLimited)
+{
+	char cmd_1[] = "V++:I=0001";
+	timer_double_t *join_timer;
+	unsigned char *vect;
+	int i;
+
+	CHECK(MVRP_db != NULL);
+	join_timer = &test_state.timers[MVRP_db->mrp_db.join_timer];
+
+	mvrp_recv_cmd(cmd_1, sizeof(cmd_1), &client);
+
+	test_state.clock_ms = 1000;
+	for (i = 0; i < 4; i++)
+		mvrp_event(MRP_EVENT_TX, NULL);
+	LONGS_EQUAL(3, MVRP_db->mrp_db.tx_opportunities);
+	LONGS_EQUAL(1, MVRP_db->mrp_db.tx_suppressed);
+
+	test_state.clock_ms = 1100;
+	mvrp_event(MRP_EVENT_LVATIMER, NULL);
+	LONGS_EQUAL(2, MVRP_db->mrp_db.tx_suppressed);
+	LONGS_EQUAL(1, MVRP_db->mrp_db.lva_deferred);
+	LONGS_EQUAL(TIMER_STARTED, join_timer->state);
+	LONGS_EQUAL(200, join_timer->value);
+
+	/* the join timer fires and the LeaveAll goes out in its place */
+	test_state.clock_ms = 1300;
+	test_state.sent_count = 0;
+	mvrp_event(MRP_EVENT_TX, NULL);
+	LONGS_EQUAL(1, mrpd_send_packet_count());
+	LONGS_EQUAL(0, MVRP_db->mrp_db.lva_deferred);
+	LONGS_EQUAL(1, MVRP_db->mrp_db.tx_merged);
+
+	vect = &test_state.tx_PDU[sizeof(eth_hdr_t) + 1 + 2];
+	CHECK(MRPDU_VECT_LVA((vect[0] << 8) | vect[1]));
+}
+
+static void mvrp_rx_event(int event, uint16_t vid)
+{
+	struct mvrp_attribute *attrib;
+
+	attrib = mvrp_alloc();
+	attrib->attribute = vid;
+	mvrp_event(event, attrib);
+}
+
+TEST(MvrpTestGroup, LeaveTimersArePerAttribute)
+{
+	struct mvrp_attribute a_ref;
+	struct mvrp_attribute *attrib;
+	timer_double_t *lv_timer;
+
+	CHECK(MVRP_db != NULL);
+	lv_timer = &test_state.timers[MVRP_db->mrp_db.lv_timer];
+
+	mvrp_rx_event(MRP_EVENT_RJOININ, 1);
+	mvrp_rx_event(MRP_EVENT_RJOININ, 2);
+
+	/* VID 1 leaves at 500ms, VID 2 at 1000ms */
+	test_state.clock_ms = 500;
+	mvrp_rx_event(MRP_EVENT_RLV, 1);
+	LONGS_EQUAL(TIMER_STARTED, lv_timer->state);
+	test_state.clock_ms = 1000;
+	mvrp_rx_event(MRP_EVENT_RLV, 2);
+
+	/* only VID 1 has run out, the timer is re-armed for VID 2 */
+	test_state.clock_ms = 1600;
+	mvrp_event(MRP_EVENT_LVTIMER, NULL);
+	a_ref.attribute = 1;
+	attrib = mvrp_lookup(&a_ref);
+	CHECK(attrib != NULL);
+	LONGS_EQUAL(MRP_MT_STATE, attrib->registrar.mrp_state);
+	a_ref.attribute = 2;
+	attrib = mvrp_lookup(&a_ref);
+	CHECK(attrib != NULL);
+	LONGS_EQUAL(MRP_LV_STATE, attrib->registrar.mrp_state);
+	LONGS_EQUAL(TIMER_STARTED, lv_timer->state);
+	CHECK(lv_timer->value > 400);
+
+	/* a rejoin cancels the leave timer */
+	mvrp_rx_event(MRP_EVENT_RJOININ, 2);
+	LONGS_EQUAL(MRP_IN_STATE, attrib->registrar.mrp_state);
+	LONGS_EQUAL(0, MVRP_db->mrp_db.lv_count);
+	LONGS_EQUAL(TIMER_STOPPED, lv_timer->state);
+}
+
+/*
+ * This test declares a VID range plus a single VID in one bulk command
+ * and verifies every VID is registered and the client gets one response.
+ */
+TEST(MvrpTestGroup, BulkDeclareVidRange)
+{
+	struct mvrp_attribute a_ref;
+	char cmd_string[] = "V++:L=0010,H=001f;I=0100";
+	char bad_string[] = "V--:L=0020,H=0010";
+	int vid;
+
+	mvrp_recv_cmd(cmd_string, sizeof(cmd_string), &client);
+
+	STRCMP_EQUAL("OK+ N=17", test_state.ctl_msg_data);
+	for (vid = 0x10; vid <= 0x1f; vid++)
+	{
+		a_ref.attribute = vid;
+		CHECK(mvrp_lookup(&a_ref) != NULL);
+	}
+	a_ref.attribute = 0x100;
+	CHECK(mvrp_lookup(&a_ref) != NULL);
+
+	/* an inverted range is rejected before anything is applied */
+	mvrp_recv_cmd(bad_string, sizeof(bad_string), &client);
+	STRCMP_EQUAL("ERP R=0", test_state.ctl_msg_data);
+}
+
+/*
+ * This test verifies that a range reaching the reserved VIDs 0 or 0xfff
+ * is rejected as a whole, without declaring any of its VIDs.
+ */
+TEST(MvrpTestGroup, BulkRejectReservedVids)
+{
+	struct mvrp_attribute a_ref;
+	char low_string[] = "V++:L=0000,H=0010";
+	char high_string[] = "V++:I=0020;L=0ff0,H=ffff";
+	char max_string[] = "V++:L=0ffe,H=0ffe";
+
+	mvrp_recv_cmd(low_string, sizeof(low_string), &client);
+	STRCMP_EQUAL("ERP R=0", test_state.ctl_msg_data);
+	a_ref.attribute = 0x1;
+	CHECK(mvrp_lookup(&a_ref) == NULL);
+
+	mvrp_recv_cmd(high_string, sizeof(high_string), &client);
+	STRCMP_EQUAL("ERP R=1", test_state.ctl_msg_data);
+	a_ref.attribute = 0x20;
+	CHECK(mvrp_lookup(&a_ref) == NULL);
+	a_ref.attribute = 0xff0;
+	CHECK(mvrp_lookup(&a_ref) == NULL);
+
+	mvrp_recv_cmd(max_string, sizeof(max_string), &client);
+	STRCMP_EQUAL("OK+ N=1", test_state.ctl_msg_data);
+}
+
+static unsigned int slab_field(const char *name)
+{
+	char cmd_string[] = "V?A";
+	const char *field;
+
+	mvrp_recv_cmd(cmd_string, sizeof(cmd_string), &client);
+	field = strstr(test_state.ctl_msg_data, name);
+	if (NULL == field)
+		return (unsigned int)-1;
+	return strtoul(field + strlen(name), NULL, 10);
+}
+
+/*
+ * This test declares a range of VIDs, drops the database and declares
+ * them again, verifying that the slab accounts for every attribute and
+ * that the second round reuses the freed attributes instead of growing.
+ */
+TEST(MvrpTestGroup, SlabRecyclesAttributes)
+{
+	char cmd_string[] = "V++:L=0010,H=001f";
+	unsigned int used;
+	unsigned int objects;
+
+	used = slab_field(" used=");
+	mvrp_recv_cmd(cmd_string, sizeof(cmd_string), &client);
+	LONGS_EQUAL(used + 16, slab_field(" used="));
+	objects = slab_field(" objects=");
+	CHECK(objects >= used + 16);
+
+	mvrp_reset();
+	mvrp_init(1);
+	LONGS_EQUAL(used, slab_field(" used="));
+
+	mvrp_recv_cmd(cmd_string, sizeof(cmd_string), &client);
+	LONGS_EQUAL(used + 16, slab_field(" used="));
+	LONGS_EQUAL(objects, slab_field(" objects="));
+}
+
+/*
+ * This test verifies that the gc only looks at attributes whose FSMs
+ * went idle: steady registrations are never queued, and VIDs that left
+ * are reclaimed once their applicant has sent the final leave.
+ */
+TEST(MvrpTestGroup, ReclaimOnlyQueuedAttributes)
+{
+	struct mvrp_attribute a_ref;
+	int vid;
+
+	for (vid = 1; vid <= 3; vid++)
+		mvrp_rx_event(MRP_EVENT_RJOININ, vid);
+	mvrp_reclaim();
+	LONGS_EQUAL(0, MVRP_db->mrp_db.gc_count);
+	mvrp_event(MRP_EVENT_TX, NULL);
+	LONGS_EQUAL(0, MVRP_db->mrp_db.gc_count);
+
+	/* VIDs 1 and 2 leave; their registrars go MT with the applicants in LO */
+	test_state.clock_ms = 500;
+	mvrp_rx_event(MRP_EVENT_RLV, 1);
+	mvrp_rx_event(MRP_EVENT_RLV, 2);
+	test_state.clock_ms = 1600;
+	mvrp_event(MRP_EVENT_LVTIMER, NULL);
+	LONGS_EQUAL(2, MVRP_db->mrp_db.gc_count);
+	LONGS_EQUAL(0, mvrp_reclaim());
+	a_ref.attribute = 1;
+	CHECK(mvrp_lookup(&a_ref) != NULL);
+
+	/* sending the leave makes them reclaimable */
+	mvrp_event(MRP_EVENT_TX, NULL);
+	LONGS_EQUAL(2, MVRP_db->mrp_db.gc_count);
+	LONGS_EQUAL(0, mvrp_reclaim());
+	for (vid = 1; vid <= 3; vid++)
+	{
+		a_ref.attribute = vid;
+		CHECK((mvrp_lookup(&a_ref) != NULL) == (3 == vid));
+	}
+}
@@ -0,0 +1,170 @@
+/******************************************************************************
+
+  Copyright (c) 2014, Intel Corporation
+  All rights reserved.
+  
+  Redistribution and use in source and binary forms, with or without 
+  modification, are permitted provided that the following conditions are met:
+  
+   1. Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+  
+   2. Redistributions in binary form must reproduce the above copyright 
+      notice, this list of conditions and the following disclaimer in the 
+      documentation and/or other materials provided with the distribution.
+  
+   3. Neither the name of the Intel Corporation nor the names of its 
+      contributors may be used to endorse or promote products derived from 
+      this software without specific prior written permission.
+  
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE 
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+
+******************************************************************************/
+
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "pacer.h"
+
+#define TS2NS(ts) ((u_int64_t)(ts).tv_sec * 1000000000ULL + (ts).tv_nsec)
+
+static u_int64_t pacer_now(clockid_t clk_id)
+{
+	struct timespec now;
+
+	clock_gettime(clk_id, &now);
+	return TS2NS(now);
+}
+
+static void pacer_account(struct pacer_stats *stats, u_int64_t late)
+{
+	int bucket = 0;
+	u_int64_t limit = 4000;
+
+	stats->late_sum += late;
+	if (late > stats->late_max)
+		stats->late_max = late;
+
+	while (late >= limit && bucket < PACER_LATE_BUCKETS - 1) {
+		limit *= 4;
+		++bucket;
+	}
+	stats->late_hist[bucket]++;
+}
+
+int pacer_init(struct pacer *pacer, struct igb_xtstamp *xt, u_int64_t lead_ns, u_int64_t spin_ns)
+{
+	if (NULL == pacer || NULL == xt)
+		return EINVAL;
+
+	memset(pacer, 0, sizeof(*pacer));
+	pacer->clk_id = xt->clk_id;
+	pacer->xt = xt;
+	pacer->lead_ns = lead_ns ? lead_ns : PACER_DEFAULT_LEAD_NS;
+	pacer->spin_ns = spin_ns ? spin_ns : PACER_DEFAULT_SPIN_NS;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &pacer->stats.cpu_start);
+	clock_gettime(pacer->clk_id, &pacer->stats.wall_start);
+
+	return 0;
+}
+
+/*
+ * Block until launch_time (device time, ns) is no more than lead_ns ahead.
+ * Returns 0 when it is time to queue the packet, ETIME when launch_time
+ * has already passed, or another errno when the wait could not be timed;
+ * all but 0 are counted.
+ */
+int pacer_wait(struct pacer *pacer, u_int64_t launch_time)
+{
+	u_int64_t now, dev_now, deadline, spin_from;
+	u_int32_t err_ns;
+	struct timespec ts;
+	int rc;
+
+	now = pacer_now(pacer->clk_id);
+	rc = igb_xtstamp_convert(pacer->xt, now, &dev_now, &err_ns);
+	if (rc)
+		goto error;
+
+	if (launch_time <= dev_now) {
+		pacer->stats.missed++;
+		return ETIME;
+	}
+	if (launch_time <= dev_now + pacer->lead_ns)
+		return 0;
+
+	/* rate is within a few ppm of 1, ignore it over a lead window */
+	deadline = now + (launch_time - pacer->lead_ns - dev_now);
+	spin_from = deadline - pacer->spin_ns;
+	pacer->stats.waits++;
+
+	if (spin_from > now) {
+		ts.tv_sec = spin_from / 1000000000ULL;
+		ts.tv_nsec = spin_from % 1000000000ULL;
+		pacer->stats.sleeps++;
+		while ((rc = clock_nanosleep(pacer->clk_id, TIMER_ABSTIME, &ts, NULL)) == EINTR)
+			;
+		if (rc)
+			goto error;
+	}
+
+	do {
+		now = pacer_now(pacer->clk_id);
+	} while (now < deadline);
+
+	pacer_account(&pacer->stats, now - deadline);
+
+	/* woken up so late that the launch time went by */
+	if (now - deadline >= pacer->lead_ns) {
+		pacer->stats.missed++;
+		return ETIME;
+	}
+
+	return 0;
+
+error:
+	pacer->stats.errors++;
+	return rc;
+}
+
+void pacer_report(struct pacer *pacer, const char *name, FILE *out)
+{
+	struct pacer_stats *stats = &pacer->stats;
+	struct timespec cpu_now, wall_now;
+	u_int64_t cpu_ns, wall_ns;
+	int i;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_now);
+	clock_gettime(pacer->clk_id, &wall_now);
+	cpu_ns = TS2NS(cpu_now) - TS2NS(stats->cpu_start);
+	wall_ns = TS2NS(wall_now) - TS2NS(stats->wall_start);
+
+	fprintf(out, "%s: cpu %.1f%% (%" PRIu64 " us over %" PRIu64 " ms), "
+		"waits %" PRIu64 " sleeps %" PRIu64 "\n", name,
+		wall_ns ? 100.0 * cpu_ns / wall_ns : 0.0, cpu_ns / 1000,
+		wall_ns / 1000000, stats->waits, stats->sleeps);
+	if (stats->missed || stats->errors)
+		fprintf(out, "%s: missed %" PRIu64 " errors %" PRIu64 "\n",
+			name, stats->missed, stats->errors);
+	if (stats->waits == 0)
+		return;
+	fprintf(out, "%s: lateness avg %" PRIu64 " ns max %" PRIu64 " ns\n",
+		name, stats->late_sum / stats->waits, stats->late_max);
+	fprintf(out, "%s: lateness histogram (us):", name);
+	for (i = 0; i < PACER_LATE_BUCKETS; ++i)
+		fprintf(out, " <%u:%" PRIu64, 4U << (2 * i),
+			stats->late_hist[i]);
+	fprintf(out, "\n");
+}
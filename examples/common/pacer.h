@@ -0,0 +1,82 @@
+/******************************************************************************
+
+  Copyright (c) 2014, Intel Corporation
+  All rights reserved.
+  
+  Redistribution and use in source and binary forms, with or without 
+  modification, are permitted provided that the following conditions are met:
+  
+   1. Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+  
+   2. Redistributions in binary form must reproduce the above copyright 
+      notice, this list of conditions and the following disclaimer in the 
+      documentation and/or other materials provided with the distribution.
+  
+   3. Neither the name of the Intel Corporation nor the names of its 
+      contributors may be used to endorse or promote products derived from 
+      this software without specific prior written permission.
+  
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE 
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+
+******************************************************************************/
+
+#ifndef _PACER_H_
+#define _PACER_H_
+
+#include <stdio.h>
+#include <time.h>
+
+#include "igb.h"
+
+/*
+ * Launch-time pacer for talkers
+ *
+ * Instead of spinning on a full DMA ring the talker asks the pacer to wait
+ * until the next packet's launch time is within the lead window.  The pacer
+ * sleeps with clock_nanosleep(TIMER_ABSTIME) and only spins for the final
+ * spin_ns before the deadline.  Launch times are in device time and are
+ * mapped to the system clock with the libigb cross-timestamp model.
+ * pacer_wait() returns ETIME when the launch time has passed by the time
+ * the packet could be queued; talkers drop such packets.
+ */
+
+#define PACER_DEFAULT_LEAD_NS	2000000	/* queue packets 2 ms ahead */
+#define PACER_DEFAULT_SPIN_NS	20000	/* spin the last 20 us */
+#define PACER_LATE_BUCKETS	8	/* lateness histogram, powers of 4 us */
+
+struct pacer_stats {
+	u_int64_t waits;	/* calls that had to wait */
+	u_int64_t sleeps;	/* calls that went to sleep */
+	u_int64_t late_sum;	/* ns */
+	u_int64_t late_max;	/* ns */
+	u_int64_t late_hist[PACER_LATE_BUCKETS];
+	u_int64_t missed;	/* launch time passed before the packet was due */
+	u_int64_t errors;	/* no time model or the sleep failed */
+	struct timespec cpu_start;
+	struct timespec wall_start;
+};
+
+struct pacer {
+	clockid_t clk_id;
+	u_int64_t lead_ns;
+	u_int64_t spin_ns;
+	struct igb_xtstamp *xt;
+	struct pacer_stats stats;
+};
+
+int pacer_init(struct pacer *pacer, struct igb_xtstamp *xt, u_int64_t lead_ns, u_int64_t spin_ns);
+int pacer_wait(struct pacer *pacer, u_int64_t launch_time);
+void pacer_report(struct pacer *pacer, const char *name, FILE *out);
+
+#endif /* _PACER_H_ */
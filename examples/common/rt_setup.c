@@ -0,0 +1,203 @@
+/******************************************************************************
+
+  Copyright (c) 2014, Intel Corporation
+  All rights reserved.
+  
+  Redistribution and use in source and binary forms, with or without 
+  modification, are permitted provided that the following conditions are met:
+  
+   1. Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+  
+   2. Redistributions in binary form must reproduce the above copyright 
+      notice, this list of conditions and the following disclaimer in the 
+      documentation and/or other materials provided with the distribution.
+  
+   3. Neither the name of the Intel Corporation nor the names of its 
+      contributors may be used to endorse or promote products derived from 
+      this software without specific prior written permission.
+  
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE 
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+
+******************************************************************************/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <inttypes.h>
+#include <malloc.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include "rt_setup.h"
+
+#define TS2NS(ts) ((u_int64_t)(ts).tv_sec * 1000000000ULL + (ts).tv_nsec)
+
+static void rt_prefault_stack(size_t size)
+{
+	volatile unsigned char *stack = alloca(size);
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t i;
+
+	for (i = 0; i < size; i += page)
+		stack[i] = 0;
+}
+
+static int rt_prefault_heap(size_t size)
+{
+	unsigned char *heap;
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t i;
+
+	/* keep freed memory in the heap and never mmap() for malloc */
+	if (!mallopt(M_TRIM_THRESHOLD, -1) || !mallopt(M_MMAP_MAX, 0))
+		return EINVAL;
+
+	heap = malloc(size);
+	if (NULL == heap)
+		return ENOMEM;
+	for (i = 0; i < size; i += page)
+		heap[i] = 0;
+	free(heap);
+
+	return 0;
+}
+
+int rt_setup(const struct rt_config *cfg)
+{
+	struct sched_param sched;
+	int rc = 0;
+
+	if (NULL == cfg)
+		return EINVAL;
+
+	if (cfg->cpu >= 0) {
+		cpu_set_t cpus;
+
+		CPU_ZERO(&cpus);
+		CPU_SET(cfg->cpu, &cpus);
+		if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0) {
+			rc = errno;
+			fprintf(stderr, "Failed to pin to CPU %d: %s\n",
+				cfg->cpu, strerror(rc));
+		}
+	}
+
+	if (cfg->priority > 0) {
+		memset(&sched, 0, sizeof(sched));
+		sched.sched_priority = cfg->priority;
+		if (sched_setscheduler(0, SCHED_FIFO, &sched) < 0) {
+			rc = errno;
+			fprintf(stderr, "Failed to select FIFO scheduler: %s\n",
+				strerror(rc));
+		}
+	} else if (cfg->nice) {
+		if (setpriority(PRIO_PROCESS, 0, cfg->nice) < 0) {
+			rc = errno;
+			fprintf(stderr, "Failed to set nice value %d: %s\n",
+				cfg->nice, strerror(rc));
+		}
+	}
+
+	if (cfg->lock_memory) {
+		if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+			rc = errno;
+			fprintf(stderr, "Failed to lock memory: %s\n",
+				strerror(rc));
+		}
+	}
+
+	if (cfg->heap_reserve) {
+		int err = rt_prefault_heap(cfg->heap_reserve);
+		if (err) {
+			rc = err;
+			fprintf(stderr, "Failed to prefault heap: %s\n",
+				strerror(rc));
+		}
+	}
+
+	if (cfg->stack_prefault)
+		rt_prefault_stack(cfg->stack_prefault);
+
+	return rc;
+}
+
+/* Fault in (and lock, unless mlockall() already did) a buffer such as a
+ * DMA page before the streaming loop touches it */
+int rt_prefault(void *addr, size_t len)
+{
+	volatile unsigned char *p = addr;
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t i;
+
+	if (NULL == addr)
+		return EINVAL;
+
+	for (i = 0; i < len; i += page)
+		(void)p[i];
+
+	if (mlock(addr, len) < 0)
+		return errno;
+
+	return 0;
+}
+
+int rt_selftest(clockid_t clk_id, unsigned int iterations, unsigned int period_us, struct rt_selftest_result *res)
+{
+	struct timespec next, now;
+	u_int64_t late, sum = 0;
+	unsigned int i;
+	int rc;
+
+	if (NULL == res || 0 == iterations || 0 == period_us)
+		return EINVAL;
+
+	memset(res, 0, sizeof(*res));
+	res->min_ns = (u_int64_t)-1;
+
+	clock_gettime(clk_id, &next);
+	for (i = 0; i < iterations; ++i) {
+		next.tv_nsec += period_us * 1000;
+		while (next.tv_nsec >= 1000000000) {
+			next.tv_nsec -= 1000000000;
+			++next.tv_sec;
+		}
+
+		while ((rc = clock_nanosleep(clk_id, TIMER_ABSTIME, &next, NULL)) == EINTR)
+			;
+		if (rc)
+			return rc;
+		clock_gettime(clk_id, &now);
+
+		late = TS2NS(now) - TS2NS(next);
+		sum += late;
+		if (late < res->min_ns)
+			res->min_ns = late;
+		if (late > res->max_ns)
+			res->max_ns = late;
+		res->samples++;
+	}
+	res->avg_ns = sum / res->samples;
+
+	return 0;
+}
+
+void rt_selftest_report(const struct rt_selftest_result *res, FILE *out)
+{
+	fprintf(out, "wakeup latency over %u samples: min %" PRIu64
+		" ns avg %" PRIu64 " ns max %" PRIu64 " ns\n", res->samples,
+		res->min_ns, res->avg_ns, res->max_ns);
+}
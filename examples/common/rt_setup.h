@@ -0,0 +1,88 @@
+/******************************************************************************
+
+  Copyright (c) 2014, Intel Corporation
+  All rights reserved.
+  
+  Redistribution and use in source and binary forms, with or without 
+  modification, are permitted provided that the following conditions are met:
+  
+   1. Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+  
+   2. Redistributions in binary form must reproduce the above copyright 
+      notice, this list of conditions and the following disclaimer in the 
+      documentation and/or other materials provided with the distribution.
+  
+   3. Neither the name of the Intel Corporation nor the names of its 
+      contributors may be used to endorse or promote products derived from 
+      this software without specific prior written permission.
+  
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE 
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+
+******************************************************************************/
+
+#ifndef _RT_SETUP_H_
+#define _RT_SETUP_H_
+
+#include <stdio.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+
+/*
+ * Real-time runtime setup shared by talkers, listeners and the daemons
+ *
+ * rt_setup() puts the calling process in a known state before it starts
+ * streaming: pinned to a CPU, SCHED_FIFO (or a nice value when no priority
+ * is given), all memory locked, stack and a heap reserve prefaulted, and
+ * malloc kept from returning memory to the kernel or satisfying requests
+ * with fresh mmap()s.  Threads created afterwards inherit the CPU and the
+ * scheduling policy.  rt_selftest() measures wakeup latency under that
+ * configuration so a platform can be checked before going live.
+ */
+
+#define RT_DEFAULT_STACK	(256 * 1024)
+#define RT_DEFAULT_HEAP		(4 * 1024 * 1024)
+
+struct rt_config {
+	int cpu;		/* CPU to pin to, -1 to leave affinity alone */
+	int priority;		/* SCHED_FIFO priority, 0 to leave policy alone */
+	int nice;		/* nice value without a priority, 0 to leave */
+	int lock_memory;	/* mlockall() current and future mappings */
+	size_t stack_prefault;	/* bytes of stack to touch */
+	size_t heap_reserve;	/* bytes of heap to prefault and retain */
+};
+
+#define RT_CONFIG_INIT { -1, 0, 0, 1, RT_DEFAULT_STACK, RT_DEFAULT_HEAP }
+
+struct rt_selftest_result {
+	unsigned int samples;
+	u_int64_t min_ns;
+	u_int64_t avg_ns;
+	u_int64_t max_ns;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int rt_setup(const struct rt_config *cfg);
+int rt_prefault(void *addr, size_t len);
+int rt_selftest(clockid_t clk_id, unsigned int iterations, unsigned int period_us, struct rt_selftest_result *res);
+void rt_selftest_report(const struct rt_selftest_result *res, FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _RT_SETUP_H_ */
@@ -51,6 +51,8 @@
 
 #include "igb.h"
 #include "talker_mrp_client.h"
+#include "pacer.h"
+#include "rt_setup.h"
 #include "jack.h"
 #include "defines.h"
 
@@ -125,6 +127,8 @@ device_t glob_igb_dev;
 volatile int glob_unleash_jack = 0;
 pthread_t glob_packetizer_id;
 u_int64_t glob_last_time;
+u_int64_t glob_lead_ns;
+int glob_packetizer_priority = 70;
 int glob_seqnum;
 uint32_t glob_time_stamp;
 seventeen22_header *glob_header1722;
@@ -278,6 +282,9 @@ static void usage(void)
 		"options:\n"
 		"    -h  show this message\n"
 		"    -i  specify interface for AVB connection\n"
+		"    -l  queue packets this many usec ahead of launch time\n"
+		"    -c  pin to this CPU\n"
+		"    -p  run the packetizer at this SCHED_FIFO priority\n"
 		"\n" "%s" "\n", version_str);
 	exit(EXIT_FAILURE);
 }
@@ -288,6 +295,7 @@ static void* packetizer_thread(void *arg) {
 	unsigned total_samples = 0;
 	int err;
 	int i;
+	struct pacer pacer;
 	(void) arg; /* unused */
 
 	const size_t bytes_to_read = CHANNELS * SAMPLES_PER_FRAME *
@@ -300,6 +308,9 @@ static void* packetizer_thread(void *arg) {
 	pthread_setcanceltype (PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
 	pthread_mutex_lock(&threadLock);
 
+	/* initialized on this thread so CPU time is accounted per stream */
+	pacer_init(&pacer, igb_xtstamp_get(&glob_igb_dev), glob_lead_ns, 0);
+
 	while (listeners && !halt_tx) {
 		pthread_cond_wait(&dataReady, &threadLock);
 
@@ -322,6 +333,13 @@ static void* packetizer_thread(void *arg) {
 
 			jack_ringbuffer_read (ringbuffer, (char*)&framebuf[0], bytes_to_read);
 
+			/*
+			 * the JACK callback only signals dataReady when it
+			 * gets threadLock, so do not hold it while the packet
+			 * is paced and queued
+			 */
+			pthread_mutex_unlock(&threadLock);
+
 			glob_header1722->seq_number = glob_seqnum++;
 			if (glob_seqnum % 4 == 0)
 				glob_header1722->timestamp_valid = 0;
@@ -347,8 +365,18 @@ static void* packetizer_thread(void *arg) {
 						sizeof(sample[i].value));
 			}
 
+			if (ETIME == pacer_wait(&pacer, glob_tmp_packet->attime)) {
+				/* too late to launch, drop it */
+				glob_tmp_packet->next = glob_free_packets;
+				glob_free_packets = glob_tmp_packet;
+				pthread_mutex_lock(&threadLock);
+				continue;
+			}
+
 			err = igb_xmit(&glob_igb_dev, 0, glob_tmp_packet);
 
+			pthread_mutex_lock(&threadLock);
+
 			if (!err) {
 				continue;
 			}
@@ -371,13 +399,15 @@ cleanup:		igb_clean(&glob_igb_dev, &cleaned_packets);
 			}
 		}
 	}
+	pacer_report(&pacer, "jackd_talker", stderr);
 	return NULL;
 }
 
 
 static void run_packetizer(void)
 {
-	jack_acquire_real_time_scheduling(glob_packetizer_id, 70);
+	jack_acquire_real_time_scheduling(glob_packetizer_id,
+					  glob_packetizer_priority);
 	glob_unleash_jack = 1;
 	pthread_join (glob_packetizer_id, NULL);
 }
@@ -398,9 +428,10 @@ int main(int argc, char *argv[])
 	uint64_t update_8021as;
 	unsigned delta_8021as, delta_local;
 	jack_client_t* _jackclient;
+	struct rt_config rt = RT_CONFIG_INIT;
 
 	for (;;) {
-		c = getopt(argc, argv, "hi:");
+		c = getopt(argc, argv, "hi:l:c:p:");
 		if (c < 0)
 			break;
 		switch (c) {
@@ -415,6 +446,15 @@ int main(int argc, char *argv[])
 			}
 			interface = strdup(optarg);
 			break;
+		case 'l':
+			glob_lead_ns = strtoull(optarg, NULL, 10) * 1000;
+			break;
+		case 'c':
+			rt.cpu = strtol(optarg, NULL, 10);
+			break;
+		case 'p':
+			glob_packetizer_priority = strtol(optarg, NULL, 10);
+			break;
 		}
 	}
 	if (optind < argc)
@@ -422,6 +462,15 @@ int main(int argc, char *argv[])
 	if (NULL == interface) {
 		usage();
 	}
+	/*
+	 * the packetizer takes its priority from JACK below and inherits
+	 * the nice value in case JACK can not give it one; lock and
+	 * prefault before JACK and the packetizer thread are started so
+	 * their buffers and stacks are locked too
+	 */
+	rt.nice = -20;
+	if (rt_setup(&rt))
+		fprintf(stderr, "real-time setup incomplete\n");
 	rc = mrp_connect();
 	if (rc) {
 		printf("socket creation failed\n");
@@ -445,6 +494,7 @@ int main(int argc, char *argv[])
 		       strerror(errno));
 		return errno;
 	}
+	rt_prefault(a_page.dma_vaddr, a_page.mmap_size);
 	signal(SIGINT, sigint_handler);
 	rc = get_mac_address(interface);
 	if (rc) {
@@ -598,16 +648,18 @@ int main(int argc, char *argv[])
 	now_8021as = update_8021as + delta_8021as;
 
 	glob_last_time = now_local + XMIT_DELAY;
-	glob_time_stamp = now_8021as + RENDER_DELAY;
 
-	rc = nice(-20);
+	if (igb_xtstamp_start(&glob_igb_dev, CLOCK_MONOTONIC, 0)) {
+		fprintf(stderr, "Failed to start cross-timestamp model\n");
+		return EXIT_FAILURE;
+	}
+	glob_time_stamp = now_8021as + RENDER_DELAY;
 
 	pthread_create (&glob_packetizer_id, NULL, packetizer_thread, NULL);
 	run_packetizer();
 
-	rc = nice(0);
-
 	stop_jack(_jackclient);
+	igb_xtstamp_stop(&glob_igb_dev);
 
 	if (halt_tx == 0)
 		printf("listener left ...\n");
@@ -28,6 +28,7 @@
 
 #include "avb.h"
 #include "listener_mrp_client.h"
+#include "rt_setup.h"
 
 #define USE_MRPD 1
 
@@ -68,7 +69,7 @@ int main(int argc, char *argv[ ])
 	long long int frame_sequence = 0;
 	unsigned char frame[MAX_FRAME_SIZE];
 	int size, length;
-	struct sched_param sched;
+	struct rt_config rt = RT_CONFIG_INIT;
 	int rc;
 
 	if (argc < 2) {
@@ -152,12 +153,9 @@ int main(int argc, char *argv[ ])
 	frame_sequence = 0;
 	memset(frame, 0, sizeof(frame));
 
-	memset(&sched, 0, sizeof sched);
-	sched.sched_priority = 1;
-	error = sched_setscheduler(0, SCHED_RR, &sched);
-	if (error < 0)
-		fprintf(stderr, "Failed to select RR scheduler: %s (%d)\n",
-			strerror(errno), errno);
+	rt.priority = 1;
+	if (rt_setup(&rt))
+		fprintf(stderr, "real-time setup incomplete\n");
 
 	while (1) {
 		error = recvfrom(socket_descriptor, frame, MAX_FRAME_SIZE, 0, (struct sockaddr *) &ifsock_addr, (socklen_t *)&size);
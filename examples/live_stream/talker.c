@@ -26,6 +26,7 @@
 
 #include "avb.h"
 #include "talker_mrp_client.h"
+#include "rt_setup.h"
 
 #define USE_MRPD 1
 
@@ -105,7 +106,7 @@ int main(int argc, char *argv[])
 	uint8_t *data_ptr;
 	void *stream_packet;
 	long long int frame_sequence = 0;
-	struct sched_param sched;
+	struct rt_config rt = RT_CONFIG_INIT;
 
 	if (argc < 2) {
 		fprintf(stderr,"%s <if_name> <payload>\n", argv[0]);
@@ -142,6 +143,7 @@ int main(int argc, char *argv[])
 		fprintf(stderr, "malloc failed (%s) - out of memory?\n", strerror(errno));
 		return errno;
 	}
+	rt_prefault(a_page.dma_vaddr, a_page.mmap_size);
 
 	signal(SIGINT, sigint_handler);
 
@@ -265,9 +267,8 @@ int main(int argc, char *argv[])
 
 #endif
 
-	memset(&sched, 0 , sizeof (sched));
-	sched.sched_priority = 1;
-	sched_setscheduler(0, SCHED_RR, &sched);
+	rt.priority = 1;
+	rt_setup(&rt);
 
 	while (listeners && !halt_tx)
 	{
@@ -47,6 +47,9 @@ static int rcv_timeout = 100;	/* 100 ms */
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <errno.h>
+#include <sys/un.h>
+#include <sys/mman.h>
 typedef int SOCKET;
 #define INVALID_SOCKET -1
 #define SOCKET_ERROR   -1
@@ -156,3 +159,178 @@ int mrpdclient_sendto(SOCKET mrpd_sock, char *notify_data, int notify_len)
 	return sendto(mrpd_sock, notify_data, notify_len, 0,
 		(struct sockaddr *)&addr, addr_len);
 }
+
+#if defined __linux__
+int mrpdclient_init_unix(const char *path)
+{
+	SOCKET mrpd_sock = SOCKET_ERROR;
+	struct sockaddr_un addr;
+	int rc;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		goto out;
+
+	mrpd_sock = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+	if (mrpd_sock == INVALID_SOCKET)
+		goto out;
+
+	rc = setsockopt(mrpd_sock, SOL_SOCKET, SO_RCVTIMEO,
+			(const char *)&rcv_timeout, sizeof(rcv_timeout));
+	if (rc != 0)
+		goto out;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	rc = connect(mrpd_sock, (struct sockaddr *)&addr, sizeof(addr));
+	if (rc <= SOCKET_ERROR)
+		goto out;
+
+	return mrpd_sock;
+
+ out:
+	if (mrpd_sock != SOCKET_ERROR)
+		closesocket(mrpd_sock);
+
+	return SOCKET_ERROR;
+}
+
+struct mrpd_shm *mrpdclient_shm_attach(SOCKET mrpd_sock)
+{
+	char cbuf[CMSG_SPACE(sizeof(int))];
+	struct mrpd_shm *shm = MAP_FAILED;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	char respbuf[8];
+	int fd = -1;
+	int rc;
+
+	rc = mrpdclient_sendto(mrpd_sock, "U+R", strlen("U+R") + 1);
+	if (rc != strlen("U+R") + 1)
+		return NULL;
+
+	memset(&msg, 0, sizeof(msg));
+	memset(respbuf, 0, sizeof(respbuf));
+	iov.iov_base = respbuf;
+	iov.iov_len = sizeof(respbuf) - 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+
+	rc = recvmsg(mrpd_sock, &msg, MSG_CMSG_CLOEXEC);
+	if (rc <= 0)
+		return NULL;
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if ((NULL == cmsg) || (SCM_RIGHTS != cmsg->cmsg_type))
+		return NULL;
+	memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+
+	if (0 == strncmp(respbuf, "OK+", 3))
+		shm = mmap(NULL, sizeof(struct mrpd_shm),
+			   PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (MAP_FAILED == shm)
+		return NULL;
+
+	if ((MRPD_SHM_MAGIC != shm->magic) ||
+	    (MRPD_SHM_VERSION != shm->version)) {
+		munmap(shm, sizeof(struct mrpd_shm));
+		return NULL;
+	}
+
+	return shm;
+}
+
+int mrpdclient_shm_sendto(SOCKET mrpd_sock, struct mrpd_shm *shm,
+			  char *notify_data, int notify_len)
+{
+	int rc;
+
+	rc = mrpd_shm_push(&shm->cmd, notify_data, notify_len);
+	if (rc < 0) {
+		errno = EAGAIN;
+		return -1;
+	}
+	if (rc)
+		send(mrpd_sock, "", 1, MSG_NOSIGNAL);
+
+	return notify_len;
+}
+
+/*
+ * Waits for one packet on the socket. A doorbell drains the notify
+ * ring, calling fn for each message; anything else is passed to fn as
+ * mrpdclient_recv() would. Returns the number of messages handled.
+ */
+int mrpdclient_shm_recv(SOCKET mrpd_sock, struct mrpd_shm *shm,
+			ptr_process_mrpd_msg fn)
+{
+	char *msgbuf;
+	int bytes;
+	int count = 0;
+	int rung = 0;
+
+	for (;;) {
+		msgbuf = (char *)malloc(MRPDCLIENT_MAX_MSG_SIZE);
+		if (NULL == msgbuf)
+			return -1;
+		memset(msgbuf, 0, MRPDCLIENT_MAX_MSG_SIZE);
+
+		if (!rung) {
+			bytes = recv(mrpd_sock, msgbuf,
+				     MRPDCLIENT_MAX_MSG_SIZE, 0);
+			/* 0 - mrpd hung up */
+			if ((bytes <= SOCKET_ERROR) || (0 == bytes)) {
+				free(msgbuf);
+				return -1;
+			}
+			if (bytes > 1) {
+				fn(msgbuf, bytes);
+				return 1;
+			}
+			rung = 1;
+		}
+
+		bytes = mrpd_shm_pop(&shm->notify, msgbuf,
+				     MRPDCLIENT_MAX_MSG_SIZE);
+		if (-2 == bytes) {
+			/* not a message mrpd wrote, skipped */
+			free(msgbuf);
+			continue;
+		}
+		if (bytes < 0) {
+			free(msgbuf);
+			break;
+		}
+		fn(msgbuf, bytes);
+		count++;
+	}
+
+	/* mrpd held notifications back because the ring was full */
+	if (__atomic_exchange_n(&shm->notify.need_wakeup, 0, __ATOMIC_SEQ_CST))
+		send(mrpd_sock, "", 1, MSG_NOSIGNAL);
+
+	return count;
+}
+
+/*
+ * Notifications still in the ring are older than the "OK+" reply that
+ * will arrive on the socket, so they are handled by the caller before
+ * detaching.
+ */
+int mrpdclient_shm_detach(SOCKET mrpd_sock, struct mrpd_shm *shm)
+{
+	int rc;
+
+	rc = mrpdclient_sendto(mrpd_sock, "U-R", strlen("U-R") + 1);
+	munmap(shm, sizeof(struct mrpd_shm));
+	if (rc != strlen("U-R") + 1)
+		return -1;
+
+	return 0;
+}
+#endif
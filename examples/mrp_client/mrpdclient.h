@@ -44,4 +44,25 @@ int mrpdclient_recv(SOCKET mrpd_sock, ptr_process_mrpd_msg fn);
 int mrpdclient_sendto(SOCKET mrpd_sock, char *notify_data, int notify_len);
 int mrpdclient_close(SOCKET *mrpd_sock);
 
+#if defined __linux__
+/*
+ * Unix domain transport (mrpd -u <path>). The socket returned by
+ * mrpdclient_init_unix() works with mrpdclient_recv(), mrpdclient_sendto()
+ * and mrpdclient_close() like the UDP one.
+ */
+int mrpdclient_init_unix(const char *path);
+
+/*
+ * Shared memory rings on a Unix connection. Attach before sending any
+ * command that causes notifications. mrpdclient_shm_sendto() returns -1
+ * with errno EAGAIN while the command ring is full.
+ */
+struct mrpd_shm *mrpdclient_shm_attach(SOCKET mrpd_sock);
+int mrpdclient_shm_sendto(SOCKET mrpd_sock, struct mrpd_shm *shm,
+			  char *notify_data, int notify_len);
+int mrpdclient_shm_recv(SOCKET mrpd_sock, struct mrpd_shm *shm,
+			ptr_process_mrpd_msg fn);
+int mrpdclient_shm_detach(SOCKET mrpd_sock, struct mrpd_shm *shm);
+#endif
+
 #endif
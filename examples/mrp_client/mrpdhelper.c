@@ -51,6 +51,7 @@ and parses them into a machine readable structure.
 #define snprintf _snprintf
 #endif
 
+#include "mrpd.h"
 #include "mrpdhelper.h"
 
 #define MRPD_N_APP_STATE_STRINGS 13
@@ -327,6 +328,145 @@ int mrpdhelper_parse_notification(char *sz, size_t len,
 	}
 }
 
+static uint64_t bytes_to_u64(const uint8_t *b, int len)
+{
+	uint64_t v = 0;
+	int i;
+
+	for (i = 0; i < len; i++)
+		v = (v << 8) | b[i];
+	return v;
+}
+
+static int parse_binary_rec(int app, const struct mrpd_notify_rec *r,
+			    struct mrpdhelper_notify *n)
+{
+	memset(n, 0, sizeof(*n));
+
+	switch (r->notify) {
+	case 1:
+		n->notify = mrpdhelper_notification_new;
+		break;
+	case 2:
+		n->notify = mrpdhelper_notification_join;
+		break;
+	case 3:
+		n->notify = mrpdhelper_notification_leave;
+		break;
+	default:
+		return -1;
+	}
+
+	switch (r->registrar_state) {
+	case 16:
+		n->state = mrpdhelper_state_in;
+		break;
+	case 17:
+		n->state = mrpdhelper_state_leave;
+		break;
+	case 18:
+		n->state = mrpdhelper_state_empty;
+		break;
+	default:
+		return -1;
+	}
+
+	/* daemon applicant states start at VO == 0 */
+	if (r->applicant_state >= MRPD_N_APP_STATE_STRINGS - 1)
+		return -1;
+	n->app_state = (enum mrpdhelper_applicant_state)(r->applicant_state + 1);
+	n->registrar = bytes_to_u64(r->registrar, 6);
+
+	switch (app) {
+	case 'M':
+		if (MRPD_NOTIFY_MMRP_MAC != r->type)
+			return -1;	/* no service requirement representation */
+		n->attrib = mrpdhelper_attribtype_mmrp;
+		n->u.m.mac = bytes_to_u64(r->u.macaddr, 6);
+		break;
+	case 'V':
+		n->attrib = mrpdhelper_attribtype_mvrp;
+		n->u.v.vid = ntohs(r->u.vid);
+		break;
+	case 'S':
+		switch (r->type) {
+		case MRPD_NOTIFY_MSRP_DOMAIN:
+			n->attrib = mrpdhelper_attribtype_msrp_domain;
+			n->u.sd.id = r->u.domain.class_id;
+			n->u.sd.priority = r->u.domain.priority;
+			n->u.sd.vid = ntohs(r->u.domain.vid);
+			n->u.sd.neighbor_priority = r->u.domain.neighbor_priority;
+			break;
+		case MRPD_NOTIFY_MSRP_LISTENER:
+			n->attrib = mrpdhelper_attribtype_msrp_listener;
+			n->u.sl.substate = r->u.listener.substate;
+			n->u.sl.id = bytes_to_u64(r->u.listener.stream_id, 8);
+			break;
+		case MRPD_NOTIFY_MSRP_TALKER:
+		case MRPD_NOTIFY_MSRP_TALKER_FAILED:
+			if (MRPD_NOTIFY_MSRP_TALKER == r->type)
+				n->attrib = mrpdhelper_attribtype_msrp_talker;
+			else
+				n->attrib = mrpdhelper_attribtype_msrp_talker_fail;
+			n->u.st.id = bytes_to_u64(r->u.talker.stream_id, 8);
+			n->u.st.dest_mac = bytes_to_u64(r->u.talker.dest_addr, 6);
+			n->u.st.vid = ntohs(r->u.talker.vid);
+			n->u.st.max_frame_size = ntohs(r->u.talker.max_frame_size);
+			n->u.st.max_interval_frames =
+			    ntohs(r->u.talker.max_interval_frames);
+			n->u.st.priority_and_rank = r->u.talker.priority_and_rank;
+			n->u.st.accum_latency =
+			    ntohl(r->u.talker.accumulated_latency);
+			n->u.st.bridge_id = bytes_to_u64(r->u.talker.bridge_id, 8);
+			n->u.st.failure_code = r->u.talker.failure_code;
+			break;
+		default:
+			return -1;
+		}
+		break;
+	default:
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Decode a datagram of the binary notification protocol (selected with
+ * M+B, V+B or S+B). Returns the number of notifications stored in n[],
+ * or -1 if buf is not a binary notification datagram; records this
+ * helper cannot represent are skipped.
+ */
+int mrpdhelper_parse_binary_notifications(char *buf, size_t len,
+					  struct mrpdhelper_notify *n,
+					  int max_n)
+{
+	struct mrpd_notify_hdr hdr;
+	struct mrpd_notify_rec rec;
+	size_t offset;
+	int count;
+	int found = 0;
+	int i;
+
+	if (len < sizeof(hdr))
+		return -1;
+	memcpy(&hdr, buf, sizeof(hdr));
+	if ((ntohs(hdr.magic) != MRPD_NOTIFY_MAGIC) ||
+	    (hdr.version != MRPD_NOTIFY_VERSION))
+		return -1;
+
+	count = ntohs(hdr.count);
+	offset = sizeof(hdr);
+	for (i = 0; (i < count) && (found < max_n); i++) {
+		if (offset + sizeof(rec) > len)
+			break;
+		memcpy(&rec, buf + offset, sizeof(rec));
+		offset += sizeof(rec);
+		if (parse_binary_rec(hdr.app, &rec, &n[found]) == 0)
+			found++;
+	}
+	return found;
+}
+
 int mrpdhelper_notify_equal(struct mrpdhelper_notify *n1,
 			    struct mrpdhelper_notify *n2)
 {
@@ -158,6 +158,10 @@ struct mrpdhelper_notify {
 int mrpdhelper_parse_notification(char *sz,
 				  size_t len, struct mrpdhelper_notify *n);
 
+int mrpdhelper_parse_binary_notifications(char *buf, size_t len,
+					  struct mrpdhelper_notify *n,
+					  int max_n);
+
 int mrpdhelper_notify_equal(struct mrpdhelper_notify *n1,
 			    struct mrpdhelper_notify *n2);
 
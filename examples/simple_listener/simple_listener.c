@@ -28,6 +28,7 @@ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include <sndfile.h>
 
 #include "listener_mrp_client.h"
+#include "rt_setup.h"
 
 #define DEBUG 0
 #define PCAP 1
@@ -176,6 +177,7 @@ int main(int argc, char *argv[])
 	struct bpf_program comp_filter_exp;		/* The compiled filter expression */
 	char filter_exp[] = "ether dst 91:E0:F0:00:0e:80";	/* The filter expression */
 	int rc;
+	struct rt_config rt = RT_CONFIG_INIT;
 
 	signal(SIGINT, sigint_handler);
 
@@ -201,6 +203,9 @@ int main(int argc, char *argv[])
 	if ((NULL == dev) || (NULL == file_name))
 		help();
 
+	if (rt_setup(&rt))
+		fprintf(stderr, "real-time setup incomplete\n");
+
 	if (create_socket())
 	{
 		fprintf(stderr, "Socket creation failed.\n");
@@ -48,6 +48,8 @@
 
 #include "igb.h"
 #include "talker_mrp_client.h"
+#include "pacer.h"
+#include "rt_setup.h"
 
 #define VERSION_STR "1.0"
 
@@ -71,6 +73,7 @@
 #define L4_PACKET_IPG (1250000)	/* (1) packet every 1.25 millisec */
 #define L4_PORT ((uint16_t)5004)
 #define PKT_SZ (100)
+#define SELFTEST_ITERATIONS (8000) /* one second of class A intervals */
 
 typedef struct {
   int64_t ml_phoffset;
@@ -434,6 +437,10 @@ static void usage(void)
 		"    -h  show this message\n"
 		"    -i  specify interface for AVB connection\n"
 		"    -t  transport equal to 2 for 1722 or 3 for RTP\n"
+		"    -l  queue packets this many usec ahead of launch time\n"
+		"    -c  pin to this CPU\n"
+		"    -p  run at this SCHED_FIFO priority\n"
+		"    -s  measure wakeup latency and exit\n"
 		"\n" "%s" "\n", version_str);
 	exit(EXIT_FAILURE);
 }
@@ -478,9 +485,13 @@ int main(int argc, char *argv[])
 	unsigned delta_8021as, delta_local;
 	uint8_t dest_addr[6];
 	size_t packet_size;
+	struct pacer pacer;
+	u_int64_t lead_ns = 0;
+	struct rt_config rt = RT_CONFIG_INIT;
+	int selftest = 0;
 
 	for (;;) {
-		c = getopt(argc, argv, "hi:t:");
+		c = getopt(argc, argv, "hi:t:l:c:p:s");
 		if (c < 0)
 			break;
 		switch (c) {
@@ -497,10 +508,39 @@ int main(int argc, char *argv[])
 			break;
 		case 't':
 			transport = strtoul( optarg, NULL, 10 );
+			break;
+		case 'l':
+			lead_ns = strtoull( optarg, NULL, 10 ) * 1000;
+			break;
+		case 'c':
+			rt.cpu = strtol( optarg, NULL, 10 );
+			break;
+		case 'p':
+			rt.priority = strtol( optarg, NULL, 10 );
+			break;
+		case 's':
+			selftest = 1;
+			break;
 		}
 	}
 	if (optind < argc)
 		usage();
+	/* without an explicit real-time priority fall back to nice */
+	rt.nice = -20;
+	if (rt_setup(&rt))
+		fprintf(stderr, "real-time setup incomplete\n");
+	if (selftest) {
+		struct rt_selftest_result res;
+
+		rc = rt_selftest(CLOCK_MONOTONIC, SELFTEST_ITERATIONS,
+				 L2_PACKET_IPG / 1000, &res);
+		if (rc) {
+			fprintf(stderr, "self-test failed: %s\n", strerror(rc));
+			return EXIT_FAILURE;
+		}
+		rt_selftest_report(&res, stdout);
+		return EXIT_SUCCESS;
+	}
 	if (NULL == interface) {
 		usage();
 	}
@@ -531,6 +571,7 @@ int main(int argc, char *argv[])
 		       strerror(errno));
 		return errno;
 	}
+	rt_prefault(a_page.dma_vaddr, a_page.mmap_size);
 	signal(SIGINT, sigint_handler);
 	rc = get_mac_address(interface);
 	if (rc) {
@@ -807,7 +848,11 @@ int main(int argc, char *argv[])
 	last_time = now_local + XMIT_DELAY;
 	time_stamp = now_8021as + RENDER_DELAY;
 
-	rc = nice(-20);
+	if (igb_xtstamp_start(&igb_dev, CLOCK_MONOTONIC, 0) ||
+	    pacer_init(&pacer, igb_xtstamp_get(&igb_dev), lead_ns, 0)) {
+		fprintf(stderr, "Failed to start launch time pacer\n");
+		return EXIT_FAILURE;
+	}
 
 	while (listeners && !halt_tx) {
 		tmp_packet = free_packets;
@@ -902,6 +947,14 @@ int main(int argc, char *argv[])
 			}
 		}
 
+		/* top up the ring only as far as the lead window */
+		if (ETIME == pacer_wait(&pacer, tmp_packet->attime)) {
+			/* too late to launch, drop it */
+			tmp_packet->next = free_packets;
+			free_packets = tmp_packet;
+			continue;
+		}
+
 		err = igb_xmit(&igb_dev, 0, tmp_packet);
 
 		if (!err) {
@@ -926,7 +979,8 @@ int main(int argc, char *argv[])
 			free_packets = tmp_packet;
 		}
 	}
-	rc = nice(0);
+	pacer_report(&pacer, "simple_talker", stderr);
+	igb_xtstamp_stop(&igb_dev);
 	
 	if (halt_tx == 0)
 		printf("listener left ...\n");
@@ -273,6 +273,8 @@ igb_detach(device_t *dev)
 	adapter = (struct adapter *)dev->private_data;
 	if (NULL == adapter) return ENXIO;
 
+	igb_xtstamp_stop(dev);
+
 	if( sem_wait( adapter->memlock ) != 0 ) {
 		goto err_nolock;
 	}
@@ -1265,6 +1267,219 @@ igb_gettime(device_t *dev, clockid_t clk_id, u_int64_t *curtime,
 	return error;
 }
 
+/*
+ * Cross-timestamp model
+ *
+ * igb_gettime() costs up to MAX_ITER register round trips under the
+ * memlock.  A refresh thread samples it periodically and keeps a linear
+ * system-to-device time model that talkers evaluate without MMIO or
+ * locking.  The model is published with a sequence counter: the single
+ * writer makes seq odd, updates the fields and makes it even again;
+ * readers retry when they observe an odd or changed seq.
+ */
+
+#define XTSTAMP_DEFAULT_INTERVAL 100 /* ms */
+
+void
+igb_xtstamp_init(struct igb_xtstamp *xt, clockid_t clk_id)
+{
+	memset(xt, 0, sizeof(*xt));
+	xt->clk_id = clk_id;
+	xt->rate = 1.0;
+}
+
+void
+igb_xtstamp_update(struct igb_xtstamp *xt, u_int64_t sys_ns,
+		   u_int64_t dev_ns, u_int32_t window_ns)
+{
+	double rate = xt->rate;
+	double rate_err = xt->rate_err;
+	u_int32_t samples = xt->samples;
+	int64_t dsys = (int64_t)(sys_ns - xt->sys_ref);
+
+	if (samples != 0 && dsys > 0) {
+		double new_rate = (double)(int64_t)(dev_ns - xt->dev_ref) / dsys;
+
+		/*
+		 * Both samples are uncertain by half their window, which
+		 * bounds the rate error together with the change in rate
+		 * since the previous estimate
+		 */
+		rate_err = (double)(xt->window_ns / 2 + window_ns / 2) / dsys;
+		if (samples > 1)
+			rate_err += new_rate > rate ?
+				new_rate - rate : rate - new_rate;
+		rate = new_rate;
+		++samples;
+	} else {
+		/* first sample or system clock stepped back, start over */
+		rate = 1.0;
+		rate_err = 0.0;
+		samples = 1;
+	}
+
+	xt->seq++;
+	__sync_synchronize();
+	xt->sys_ref = sys_ns;
+	xt->dev_ref = dev_ns;
+	xt->rate = rate;
+	xt->rate_err = rate_err;
+	xt->err_ns = window_ns / 2;
+	xt->window_ns = window_ns;
+	xt->samples = samples;
+	__sync_synchronize();
+	xt->seq++;
+}
+
+int
+igb_xtstamp_refresh(struct igb_xtstamp *xt, igb_xtstamp_sample_t sample,
+		    void *arg)
+{
+	u_int64_t dev_ns, sys_ns;
+	int ret;
+
+	ret = sample(arg, xt->clk_id, &dev_ns, &sys_ns);
+	if (ret > 0)
+		return ret;
+
+	igb_xtstamp_update(xt, sys_ns, dev_ns, (u_int32_t)-ret);
+
+	return 0;
+}
+
+int
+igb_xtstamp_convert(struct igb_xtstamp *xt, u_int64_t sys_ns,
+		    u_int64_t *dev_ns, u_int32_t *err_ns)
+{
+	struct igb_xtstamp snap;
+	u_int32_t seq;
+	int64_t dsys;
+	double err;
+
+	if (NULL == xt || NULL == dev_ns) return EINVAL;
+
+	do {
+		seq = xt->seq;
+		__sync_synchronize();
+		snap.sys_ref = xt->sys_ref;
+		snap.dev_ref = xt->dev_ref;
+		snap.rate = xt->rate;
+		snap.rate_err = xt->rate_err;
+		snap.err_ns = xt->err_ns;
+		snap.samples = xt->samples;
+		__sync_synchronize();
+	} while ((seq & 1) || seq != xt->seq);
+
+	if (snap.samples < 2) return EAGAIN;
+
+	dsys = (int64_t)(sys_ns - snap.sys_ref);
+	*dev_ns = snap.dev_ref + (int64_t)(dsys * snap.rate);
+
+	if (err_ns) {
+		err = snap.err_ns + (dsys < 0 ? -dsys : dsys) * snap.rate_err;
+		*err_ns = err > (u_int32_t)-1 ? (u_int32_t)-1 : (u_int32_t)err;
+	}
+
+	return (0);
+}
+
+static int
+igb_xtstamp_sample_dev(void *arg, clockid_t clk_id, u_int64_t *dev_ns,
+		       u_int64_t *sys_ns)
+{
+	struct timespec system_time;
+	int ret;
+
+	ret = igb_gettime((device_t *)arg, clk_id, dev_ns, &system_time);
+	if (ret <= 0)
+		*sys_ns = TS2NS(system_time);
+
+	return ret;
+}
+
+static void *
+igb_xtstamp_thread(void *arg)
+{
+	device_t *dev = (device_t *)arg;
+	struct adapter *adapter = (struct adapter *)dev->private_data;
+	struct timespec interval;
+
+	interval.tv_sec = adapter->xtstamp_interval / 1000;
+	interval.tv_nsec = (adapter->xtstamp_interval % 1000) * 1000000;
+
+	while (adapter->xtstamp_run) {
+		igb_xtstamp_refresh(&adapter->xtstamp, igb_xtstamp_sample_dev,
+				    dev);
+		nanosleep(&interval, NULL);
+	}
+
+	return NULL;
+}
+
+int
+igb_xtstamp_start(device_t *dev, clockid_t clk_id, unsigned int interval_ms)
+{
+	struct adapter	*adapter;
+	int error;
+
+	if (NULL == dev) return EINVAL;
+	adapter = (struct adapter *)dev->private_data;
+	if (NULL == adapter) return ENXIO;
+
+	if (adapter->xtstamp_run) return EBUSY;
+
+	igb_xtstamp_init(&adapter->xtstamp, clk_id);
+	adapter->xtstamp_interval =
+		interval_ms ? interval_ms : XTSTAMP_DEFAULT_INTERVAL;
+
+	/* two samples so the model is valid when we return */
+	error = igb_xtstamp_refresh(&adapter->xtstamp, igb_xtstamp_sample_dev,
+				    dev);
+	if (!error)
+		error = igb_xtstamp_refresh(&adapter->xtstamp,
+					    igb_xtstamp_sample_dev, dev);
+	if (error) return error;
+
+	adapter->xtstamp_run = 1;
+	error = pthread_create(&adapter->xtstamp_thread, NULL,
+			       igb_xtstamp_thread, dev);
+	if (error) {
+		adapter->xtstamp_run = 0;
+		return error;
+	}
+
+	return (0);
+}
+
+int
+igb_xtstamp_stop(device_t *dev)
+{
+	struct adapter	*adapter;
+
+	if (NULL == dev) return EINVAL;
+	adapter = (struct adapter *)dev->private_data;
+	if (NULL == adapter) return ENXIO;
+
+	if (!adapter->xtstamp_run) return (0);
+
+	adapter->xtstamp_run = 0;
+	pthread_join(adapter->xtstamp_thread, NULL);
+
+	return (0);
+}
+
+struct igb_xtstamp *
+igb_xtstamp_get(device_t *dev)
+{
+	struct adapter	*adapter;
+
+	if (NULL == dev) return NULL;
+	adapter = (struct adapter *)dev->private_data;
+	if (NULL == adapter) return NULL;
+
+	return &adapter->xtstamp;
+}
+
 int	
 igb_set_class_bandwidth(device_t *dev, 
 	u_int32_t class_a,
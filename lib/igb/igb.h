@@ -36,6 +36,7 @@
 #define _IGB_H_DEFINED_
 
 #include <sys/types.h>
+#include <time.h>
 
 struct resource {
         u_int64_t       paddr;
@@ -67,6 +68,31 @@ typedef struct _device_t {
 	u_int8_t	func;
 } device_t;
 
+/*
+ * Linear model from a system clock to device time.  The model is written
+ * by a single refresh thread (igb_xtstamp_start) and read lock free
+ * through igb_xtstamp_convert; seq is odd while an update is in progress.
+ */
+struct igb_xtstamp {
+	volatile u_int32_t seq;
+	clockid_t	clk_id;
+	u_int64_t	sys_ref;	/* system time of last sample, ns */
+	u_int64_t	dev_ref;	/* device time of last sample, ns */
+	double		rate;		/* device ns per system ns */
+	double		rate_err;	/* bound on the error of rate */
+	u_int32_t	err_ns;		/* error bound at sys_ref */
+	u_int32_t	window_ns;	/* sampling window of last sample */
+	u_int32_t	samples;	/* model is valid after two samples */
+};
+
+/*
+ * Source of one cross-timestamp; returns -window (ns) on success or a
+ * positive errno, like igb_gettime().  A simulated source can be used to
+ * drive igb_xtstamp_refresh() without hardware.
+ */
+typedef int (*igb_xtstamp_sample_t)(void *arg, clockid_t clk_id,
+	u_int64_t *dev_ns, u_int64_t *sys_ns);
+
 /*
  * Bus dma allocation structure used by
  * e1000_dma_malloc_page and e1000_dma_free_page.
@@ -92,6 +118,14 @@ int	igb_get_wallclock(device_t *dev, u_int64_t	*curtime, u_int64_t *rdtsc);
 int igb_gettime(device_t *dev, clockid_t clk_id, u_int64_t *curtime, struct timespec *system_time );
 int	igb_set_class_bandwidth(device_t *dev, u_int32_t class_a, u_int32_t class_b, u_int32_t tpktsz_a, u_int32_t tpktsz_b);
 
+void	igb_xtstamp_init(struct igb_xtstamp *xt, clockid_t clk_id);
+void	igb_xtstamp_update(struct igb_xtstamp *xt, u_int64_t sys_ns, u_int64_t dev_ns, u_int32_t window_ns);
+int	igb_xtstamp_refresh(struct igb_xtstamp *xt, igb_xtstamp_sample_t sample, void *arg);
+int	igb_xtstamp_convert(struct igb_xtstamp *xt, u_int64_t sys_ns, u_int64_t *dev_ns, u_int32_t *err_ns);
+int	igb_xtstamp_start(device_t *dev, clockid_t clk_id, unsigned int interval_ms);
+int	igb_xtstamp_stop(device_t *dev);
+struct igb_xtstamp *igb_xtstamp_get(device_t *dev);
+
 void	igb_trigger(device_t *dev, u_int32_t data);
 void	igb_readreg(device_t *dev, u_int32_t reg, u_int32_t *data);
 void	igb_writereg(device_t *dev, u_int32_t reg, u_int32_t data);
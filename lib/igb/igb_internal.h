@@ -36,6 +36,7 @@
 #define _IGB_INTERNAL_H_DEFINED_
 
 #include "igb.h"
+#include <pthread.h>
 
 /*
  * Micellaneous constants
@@ -140,6 +141,12 @@ struct adapter {
 	struct tx_ring		*tx_rings;
         u16			num_tx_desc;
 
+	/* Cross-timestamp model refreshed by xtstamp_thread */
+	struct igb_xtstamp	xtstamp;
+	pthread_t		xtstamp_thread;
+	volatile int		xtstamp_run;
+	unsigned int		xtstamp_interval;	/* ms */
+
 #ifdef IGB_IEEE1588
 	/* IEEE 1588 precision time support */
 	struct cyclecounter     cycles;
@@ -0,0 +1,344 @@
+/******************************************************************************
+
+  Copyright (c) 2001-2012, Intel Corporation
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+   3. Neither the name of the Intel Corporation nor the names of its
+      contributors may be used to endorse or promote products derived from
+      this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+
+******************************************************************************/
+
+/*
+ * Tests of the cross-timestamp model, driven by a simulated sample source
+ * instead of the adapter: "make test" builds and runs them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "igb.h"
+
+#define NSEC_PER_SEC 1000000000ULL
+
+static int failures;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: %s: CHECK(%s) failed\n", \
+			__FILE__, __LINE__, __func__, #cond); \
+		failures++; \
+	} \
+} while (0)
+
+/*
+ * Simulated device: dev = dev_base + (sys - sys_base) * num / den,
+ * sampled every step_ns with a window of window_ns.  fail makes the
+ * next sample return that errno.
+ */
+struct sim_source {
+	u_int64_t sys;
+	u_int64_t sys_base;
+	u_int64_t dev_base;
+	u_int64_t num;
+	u_int64_t den;
+	u_int64_t step_ns;
+	u_int32_t window_ns;
+	int fail;
+	int calls;
+};
+
+static u_int64_t sim_dev(struct sim_source *sim, u_int64_t sys_ns)
+{
+	int64_t dsys = (int64_t)(sys_ns - sim->sys_base);
+
+	return sim->dev_base + dsys * (int64_t)sim->num / (int64_t)sim->den;
+}
+
+static int
+sim_sample(void *arg, clockid_t clk_id, u_int64_t *dev_ns, u_int64_t *sys_ns)
+{
+	struct sim_source *sim = (struct sim_source *)arg;
+
+	(void)clk_id;
+	sim->calls++;
+	if (sim->fail)
+		return sim->fail;
+
+	*sys_ns = sim->sys;
+	*dev_ns = sim_dev(sim, sim->sys);
+	sim->sys += sim->step_ns;
+
+	return -(int)sim->window_ns;
+}
+
+static void
+sim_init(struct sim_source *sim, u_int64_t num, u_int64_t den)
+{
+	memset(sim, 0, sizeof(*sim));
+	sim->sys = sim->sys_base = 1000 * NSEC_PER_SEC;
+	sim->dev_base = 5000 * NSEC_PER_SEC + 123;
+	sim->num = num;
+	sim->den = den;
+	sim->step_ns = NSEC_PER_SEC / 10;
+	sim->window_ns = 2000;
+}
+
+static u_int64_t absdiff(u_int64_t a, u_int64_t b)
+{
+	return a > b ? a - b : b - a;
+}
+
+static double fabsdiff(double a, double b)
+{
+	return a > b ? a - b : b - a;
+}
+
+/* the model is not usable before two samples, failed samples are ignored */
+static void test_needs_two_samples(void)
+{
+	struct igb_xtstamp xt;
+	struct sim_source sim;
+	u_int64_t dev_ns;
+
+	sim_init(&sim, 1, 1);
+	igb_xtstamp_init(&xt, CLOCK_MONOTONIC);
+
+	CHECK(EAGAIN == igb_xtstamp_convert(&xt, sim.sys, &dev_ns, NULL));
+	CHECK(EINVAL == igb_xtstamp_convert(NULL, sim.sys, &dev_ns, NULL));
+
+	sim.fail = EBUSY;
+	CHECK(EBUSY == igb_xtstamp_refresh(&xt, sim_sample, &sim));
+	CHECK(0 == xt.samples && 0 == xt.seq);
+
+	sim.fail = 0;
+	CHECK(0 == igb_xtstamp_refresh(&xt, sim_sample, &sim));
+	CHECK(1 == xt.samples && 2 == xt.seq);
+	CHECK(EAGAIN == igb_xtstamp_convert(&xt, sim.sys, &dev_ns, NULL));
+
+	CHECK(0 == igb_xtstamp_refresh(&xt, sim_sample, &sim));
+	CHECK(0 == igb_xtstamp_convert(&xt, sim.sys, &dev_ns, NULL));
+	CHECK(3 == sim.calls);
+}
+
+/* conversions against the simulated clock stay within the reported error */
+static void test_convert_known_samples(void)
+{
+	struct igb_xtstamp xt;
+	struct sim_source sim;
+	u_int64_t dev_ns, sys_ns;
+	u_int32_t err_ns;
+	int i;
+
+	/* device runs 100 ppm fast */
+	sim_init(&sim, 10001, 10000);
+	igb_xtstamp_init(&xt, CLOCK_MONOTONIC);
+
+	CHECK(0 == igb_xtstamp_refresh(&xt, sim_sample, &sim));
+	CHECK(0 == igb_xtstamp_refresh(&xt, sim_sample, &sim));
+
+	/* 2 us window at both ends of a 100 ms interval */
+	CHECK(fabsdiff(xt.rate * 1e9, 1.0001e9) < 1.0);
+	CHECK(fabsdiff(xt.rate_err * 1e9, 2000 * 1e9 / sim.step_ns) < 1.0);
+	CHECK(1000 == xt.err_ns);
+
+	/* at the last sample only its own window counts */
+	sys_ns = xt.sys_ref;
+	CHECK(0 == igb_xtstamp_convert(&xt, sys_ns, &dev_ns, &err_ns));
+	CHECK(sim_dev(&sim, sys_ns) == dev_ns);
+	CHECK(1000 == err_ns);
+
+	/* before and after it, the rate error grows with the distance */
+	for (i = -20; i <= 20; i++) {
+		sys_ns = xt.sys_ref + (int64_t)i * (int64_t)NSEC_PER_SEC / 20;
+		CHECK(0 == igb_xtstamp_convert(&xt, sys_ns, &dev_ns, &err_ns));
+		CHECK(absdiff(dev_ns, sim_dev(&sim, sys_ns)) <= 1);
+		CHECK(err_ns >= 1000 + (u_int32_t)(absdiff(sys_ns, xt.sys_ref) *
+			xt.rate_err) - 1);
+	}
+
+	/* a change in rate adds to the error bound of the next estimate */
+	sim.sys_base = xt.sys_ref;
+	sim.dev_base = xt.dev_ref;
+	sim.num = 10002;
+	CHECK(0 == igb_xtstamp_refresh(&xt, sim_sample, &sim));
+	CHECK(3 == xt.samples);
+	CHECK(fabsdiff(xt.rate_err * 1e9,
+		(2000 * 1e9 / sim.step_ns) + 1e9 * 0.0001) < 1.0);
+
+	/* the system clock stepping back starts the model over */
+	sim.sys = xt.sys_ref - NSEC_PER_SEC;
+	CHECK(0 == igb_xtstamp_refresh(&xt, sim_sample, &sim));
+	CHECK(1 == xt.samples);
+	CHECK(EAGAIN == igb_xtstamp_convert(&xt, sim.sys, &dev_ns, NULL));
+}
+
+struct reader_arg {
+	struct igb_xtstamp *xt;
+	u_int64_t sys_ns;
+	u_int64_t dev_ns;
+	volatile int released;
+	volatile int done;
+	int ret;
+	int early;
+};
+
+static void *reader(void *arg)
+{
+	struct reader_arg *r = (struct reader_arg *)arg;
+
+	r->ret = igb_xtstamp_convert(r->xt, r->sys_ns, &r->dev_ns, NULL);
+	r->early = !r->released;
+	r->done = 1;
+
+	return NULL;
+}
+
+/*
+ * A reader that finds an update in progress waits for it and converts
+ * with the new model, never with a mix of both
+ */
+static void test_retry_on_update(void)
+{
+	struct igb_xtstamp xt;
+	struct sim_source sim;
+	struct reader_arg r;
+	pthread_t tid;
+
+	sim_init(&sim, 1, 1);
+	igb_xtstamp_init(&xt, CLOCK_MONOTONIC);
+	CHECK(0 == igb_xtstamp_refresh(&xt, sim_sample, &sim));
+	CHECK(0 == igb_xtstamp_refresh(&xt, sim_sample, &sim));
+
+	memset(&r, 0, sizeof(r));
+	r.xt = &xt;
+	r.sys_ns = xt.sys_ref + NSEC_PER_SEC;
+
+	/* open an update the way igb_xtstamp_update() does */
+	xt.seq++;
+	__sync_synchronize();
+	xt.dev_ref += NSEC_PER_SEC;
+
+	CHECK(0 == pthread_create(&tid, NULL, reader, &r));
+	usleep(20000);
+	CHECK(!r.done);
+
+	xt.rate = 2.0;
+	r.released = 1;
+	__sync_synchronize();
+	xt.seq++;
+
+	CHECK(0 == pthread_join(tid, NULL));
+	CHECK(0 == r.ret);
+	CHECK(!r.early);
+	CHECK(sim_dev(&sim, xt.sys_ref) + 3 * NSEC_PER_SEC == r.dev_ns);
+}
+
+#define HAMMER_READS 2000000
+
+struct hammer_arg {
+	struct igb_xtstamp *xt;
+	volatile int stop;
+};
+
+static void *hammer_writer(void *arg)
+{
+	struct hammer_arg *h = (struct hammer_arg *)arg;
+	struct igb_xtstamp *xt = h->xt;
+	int flip = 0;
+
+	while (!h->stop) {
+		/* no field agrees between the two models */
+		flip = !flip;
+		xt->seq++;
+		__sync_synchronize();
+		xt->sys_ref = flip ? 1 * NSEC_PER_SEC : 2 * NSEC_PER_SEC;
+		xt->dev_ref = flip ? 5 * NSEC_PER_SEC : 9 * NSEC_PER_SEC;
+		xt->rate = flip ? 1.0 : 2.0;
+		xt->err_ns = flip ? 10 : 20;
+		__sync_synchronize();
+		xt->seq++;
+	}
+
+	return NULL;
+}
+
+/* readers racing a writer only ever see one of the published models */
+static void test_no_torn_reads(void)
+{
+	struct igb_xtstamp xt;
+	struct hammer_arg h;
+	pthread_t tid;
+	u_int64_t dev_ns;
+	u_int32_t err_ns;
+	int i, torn = 0;
+
+	igb_xtstamp_init(&xt, CLOCK_MONOTONIC);
+	xt.sys_ref = 1 * NSEC_PER_SEC;
+	xt.dev_ref = 5 * NSEC_PER_SEC;
+	xt.err_ns = 10;
+	xt.samples = 2;
+
+	h.xt = &xt;
+	h.stop = 0;
+	CHECK(0 == pthread_create(&tid, NULL, hammer_writer, &h));
+
+	for (i = 0; i < HAMMER_READS; i++) {
+		if (igb_xtstamp_convert(&xt, 3 * NSEC_PER_SEC, &dev_ns,
+					&err_ns)) {
+			torn++;
+			continue;
+		}
+		if (!(7 * NSEC_PER_SEC == dev_ns && 10 == err_ns) &&
+		    !(11 * NSEC_PER_SEC == dev_ns && 20 == err_ns))
+			torn++;
+	}
+
+	h.stop = 1;
+	CHECK(0 == pthread_join(tid, NULL));
+	CHECK(0 == torn);
+}
+
+int main(void)
+{
+	test_needs_two_samples();
+	test_convert_known_samples();
+	test_retry_on_update();
+	test_no_torn_reads();
+
+	if (failures) {
+		fprintf(stderr, "xtstamp_test: %d failures\n", failures);
+		return 1;
+	}
+	printf("xtstamp_test: OK\n");
+
+	return 0;
+}